@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>  // htons and ntohs
+#include "aggregate.h"
+#include "mip_arp.h"
+#include "raw_socket.h"
+#include "trace.h"
+#include "utils.h"
+
+uint64_t aggregation_window_ns = 0;
+
+/*Struct for the messages waiting to be sent to one destination, already packed with their sub-headers*/
+struct aggregate {
+    size_t used;                    /*Bytes of the buffer in use*/
+    int count;                      /*Number of messages in the buffer*/
+    uint64_t deadline_ns;           /*Monotonic time when the aggregate has to be sent*/
+    uint8_t buffer[MAX_SDU_SIZE];
+};
+
+/*One aggregate for each mip address, allocated the first time we send to it*/
+static struct aggregate *aggregates[256];
+
+/*Number of aggregates holding messages, so we can skip the table when nothing is waiting*/
+static int active_aggregates = 0;
+
+
+/*Helper function to send the messages in an aggregate. If it only holds a single message, it is sent as a normal SDU to avoid the sub-header.*/
+static void flush_aggregate(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address)
+{
+    struct aggregate *aggr = aggregates[dst_mip_address];
+    if (aggr == NULL || aggr->count == 0)
+    {
+        return;
+    }
+
+    if (aggr->count == 1)
+    {
+        uint16_t subheader;
+        memcpy(&subheader, aggr->buffer, AGGR_SUBHEADER_SIZE);
+        subheader = ntohs(subheader);
+        send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, subheader >> 13, 
+                 aggr->buffer + AGGR_SUBHEADER_SIZE, subheader & 0x1FFF);
+    } else 
+    {
+        TRACE(TRACE_DEBUG, TRACE_AGGREGATE_SENT, aggr->count, aggr->used, dst_mip_address);
+        send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, MIP_AGGR, aggr->buffer, aggr->used);
+    }
+
+    aggr->used = 0;
+    aggr->count = 0;
+    aggr->deadline_ns = 0;
+    active_aggregates--;
+}
+
+
+void aggregate_sdu(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                   uint8_t sdu_type, uint8_t *sdu, size_t sdu_len)
+{
+    if (sdu_len == 0 || sdu_len > AGGR_MAX_MESSAGE_SIZE) /*Too large to be worth aggregating, send it on its own after the waiting ones*/
+    {
+        flush_aggregate(raw_socket, if_list, my_mip_address, dst_mip_address);
+        send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, sdu_type, sdu, sdu_len);
+        return;
+    }
+
+    struct aggregate *aggr = aggregates[dst_mip_address];
+    if (aggr == NULL) /*First message to this destination*/
+    {
+        aggr = (struct aggregate *)calloc(1, sizeof(struct aggregate));
+        if (aggr == NULL)
+        {
+            perror("calloc failed");
+            send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, sdu_type, sdu, sdu_len);
+            return;
+        }
+        aggregates[dst_mip_address] = aggr;
+    }
+
+    /*The aggregate should fit in one pdu on the interface, if we do not know the interface yet we use the protocol maximum*/
+    uint8_t *mac_src = lookup_mac_src(dst_mip_address);
+    size_t limit = mac_src == NULL ? MAX_SDU_SIZE : get_max_sdu_size(if_list, find_interface_by_mac(if_list, mac_src));
+
+    if (aggr->used + AGGR_SUBHEADER_SIZE + sdu_len > limit) /*The message does not fit, so we send what we have first*/
+    {
+        flush_aggregate(raw_socket, if_list, my_mip_address, dst_mip_address);
+    }
+
+    if (aggr->count == 0) /*The window starts with the first message*/
+    {
+        aggr->deadline_ns = get_time_ns() + aggregation_window_ns;
+        active_aggregates++;
+    }
+
+    /*Add the sub-header and the message*/
+    uint16_t subheader = htons((uint16_t)((sdu_type & 0x7) << 13 | (sdu_len & 0x1FFF)));
+    memcpy(aggr->buffer + aggr->used, &subheader, AGGR_SUBHEADER_SIZE);
+    memcpy(aggr->buffer + aggr->used + AGGR_SUBHEADER_SIZE, sdu, sdu_len);
+    aggr->used += AGGR_SUBHEADER_SIZE + sdu_len;
+    aggr->count++;
+
+    if (aggr->used + AGGR_SUBHEADER_SIZE >= limit) /*The aggregate is full, no reason to wait for the window*/
+    {
+        flush_aggregate(raw_socket, if_list, my_mip_address, dst_mip_address);
+    }
+}
+
+
+void flush_expired_aggregates(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint64_t now_ns)
+{
+    for (int i = 0; i < 256 && active_aggregates > 0; i++)
+    {
+        if (aggregates[i] != NULL && aggregates[i]->count > 0 && aggregates[i]->deadline_ns <= now_ns)
+        {
+            flush_aggregate(raw_socket, if_list, my_mip_address, (uint8_t)i);
+        }
+    }
+}
+
+
+uint64_t next_aggregation_deadline(void)
+{
+    uint64_t next = 0;
+    for (int i = 0; i < 256 && active_aggregates > 0; i++)
+    {
+        if (aggregates[i] != NULL && aggregates[i]->count > 0 && (next == 0 || aggregates[i]->deadline_ns < next))
+        {
+            next = aggregates[i]->deadline_ns;
+        }
+    }
+    return next;
+}
+
+
+void handle_aggregate(int unix_socket, uint8_t src_mip_address, uint8_t *sdu, size_t sdu_len)
+{
+    size_t offset = 0;
+
+    /*Walk through the sub-headers until we reach the padding or the end of the sdu*/
+    while (offset + AGGR_SUBHEADER_SIZE <= sdu_len)
+    {
+        uint16_t subheader;
+        memcpy(&subheader, sdu + offset, AGGR_SUBHEADER_SIZE);
+        subheader = ntohs(subheader);
+
+        size_t len = subheader & 0x1FFF;
+        if (len == 0) /*Padding, no more messages*/
+        {
+            break;
+        }
+        offset += AGGR_SUBHEADER_SIZE;
+        if (offset + len > sdu_len)
+        {
+            TRACE(TRACE_WARN, TRACE_AGGREGATE_OVERRUN, src_mip_address);
+            break;
+        }
+
+        handle_upper_sdu(unix_socket, src_mip_address, subheader >> 13, sdu + offset, len);
+        offset += len;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "local_interfaces.h"
+#include "pdu.h"
+
+/*Size of the sub-header in front of every message in an SDU of type MIP_AGGR.
+The sub-header is 16 bits in network byte order, the upper 3 bits hold the SDU type and the lower 13 bits the length of the message.
+A length of 0 marks the end of the messages, which is what the 32 bit padding of the SDU is read as.*/
+#define AGGR_SUBHEADER_SIZE 2
+
+/*Largest message we pack into an aggregate, larger messages are sent on their own*/
+#define AGGR_MAX_MESSAGE_SIZE 1024
+
+/*Global variable for the aggregation window in nanoseconds, 0 means aggregation is disabled*/
+extern uint64_t aggregation_window_ns;
+
+/*Function to add a message to the aggregate for its destination. The aggregate is sent when the window has passed since its first message,
+or when the message does not fit in it. Messages which are too large to be aggregated are sent on their own, after the aggregate
+for the destination has been sent so the order is kept.
+Function takes the raw socket fd, a pointer to interface_info, our mip address, the destination mip address, the sdu type,
+a pointer to the message and the length of the message as parameters.*/
+void aggregate_sdu(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                   uint8_t sdu_type, uint8_t *sdu, size_t sdu_len);
+
+
+/*Function to send every aggregate whose window has passed.
+Function takes the raw socket fd, a pointer to interface_info, our mip address and the current monotonic time in nanoseconds as parameters.*/
+void flush_expired_aggregates(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint64_t now_ns);
+
+
+/*Function to find the time the next aggregate has to be sent, so the caller can arm a timer.
+Returns the monotonic time in nanoseconds, or 0 if no messages are waiting.*/
+uint64_t next_aggregation_deadline(void);
+
+
+/*Function to unpack a received SDU of type MIP_AGGR, and hand each message to handle_upper_sdu().
+Function takes the unix socket fd, the source mip address, a pointer to the sdu and the sdu length as parameters.*/
+void handle_aggregate(int unix_socket, uint8_t src_mip_address, uint8_t *sdu, size_t sdu_len);
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "broadcast.h"
+#include "mip_arp.h"
+#include "pdu.h"
+#include "link.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+/*Struct for a broadcast we have delivered, to recognize its copies from other interfaces*/
+struct broadcast_seen {
+    uint64_t seen_ns;  /*0 if the slot is unused*/
+    uint32_t hash;
+    uint16_t len;
+    uint8_t src_mip_address;
+    uint8_t sdu_type;
+    int ifindex;
+};
+
+/*Interfaces broadcasts are sent on, every interface if there are none*/
+static int chosen[MAX_INTERFACES];
+static int chosen_count = 0;
+
+static struct broadcast_seen history[BROADCAST_HISTORY];
+static int history_next = 0;
+
+
+int broadcast_configure(const char *spec)
+{
+    char copy[1024];
+    if (strlen(spec) >= sizeof(copy))
+    {
+        printf("Broadcast interface list is too long\n");
+        return 0;
+    }
+    strcpy(copy, spec);
+
+    char *saveptr;
+    for (char *field = strtok_r(copy, ",", &saveptr); field != NULL; field = strtok_r(NULL, ",", &saveptr))
+    {
+        if (atoi(field) < 1 || chosen_count == MAX_INTERFACES)
+        {
+            printf("Invalid broadcast interface %s\n", field);
+            return 0;
+        }
+        chosen[chosen_count++] = atoi(field);
+    }
+    return chosen_count > 0;
+}
+
+
+/*Function to check if broadcasts are sent on an interface*/
+static int is_chosen(int ifindex)
+{
+    if (chosen_count == 0)
+    {
+        return 1;
+    }
+    for (int i = 0; i < chosen_count; i++)
+    {
+        if (chosen[i] == ifindex)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+int broadcast_send(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t sdu_type, uint8_t *sdu, size_t sdu_len)
+{
+    static struct sockaddr_ll ifaces[MAX_INTERFACES];
+    int count = 0;
+    for (int i = 0; i < if_list->num_interfaces; i++)
+    {
+        struct sockaddr_ll *iface = &if_list->interface_addrs[i];
+        if (is_chosen(iface->sll_ifindex) && sdu_len <= get_max_sdu_size(if_list, iface)) /*A broadcast is never fragmented*/
+        {
+            ifaces[count++] = *iface;
+        }
+    }
+    if (count == 0)
+    {
+        TRACE(TRACE_WARN, TRACE_BROADCAST_TOO_LARGE, sdu_len);
+        STATS_INC(broadcast_drops);
+        return 0;
+    }
+
+    /*The frame is built once, link_send_all() puts the mac address of every interface in its ethernet header*/
+    uint8_t broadcast_mac[6] = ETH_BROADCAST_ADDR;
+    uint8_t frame[BUFFER_SIZE];
+    int sent = 0;
+    struct pdu *pdu = alloc_pdu();
+    if (fill_pdu(pdu, ifaces[0].sll_addr, broadcast_mac, my_mip_address, MIP_BROADCAST, sdu_type, sdu, sdu_len))
+    {
+        size_t len = mip_serialize_pdu(pdu, frame);
+        sent = link_send_all(raw_socket, ifaces, count, frame, len);
+    }
+    destroy_pdu(pdu);
+    STATS_INC(broadcasts_sent);
+    STATS_ADD(broadcast_frames, sent);
+    return sent;
+}
+
+
+int broadcast_is_duplicate(uint8_t src_mip_address, int ifindex, uint8_t sdu_type, const uint8_t *sdu, size_t sdu_len, uint64_t now_ns)
+{
+    uint32_t hash = 2166136261u; /*FNV-1a*/
+    for (size_t i = 0; i < sdu_len; i++)
+    {
+        hash = (hash ^ sdu[i]) * 16777619u;
+    }
+
+    for (int i = 0; i < BROADCAST_HISTORY; i++)
+    {
+        struct broadcast_seen *seen = &history[i];
+        if (seen->seen_ns == 0 || now_ns - seen->seen_ns > BROADCAST_DUPLICATE_NS || seen->hash != hash || seen->len != sdu_len ||
+            seen->src_mip_address != src_mip_address || seen->sdu_type != sdu_type)
+        {
+            continue;
+        }
+        if (seen->ifindex != ifindex)
+        {
+            STATS_INC(broadcast_duplicates);
+            return 1;
+        }
+        seen->seen_ns = now_ns; /*Sent again on the same interface, so it is a new message and its copies come after this one*/
+        return 0;
+    }
+
+    struct broadcast_seen *seen = &history[history_next];
+    history_next = (history_next + 1) % BROADCAST_HISTORY;
+    seen->seen_ns = now_ns;
+    seen->hash = hash;
+    seen->len = (uint16_t)sdu_len;
+    seen->src_mip_address = src_mip_address;
+    seen->sdu_type = sdu_type;
+    seen->ifindex = ifindex;
+    return 0;
+}
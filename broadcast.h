@@ -0,0 +1,41 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "local_interfaces.h"
+
+/*Broadcast of application messages. A message to MIP_BROADCAST (255) is put in one frame with the ethernet broadcast address, which is
+sent on every interface, or on the interfaces given with mipd -B <ifindex>[,<ifindex>...], with one sendmmsg when the link allows it
+(see link_send_all()). The message is sent with the SDU type of the connection, so on the receiving nodes it is delivered once to every
+application which registered the type (see dispatch.h), which is how an application subscribes to the broadcasts of a protocol.
+
+A broadcast is not fragmented, aggregated or sent reliably, so it has to fit in one SDU on every interface it is sent on.
+When two nodes are connected by several links, a broadcast arrives once on each of them. The copies are recognized by the
+source, type, length and a hash of the content, and a copy heard on another interface within BROADCAST_DUPLICATE_NS is not delivered again.
+The same message sent twice on the same interface is delivered twice.*/
+
+/*How long a broadcast is remembered to recognize its copies from other interfaces*/
+#define BROADCAST_DUPLICATE_NS (10ULL * 1000000ULL)
+
+/*Number of broadcasts remembered*/
+#define BROADCAST_HISTORY 64
+
+
+/*Function to choose the interfaces broadcasts are sent on, a comma separated list of interface indexes.
+Takes the spec as parameter. Returns 1 on success and 0 if the spec is invalid.*/
+int broadcast_configure(const char *spec);
+
+
+/*Function to send an SDU to MIP_BROADCAST on the chosen interfaces.
+Takes the raw socket, a pointer to interface_info, our mip address, the SDU type, a pointer to the SDU and its length as parameters.
+Returns the number of interfaces it was sent on.*/
+int broadcast_send(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t sdu_type, uint8_t *sdu, size_t sdu_len);
+
+
+/*Function to check if a received broadcast is a copy of one heard on another interface a moment ago, and remember it if it is not.
+Takes the source mip address, the interface it was received on, the SDU type, a pointer to the SDU, its length and the current time as parameters.
+Returns 1 if it is a copy which should not be delivered, and 0 otherwise.*/
+int broadcast_is_duplicate(uint8_t src_mip_address, int ifindex, uint8_t sdu_type, const uint8_t *sdu, size_t sdu_len, uint64_t now_ns);
+
+#endif
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "capture.h"
+#include "local_interfaces.h"
+#include "utils.h"
+
+/*pcapng block types and options, see https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html*/
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+/*Size of an interface description block with the options we write, the name is at most 16 bytes*/
+#define IDB_SIZE 52
+/*Size of an enhanced packet block without the packet data*/
+#define EPB_OVERHEAD 44
+
+/*Smallest file size we accept, so a block always fits in an empty file*/
+#define CAPTURE_MIN_FILE_SIZE (64 * 1024)
+
+/*How long the writer sleeps when the ring is empty*/
+#define WRITER_IDLE_NS 1000000
+
+/*Struct for a frame in the ring*/
+struct capture_slot {
+    uint64_t timestamp_ns;
+    int32_t ifindex;
+    uint16_t direction;
+    uint16_t caplen;
+    uint32_t len;
+    uint8_t data[CAPTURE_SNAPLEN];
+};
+
+atomic_int capture_enabled = 0;
+
+/*The ring, head is only written by the daemon and tail only by the writer. They are on separate cache lines so the two
+threads do not make each other's cache line bounce on every frame*/
+static struct capture_slot *ring = NULL;
+static _Alignas(64) atomic_uint_fast64_t ring_head = 0;
+static _Alignas(64) atomic_uint_fast64_t ring_tail = 0;
+
+/*Counters, read by capture_get_stats() while the writer runs*/
+static atomic_uint_fast64_t frames_written = 0;
+static atomic_uint_fast64_t frames_dropped = 0;
+static atomic_uint_fast64_t bytes_written = 0;
+static atomic_uint rotations = 0;
+static atomic_int current_file = 0;
+
+/*Writer state*/
+static pthread_t writer;
+static atomic_int writer_running = 0;
+static char base_path[256];
+static size_t max_file_size;
+static int max_files;
+static int file_fd = -1;
+static uint8_t *file_map = NULL;
+static size_t file_offset = 0;
+
+/*The ifindexes we have written an interface description block for in the current file, the position is the pcapng interface id*/
+static int file_interfaces[MAX_INTERFACES];
+static int file_interface_count = 0;
+
+
+/*Function to append bytes to the mapped file, the caller has checked that they fit*/
+static void put(const void *data, size_t len)
+{
+    memcpy(file_map + file_offset, data, len);
+    file_offset += len;
+}
+
+
+static void put32(uint32_t value)
+{
+    put(&value, sizeof(value));
+}
+
+
+static void put16(uint16_t value)
+{
+    put(&value, sizeof(value));
+}
+
+
+/*Function to truncate the current file to the data it holds and close it*/
+static void close_file(void)
+{
+    if (file_map != NULL)
+    {
+        munmap(file_map, max_file_size);
+        file_map = NULL;
+    }
+    if (file_fd != -1)
+    {
+        if (ftruncate(file_fd, file_offset) == -1)
+        {
+            perror("capture: ftruncate");
+        }
+        close(file_fd);
+        file_fd = -1;
+    }
+}
+
+
+/*Function to create and map the capture file with the given index, and write the section header block.
+Returns 1 on success and 0 on failure.*/
+static int open_file(int index)
+{
+    char path[sizeof(base_path) + 16];
+    snprintf(path, sizeof(path), "%s.%d", base_path, index);
+
+    file_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file_fd == -1)
+    {
+        perror("capture: open");
+        return 0;
+    }
+    if (ftruncate(file_fd, max_file_size) == -1)
+    {
+        perror("capture: ftruncate");
+        close(file_fd);
+        file_fd = -1;
+        return 0;
+    }
+    file_map = mmap(NULL, max_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_fd, 0);
+    if (file_map == MAP_FAILED)
+    {
+        perror("capture: mmap");
+        file_map = NULL;
+        close(file_fd);
+        file_fd = -1;
+        return 0;
+    }
+    file_offset = 0;
+    file_interface_count = 0;
+    atomic_store(&current_file, index);
+
+    /*Section header block, without options and with an unknown section length*/
+    put32(PCAPNG_SECTION_HEADER);
+    put32(28);
+    put32(PCAPNG_BYTE_ORDER_MAGIC);
+    put16(1);
+    put16(0);
+    put32(0xFFFFFFFF);
+    put32(0xFFFFFFFF);
+    put32(28);
+    return 1;
+}
+
+
+/*Function to write an interface description block for an ifindex, with nanosecond timestamps.
+Returns the pcapng interface id.*/
+static int add_interface(int ifindex)
+{
+    char name[16];
+    memset(name, 0, sizeof(name));
+    snprintf(name, sizeof(name), "ifindex %d", ifindex);
+
+    put32(PCAPNG_INTERFACE_DESCRIPTION);
+    put32(IDB_SIZE);
+    put16(PCAPNG_LINKTYPE_ETHERNET);
+    put16(0);
+    put32(CAPTURE_SNAPLEN);
+    put16(PCAPNG_OPT_IF_NAME);
+    put16(sizeof(name));
+    put(name, sizeof(name));
+    put16(PCAPNG_OPT_IF_TSRESOL);
+    put16(1);
+    put32(9); /*10^-9, the value is one byte followed by three bytes of padding*/
+    put16(PCAPNG_OPT_END);
+    put16(0);
+    put32(IDB_SIZE);
+
+    file_interfaces[file_interface_count] = ifindex;
+    return file_interface_count++;
+}
+
+
+/*Function to find the pcapng interface id of an ifindex in the current file, returns -1 if it has none yet*/
+static int find_interface_id(int ifindex)
+{
+    for (int i = 0; i < file_interface_count; i++)
+    {
+        if (file_interfaces[i] == ifindex)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/*Function to write a frame from the ring as an enhanced packet block, rotating to the next file if it does not fit.
+Returns 1 on success and 0 if the capture can not continue.*/
+static int write_slot(const struct capture_slot *slot)
+{
+    uint32_t padded = (slot->caplen + 3) & ~3U;
+    uint32_t block_len = EPB_OVERHEAD + padded;
+    int id = find_interface_id(slot->ifindex);
+    size_t needed = block_len + (id == -1 ? IDB_SIZE : 0);
+
+    if (file_offset + needed > max_file_size)
+    {
+        close_file();
+        if (!open_file((atomic_load(&current_file) + 1) % max_files))
+        {
+            return 0;
+        }
+        atomic_fetch_add(&rotations, 1);
+        id = -1;
+    }
+    size_t start = file_offset;
+    if (id == -1)
+    {
+        if (file_interface_count == MAX_INTERFACES)
+        {
+            return 1; /*More interfaces than a node can have, skip the frame*/
+        }
+        id = add_interface(slot->ifindex);
+    }
+
+    static const uint8_t padding[4] = {0};
+    put32(PCAPNG_ENHANCED_PACKET);
+    put32(block_len);
+    put32((uint32_t)id);
+    put32((uint32_t)(slot->timestamp_ns >> 32));
+    put32((uint32_t)slot->timestamp_ns);
+    put32(slot->caplen);
+    put32(slot->len);
+    put(slot->data, slot->caplen);
+    put(padding, padded - slot->caplen);
+    put16(PCAPNG_OPT_EPB_FLAGS);
+    put16(4);
+    put32(slot->direction);
+    put16(PCAPNG_OPT_END);
+    put16(0);
+    put32(block_len);
+
+    atomic_fetch_add_explicit(&frames_written, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes_written, file_offset - start, memory_order_relaxed);
+    return 1;
+}
+
+
+/*Writer thread, moves frames from the ring to the capture files until the capture is stopped and the ring is empty*/
+static void *writer_main(void *arg)
+{
+    unpin_from_cpu(); /*Started by the thread which handles frames, which may be pinned to a CPU*/
+    int failed = 0;
+    while (1)
+    {
+        uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+        if (tail == head)
+        {
+            if (!atomic_load(&writer_running))
+            {
+                break;
+            }
+            struct timespec idle = { 0, WRITER_IDLE_NS };
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        while (tail != head)
+        {
+            if (!failed && !write_slot(&ring[tail & (CAPTURE_RING_SLOTS - 1)]))
+            {
+                failed = 1; /*Stop capturing, the frames already in the ring are thrown away*/
+                atomic_store(&capture_enabled, 0);
+                printf("Capture stopped, could not write the capture file\n");
+            }
+            tail++;
+            atomic_store_explicit(&ring_tail, tail, memory_order_release);
+        }
+    }
+    close_file();
+    return NULL;
+}
+
+
+int capture_start(const char *path, size_t file_size, int files)
+{
+    if (atomic_load(&writer_running) || ring != NULL)
+    {
+        printf("A capture is already running\n");
+        return 0;
+    }
+    if (strlen(path) >= sizeof(base_path) || file_size < CAPTURE_MIN_FILE_SIZE || files < 1)
+    {
+        printf("Invalid capture parameters, the file size must be at least %d bytes\n", CAPTURE_MIN_FILE_SIZE);
+        return 0;
+    }
+
+    strcpy(base_path, path);
+    max_file_size = file_size;
+    max_files = files;
+    ring = malloc(CAPTURE_RING_SLOTS * sizeof(struct capture_slot));
+    if (ring == NULL)
+    {
+        perror("malloc");
+        return 0;
+    }
+    if (!open_file(0))
+    {
+        free(ring);
+        ring = NULL;
+        return 0;
+    }
+
+    atomic_store(&ring_head, 0);
+    atomic_store(&ring_tail, 0);
+    atomic_store(&frames_written, 0);
+    atomic_store(&frames_dropped, 0);
+    atomic_store(&bytes_written, 0);
+    atomic_store(&rotations, 0);
+    atomic_store(&writer_running, 1);
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0)
+    {
+        printf("Could not start the capture writer\n");
+        atomic_store(&writer_running, 0);
+        close_file();
+        free(ring);
+        ring = NULL;
+        return 0;
+    }
+    atomic_store(&capture_enabled, 1);
+    return 1;
+}
+
+
+void capture_stop(void)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    atomic_store(&capture_enabled, 0);
+    atomic_store(&writer_running, 0);
+    pthread_join(writer, NULL);
+    free(ring);
+    ring = NULL;
+}
+
+
+void capture_frame(int direction, int ifindex, const uint8_t *frame, size_t len)
+{
+    uint_fast64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    uint_fast64_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    if (head - tail == CAPTURE_RING_SLOTS)
+    {
+        atomic_fetch_add_explicit(&frames_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct capture_slot *slot = &ring[head & (CAPTURE_RING_SLOTS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts); /*pcapng timestamps are since the epoch*/
+    slot->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    slot->ifindex = ifindex;
+    slot->direction = direction;
+    slot->len = len;
+    slot->caplen = len < CAPTURE_SNAPLEN ? len : CAPTURE_SNAPLEN;
+    memcpy(slot->data, frame, slot->caplen);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+
+void capture_get_stats(struct capture_stats *stats, char *path, size_t path_size)
+{
+    stats->frames = atomic_load_explicit(&frames_written, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&frames_dropped, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&bytes_written, memory_order_relaxed);
+    stats->rotations = atomic_load_explicit(&rotations, memory_order_relaxed);
+    if (path != NULL && path_size > 0)
+    {
+        snprintf(path, path_size, "%s.%d", base_path, atomic_load(&current_file));
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*Capture of the frames mipd sends and receives into pcapng files, which can be turned on and off while mipd runs (see control.h).
+
+The link layer copies every frame into a lock-free ring with a nanosecond timestamp, and a writer thread moves the frames from
+the ring into a memory-mapped pcapng file. The datapath never blocks on the file: if the ring is full the frame is counted as
+dropped. When a file is full the capture rotates to the next one, named <path>.0, <path>.1, ... up to the number of files,
+after which the oldest file is overwritten. When the capture is off the cost is one load of capture_enabled per frame.*/
+
+/*Number of frames the ring holds, must be a power of two*/
+#define CAPTURE_RING_SLOTS 1024
+
+/*Largest part of a frame which is captured, a full MIP frame fits*/
+#define CAPTURE_SNAPLEN 2064
+
+/*Default size of one capture file, and number of files to rotate through*/
+#define CAPTURE_DEFAULT_FILE_SIZE (64 * 1024 * 1024)
+#define CAPTURE_DEFAULT_FILES 4
+
+/*Direction of a captured frame, stored in the epb_flags option of the pcapng packet block*/
+#define CAPTURE_INBOUND 1
+#define CAPTURE_OUTBOUND 2
+
+/*Struct for the counters of the capture*/
+struct capture_stats {
+    uint64_t frames;    /*Frames written to the capture files*/
+    uint64_t dropped;   /*Frames dropped because the ring was full*/
+    uint64_t bytes;     /*Bytes written to the capture files*/
+    uint32_t rotations; /*Times the capture moved on to the next file*/
+};
+
+/*1 while a capture is running, checked by the link layer before every call to capture_frame()*/
+extern atomic_int capture_enabled;
+
+
+/*Function to start a capture. Takes the path the files are named after, the size of each file in bytes and the number of files as parameters.
+Returns 1 on success and 0 on failure, or if a capture is already running.*/
+int capture_start(const char *path, size_t file_size, int files);
+
+
+/*Function to stop the capture. The frames left in the ring are written and the current file is truncated to the data it holds.*/
+void capture_stop(void);
+
+
+/*Function to add a frame to the capture ring. Only called from the thread which runs the daemon, and only while capture_enabled is set.
+Takes the direction (CAPTURE_INBOUND or CAPTURE_OUTBOUND), the ifindex of the interface, a pointer to the frame and the length of the frame as parameters.*/
+void capture_frame(int direction, int ifindex, const uint8_t *frame, size_t len);
+
+
+/*Function to get the counters of the current or last capture, and the path of the file being written.
+Takes a pointer to struct capture_stats, and a buffer and its size for the path (which may be NULL) as parameters.*/
+void capture_get_stats(struct capture_stats *stats, char *path, size_t path_size);
+
+#endif
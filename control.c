@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "control.h"
+#include "capture.h"
+#include "trace.h"
+#include "stats.h"
+#include "mip_arp.h"
+#include "upgrade.h"
+#include "utils.h"
+
+static int control_socket = -1;
+static int connections[CONTROL_MAX_CONNECTIONS];
+static int connection_count = 0;
+
+static int help_command(char *args, char *reply, size_t reply_size);
+static int capture_command(char *args, char *reply, size_t reply_size);
+static int log_command(char *args, char *reply, size_t reply_size);
+static int stats_command(char *args, char *reply, size_t reply_size);
+static int arp_command(char *args, char *reply, size_t reply_size);
+static int upgrade_command(char *args, char *reply, size_t reply_size);
+
+/*The commands of the control socket*/
+static const struct control_command commands[] = {
+    { "help", "list the commands", help_command },
+    { "capture", "start <path> [file_mb] [files] | stop | status, capture the frames mipd sends and receives to pcapng files", capture_command },
+    { "log", "[error | warn | info | debug], show or set the level of the log", log_command },
+    { "stats", "[reset], show the counters as JSON, or set them to 0", stats_command },
+    { "arp", "[flush | announce], show the arp cache, remove every entry from it, or announce our address to the neighbours", arp_command },
+    { "upgrade", "[binary], hand the sockets and the ARP cache to a new mipd, by default the binary we were started from", upgrade_command },
+};
+
+
+static int help_command(char *args, char *reply, size_t reply_size)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]) && len < reply_size; i++)
+    {
+        len += snprintf(reply + len, reply_size - len, "%-8s %s\n", commands[i].name, commands[i].help);
+    }
+    return len < reply_size ? (int)len : (int)reply_size - 1;
+}
+
+
+static int capture_command(char *args, char *reply, size_t reply_size)
+{
+    char *save = NULL;
+    char *action = strtok_r(args, " ", &save);
+    struct capture_stats stats;
+    char path[300];
+
+    if (action != NULL && strcmp(action, "start") == 0)
+    {
+        char *file = strtok_r(NULL, " ", &save);
+        char *size_mb = strtok_r(NULL, " ", &save);
+        char *files = strtok_r(NULL, " ", &save);
+        if (file == NULL)
+        {
+            return snprintf(reply, reply_size, "error: capture start needs a path\n");
+        }
+        size_t file_size = size_mb ? strtoull(size_mb, NULL, 10) * 1024 * 1024 : CAPTURE_DEFAULT_FILE_SIZE;
+        int file_count = files ? atoi(files) : CAPTURE_DEFAULT_FILES;
+        if (!capture_start(file, file_size, file_count))
+        {
+            return snprintf(reply, reply_size, "error: could not start the capture\n");
+        }
+        return snprintf(reply, reply_size, "capturing to %s.0 (%zu bytes per file, %d files)\n", file, file_size, file_count);
+    } else if (action != NULL && strcmp(action, "stop") == 0)
+    {
+        capture_stop();
+        capture_get_stats(&stats, path, sizeof(path));
+        return snprintf(reply, reply_size, "capture stopped, %lu frames written, %lu dropped\n",
+                        (unsigned long)stats.frames, (unsigned long)stats.dropped);
+    } else if (action != NULL && strcmp(action, "status") == 0)
+    {
+        capture_get_stats(&stats, path, sizeof(path));
+        return snprintf(reply, reply_size, "capture %s, file %s, %lu frames, %lu bytes, %lu dropped, %u rotations\n",
+                        atomic_load(&capture_enabled) ? "on" : "off", path, (unsigned long)stats.frames,
+                        (unsigned long)stats.bytes, (unsigned long)stats.dropped, stats.rotations);
+    }
+    return snprintf(reply, reply_size, "error: usage: capture start <path> [file_mb] [files] | stop | status\n");
+}
+
+
+static int log_command(char *args, char *reply, size_t reply_size)
+{
+    static const char *const levels[] = { "error", "warn", "info", "debug" };
+    char *save = NULL;
+    char *level = strtok_r(args, " ", &save);
+
+    if (level != NULL)
+    {
+        int found = -1;
+        for (int i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++)
+        {
+            if (strcmp(level, levels[i]) == 0)
+            {
+                found = i;
+            }
+        }
+        if (found == -1)
+        {
+            return snprintf(reply, reply_size, "error: usage: log [error | warn | info | debug]\n");
+        }
+        if (found > TRACE_COMPILE_LEVEL)
+        {
+            return snprintf(reply, reply_size, "error: mipd was built without the %s level\n", level);
+        }
+        atomic_store(&trace_level, found);
+    }
+    return snprintf(reply, reply_size, "log level %s, %lu records dropped\n", levels[atomic_load(&trace_level)],
+                    (unsigned long)trace_dropped());
+}
+
+
+static int stats_command(char *args, char *reply, size_t reply_size)
+{
+    if (strcmp(args, "reset") == 0)
+    {
+        stats_reset();
+        return snprintf(reply, reply_size, "counters reset\n");
+    } else if (*args != '\0')
+    {
+        return snprintf(reply, reply_size, "error: usage: stats [reset]\n");
+    }
+    return stats_to_json(reply, reply_size);
+}
+
+
+static int arp_command(char *args, char *reply, size_t reply_size)
+{
+    if (strcmp(args, "flush") == 0)
+    {
+        int entries = arp_cache_count;
+        flush_arp_cache();
+        return snprintf(reply, reply_size, "removed %d entries from the arp cache\n", entries);
+    } else if (strcmp(args, "announce") == 0) /*After our address or interfaces changed, the timers send it right away*/
+    {
+        schedule_arp_announcement();
+        return snprintf(reply, reply_size, "announcement scheduled\n");
+    } else if (*args != '\0')
+    {
+        return snprintf(reply, reply_size, "error: usage: arp [flush | announce]\n");
+    }
+
+    size_t len = snprintf(reply, reply_size, "%d entries, %d SDUs waiting for a response\n", arp_cache_count, pending_queue_length());
+    for (int i = 0; i < arp_cache_count && len < reply_size; i++)
+    {
+        uint8_t *mac = arp_list[i].mac_address;
+        uint8_t *src = arp_list[i].src_mac_address;
+        len += snprintf(reply + len, reply_size - len, "MIP %3u at %02x:%02x:%02x:%02x:%02x:%02x via %02x:%02x:%02x:%02x:%02x:%02x\n",
+                        arp_list[i].mip_address, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                        src[0], src[1], src[2], src[3], src[4], src[5]);
+    }
+    return len < reply_size ? (int)len : (int)reply_size - 1;
+}
+
+
+static int upgrade_command(char *args, char *reply, size_t reply_size)
+{
+    if (strchr(args, ' ') != NULL)
+    {
+        return snprintf(reply, reply_size, "error: usage: upgrade [binary]\n");
+    }
+    if (*args != '\0' && access(args, X_OK) == -1)
+    {
+        return snprintf(reply, reply_size, "error: %s is not an executable\n", args);
+    }
+    /*The main loop starts the new daemon once this reply is sent*/
+    upgrade_request(*args != '\0' ? args : NULL);
+    return snprintf(reply, reply_size, "upgrading\n");
+}
+
+
+/*Function to run a command line and write the reply.
+Takes the command, and a buffer and its size for the reply as parameters. Returns the length of the reply.*/
+static int run_command(char *line, char *reply, size_t reply_size)
+{
+    line[strcspn(line, "\r\n")] = '\0';
+    char *args = line + strcspn(line, " ");
+    if (*args != '\0')
+    {
+        *args++ = '\0';
+    }
+
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (strcmp(line, commands[i].name) == 0)
+        {
+            int len = commands[i].handler(args, reply, reply_size);
+            return len < (int)reply_size ? len : (int)reply_size - 1;
+        }
+    }
+    return snprintf(reply, reply_size, "error: unknown command '%s', try help\n", line);
+}
+
+
+/*Function to close a control connection and remove it from epoll and the list of connections*/
+static void close_connection(int epoll_fd, int index)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connections[index], NULL);
+    close(connections[index]);
+    connections[index] = connections[--connection_count];
+}
+
+
+int control_open(const char *path, int epoll_fd)
+{
+    return control_adopt(create_unix_socket(path), epoll_fd);
+}
+
+
+int control_adopt(int fd, int epoll_fd)
+{
+    control_socket = fd;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = control_socket;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, control_socket, &ev) == -1)
+    {
+        perror("epoll_ctl: control_socket");
+        exit(EXIT_FAILURE);
+    }
+    return control_socket;
+}
+
+
+int control_handle_event(int epoll_fd, int fd)
+{
+    if (control_socket == -1)
+    {
+        return 0;
+    }
+
+    if (fd == control_socket) /*New control connection*/
+    {
+        int connection = accept(control_socket, NULL, NULL);
+        if (connection == -1)
+        {
+            perror("accept: control_socket");
+            return 1;
+        }
+        if (connection_count == CONTROL_MAX_CONNECTIONS)
+        {
+            printf("Too many control connections, closing the new one\n");
+            close(connection);
+            return 1;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = connection;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection, &ev) == -1)
+        {
+            perror("epoll_ctl: control connection");
+            close(connection);
+            return 1;
+        }
+        connections[connection_count++] = connection;
+        return 1;
+    }
+
+    for (int i = 0; i < connection_count; i++)
+    {
+        if (connections[i] != fd)
+        {
+            continue;
+        }
+
+        static char line[CONTROL_MAX_MESSAGE];
+        static char reply[CONTROL_MAX_MESSAGE];
+        ssize_t rc = recv(fd, line, sizeof(line) - 1, 0);
+        if (rc <= 0) /*The connection has been closed*/
+        {
+            close_connection(epoll_fd, i);
+            return 1;
+        }
+        line[rc] = '\0';
+        int len = run_command(line, reply, sizeof(reply));
+        if (send(fd, reply, len, MSG_NOSIGNAL) == -1)
+        {
+            perror("send: control connection");
+            close_connection(epoll_fd, i);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+
+int control_get_socket(void)
+{
+    return control_socket;
+}
+
+
+void control_close(void)
+{
+    for (int i = 0; i < connection_count; i++)
+    {
+        close(connections[i]);
+    }
+    connection_count = 0;
+    if (control_socket != -1)
+    {
+        close(control_socket);
+        control_socket = -1;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stddef.h>
+
+/*Control socket of mipd (mipd -c <path>), used to inspect and change a running daemon without restarting it.
+It is a UNIX SOCK_SEQPACKET socket like the application socket, where every message is one command line and gets one reply.
+The first word of a command is its name and the rest are its arguments, "help" lists the commands. mipctl sends a single command.*/
+
+/*Max number of control connections at the same time*/
+#define CONTROL_MAX_CONNECTIONS 8
+
+/*Largest command and reply, the reply of the stats command grows with the number of interfaces*/
+#define CONTROL_MAX_MESSAGE 65536
+
+/*Struct for a command of the control socket*/
+struct control_command {
+    const char *name;
+    const char *help;
+    /*Takes the arguments after the name, and a buffer and its size for the reply. Returns the length of the reply*/
+    int (*handler)(char *args, char *reply, size_t reply_size);
+};
+
+
+/*Function to create the control socket and add it to epoll.
+Takes the path of the socket and the epoll fd as parameters. Returns the control socket, and exits on failure.*/
+int control_open(const char *path, int epoll_fd);
+
+
+/*Function to use a control socket which is already listening, the one an upgraded daemon got from the old one (see upgrade.h),
+and add it to epoll. Takes the socket and the epoll fd as parameters. Returns the control socket, and exits on failure.*/
+int control_adopt(int fd, int epoll_fd);
+
+
+/*Function to get the control socket, to hand it over in an upgrade. Returns the socket, or -1 if there is none.*/
+int control_get_socket(void);
+
+
+/*Function to handle an epoll event if it belongs to the control socket or one of its connections.
+New connections are accepted and added to epoll, and a command on a connection is run and answered.
+Takes the epoll fd and the fd of the event as parameters. Returns 1 if the fd belonged to the control socket, and 0 otherwise.*/
+int control_handle_event(int epoll_fd, int fd);
+
+
+/*Function to close the control socket and all its connections.*/
+void control_close(void);
+
+#endif
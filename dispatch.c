@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "dispatch.h"
+#include "stats.h"
+
+/*Struct for the messages waiting for the socket of an application*/
+struct delivery_queue {
+    int in_use;
+    int fd;
+    int head;       /*Index of the oldest message*/
+    int count;
+    size_t bytes;
+    uint8_t *messages[DISPATCH_QUEUE_MESSAGES];
+    size_t lengths[DISPATCH_QUEUE_MESSAGES];
+};
+
+/*The sockets registered for every SDU type, in the order they registered*/
+static int table[SDU_TYPES][DISPATCH_MAX_SOCKETS];
+static int table_count[SDU_TYPES];
+
+static struct delivery_queue queues[DISPATCH_MAX_SOCKETS];
+static int queued_total = 0; /*Messages waiting in every queue, so the common case of none is found at once*/
+
+
+int dispatch_is_upper_type(uint8_t sdu_type)
+{
+    return sdu_type < SDU_TYPES && (DISPATCH_UPPER_TYPES & (1 << sdu_type)) != 0;
+}
+
+
+int dispatch_register(int fd, uint8_t sdu_type)
+{
+    if (!dispatch_is_upper_type(sdu_type))
+    {
+        return 0;
+    }
+    for (int i = 0; i < table_count[sdu_type]; i++)
+    {
+        if (table[sdu_type][i] == fd) /*Registered already*/
+        {
+            return 1;
+        }
+    }
+    if (table_count[sdu_type] == DISPATCH_MAX_SOCKETS)
+    {
+        return 0;
+    }
+    table[sdu_type][table_count[sdu_type]++] = fd;
+    return 1;
+}
+
+
+/*Function to find the queue of a socket. Takes the socket and whether to claim a free queue if it has none as parameters.
+Returns a pointer to the queue, or NULL if it has none.*/
+static struct delivery_queue *find_queue(int fd, int create)
+{
+    struct delivery_queue *free_queue = NULL;
+    for (int i = 0; i < DISPATCH_MAX_SOCKETS; i++)
+    {
+        if (queues[i].in_use && queues[i].fd == fd)
+        {
+            return &queues[i];
+        }
+        if (!queues[i].in_use && free_queue == NULL)
+        {
+            free_queue = &queues[i];
+        }
+    }
+    if (!create || free_queue == NULL)
+    {
+        return NULL;
+    }
+    free_queue->in_use = 1;
+    free_queue->fd = fd;
+    free_queue->head = 0;
+    free_queue->count = 0;
+    free_queue->bytes = 0;
+    return free_queue;
+}
+
+
+/*Function to remove the oldest message of a queue, and release the queue when it is empty*/
+static void pop_message(struct delivery_queue *queue)
+{
+    free(queue->messages[queue->head]);
+    queue->bytes -= queue->lengths[queue->head];
+    queue->head = (queue->head + 1) % DISPATCH_QUEUE_MESSAGES;
+    queue->count--;
+    queued_total--;
+    if (queue->count == 0)
+    {
+        queue->in_use = 0;
+    }
+}
+
+
+/*Function to drop every message waiting in a queue*/
+static void drop_queue(struct delivery_queue *queue)
+{
+    while (queue->count > 0)
+    {
+        pop_message(queue);
+        STATS_INC(app_delivery_drops);
+    }
+    queue->in_use = 0;
+}
+
+
+void dispatch_unregister(int fd)
+{
+    struct delivery_queue *queue = queued_total > 0 ? find_queue(fd, 0) : NULL;
+    if (queue != NULL)
+    {
+        drop_queue(queue);
+    }
+
+    for (int t = 0; t < SDU_TYPES; t++)
+    {
+        /*Keep the order of the others, so the first connection to register a type is still delivered to first*/
+        int kept = 0;
+        for (int i = 0; i < table_count[t]; i++)
+        {
+            if (table[t][i] != fd)
+            {
+                table[t][kept++] = table[t][i];
+            }
+        }
+        table_count[t] = kept;
+    }
+}
+
+
+int dispatch_lookup(uint8_t sdu_type, const int **fds)
+{
+    if (sdu_type >= SDU_TYPES)
+    {
+        return 0;
+    }
+    *fds = table[sdu_type];
+    return table_count[sdu_type];
+}
+
+
+int dispatch_deliver(int fd, const uint8_t *message, size_t len)
+{
+    struct delivery_queue *queue = queued_total > 0 ? find_queue(fd, 0) : NULL;
+    if (queue == NULL) /*Nothing is waiting, so the message can go straight to the socket*/
+    {
+        if (send(fd, message, len, MSG_DONTWAIT | MSG_NOSIGNAL) != -1)
+        {
+            return 1;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            perror("send");
+            STATS_INC(app_delivery_drops);
+            return 0;
+        }
+    }
+
+    /*The socket is full, so the message waits until epoll reports room for it*/
+    if (queue != NULL && (queue->count == DISPATCH_QUEUE_MESSAGES || queue->bytes + len > DISPATCH_QUEUE_BYTES))
+    {
+        STATS_INC(app_delivery_drops);
+        return 0;
+    }
+    uint8_t *copy = malloc(len);
+    if (copy == NULL)
+    {
+        perror("malloc");
+        STATS_INC(app_delivery_drops);
+        return 0;
+    }
+    if (queue == NULL && (queue = find_queue(fd, 1)) == NULL) /*Claimed only now, so a failed copy never leaves an empty queue in use*/
+    {
+        free(copy);
+        STATS_INC(app_delivery_drops);
+        return 0;
+    }
+    memcpy(copy, message, len);
+    int tail = (queue->head + queue->count) % DISPATCH_QUEUE_MESSAGES;
+    queue->messages[tail] = copy;
+    queue->lengths[tail] = len;
+    queue->count++;
+    queue->bytes += len;
+    queued_total++;
+    STATS_INC(app_delivery_queued);
+    return 1;
+}
+
+
+void dispatch_flush(int fd)
+{
+    struct delivery_queue *queue = queued_total > 0 ? find_queue(fd, 0) : NULL;
+    while (queue != NULL && queue->count > 0)
+    {
+        if (send(fd, queue->messages[queue->head], queue->lengths[queue->head], MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("send");
+                drop_queue(queue);
+            }
+            return;
+        }
+        pop_message(queue);
+    }
+}
+
+
+size_t dispatch_queued(int fd)
+{
+    struct delivery_queue *queue = queued_total > 0 ? find_queue(fd, 0) : NULL;
+    return queue == NULL ? 0 : queue->bytes;
+}
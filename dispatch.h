@@ -0,0 +1,70 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pdu.h"
+#include "sched.h"
+
+/*Demultiplexing of received SDUs to the applications by SDU type.
+
+An application registers an SDU type by sending a message of a single byte, the type, on its connection. It may send several
+to register several types, and its messages to the network are sent with the first type it registered. Every type an application
+may register (see dispatch_is_upper_type()) has a row in a table indexed by type, so a received SDU is looked up in O(1) and
+delivered once to every connection which registered its type. The types used by the daemon itself can not be registered.
+
+An application which has not registered any type is an application of the PING type, as before registration existed:
+PING SDUs nobody registered are delivered to the newest of them.
+
+Messages are delivered without blocking, so an application which does not read can not stall the daemon. When the socket of an application
+is full, its messages wait in a queue of its own, which mipd sends when epoll reports room on the socket. A message is dropped when the
+queue is full.*/
+
+/*Most connections which can register a type*/
+#define DISPATCH_MAX_SOCKETS SCHED_MAX_CLIENTS
+
+/*Most messages, and bytes, waiting for the socket of one application*/
+#define DISPATCH_QUEUE_MESSAGES 256
+#define DISPATCH_QUEUE_BYTES (1024 * 1024)
+
+/*Bit mask of the types applications may register: 0x00, PING (0x02) and 0x04*/
+#define DISPATCH_UPPER_TYPES ((1 << 0x00) | (1 << PING) | (1 << 0x04))
+
+
+/*Function to check if an SDU type is handled by the applications rather than the daemon.
+Takes the SDU type as parameter. Returns 1 if it is, and 0 otherwise.*/
+int dispatch_is_upper_type(uint8_t sdu_type);
+
+
+/*Function to register an application connection for an SDU type, so received SDUs of the type are delivered to it.
+Takes the socket of the connection and the SDU type as parameters. Returns 1 on success, or 0 if the type is not an application type.*/
+int dispatch_register(int fd, uint8_t sdu_type);
+
+
+/*Function to remove every registration of an application connection, and drop the messages waiting for it, called when it is closed.
+Takes the socket of the connection as parameter.*/
+void dispatch_unregister(int fd);
+
+
+/*Function to get the connections registered for an SDU type.
+Takes the SDU type and a pointer to set to the array of sockets as parameters. Returns the number of sockets.*/
+int dispatch_lookup(uint8_t sdu_type, const int **fds);
+
+
+/*Function to deliver a message to an application without blocking. If the socket is full, or messages are waiting for it already,
+the message is copied to the queue of the socket.
+Takes the socket, a pointer to the message and its length as parameters. Returns 1 if the message was sent or queued, and 0 if it was dropped.*/
+int dispatch_deliver(int fd, const uint8_t *message, size_t len);
+
+
+/*Function to send the messages waiting for an application, as many as its socket has room for, called when epoll reports room.
+The queue is dropped if the socket fails, e.g. when the application has hung up.
+Takes the socket as parameter.*/
+void dispatch_flush(int fd);
+
+
+/*Function to get the number of bytes waiting for an application.
+Takes the socket as parameter. Returns the number of bytes, 0 if none are waiting.*/
+size_t dispatch_queued(int fd);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>  // htons and ntohs
+#include "fragment.h"
+#include "pdu.h"
+#include "raw_socket.h"
+#include "rdt.h"
+#include "trace.h"
+#include "utils.h"
+
+/*The reassembly table is allocated once, so reassembly never has to allocate memory per message*/
+static struct reassembly_entry reassembly_table[MAX_REASSEMBLY_ENTRIES];
+
+/*Id of the next message we fragment*/
+static uint16_t next_msg_id = 0;
+
+
+void send_fragmented_sdu(int raw_socket, struct interface_info *if_list, uint8_t *src_mac, uint8_t *dst_mac, 
+                         uint8_t my_mip_address, uint8_t dst_mip_address, uint8_t inner_type, 
+                         uint8_t *data, size_t data_len, size_t max_sdu)
+{
+    uint8_t sdu[MAX_SDU_SIZE];
+    struct mip_frag_header header;
+
+    if (data_len > MAX_MESSAGE_SIZE)
+    {
+        TRACE(TRACE_WARN, TRACE_FRAGMENT_TOO_LARGE, data_len, dst_mip_address);
+        return;
+    }
+
+    /*Data per fragment, kept 32 bit aligned so every offset is a multiple of 4*/
+    size_t chunk_size = (max_sdu - sizeof(struct mip_frag_header)) & ~(size_t)3;
+    if (max_sdu <= sizeof(struct mip_frag_header) || chunk_size == 0)
+    {
+        TRACE(TRACE_WARN, TRACE_FRAGMENT_MTU_TOO_SMALL, max_sdu, dst_mip_address);
+        return;
+    }
+
+    struct pdu *frag_pdu = alloc_pdu();
+    uint16_t msg_id = next_msg_id++;
+
+    /*Send one fragment for each chunk of the message*/
+    for (size_t offset = 0; offset < data_len; offset += chunk_size)
+    {
+        size_t len = data_len - offset < chunk_size ? data_len - offset : chunk_size;
+
+        header.msg_id = htons(msg_id);
+        header.offset = htons((uint16_t)offset);
+        header.total_len = htons((uint16_t)data_len);
+        header.inner_type = inner_type;
+        header.reserved = 0;
+
+        memcpy(sdu, &header, sizeof(header));
+        memcpy(sdu + sizeof(header), data + offset, len);
+
+        if (fill_pdu(frag_pdu, src_mac, dst_mac, my_mip_address, dst_mip_address, MIP_FRAG, sdu, sizeof(header) + len))
+        {
+            send_pdu_to_raw_socket(raw_socket, frag_pdu, if_list);
+        }
+    }
+
+    TRACE(TRACE_DEBUG, TRACE_FRAGMENTS_SENT, msg_id, data_len, dst_mip_address, chunk_size);
+    destroy_pdu(frag_pdu);
+}
+
+
+/*Helper function to find the entry for a message, or claim a new one. If the table is full we evict the entry which is closest to expiring.
+Returns a pointer to the entry.*/
+static struct reassembly_entry *find_reassembly_entry(uint8_t src_mip, uint16_t msg_id)
+{
+    struct reassembly_entry *free_entry = NULL;
+    struct reassembly_entry *oldest = &reassembly_table[0];
+
+    for (int i = 0; i < MAX_REASSEMBLY_ENTRIES; i++)
+    {
+        struct reassembly_entry *entry = &reassembly_table[i];
+        if (!entry->in_use)
+        {
+            if (free_entry == NULL)
+            {
+                free_entry = entry;
+            }
+            continue;
+        }
+        if (entry->src_mip == src_mip && entry->msg_id == msg_id) /*We already have fragments of this message*/
+        {
+            return entry;
+        }
+        if (entry->expires_ns < oldest->expires_ns)
+        {
+            oldest = entry;
+        }
+    }
+
+    if (free_entry == NULL) /*Table is full, we give up on the oldest message*/
+    {
+        TRACE(TRACE_WARN, TRACE_REASSEMBLY_FULL, oldest->msg_id, oldest->src_mip);
+        free_entry = oldest;
+    }
+
+    free_entry->in_use = 0;
+    free_entry->src_mip = src_mip;
+    free_entry->msg_id = msg_id;
+    free_entry->words_received = 0;
+    memset(free_entry->received, 0, sizeof(free_entry->received));
+    return free_entry;
+}
+
+
+void handle_fragment(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, int unix_socket, struct pdu *pdu)
+{
+    size_t sdu_len = pdu->mip_header->sdu_len * 4;
+    struct mip_frag_header header;
+
+    if (sdu_len < sizeof(header))
+    {
+        TRACE(TRACE_WARN, TRACE_BAD_FRAGMENT, 0, pdu->mip_header->src_addr);
+        return;
+    }
+
+    memcpy(&header, pdu->sdu, sizeof(header));
+    uint16_t msg_id = ntohs(header.msg_id);
+    uint16_t offset = ntohs(header.offset);
+    uint16_t total_len = ntohs(header.total_len);
+
+    /*The sdu is padded to 32 bits, so the real length of the last fragment is given by the total length*/
+    size_t len = sdu_len - sizeof(header);
+    if (offset % 4 != 0 || offset >= total_len)
+    {
+        TRACE(TRACE_WARN, TRACE_BAD_FRAGMENT, msg_id, pdu->mip_header->src_addr);
+        return;
+    }
+    if (len > (size_t)(total_len - offset))
+    {
+        len = total_len - offset;
+    }
+
+    struct reassembly_entry *entry = find_reassembly_entry(pdu->mip_header->src_addr, msg_id);
+    if (!entry->in_use) /*First fragment of the message*/
+    {
+        entry->in_use = 1;
+        entry->inner_type = header.inner_type;
+        entry->total_len = total_len;
+        entry->expires_ns = get_time_ns() + REASSEMBLY_TIMEOUT_NS;
+    } else if (entry->total_len != total_len)
+    {
+        TRACE(TRACE_WARN, TRACE_BAD_FRAGMENT, msg_id, pdu->mip_header->src_addr);
+        return;
+    }
+
+    /*Copy the fragment directly to its place in the message*/
+    memcpy(entry->buffer + offset, pdu->sdu + sizeof(header), len);
+
+    /*Mark the words we received, only counting the ones we have not seen before*/
+    for (size_t word = offset / 4; word < (offset + len + 3) / 4; word++)
+    {
+        if (!(entry->received[word / 8] & (1 << (word % 8))))
+        {
+            entry->received[word / 8] |= (1 << (word % 8));
+            entry->words_received++;
+        }
+    }
+
+    if (entry->words_received < (uint32_t)(total_len + 3) / 4) /*Still waiting for more fragments*/
+    {
+        return;
+    }
+
+    /*The message is complete*/
+    TRACE(TRACE_DEBUG, TRACE_REASSEMBLED, msg_id, total_len, entry->src_mip);
+    if (entry->inner_type == MIP_RDT)
+    {
+        rdt_handle_segment(raw_socket, if_list, my_mip_address, unix_socket, entry->src_mip, entry->buffer, entry->total_len);
+    } else
+    {
+        handle_upper_sdu(unix_socket, entry->src_mip, entry->inner_type, entry->buffer, entry->total_len);
+    }
+    entry->in_use = 0;
+}
+
+
+void expire_reassembly_entries(uint64_t now_ns)
+{
+    for (int i = 0; i < MAX_REASSEMBLY_ENTRIES; i++)
+    {
+        struct reassembly_entry *entry = &reassembly_table[i];
+        if (entry->in_use && entry->expires_ns <= now_ns)
+        {
+            TRACE(TRACE_WARN, TRACE_REASSEMBLY_TIMEOUT, entry->msg_id, entry->src_mip);
+            entry->in_use = 0;
+        }
+    }
+}
+
+
+uint64_t next_reassembly_expiry(void)
+{
+    uint64_t next = 0;
+    for (int i = 0; i < MAX_REASSEMBLY_ENTRIES; i++)
+    {
+        if (reassembly_table[i].in_use && (next == 0 || reassembly_table[i].expires_ns < next))
+        {
+            next = reassembly_table[i].expires_ns;
+        }
+    }
+    return next;
+}
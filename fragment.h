@@ -0,0 +1,66 @@
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "local_interfaces.h"
+#include "pdu.h"
+#include "utils.h"
+
+/*Max number of messages we reassemble at the same time. Each entry holds a preallocated buffer of MAX_MESSAGE_SIZE bytes.*/
+#define MAX_REASSEMBLY_ENTRIES 16
+
+/*How long we wait for the remaining fragments of a message before we give up on it*/
+#define REASSEMBLY_TIMEOUT_NS (2000ULL * 1000000ULL)
+
+/*Struct for the fragment header, placed in front of the data in every SDU of type MIP_FRAG.
+Contains the id of the message, the byte offset of the fragment, the total length of the message and the SDU type of the message.
+The header is 8 bytes, which keeps the data that follows it 32 bit aligned.*/
+struct mip_frag_header {
+    uint16_t msg_id;     /*Id of the message, unique per source mip*/
+    uint16_t offset;     /*Byte offset of this fragment in the message, always a multiple of 4*/
+    uint16_t total_len;  /*Length of the entire message in bytes*/
+    uint8_t inner_type;  /*SDU type of the reassembled message (e.g. PING)*/
+    uint8_t reserved;    /*Padding (set to 0)*/
+} __attribute__((packed));
+
+/*Struct for a message being reassembled. The fragments are copied straight into buffer at their offset, 
+so the complete message lies contiguously in memory and can be delivered with a single send.
+The first byte of a message is the mip address, which we overwrite with the source mip address before delivery.*/
+struct reassembly_entry {
+    int in_use;
+    uint8_t src_mip;
+    uint8_t inner_type;
+    uint16_t msg_id;
+    uint16_t total_len;
+    uint32_t words_received;                             /*Number of 32 bit words of the message we have received*/
+    uint64_t expires_ns;                                 /*Monotonic time when we give up on the message*/
+    uint8_t received[(MAX_MESSAGE_SIZE + 31) / 32];      /*Bitmap of the 32 bit words we have received, so duplicates are not counted twice*/
+    uint8_t buffer[MAX_MESSAGE_SIZE];                    /*The message being reassembled*/
+};
+
+/*Function to split a message into fragments which fit in max_sdu bytes and send them over the raw socket.
+Takes the raw socket fd, a pointer to interface_info, the source and destination mac address, our mip address, the destination mip address,
+the SDU type of the message, a pointer to the message, the length of the message and the largest SDU we can send on the interface as parameters.*/
+void send_fragmented_sdu(int raw_socket, struct interface_info *if_list, uint8_t *src_mac, uint8_t *dst_mac, 
+                         uint8_t my_mip_address, uint8_t dst_mip_address, uint8_t inner_type, 
+                         uint8_t *data, size_t data_len, size_t max_sdu);
+
+
+/*Function to handle a received SDU of type MIP_FRAG. The fragment is copied into the reassembly table, and when the message is complete it is
+handed to handle_upper_sdu(), which delivers it to the application over the unix socket with a single send. A reliable segment which was
+fragmented, because it was sized before we knew the interface, is handed to rdt_handle_segment() instead.
+Takes the raw socket fd, a pointer to interface_info, our mip address, the unix socket fd and a pointer to the received pdu as parameters.*/
+void handle_fragment(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, int unix_socket, struct pdu *pdu);
+
+
+/*Function to discard messages which have not been completed before their timeout.
+Takes the current monotonic time in nanoseconds as parameter.*/
+void expire_reassembly_entries(uint64_t now_ns);
+
+
+/*Function to find the time of the next reassembly timeout, so the caller can arm a timer.
+Returns the monotonic time in nanoseconds, or 0 if no message is being reassembled.*/
+uint64_t next_reassembly_expiry(void);
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>  // htonl and ntohl
+#include "keepalive.h"
+#include "mip_arp.h"
+#include "raw_socket.h"
+#include "trace.h"
+#include "utils.h"
+
+/*Number of MIP addresses, since the address is 8 bits*/
+#define KEEPALIVE_NEIGHBOURS 256
+
+static int enabled = 0;
+static uint64_t interval_ns = KEEPALIVE_DEFAULT_INTERVAL_NS;
+static int misses = KEEPALIVE_DEFAULT_MISSES;
+
+static struct neighbour neighbours[KEEPALIVE_NEIGHBOURS];
+static struct keepalive_stats keepalive_stats;
+
+
+int keepalive_configure(const char *spec)
+{
+    char copy[256];
+    if (strlen(spec) >= sizeof(copy))
+    {
+        return 0;
+    }
+    strcpy(copy, spec);
+
+    char *saveptr;
+    for (char *field = strtok_r(copy, ",", &saveptr); field != NULL; field = strtok_r(NULL, ",", &saveptr))
+    {
+        char *value = strchr(field, '=');
+        if (value == NULL || strtoull(value + 1, NULL, 10) == 0)
+        {
+            printf("Invalid keepalive option %s\n", field);
+            return 0;
+        }
+        *value++ = '\0';
+        if (strcmp(field, "interval_us") == 0)
+        {
+            interval_ns = strtoull(value, NULL, 10) * 1000ULL;
+        } else if (strcmp(field, "misses") == 0)
+        {
+            misses = atoi(value);
+        } else
+        {
+            printf("Unknown keepalive option %s\n", field);
+            return 0;
+        }
+    }
+    enabled = 1;
+    return 1;
+}
+
+
+int keepalive_enabled(void)
+{
+    return enabled;
+}
+
+
+void keepalive_heard(uint8_t mip_address, uint64_t now_ns)
+{
+    if (!enabled)
+    {
+        return;
+    }
+    struct neighbour *neighbour = &neighbours[mip_address];
+    neighbour->last_heard_ns = now_ns;
+    if (neighbour->state == NEIGHBOUR_DOWN)
+    {
+        neighbour->state = NEIGHBOUR_UP;
+        keepalive_stats.neighbours_up++;
+        TRACE(TRACE_WARN, TRACE_NEIGHBOUR_UP, mip_address);
+    }
+}
+
+
+/*Function to send a probe or an echo to a neighbour on one path, so every path to a neighbour is watched on its own*/
+static void send_keepalive(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                           uint8_t src_mac[6], uint8_t dst_mac[6], uint8_t type, uint32_t seq)
+{
+    struct keepalive_message message;
+    memset(&message, 0, sizeof(message));
+    message.type = type;
+    message.seq = htonl(seq);
+    struct pdu *pdu = alloc_pdu();
+    if (fill_pdu(pdu, src_mac, dst_mac, my_mip_address, dst_mip_address, MIP_KEEPALIVE, (uint8_t *)&message, sizeof(message)))
+    {
+        send_pdu_to_raw_socket(raw_socket, pdu, if_list);
+    }
+    destroy_pdu(pdu);
+}
+
+
+void keepalive_handle_message(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, struct pdu *pdu)
+{
+    if (pdu->mip_header->sdu_len * 4 < sizeof(struct keepalive_message))
+    {
+        TRACE(TRACE_WARN, TRACE_BAD_SDU_LENGTH, pdu->mip_header->sdu_len * 4, sizeof(struct keepalive_message));
+        return;
+    }
+    struct keepalive_message *message = (struct keepalive_message *)pdu->sdu;
+    if (message->type == KEEPALIVE_PROBE)
+    {
+        keepalive_stats.probes_received++;
+        /*The echo goes back on the path the probe came on*/
+        send_keepalive(raw_socket, if_list, my_mip_address, pdu->mip_header->src_addr, pdu->ether_header->dst_addr,
+                       pdu->ether_header->src_addr, KEEPALIVE_ECHO, ntohl(message->seq));
+        keepalive_stats.echoes_sent++;
+    } else if (message->type == KEEPALIVE_ECHO)
+    {
+        keepalive_stats.echoes_received++; /*Hearing the echo is what counts, which keepalive_heard() has noted already*/
+    }
+}
+
+
+int keepalive_fail_fast(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address)
+{
+    struct neighbour *neighbour = &neighbours[dst_mip_address];
+    if (!enabled || neighbour->state != NEIGHBOUR_DOWN)
+    {
+        return 0;
+    }
+    keepalive_stats.fast_failed++;
+    uint64_t now = get_time_ns();
+    if (now - neighbour->last_probe_ns >= interval_ns)
+    {
+        neighbour->last_probe_ns = now;
+        send_arp_request(raw_socket, if_list, dst_mip_address, my_mip_address);
+    }
+    return 1;
+}
+
+
+/*Function to declare a neighbour down, remove its ARP entry and drop the SDUs waiting for it*/
+static void declare_down(uint8_t mip_address, struct neighbour *neighbour, uint64_t now_ns)
+{
+    uint64_t silent_ns = now_ns - neighbour->last_heard_ns;
+    neighbour->state = NEIGHBOUR_DOWN;
+    neighbour->down_count++;
+    neighbour->last_probe_ns = now_ns;
+    remove_from_arp_cache(mip_address);
+    keepalive_stats.pending_failed += drop_pending_sdus(mip_address);
+    keepalive_stats.neighbours_down++;
+    stats_latency_add(&keepalive_stats.detection, silent_ns);
+    TRACE(TRACE_WARN, TRACE_NEIGHBOUR_DOWN, mip_address, silent_ns / 1000);
+}
+
+
+void keepalive_handle_timers(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint64_t now_ns)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    /*Every path to a neighbour is watched, going backwards since a path which is down is removed from the cache*/
+    for (int i = arp_cache_count - 1; i >= 0; i--)
+    {
+        struct arp_entry *path = &arp_list[i];
+        uint8_t mip_address = path->mip_address;
+        struct neighbour *neighbour = &neighbours[mip_address];
+        if (neighbour->state != NEIGHBOUR_UP) /*A new entry, or one learned again by a request from the neighbour*/
+        {
+            neighbour->state = NEIGHBOUR_UP;
+            if (neighbour->last_heard_ns == 0)
+            {
+                neighbour->last_heard_ns = now_ns;
+            }
+        }
+        if (path->last_heard_ns == 0)
+        {
+            path->last_heard_ns = now_ns;
+        }
+
+        uint64_t silent_ns = now_ns - path->last_heard_ns;
+        if (silent_ns >= interval_ns * misses)
+        {
+            if (count_arp_paths(mip_address) > 1) /*The neighbour is still up on its other paths, which take over the traffic*/
+            {
+                TRACE(TRACE_WARN, TRACE_ARP_PATH_DOWN, mip_address, trace_mac(path->mac_address));
+                remove_arp_path(mip_address, path->mac_address);
+                keepalive_stats.paths_down++;
+            } else
+            {
+                declare_down(mip_address, neighbour, now_ns);
+            }
+        } else if (silent_ns >= interval_ns && now_ns - path->last_probe_ns >= interval_ns)
+        {
+            path->last_probe_ns = now_ns;
+            send_keepalive(raw_socket, if_list, my_mip_address, mip_address, path->src_mac_address, path->mac_address,
+                           KEEPALIVE_PROBE, neighbour->next_seq++);
+            keepalive_stats.probes_sent++;
+        }
+    }
+}
+
+
+uint64_t keepalive_next_deadline(void)
+{
+    uint64_t next = 0;
+    for (int i = 0; enabled && i < arp_cache_count; i++)
+    {
+        const struct arp_entry *path = &arp_list[i];
+        if (neighbours[path->mip_address].state != NEIGHBOUR_UP || path->last_heard_ns == 0)
+        {
+            return 1; /*The entry is new to us, so the timers should look at it right away*/
+        }
+        uint64_t probe = path->last_heard_ns + interval_ns;
+        if (path->last_probe_ns + interval_ns > probe)
+        {
+            probe = path->last_probe_ns + interval_ns;
+        }
+        uint64_t down = path->last_heard_ns + interval_ns * misses;
+        uint64_t deadline = probe < down ? probe : down;
+        if (next == 0 || deadline < next)
+        {
+            next = deadline;
+        }
+    }
+    return next;
+}
+
+
+void keepalive_get_config(uint64_t *interval, int *miss_count)
+{
+    *interval = interval_ns;
+    *miss_count = misses;
+}
+
+
+const struct neighbour *keepalive_get_neighbour(uint8_t mip_address)
+{
+    return &neighbours[mip_address];
+}
+
+
+const struct keepalive_stats *keepalive_get_stats(void)
+{
+    return &keepalive_stats;
+}
+
+
+void keepalive_reset_stats(void)
+{
+    memset(&keepalive_stats, 0, sizeof(keepalive_stats));
+}
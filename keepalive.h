@@ -0,0 +1,118 @@
+#ifndef KEEPALIVE_H
+#define KEEPALIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "local_interfaces.h"
+#include "pdu.h"
+#include "stats.h"
+
+/*Liveness detection of the direct neighbours, in the spirit of BFD, turned on with mipd -k interval_us=<us>,misses=<n>.
+
+Every path to a neighbour in the ARP cache is watched. Any frame from a neighbour shows the path it came on is alive, so a path we hear
+from does not cost any probes. When we have not heard from a path for an interval, we send a probe (SDU type MIP_KEEPALIVE) on it every
+interval, which the neighbour answers with an echo on the same path. The neighbour does not need liveness detection itself to answer.
+When a path has been silent for misses intervals and the neighbour has other paths, only the path is removed and its traffic moves to
+the others. When the last path has been silent for misses intervals the neighbour is declared down: its ARP entry is removed and the SDUs waiting
+for it are dropped. While it is down, SDUs for it are dropped at once instead of waiting for an ARP response, and an ARP request
+is sent at most once an interval, so the neighbour is up again as soon as it answers or sends anything.
+
+Keepalive frames are in the control class of the transmit scheduler, so a full link does not delay them.
+The stats command shows the probes, echoes, the state of every neighbour and the detection times.*/
+
+/*Default interval between probes and number of missed intervals before a neighbour is down*/
+#define KEEPALIVE_DEFAULT_INTERVAL_NS (100ULL * 1000000ULL)
+#define KEEPALIVE_DEFAULT_MISSES 3
+
+/*Types of a keepalive message*/
+#define KEEPALIVE_PROBE 0
+#define KEEPALIVE_ECHO 1
+
+/*States of a neighbour*/
+#define NEIGHBOUR_UNKNOWN 0 /*Not in the ARP cache since we started*/
+#define NEIGHBOUR_UP 1
+#define NEIGHBOUR_DOWN 2
+
+/*Struct for a keepalive message, the SDU of a MIP_KEEPALIVE pdu. The sequence number of an echo is the one of the probe*/
+struct keepalive_message {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t seq; /*Network byte order*/
+} __attribute__((packed));
+
+/*Struct for a neighbour we watch*/
+struct neighbour {
+    int state;
+    uint64_t last_heard_ns;  /*Time we last received a frame from the neighbour*/
+    uint64_t last_probe_ns;  /*Time we last sent it a probe, or an ARP request while it is down*/
+    uint32_t next_seq;
+    uint64_t down_count;     /*Times the neighbour was declared down*/
+};
+
+/*Struct for the counters of liveness detection*/
+struct keepalive_stats {
+    uint64_t probes_sent;
+    uint64_t probes_received;
+    uint64_t echoes_sent;
+    uint64_t echoes_received;
+    uint64_t neighbours_down;   /*Times a neighbour was declared down*/
+    uint64_t paths_down;        /*Times one of several paths to a neighbour was removed*/
+    uint64_t neighbours_up;     /*Times a neighbour which was down was heard again*/
+    uint64_t pending_failed;    /*SDUs waiting for ARP which were dropped when their neighbour went down*/
+    uint64_t fast_failed;       /*SDUs dropped at once since their neighbour is down*/
+    struct latency_stats detection; /*Time from the last frame of a neighbour until it was declared down*/
+};
+
+
+/*Function to turn on liveness detection with a spec, a comma separated list of interval_us=<us> and misses=<n>.
+Takes the spec as parameter. Returns 1 on success and 0 if the spec is invalid.*/
+int keepalive_configure(const char *spec);
+
+
+/*Function to check if liveness detection is on. Returns 1 if it is, and 0 otherwise.*/
+int keepalive_enabled(void);
+
+
+/*Function to note that we received a frame from a neighbour, called for every PDU we receive.
+Takes the MIP address of the neighbour and the current time as parameters.*/
+void keepalive_heard(uint8_t mip_address, uint64_t now_ns);
+
+
+/*Function to handle a received keepalive message, a probe is answered with an echo whether liveness detection is on or not.
+Takes the raw socket, interface list, our mip address and the received pdu as parameters.*/
+void keepalive_handle_message(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, struct pdu *pdu);
+
+
+/*Function to check if an SDU should fail fast since its destination is down. Sends an ARP request for the destination
+if the last one was more than an interval ago, so we learn when it is back.
+Takes the raw socket, interface list, our mip address and the destination as parameters.
+Returns 1 if the SDU should be dropped, and 0 otherwise.*/
+int keepalive_fail_fast(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address);
+
+
+/*Function to send the probes which are due and declare the neighbours which have been silent too long down.
+Takes the raw socket, interface list, our mip address and the current time as parameters.*/
+void keepalive_handle_timers(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint64_t now_ns);
+
+
+/*Function to get the time the next probe is due or a neighbour may be declared down.
+Returns the monotonic time in nanoseconds, or 0 if no neighbour is watched.*/
+uint64_t keepalive_next_deadline(void);
+
+
+/*Function to get the configuration for the stats command. Takes pointers to set to the interval and the number of misses as parameters.*/
+void keepalive_get_config(uint64_t *interval_ns, int *misses);
+
+
+/*Function to get a neighbour for the stats command. Takes the MIP address as parameter. Returns a pointer to the neighbour.*/
+const struct neighbour *keepalive_get_neighbour(uint8_t mip_address);
+
+
+/*Function to get the counters. Returns a pointer to the counters.*/
+const struct keepalive_stats *keepalive_get_stats(void);
+
+
+/*Function to set the counters to 0, called by stats_reset().*/
+void keepalive_reset_stats(void);
+
+#endif
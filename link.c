@@ -0,0 +1,775 @@
+#define _GNU_SOURCE /*For sendmmsg*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include "link.h"
+#include "capture.h"
+#include "raw_socket.h"
+#include "local_interfaces.h"
+#include "sched.h"
+#include "shaper.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+#ifdef MIP_XDP
+#include "xdp.h"
+#endif
+
+/*Struct for a frame waiting for its emulated delay to pass*/
+struct delayed_frame {
+    uint64_t send_ns;          /*Monotonic time when the frame should be sent*/
+    struct sockaddr_ll iface;  /*Interface to send the frame on*/
+    int tx_class;              /*Class of the frame in the transmit scheduler*/
+    size_t len;
+    uint8_t frame[BUFFER_SIZE];
+};
+
+/*Settings of the link layer, chosen by link_configure()*/
+static int link_type = LINK_PACKET;
+static uint64_t delay_ns = 0;
+static double loss_percent = 0.0;
+static int emulated_mtu = DEFAULT_MTU;
+static int xdp_queue = 0;
+static int xdp_mode = 0;
+
+/*Addresses of the emulated link layers, the local socket and one peer per interface*/
+static struct sockaddr_storage local_addr;
+static socklen_t local_addr_len = 0;
+static struct sockaddr_storage peer_addrs[MAX_INTERFACES];
+static socklen_t peer_addr_lens[MAX_INTERFACES];
+static int peer_count = 0;
+static char local_name[108];
+
+/*Frames waiting for their delay, in the order they were sent. The delay is the same for every frame,
+so the queue is always sorted by send time and a ring buffer is enough.*/
+static struct delayed_frame *delayed_frames = NULL;
+static int delayed_head = 0;
+static int delayed_count = 0;
+
+/*Time to try the frames waiting in the transmit scheduler again after the socket had no room, 0 if we are not waiting*/
+static uint64_t retry_ns = 0;
+
+/*Messages of a batched send of one frame on several interfaces, every message has its own ethernet header and shares the rest*/
+static struct mmsghdr batch_msgs[MAX_INTERFACES];
+static struct iovec batch_iovs[MAX_INTERFACES][2];
+static struct ether_frame batch_headers[MAX_INTERFACES];
+
+/*Kernel receive time of the last frame in CLOCK_REALTIME nanoseconds, 0 if the link layer gave us none*/
+static uint64_t rx_timestamp_ns = 0;
+
+
+/*Function to ask the kernel for a software timestamp of every frame we receive, which is used for the kernel RX latency.
+The timestamps are only a measurement, so the link works as before if the kernel does not support them.*/
+static void enable_rx_timestamps(int fd)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1)
+    {
+        TRACE(TRACE_WARN, TRACE_LINK_NO_TIMESTAMPS, errno);
+    } else if (link_type == LINK_UNIX && setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1)
+    {
+        /*UNIX sockets only stamp datagrams when SO_TIMESTAMPNS is on, and then report the stamp both ways*/
+        TRACE(TRACE_WARN, TRACE_LINK_NO_TIMESTAMPS, errno);
+    }
+}
+
+
+/*Function to take the kernel receive timestamp out of the control messages of a received frame and store it in rx_timestamp_ns*/
+static void read_rx_timestamp(struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING)
+        {
+            struct scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            rx_timestamp_ns = (uint64_t)stamps.ts[0].tv_sec * 1000000000ULL + (uint64_t)stamps.ts[0].tv_nsec; /*ts[0] is the software stamp*/
+            return;
+        }
+    }
+}
+
+
+/*AF_PACKET link layer, which uses the raw socket and the real interfaces*/
+static int packet_open(void)
+{
+    int sd = create_raw_socket();
+    enable_rx_timestamps(sd);
+    return sd;
+}
+
+
+static ssize_t packet_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    struct iovec msgvec[1];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    msgvec[0].iov_base = frame;
+    msgvec[0].iov_len = len;
+    msg.msg_name = iface;
+    msg.msg_namelen = sizeof(struct sockaddr_ll);
+    msg.msg_iov = msgvec;
+    msg.msg_iovlen = 1;
+
+    return sendmsg(fd, &msg, MSG_DONTWAIT); /*A full socket is handled by the transmit scheduler*/
+}
+
+
+/*Function to fill the messages of a batched send, with the source mac address of each interface in its ethernet header*/
+static void fill_batch(struct sockaddr_ll *ifaces, int count, uint8_t *frame, size_t len)
+{
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(&batch_headers[i], frame, sizeof(struct ether_frame));
+        memcpy(batch_headers[i].src_addr, ifaces[i].sll_addr, 6);
+        batch_iovs[i][0].iov_base = &batch_headers[i];
+        batch_iovs[i][0].iov_len = sizeof(struct ether_frame);
+        batch_iovs[i][1].iov_base = frame + sizeof(struct ether_frame);
+        batch_iovs[i][1].iov_len = len - sizeof(struct ether_frame);
+        memset(&batch_msgs[i], 0, sizeof(batch_msgs[i]));
+        batch_msgs[i].msg_hdr.msg_iov = batch_iovs[i];
+        batch_msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+}
+
+
+static int packet_send_frames(int fd, struct sockaddr_ll *ifaces, int count, uint8_t *frame, size_t len)
+{
+    fill_batch(ifaces, count, frame, len);
+    for (int i = 0; i < count; i++)
+    {
+        batch_msgs[i].msg_hdr.msg_name = &ifaces[i];
+        batch_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+    }
+    return sendmmsg(fd, batch_msgs, count, MSG_DONTWAIT);
+}
+
+
+static ssize_t packet_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface)
+{
+    struct iovec msgvec[1];
+    struct msghdr msg;
+    uint8_t control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    memset(&msg, 0, sizeof(msg));
+
+    msgvec[0].iov_base = frame;
+    msgvec[0].iov_len = len;
+    msg.msg_name = iface;
+    msg.msg_namelen = sizeof(struct sockaddr_ll);
+    msg.msg_iov = msgvec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t rc = recvmsg(fd, &msg, 0);
+    if (rc > 0)
+    {
+        read_rx_timestamp(&msg);
+    }
+    return rc;
+}
+
+
+/*Emulated link layers, where every interface is a peer socket*/
+static int emulated_open(void)
+{
+    int family = link_type == LINK_UDP ? AF_INET : AF_UNIX;
+    int sd = socket(family, SOCK_DGRAM, 0);
+    if (sd == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    if (link_type == LINK_UNIX)
+    {
+        unlink(((struct sockaddr_un *)&local_addr)->sun_path); /*Remove the socket file of an earlier run*/
+    }
+    if (bind(sd, (struct sockaddr *)&local_addr, local_addr_len) == -1)
+    {
+        perror("bind");
+        close(sd);
+        exit(EXIT_FAILURE);
+    }
+    enable_rx_timestamps(sd);
+    return sd;
+}
+
+
+static void emulated_get_interfaces(struct interface_info *if_list, int fd)
+{
+    /*The mac addresses are made from a hash of the local address, so they are unique as long as the local addresses are*/
+    uint32_t hash = 2166136261u;
+    for (const char *c = local_name; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+
+    memset(if_list, 0, sizeof(*if_list));
+    for (int i = 0; i < peer_count; i++)
+    {
+        struct sockaddr_ll *sll = &if_list->interface_addrs[i];
+        sll->sll_family = AF_PACKET;
+        sll->sll_protocol = htons(ETH_P_MIP);
+        sll->sll_ifindex = i + 1; /*The ifindex is the index of the peer, plus one since 0 is not a valid ifindex*/
+        sll->sll_halen = 6;
+        sll->sll_addr[0] = 0x02; /*Locally administered unicast address*/
+        sll->sll_addr[1] = (uint8_t)(hash >> 24);
+        sll->sll_addr[2] = (uint8_t)(hash >> 16);
+        sll->sll_addr[3] = (uint8_t)(hash >> 8);
+        sll->sll_addr[4] = (uint8_t)hash;
+        sll->sll_addr[5] = (uint8_t)i;
+        if_list->mtu[i] = emulated_mtu;
+
+        if (debug_mode)
+        {
+            printf("Emulated interface %d, MAC: %02x:%02x:%02x:%02x:%02x:%02x, MTU: %d\n", i + 1,
+                   sll->sll_addr[0], sll->sll_addr[1], sll->sll_addr[2], sll->sll_addr[3], sll->sll_addr[4], sll->sll_addr[5],
+                   emulated_mtu);
+        }
+    }
+    if_list->num_interfaces = peer_count;
+    if_list->socket_fd = fd;
+}
+
+
+static ssize_t emulated_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    int peer = iface->sll_ifindex - 1;
+    if (peer < 0 || peer >= peer_count)
+    {
+        errno = ENXIO;
+        return -1;
+    }
+    return sendto(fd, frame, len, MSG_DONTWAIT, (struct sockaddr *)&peer_addrs[peer], peer_addr_lens[peer]);
+}
+
+
+static int emulated_send_frames(int fd, struct sockaddr_ll *ifaces, int count, uint8_t *frame, size_t len)
+{
+    fill_batch(ifaces, count, frame, len);
+    for (int i = 0; i < count; i++)
+    {
+        int peer = ifaces[i].sll_ifindex - 1;
+        if (peer < 0 || peer >= peer_count) /*Send the frames before it, link_send() reports the error*/
+        {
+            count = i;
+            break;
+        }
+        batch_msgs[i].msg_hdr.msg_name = &peer_addrs[peer];
+        batch_msgs[i].msg_hdr.msg_namelen = peer_addr_lens[peer];
+    }
+    return count > 0 ? sendmmsg(fd, batch_msgs, count, MSG_DONTWAIT) : 0;
+}
+
+
+/*Function to compare the address a frame came from with the address of a peer*/
+static int same_peer(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+    if (link_type == LINK_UDP)
+    {
+        struct sockaddr_in *x = (struct sockaddr_in *)a;
+        struct sockaddr_in *y = (struct sockaddr_in *)b;
+        return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+    }
+    return strcmp(((struct sockaddr_un *)a)->sun_path, ((struct sockaddr_un *)b)->sun_path) == 0;
+}
+
+
+static ssize_t emulated_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface)
+{
+    struct sockaddr_storage from;
+    struct iovec msgvec[1];
+    struct msghdr msg;
+    uint8_t control[CMSG_SPACE(sizeof(struct scm_timestamping)) + CMSG_SPACE(sizeof(struct timespec))];
+    memset(&from, 0, sizeof(from));
+    memset(&msg, 0, sizeof(msg));
+
+    msgvec[0].iov_base = frame;
+    msgvec[0].iov_len = len;
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = msgvec;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t rc = recvmsg(fd, &msg, 0);
+    if (rc <= 0)
+    {
+        return rc;
+    }
+    read_rx_timestamp(&msg);
+
+    /*The interface a frame arrives on is the one whose peer sent it*/
+    for (int i = 0; i < peer_count; i++)
+    {
+        if (same_peer(&from, &peer_addrs[i]))
+        {
+            memset(iface, 0, sizeof(*iface));
+            iface->sll_family = AF_PACKET;
+            iface->sll_protocol = htons(ETH_P_MIP);
+            iface->sll_ifindex = i + 1;
+            return rc;
+        }
+    }
+    TRACE(TRACE_DEBUG, TRACE_LINK_UNKNOWN_PEER, 0);
+    return 0;
+}
+
+
+/*The link layers, indexed by link type*/
+static const struct link_ops link_layers[] = {
+    [LINK_PACKET] = { "packet", packet_open, get_local_interfaces, packet_send, packet_recv, packet_send_frames, refresh_local_interfaces },
+    [LINK_UDP] = { "udp", emulated_open, emulated_get_interfaces, emulated_send, emulated_recv, emulated_send_frames },
+    [LINK_UNIX] = { "unix", emulated_open, emulated_get_interfaces, emulated_send, emulated_recv, emulated_send_frames },
+#ifdef MIP_XDP
+    [LINK_XDP] = { "xdp", xdp_open, xdp_get_interfaces, xdp_send, xdp_recv },
+#endif
+};
+
+/*The link layer in use*/
+static const struct link_ops *active_link = &link_layers[LINK_PACKET];
+
+
+/*Function to send a frame with the active link layer and count how long the send call took*/
+static ssize_t timed_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    uint64_t start = get_real_time_ns();
+    ssize_t rc = active_link->send_frame(fd, iface, frame, len);
+    stats_count_latency(STATS_LATENCY_TX, get_real_time_ns() - start);
+    return rc;
+}
+
+
+/*Function to send the frames waiting in the transmit scheduler, in the order it picks, until the socket has no room*/
+static void flush_scheduler(int fd)
+{
+    struct sched_frame *next;
+    while ((next = sched_peek()) != NULL)
+    {
+        if (timed_send(fd, &next->iface, next->frame, next->len) == -1)
+        {
+            if (errno == EAGAIN || errno == ENOBUFS)
+            {
+                retry_ns = get_time_ns() + SCHED_RETRY_NS;
+                return;
+            }
+            perror("flush_scheduler: send");
+        }
+        sched_done(get_real_time_ns());
+    }
+    retry_ns = 0;
+}
+
+
+/*Function to send a frame through the transmit scheduler. The frame is sent straight away if nothing is waiting,
+and queued if the socket has no room or other frames wait, in which case the waiting frames are sent in the order of the scheduler.
+Returns the length of the frame, or -1 if it failed or was dropped since its queue is full.*/
+static ssize_t scheduled_send(int fd, int tx_class, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    if (!sched_backlog())
+    {
+        ssize_t rc = timed_send(fd, iface, frame, len);
+        if (rc != -1)
+        {
+            sched_count_sent(tx_class);
+            return rc;
+        }
+        if (errno != EAGAIN && errno != ENOBUFS)
+        {
+            return -1;
+        }
+    }
+    if (!sched_enqueue(tx_class, iface, frame, len, get_real_time_ns()))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    if (retry_ns == 0) /*Unless we are waiting for the socket to get room, the frame may go out now if it has priority*/
+    {
+        flush_scheduler(fd);
+    }
+    return (ssize_t)len;
+}
+
+
+/*Function to parse an address of the emulated link layer, host:port for udp and a path for unix.
+Takes the address string and where to store the address and its length as parameters. Returns 1 on success and 0 on failure.*/
+static int parse_address(const char *text, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    memset(addr, 0, sizeof(*addr));
+    if (link_type == LINK_UNIX)
+    {
+        struct sockaddr_un *sun = (struct sockaddr_un *)addr;
+        if (strlen(text) == 0 || strlen(text) >= sizeof(sun->sun_path))
+        {
+            return 0;
+        }
+        sun->sun_family = AF_UNIX;
+        strcpy(sun->sun_path, text);
+        *addr_len = sizeof(struct sockaddr_un);
+        return 1;
+    }
+
+    char host[64];
+    const char *colon = strrchr(text, ':');
+    if (colon == NULL || colon == text || (size_t)(colon - text) >= sizeof(host))
+    {
+        return 0;
+    }
+    memcpy(host, text, colon - text);
+    host[colon - text] = '\0';
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0)
+    {
+        return 0;
+    }
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 1;
+}
+
+
+int link_configure(const char *spec)
+{
+    char copy[4096];
+    if (strlen(spec) >= sizeof(copy))
+    {
+        return 0;
+    }
+    strcpy(copy, spec);
+
+    char *saveptr;
+    char *field = strtok_r(copy, ",", &saveptr);
+    if (field == NULL)
+    {
+        return 0;
+    }
+
+    if (strcmp(field, "packet") == 0)
+    {
+        link_type = LINK_PACKET;
+    } else if (strcmp(field, "udp") == 0)
+    {
+        link_type = LINK_UDP;
+    } else if (strcmp(field, "unix") == 0)
+    {
+        link_type = LINK_UNIX;
+    } else if (strcmp(field, "xdp") == 0)
+    {
+#ifdef MIP_XDP
+        link_type = LINK_XDP;
+#else
+        printf("mipd is built without the AF_XDP link, build it with make XDP=1\n");
+        return 0;
+#endif
+    } else
+    {
+        printf("Unknown link type %s\n", field);
+        return 0;
+    }
+
+    while ((field = strtok_r(NULL, ",", &saveptr)) != NULL)
+    {
+        char *value = strchr(field, '=');
+        if (value == NULL)
+        {
+            printf("Link option %s has no value\n", field);
+            return 0;
+        }
+        *value++ = '\0';
+
+        if (strcmp(field, "delay_us") == 0)
+        {
+            delay_ns = strtoull(value, NULL, 10) * 1000ULL;
+        } else if (strcmp(field, "loss") == 0)
+        {
+            loss_percent = atof(value);
+        } else if (strcmp(field, "queue") == 0 && link_type == LINK_XDP)
+        {
+            xdp_queue = atoi(value);
+        } else if (strcmp(field, "mode") == 0 && link_type == LINK_XDP)
+        {
+            if (strcmp(value, "auto") == 0 || strcmp(value, "skb") == 0 || strcmp(value, "native") == 0)
+            {
+                xdp_mode = value[0] == 'a' ? 0 : value[0] == 's' ? 1 : 2; /*XDP_LINK_AUTO, XDP_LINK_SKB or XDP_LINK_NATIVE*/
+            } else
+            {
+                printf("Unknown XDP mode %s\n", value);
+                return 0;
+            }
+        } else if (strcmp(field, "mtu") == 0 && link_type != LINK_PACKET && link_type != LINK_XDP)
+        {
+            emulated_mtu = atoi(value);
+        } else if (strcmp(field, "local") == 0 && link_type != LINK_PACKET && link_type != LINK_XDP)
+        {
+            if (!parse_address(value, &local_addr, &local_addr_len))
+            {
+                printf("Invalid local address %s\n", value);
+                return 0;
+            }
+            snprintf(local_name, sizeof(local_name), "%s", value);
+        } else if (strcmp(field, "peer") == 0 && link_type != LINK_PACKET && link_type != LINK_XDP)
+        {
+            if (peer_count == MAX_INTERFACES || !parse_address(value, &peer_addrs[peer_count], &peer_addr_lens[peer_count]))
+            {
+                printf("Invalid peer address %s, or too many peers\n", value);
+                return 0;
+            }
+            peer_count++;
+        } else
+        {
+            printf("Unknown link option %s for link type %s\n", field, link_layers[link_type].name);
+            return 0;
+        }
+    }
+
+    if ((link_type == LINK_UDP || link_type == LINK_UNIX) && local_addr_len == 0)
+    {
+        printf("The %s link needs a local address\n", link_layers[link_type].name);
+        return 0;
+    }
+    if (emulated_mtu < MIP_HEADER_SIZE + 4)
+    {
+        printf("The MTU must be at least %d bytes\n", MIP_HEADER_SIZE + 4);
+        return 0;
+    }
+#ifdef MIP_XDP
+    xdp_configure(xdp_queue, xdp_mode);
+#endif
+    active_link = &link_layers[link_type];
+    srand((unsigned int)(get_time_ns() ^ (uint64_t)getpid()));
+    return 1;
+}
+
+
+void link_set_ops(const struct link_ops *ops)
+{
+    active_link = ops;
+}
+
+
+int link_open(void)
+{
+    return active_link->open();
+}
+
+
+int link_can_hand_off(void)
+{
+    /*The packet socket and the emulated peer sockets are all there is, but the rings of AF_XDP are mapped into the process*/
+    return strcmp(active_link->name, "xdp") != 0;
+}
+
+
+void link_get_interfaces(struct interface_info *if_list, int fd)
+{
+    active_link->get_interfaces(if_list, fd);
+}
+
+
+int link_refresh_interfaces(struct interface_info *if_list, int fd)
+{
+    if (active_link->refresh_interfaces == NULL) /*The emulated peers and the XDP sockets are fixed when the link is opened*/
+    {
+        return 0;
+    }
+    return active_link->refresh_interfaces(if_list, fd);
+}
+
+
+void link_set_busy_poll(int fd, int budget_us)
+{
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &budget_us, sizeof(budget_us)) == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on)) == -1)
+    {
+        TRACE(TRACE_WARN, TRACE_LINK_NO_BUSY_POLL, errno);
+    }
+}
+
+
+/*Function to send a frame which has passed the shaper, through the emulated loss and delay and the transmit scheduler*/
+static ssize_t transmit(int fd, int tx_class, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    if (atomic_load_explicit(&capture_enabled, memory_order_relaxed))
+    {
+        capture_frame(CAPTURE_OUTBOUND, iface->sll_ifindex, frame, len);
+    }
+    stats_count_frame(iface->sll_ifindex, len, 0);
+    if (loss_percent > 0.0 && rand() / ((double)RAND_MAX + 1.0) * 100.0 < loss_percent)
+    {
+        return (ssize_t)len; /*The frame is lost on the emulated link*/
+    }
+
+    if (delay_ns == 0)
+    {
+        return scheduled_send(fd, tx_class, iface, frame, len);
+    }
+
+    if (delayed_frames == NULL)
+    {
+        delayed_frames = malloc(MAX_DELAYED_FRAMES * sizeof(struct delayed_frame));
+        if (delayed_frames == NULL)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (delayed_count == MAX_DELAYED_FRAMES || len > BUFFER_SIZE)
+    {
+        TRACE(TRACE_WARN, TRACE_LINK_DELAY_FULL, 0);
+        return (ssize_t)len;
+    }
+
+    struct delayed_frame *entry = &delayed_frames[(delayed_head + delayed_count) % MAX_DELAYED_FRAMES];
+    entry->send_ns = get_time_ns() + delay_ns;
+    entry->iface = *iface;
+    entry->tx_class = tx_class;
+    entry->len = len;
+    memcpy(entry->frame, frame, len);
+    delayed_count++;
+    return (ssize_t)len;
+}
+
+
+ssize_t link_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    int tx_class = sched_classify(frame, len);
+    if (shaper_enabled())
+    {
+        int verdict = shaper_admit(tx_class, iface, frame, len, get_time_ns());
+        if (verdict == SHAPER_QUEUED)
+        {
+            return (ssize_t)len;
+        }
+        if (verdict == SHAPER_DROPPED)
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+    }
+    return transmit(fd, tx_class, iface, frame, len);
+}
+
+
+int link_send_all(int fd, struct sockaddr_ll *ifaces, int count, uint8_t *frame, size_t len)
+{
+    int sent = 0;
+    int tx_class = sched_classify(frame, len);
+    if (active_link->send_frames != NULL && count > 1 && len >= sizeof(struct ether_frame) && !shaper_enabled() && delay_ns == 0 &&
+        loss_percent == 0.0 && !sched_backlog() && !atomic_load_explicit(&capture_enabled, memory_order_relaxed))
+    {
+        uint64_t start = get_real_time_ns();
+        int rc = active_link->send_frames(fd, ifaces, count, frame, len);
+        stats_count_latency(STATS_LATENCY_TX, get_real_time_ns() - start);
+        for (; sent < rc; sent++)
+        {
+            stats_count_frame(ifaces[sent].sll_ifindex, len, 0);
+            sched_count_sent(tx_class);
+        }
+        STATS_ADD(link_batched_frames, sent);
+    }
+
+    /*What the batch did not send, e.g. since the socket had no room, goes one frame at a time so it can wait in the scheduler*/
+    int done = sent;
+    uint8_t copy[BUFFER_SIZE];
+    if (sent < count && len <= sizeof(copy))
+    {
+        memcpy(copy, frame, len);
+        for (int i = sent; i < count; i++)
+        {
+            memcpy(((struct ether_frame *)copy)->src_addr, ifaces[i].sll_addr, 6);
+            if (link_send(fd, &ifaces[i], copy, len) != -1)
+            {
+                done++;
+            }
+        }
+    }
+    return done;
+}
+
+
+ssize_t link_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface)
+{
+    rx_timestamp_ns = 0;
+    ssize_t rc = active_link->recv_frame(fd, frame, len, iface);
+    if (rc > 0)
+    {
+        if (rx_timestamp_ns != 0)
+        {
+            /*The kernel stamps frames with the wall clock, so it is compared with the wall clock and not the monotonic one*/
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+            stats_count_latency(STATS_LATENCY_KERNEL_RX, now_ns > rx_timestamp_ns ? now_ns - rx_timestamp_ns : 0);
+        }
+        stats_count_frame(iface->sll_ifindex, rc, 1);
+        if (atomic_load_explicit(&capture_enabled, memory_order_relaxed))
+        {
+            capture_frame(CAPTURE_INBOUND, iface->sll_ifindex, frame, rc);
+        }
+    }
+    return rc;
+}
+
+
+void link_flush_delayed(int fd, uint64_t now_ns)
+{
+    while (delayed_count > 0 && delayed_frames[delayed_head].send_ns <= now_ns)
+    {
+        struct delayed_frame *entry = &delayed_frames[delayed_head];
+        if (scheduled_send(fd, entry->tx_class, &entry->iface, entry->frame, entry->len) == -1)
+        {
+            perror("link_flush_delayed: send");
+        }
+        delayed_head = (delayed_head + 1) % MAX_DELAYED_FRAMES;
+        delayed_count--;
+    }
+    struct sched_frame *paced;
+    while ((paced = shaper_dequeue(now_ns)) != NULL)
+    {
+        if (transmit(fd, paced->tx_class, &paced->iface, paced->frame, paced->len) == -1)
+        {
+            perror("link_flush_delayed: send");
+        }
+    }
+    if (retry_ns != 0 && retry_ns <= now_ns)
+    {
+        flush_scheduler(fd);
+    }
+}
+
+
+uint64_t link_next_deadline(void)
+{
+    uint64_t deadline = delayed_count > 0 ? delayed_frames[delayed_head].send_ns : 0;
+    if (retry_ns != 0 && (deadline == 0 || retry_ns < deadline))
+    {
+        deadline = retry_ns;
+    }
+    uint64_t paced = shaper_next_deadline();
+    if (paced != 0 && (deadline == 0 || paced < deadline))
+    {
+        deadline = paced;
+    }
+    return deadline;
+}
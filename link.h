@@ -0,0 +1,115 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include "local_interfaces.h"
+
+/*The link layer mipd sends its frames over. The default is an AF_PACKET raw socket on the real interfaces.
+The emulated link layers use one UDP or UNIX datagram socket, where every interface is a peer socket of another mipd,
+so a topology can be built on one machine without root. The frames sent over an emulated link are the same bytes as on ethernet.
+
+The link is chosen with a spec of comma separated fields, the first field is the type:
+  packet                                        AF_PACKET raw socket (default)
+  udp,local=<host:port>,peer=<host:port>,...    one interface per peer
+  unix,local=<path>,peer=<path>,...             one interface per peer
+  xdp,queue=<n>,mode=auto|skb|native            AF_XDP sockets on the real interfaces, only with make XDP=1 (see xdp.h)
+Options for every type: delay_us=<us> delays every frame we send, loss=<percent> drops frames we send at random.
+Option for the emulated types: mtu=<bytes> sets the MTU of the interfaces (default DEFAULT_MTU).
+The built in types enable SO_TIMESTAMPING, so the time a frame waits in the kernel is counted in the latency stats (see stats.h).*/
+#define LINK_PACKET 0
+#define LINK_UDP 1
+#define LINK_UNIX 2
+#define LINK_XDP 3
+
+/*Max number of delayed frames waiting to be sent, frames are dropped when the queue is full*/
+#define MAX_DELAYED_FRAMES 1024
+
+/*Struct for the functions of a link layer, every link type provides one*/
+struct link_ops {
+    const char *name;
+    int (*open)(void);                                                                  /*Returns the fd to poll for frames*/
+    void (*get_interfaces)(struct interface_info *if_list, int fd);                     /*Fills the interface list*/
+    ssize_t (*send_frame)(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len);
+    ssize_t (*recv_frame)(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface); /*Returns 0 for frames which should be ignored*/
+    int (*send_frames)(int fd, struct sockaddr_ll *ifaces, int count, uint8_t *frame, size_t len); /*One frame on several interfaces with
+                                                        a single call, returns how many were sent. NULL if the type sends one at a time*/
+    int (*refresh_interfaces)(struct interface_info *if_list, int fd); /*Reads the interfaces again quietly, returns 1 on success.
+                                                        NULL if the interfaces of the type never change*/
+};
+
+
+/*Function to choose the link layer from a spec as described above. Must be called before link_open().
+Takes the spec as parameter. Returns 1 on success and 0 if the spec is invalid.*/
+int link_configure(const char *spec);
+
+
+/*Function to use a link layer which is not one of the built in types, used by the simulator to carry frames between its nodes.
+Takes a pointer to the struct link_ops, which must stay valid while it is in use, as parameter.*/
+void link_set_ops(const struct link_ops *ops);
+
+
+/*Function to let the kernel busy poll the device queue of the link socket, instead of waiting for an interrupt, when we receive.
+Sets SO_BUSY_POLL to the budget and SO_PREFER_BUSY_POLL. The options need CAP_NET_ADMIN to raise the budget above net.core.busy_read,
+and a failure is only logged since they do not change what the link does.
+Takes the link fd and how long the kernel may busy poll per receive in microseconds as parameters.*/
+void link_set_busy_poll(int fd, int budget_us);
+
+
+/*Function to open the link layer. Returns the fd mipd polls for incoming frames, and exits on failure.*/
+int link_open(void);
+
+
+/*Function to check if the fd of the link layer holds all of its state, so a new daemon can take it over in an upgrade
+(see upgrade.h) instead of calling link_open(). Returns 1 if it does, and 0 otherwise.*/
+int link_can_hand_off(void);
+
+
+/*Function to fill the interface list with the interfaces of the link layer.
+Takes a pointer to struct interface_info and the fd returned by link_open() as parameters.*/
+void link_get_interfaces(struct interface_info *if_list, int fd);
+
+
+/*Function to read the interfaces of the link layer again while mipd runs, to notice interfaces which come, go or change mac address.
+Nothing is printed and a failure is not fatal, since it runs every few seconds.
+Takes a pointer to struct interface_info and the fd returned by link_open() as parameters.
+Returns 1 if if_list holds the current interfaces, and 0 if they could not be read or the link type has a fixed set of interfaces.*/
+int link_refresh_interfaces(struct interface_info *if_list, int fd);
+
+
+/*Function to send a frame on an interface. The frame waits for tokens in the shaper (see shaper.h) if it is configured,
+is dropped or delayed if the link is configured with loss or delay, and waits in the transmit scheduler (see sched.h) if the socket has no room.
+Takes the link fd, the interface to send on, a pointer to the frame and the length of the frame as parameters.
+Returns the number of bytes sent (or queued, or dropped by the emulated loss), or -1 on error or if the queue of the frame is full.*/
+ssize_t link_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len);
+
+
+/*Function to send a frame on several interfaces, with the mac address of each interface as ethernet source. When nothing
+would hold the frames back (the shaper, the emulated loss and delay, the capture and a backlog in the transmit scheduler), the link
+types which can do so send them all with one sendmmsg, where every frame has its own ethernet header and shares the rest of the frame.
+Otherwise, and for the frames sendmmsg did not send, the frame goes to every interface with link_send().
+Takes the link fd, the interfaces, the number of interfaces, a pointer to the frame and the length of the frame as parameters.
+Returns the number of interfaces the frame was sent (or queued) on.*/
+int link_send_all(int fd, struct sockaddr_ll *ifaces, int count, uint8_t *frame, size_t len);
+
+
+/*Function to receive a frame. The interface it was received on is written to iface.
+Takes the link fd, a buffer, the size of the buffer and a pointer to the interface as parameters.
+Returns the length of the frame, 0 if the frame should be ignored, or -1 on error.*/
+ssize_t link_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface);
+
+
+/*Function to send the delayed frames whose delay has passed, the frames of the shaper whose buckets have refilled,
+and to try the frames waiting in the transmit scheduler again once their retry time has passed.
+Takes the link fd and the current monotonic time in nanoseconds as parameters.*/
+void link_flush_delayed(int fd, uint64_t now_ns);
+
+
+/*Function to get the time the next delayed frame or frame of the shaper should be sent, or the waiting frames of the transmit scheduler tried again.
+Returns the monotonic time in nanoseconds, or 0 if no frame is delayed or waiting.*/
+uint64_t link_next_deadline(void);
+
+#endif
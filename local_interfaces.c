@@ -6,10 +6,13 @@
 #include <linux/if_packet.h>
 #include <net/if.h>
 #include <arpa/inet.h>
+#include <sys/ioctl.h>
 #include "local_interfaces.h"
 #include "utils.h"
 
-void get_local_interfaces(struct interface_info *if_list, int socket_fd) 
+/*Function to read the interfaces into if_list. When quiet is set nothing is printed, since it runs every time the interfaces are checked.
+Returns 1 on success and 0 if the interfaces could not be listed.*/
+static int read_local_interfaces(struct interface_info *if_list, int socket_fd, int quiet)
 {
     struct ifaddrs *ifaces, *iface;
     if_list->num_interfaces = 0; 
@@ -17,8 +20,11 @@ void get_local_interfaces(struct interface_info *if_list, int socket_fd)
     /*Get the list of network interfaces*/
     if (getifaddrs(&ifaces) == -1) 
     {
-        perror("getifaddrs");
-        exit(EXIT_FAILURE);
+        if (!quiet)
+        {
+            perror("getifaddrs");
+        }
+        return 0;
     }
 
     /*Loop through all iterations and add the interfaces to the list*/
@@ -32,18 +38,35 @@ void get_local_interfaces(struct interface_info *if_list, int socket_fd)
                 /*We copy the interface structure to our list*/
                 memcpy(&if_list->interface_addrs[if_list->num_interfaces], sll, sizeof(struct sockaddr_ll));
 
-                /*Increase number of interfaces*/
-                if_list->num_interfaces++;
+                /*Query the MTU of the interface, so we know how large SDUs we can send on it*/
+                struct ifreq ifr;
+                memset(&ifr, 0, sizeof(ifr));
+                strncpy(ifr.ifr_name, iface->ifa_name, IFNAMSIZ - 1);
+                if (ioctl(socket_fd, SIOCGIFMTU, &ifr) == -1)
+                {
+                    if (!quiet)
+                    {
+                        perror("ioctl: SIOCGIFMTU");
+                    }
+                    if_list->mtu[if_list->num_interfaces] = DEFAULT_MTU;
+                } else 
+                {
+                    if_list->mtu[if_list->num_interfaces] = ifr.ifr_mtu;
+                }
 
-                if(debug_mode)
+                if(debug_mode && !quiet)
                 {
                     char mac_str[18];
                     snprintf(mac_str, sizeof(mac_str), "%02x:%02x:%02x:%02x:%02x:%02x",
                             sll->sll_addr[0], sll->sll_addr[1], sll->sll_addr[2],
                             sll->sll_addr[3], sll->sll_addr[4], sll->sll_addr[5]);
-                    printf("Interface %s, MAC: %s, ifindex: %d\n", iface->ifa_name, mac_str, sll->sll_ifindex);
+                    printf("Interface %s, MAC: %s, ifindex: %d, MTU: %d\n", iface->ifa_name, mac_str, sll->sll_ifindex, 
+                            if_list->mtu[if_list->num_interfaces]);
                 }
 
+                /*Increase number of interfaces*/
+                if_list->num_interfaces++;
+
                 if (if_list->num_interfaces >= MAX_INTERFACES) /*If we reach the maximum number of interfaces we stop*/
                 {
                     break;
@@ -56,6 +79,22 @@ void get_local_interfaces(struct interface_info *if_list, int socket_fd)
     if_list->socket_fd = socket_fd;
     /*Lastly we free the ifaddrs*/
     freeifaddrs(ifaces);
+    return 1;
+}
+
+
+void get_local_interfaces(struct interface_info *if_list, int socket_fd) 
+{
+    if (!read_local_interfaces(if_list, socket_fd, 0)) /*mipd can not run without its interfaces*/
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+int refresh_local_interfaces(struct interface_info *if_list, int socket_fd)
+{
+    return read_local_interfaces(if_list, socket_fd, 1);
 }
 
 
@@ -98,4 +137,29 @@ struct sockaddr_ll* find_interface_by_mac(struct interface_info *if_list, uint8_
 
     /*Return null if we dont find a match*/
     return NULL;
-}
\ No newline at end of file
+}
+
+
+size_t get_max_sdu_size(struct interface_info *if_list, struct sockaddr_ll *iface)
+{
+    if (if_list == NULL || iface == NULL) /*Safety check*/
+    {
+        return MAX_SDU_SIZE;
+    }
+
+    for (int i = 0; i < if_list->num_interfaces; i++) /*Find the interface in our list*/
+    {
+        if (if_list->interface_addrs[i].sll_ifindex == iface->sll_ifindex)
+        {
+            /*The MTU has to hold the mip header, and the SDU has to be 32 bit aligned*/
+            int max_sdu = (if_list->mtu[i] - MIP_HEADER_SIZE) & ~3;
+            if (max_sdu < 0)
+            {
+                return 0;
+            }
+            return max_sdu < MAX_SDU_SIZE ? (size_t)max_sdu : MAX_SDU_SIZE;
+        }
+    }
+    /*If we do not know the interface we fall back to the protocol maximum*/
+    return MAX_SDU_SIZE;
+}
@@ -2,6 +2,7 @@
 #define INTERFACE_INFO_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <sys/socket.h>
 #include <linux/if_packet.h>
 
@@ -9,9 +10,13 @@
 #define MAX_INTERFACES 253
 
 
-/*Struct for containing the interfaces of the mipd, contains a list of sockaddr_ll, the raw socket fd, and number of interfaces */
+/*MTU we assume for an interface if we are not able to query it, which is the ethernet default*/
+#define DEFAULT_MTU 1500
+
+/*Struct for containing the interfaces of the mipd, contains a list of sockaddr_ll, the MTU of each interface, the raw socket fd, and number of interfaces */
 struct interface_info {
     struct sockaddr_ll interface_addrs[MAX_INTERFACES];
+    int mtu[MAX_INTERFACES]; /*MTU of the interface at the same index in interface_addrs*/
     int socket_fd;
     int num_interfaces;
 };
@@ -29,9 +34,22 @@ Function takes a pointer to a struct interface_info and a raw socket descriptor.
 void get_local_interfaces(struct interface_info *if_list, int socket_fd);
 
 
+/*Function to read the interfaces again while mipd runs, like get_local_interfaces() but without printing anything and without exiting on failure.
+Function takes a pointer to a struct interface_info and a raw socket descriptor.
+Returns 1 on success, and 0 if the interfaces could not be listed, in which case if_list should not be used.*/
+int refresh_local_interfaces(struct interface_info *if_list, int socket_fd);
+
+
 /*This function finds the local interface in a given struct interface_info based on a given mac address
 The function takes a pointer to struct interface_info and a mac address as parameters.
 The function either returns the correct struct sockaddr_ll (interface) or NULL*/
 struct sockaddr_ll* find_interface_by_mac(struct interface_info *if_list, uint8_t *mac_addr);
 
+
+/*Function to find the largest SDU we can send on a given interface. The MTU of the interface has to hold the mip header and the SDU,
+and the SDU has to be 32 bit aligned and can not exceed MAX_SDU_SIZE.
+Function takes a pointer to struct interface_info and a pointer to a specific interface as parameters.
+Returns the largest SDU size in bytes, or MAX_SDU_SIZE if the interface is not found.*/
+size_t get_max_sdu_size(struct interface_info *if_list, struct sockaddr_ll *iface);
+
 #endif
@@ -4,6 +4,9 @@
 #include "mip_arp.h"
 #include "raw_socket.h"  // For sending MIP packets
 #include "pdu.h"
+#include "link.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 
@@ -11,6 +14,23 @@
 struct arp_entry arp_list[MAX_ARP_CACHE_SIZE];
 int arp_cache_count = 0;
 
+/*Queue of SDUs waiting for an ARP response, in the order they were received*/
+static struct pending_sdu pending_queue[MAX_PENDING_SDUS];
+static int pending_count = 0;
+
+/*How SDUs are spread over the paths to a mip address, and the next path of each mip address for round robin*/
+static int multipath_policy = MULTIPATH_FLOW;
+static uint8_t next_path[256];
+
+/*Gratuitous announcements and proxy answers, see mipd -g and -P*/
+static int announcements_enabled = 0;
+static int announcement_pending = 0;
+static uint64_t next_interface_check_ns = 0;
+static uint64_t proxy_max_age_ns = 0;
+
+static int send_request_on_interface(int raw_socket, struct sockaddr_ll *iface, uint8_t dest_mac[6], uint8_t mip_address,
+                                     uint8_t src_mip_address);
+
 void initialize_arp_cache() 
 {
     memset(arp_list, 0, sizeof(arp_list));  /*Clear the ARP cache list*/
@@ -19,6 +39,14 @@ void initialize_arp_cache()
 }
 
 
+void flush_arp_cache(void)
+{
+    memset(arp_list, 0, sizeof(arp_list));
+    arp_cache_count = 0;
+    STATS_INC(arp_flushes);
+}
+
+
 uint8_t *lookup_mac_dest(uint8_t mip_address) /*For larger networks we would need a more efficient search algorithm*/
 {
     for (int i = 0; i < arp_cache_count; i++) /*Iterate through arp_list for each entry*/
@@ -47,29 +75,185 @@ uint8_t *lookup_mac_src(uint8_t mip_address) /*For larger networks we would need
 }
 
 
-void add_to_arp_cache(uint8_t mip_address, uint8_t dest_mac[6], uint8_t src_mac_address[6]) 
+struct arp_entry *add_to_arp_cache(uint8_t mip_address, uint8_t dest_mac[6], uint8_t src_mac_address[6]) 
 {
+    for (int i = 0; i < arp_cache_count; i++) /*Check if we know the path already, or the interface has a new neighbour for the mip address*/
+    {
+        if (arp_list[i].mip_address == mip_address &&
+            (memcmp(arp_list[i].mac_address, dest_mac, 6) == 0 || memcmp(arp_list[i].src_mac_address, src_mac_address, 6) == 0))
+        {
+            memcpy(arp_list[i].mac_address, dest_mac, 6);
+            memcpy(arp_list[i].src_mac_address, src_mac_address, 6);
+            arp_list[i].last_heard_ns = get_time_ns();
+            if (arp_list[i].unverified)
+            {
+                arp_list[i].unverified = 0;
+                STATS_INC(arp_snapshot_verified);
+            }
+            return &arp_list[i];
+        }
+    }
+
     if (arp_cache_count < MAX_ARP_CACHE_SIZE) /*Check that we have room for more arp_entries*/
     {
+        memset(&arp_list[arp_cache_count], 0, sizeof(struct arp_entry));
         arp_list[arp_cache_count].mip_address = mip_address; /*Set mip address*/
         memcpy(arp_list[arp_cache_count].mac_address, dest_mac, 6); /*Set destination mac address*/
         memcpy(arp_list[arp_cache_count].src_mac_address, src_mac_address, 6); /*Set source mac address*/
+        arp_list[arp_cache_count].last_heard_ns = get_time_ns();
         arp_cache_count++;                                                   /*Update count*/
-        printf("ARP cache size: %d\n", arp_cache_count);
-    } else 
+        TRACE(TRACE_DEBUG, TRACE_ARP_CACHE_ADD, mip_address, trace_mac(dest_mac), arp_cache_count);
+        return &arp_list[arp_cache_count - 1];
+    }
+    TRACE(TRACE_WARN, TRACE_ARP_CACHE_FULL, mip_address);
+    return NULL;
+}
+
+
+void set_multipath_policy(int policy)
+{
+    multipath_policy = policy;
+}
+
+
+struct arp_entry *lookup_arp_path(uint8_t mip_address, uint8_t sdu_type, int flow)
+{
+    struct arp_entry *paths[MAX_INTERFACES];
+    int count = 0;
+    for (int i = 0; i < arp_cache_count && count < MAX_INTERFACES; i++)
+    {
+        if (arp_list[i].mip_address == mip_address)
+        {
+            paths[count++] = &arp_list[i];
+        }
+    }
+    if (count <= 1)
+    {
+        return count == 1 ? paths[0] : NULL;
+    }
+
+    if (multipath_policy == MULTIPATH_ROUND_ROBIN)
     {
-        printf("ARP cache is full, can not add to cache.\n");
+        return paths[next_path[mip_address]++ % count];
     }
+    uint32_t hash = ((uint32_t)mip_address << 16 | (uint32_t)sdu_type << 8 | (uint32_t)flow) * 2654435761U; /*Knuth's multiplicative hash*/
+    return paths[(hash >> 16) % count];
 }
 
 
-void send_arp_request(int raw_socket, struct interface_info *if_list, uint8_t mip_address, uint8_t src_mip_address) 
+int count_arp_paths(uint8_t mip_address)
+{
+    int count = 0;
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        count += arp_list[i].mip_address == mip_address;
+    }
+    return count;
+}
+
+
+void remove_arp_path(uint8_t mip_address, const uint8_t mac_address[6])
+{
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        if (arp_list[i].mip_address == mip_address && memcmp(arp_list[i].mac_address, mac_address, 6) == 0)
+        {
+            memmove(&arp_list[i], &arp_list[i + 1], (arp_cache_count - i - 1) * sizeof(struct arp_entry));
+            arp_cache_count--;
+            memset(&arp_list[arp_cache_count], 0, sizeof(struct arp_entry));
+            return;
+        }
+    }
+}
+
+
+void arp_path_heard(uint8_t mip_address, const uint8_t mac_address[6], uint64_t now_ns)
+{
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        if (arp_list[i].mip_address == mip_address && memcmp(arp_list[i].mac_address, mac_address, 6) == 0)
+        {
+            arp_list[i].last_heard_ns = now_ns;
+            if (arp_list[i].unverified)
+            {
+                arp_list[i].unverified = 0;
+                STATS_INC(arp_snapshot_verified);
+            }
+            return;
+        }
+    }
+}
+
+
+void revalidate_arp_path(int raw_socket, struct interface_info *if_list, struct arp_entry *path, uint8_t my_mip_address)
+{
+    if (!path->unverified || path->verify_deadline_ns != 0)
+    {
+        return;
+    }
+    path->verify_deadline_ns = get_time_ns() + ARP_VERIFY_TIMEOUT_NS;
+    struct sockaddr_ll *iface = find_interface_by_mac(if_list, path->src_mac_address);
+    if (iface != NULL && send_request_on_interface(raw_socket, iface, path->mac_address, path->mip_address, my_mip_address) == 0)
+    {
+        STATS_INC(arp_snapshot_revalidations);
+    }
+}
+
+
+int expire_unverified_arp_paths(uint64_t now_ns)
+{
+    int removed = 0;
+    for (int i = arp_cache_count - 1; i >= 0; i--)
+    {
+        if (arp_list[i].unverified && arp_list[i].verify_deadline_ns != 0 && arp_list[i].verify_deadline_ns <= now_ns)
+        {
+            TRACE(TRACE_WARN, TRACE_ARP_PATH_DOWN, arp_list[i].mip_address, trace_mac(arp_list[i].mac_address));
+            remove_arp_path(arp_list[i].mip_address, arp_list[i].mac_address);
+            STATS_INC(arp_snapshot_expired);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+
+uint64_t unverified_arp_deadline(void)
+{
+    uint64_t next = 0;
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        uint64_t deadline = arp_list[i].unverified ? arp_list[i].verify_deadline_ns : 0;
+        if (deadline != 0 && (next == 0 || deadline < next))
+        {
+            next = deadline;
+        }
+    }
+    return next;
+}
+
+
+void remove_from_arp_cache(uint8_t mip_address)
+{
+    int kept = 0;
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        if (arp_list[i].mip_address != mip_address)
+        {
+            arp_list[kept++] = arp_list[i];
+        }
+    }
+    memset(&arp_list[kept], 0, (arp_cache_count - kept) * sizeof(struct arp_entry));
+    arp_cache_count = kept;
+}
+
+
+/*Function to send an arp request on one interface, to the broadcast address or to the mac address we expect to answer.
+Returns 0 on success and -1 if the link layer failed.*/
+static int send_request_on_interface(int raw_socket, struct sockaddr_ll *iface, uint8_t dest_mac[6], uint8_t mip_address,
+                                     uint8_t src_mip_address)
 {
     struct mip_arp_message arp_request;
     struct pdu *pdu_request;
-    struct msghdr *msg;
-    struct iovec msgvec[1];
-    uint8_t broadcast_mac[6] = ETH_BROADCAST_ADDR;  /*Ethernet broadcast address*/
 
     /*Set up arp request message*/
     arp_request.type = MIP_ARP_REQUEST;
@@ -79,54 +263,48 @@ void send_arp_request(int raw_socket, struct interface_info *if_list, uint8_t mi
     /*Allocate the pdu*/
     pdu_request = alloc_pdu();
 
+    /*Make sure that buffer is set to 0*/
     uint8_t buffer[BUFFER_SIZE];
-
-    /*For each interface send an arp request*/
-    for (int i = 0; i < if_list->num_interfaces; i++) 
+    memset(buffer, 0, sizeof(buffer));
+
+    fill_pdu(
+        pdu_request,                           /*Pointer to struct pdu*/
+        iface->sll_addr,                       /*Source mac address*/
+        dest_mac,                              /*Destination mac address*/
+        src_mip_address,                       /*Source mip address*/
+        0xFF,                                  /*Destination mip address, in this case broadcast*/
+        MIP_ARP,                               /*Sdu type mip arp message*/
+        (uint8_t*)&arp_request,                /*Sdu, the arp request payload*/
+        sizeof(struct mip_arp_message)         /*Size of the sdu*/
+        );
+
+    /*Serialize the pdu into byte stream*/
+    size_t pdu_size = mip_serialize_pdu(pdu_request, buffer);
+
+    int rc = link_send(raw_socket, iface, buffer, pdu_size); /*Send the pdu on the interface*/
+    if (rc == -1)
     {
-        /*Make sure that buffer is set to 0*/
-        memset(buffer, 0, sizeof(buffer));
-
-        fill_pdu(
-            pdu_request,                           /*Pointer to struct pdu*/
-            if_list->interface_addrs[i].sll_addr,  /*Source mac address*/
-            broadcast_mac,                         /*Destination mac address*/
-            src_mip_address,                       /*Source mip address*/
-            0xFF,                                  /*Destination mip address, in this case broadcast*/
-            MIP_ARP,                               /*Sdu type mip arp message*/
-            (uint8_t*)&arp_request,                /*Sdu, the arp request payload*/
-            sizeof(struct mip_arp_message)         /*Size of the sdu*/
-            );
-
-        /*Serialize the pdu into byte stream*/
-        size_t pdu_size = mip_serialize_pdu(pdu_request, buffer);
-        /*Set appropriate values for sending*/
-        msgvec[0].iov_base = buffer;
-        msgvec[0].iov_len = pdu_size;
+        perror("link_send");
+    }
+    /*Free allocated pdu after sending*/
+    destroy_pdu(pdu_request);
+    return rc == -1 ? -1 : 0;
+}
 
-        msg = (struct msghdr *)calloc(1, sizeof(struct msghdr));
 
-        msg->msg_name = &if_list->interface_addrs[i]; /*Correct interface*/
-        msg->msg_namelen = sizeof(struct sockaddr_ll);
-        msg->msg_iov = msgvec;
-        msg->msg_iovlen = 1;
+void send_arp_request(int raw_socket, struct interface_info *if_list, uint8_t mip_address, uint8_t src_mip_address) 
+{
+    uint8_t broadcast_mac[6] = ETH_BROADCAST_ADDR;  /*Ethernet broadcast address*/
 
-        if (sendmsg(raw_socket, msg, 0) == -1) /*Send the pdu over raw socket*/
-        {
-            perror("sendmsg");
-        } else 
+    /*For each interface send an arp request*/
+    for (int i = 0; i < if_list->num_interfaces; i++) 
+    {
+        if (send_request_on_interface(raw_socket, &if_list->interface_addrs[i], broadcast_mac, mip_address, src_mip_address) == 0)
         {
-            printf("Sent MIP-ARP PDU request for MIP address: %d on interface %d\n", mip_address, i);
-            if(debug_mode)
-            {
-                print_pdu_content(pdu_request);
-            }
+            TRACE(TRACE_INFO, TRACE_ARP_REQUEST_SENT, mip_address, i);
+            STATS_INC(arp_requests_sent);
         }
-        
-        free(msg);
     }
-    /*Free allocated pdu after sending*/
-    destroy_pdu(pdu_request);
 }
 
 
@@ -135,8 +313,6 @@ void send_arp_response( int raw_socket, struct sockaddr_ll *so_name, uint8_t mip
 {
     struct mip_arp_message arp_response;
     struct pdu *pdu_response;
-    struct msghdr *msg;
-    struct iovec msgvec[1];
 
     /*Set up arp response message*/
     arp_response.type = MIP_ARP_RESPONSE;
@@ -169,31 +345,332 @@ void send_arp_response( int raw_socket, struct sockaddr_ll *so_name, uint8_t mip
             uint8_t buffer[BUFFER_SIZE];
             size_t pdu_size = mip_serialize_pdu(pdu_response, buffer);
 
-            msgvec[0].iov_base = buffer;
-            msgvec[0].iov_len = pdu_size;
-
-            msg = (struct msghdr *)calloc(1, sizeof(struct msghdr)); /*Allocate memory for msg, and initialize as 0*/
-
-            msg->msg_name = &if_list->interface_addrs[i];
-            msg->msg_namelen = sizeof(struct sockaddr_ll);
-            msg->msg_iov = msgvec;
-            msg->msg_iovlen = 1;
-
-            if (sendmsg(raw_socket, msg, 0) == -1) /*Send arp response over raw socket*/
+            if (link_send(raw_socket, &if_list->interface_addrs[i], buffer, pdu_size) == -1) /*Send arp response on the interface it came from*/
             {
-                perror("sendmsg");
-                free(msg);
+                perror("link_send");
             } else 
             {
-                printf("Sent MIP-ARP response: MIP address %d is at our MAC address\n", mip_address);
-                if(debug_mode){
-                    print_pdu_content(pdu_response);
-                }
+                TRACE(TRACE_INFO, TRACE_ARP_RESPONSE_SENT, mip_address);
+                STATS_INC(arp_responses_sent);
             }
-            free(msg); /*Free msg*/
             break; /*If we find the matching interface we break the loop*/
         }
     }
     /*Free allocated pdu after sending*/
     destroy_pdu(pdu_response);
 }
+
+
+void send_arp_announcement(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address)
+{
+    if (!announcement_pending)
+    {
+        return;
+    }
+    announcement_pending = 0;
+
+    struct mip_arp_message announcement;
+    announcement.type = MIP_ARP_ANNOUNCE;
+    announcement.address = my_mip_address;
+    announcement.reserved = 0;
+    uint8_t broadcast_mac[6] = ETH_BROADCAST_ADDR;
+    struct pdu *pdu = alloc_pdu();
+    uint8_t buffer[BUFFER_SIZE];
+
+    /*Like a request, the announcement goes out on every interface*/
+    for (int i = 0; i < if_list->num_interfaces; i++)
+    {
+        fill_pdu(pdu, if_list->interface_addrs[i].sll_addr, broadcast_mac, my_mip_address, 0xFF, MIP_ARP,
+                 (uint8_t *)&announcement, sizeof(struct mip_arp_message));
+        size_t pdu_size = mip_serialize_pdu(pdu, buffer);
+        if (link_send(raw_socket, &if_list->interface_addrs[i], buffer, pdu_size) == -1)
+        {
+            perror("link_send");
+        } else
+        {
+            TRACE(TRACE_INFO, TRACE_ARP_ANNOUNCE_SENT, my_mip_address, i);
+            STATS_INC(arp_announcements_sent);
+        }
+    }
+    destroy_pdu(pdu);
+}
+
+
+void schedule_arp_announcement(void)
+{
+    announcement_pending = 1;
+}
+
+
+void check_arp_interfaces(struct interface_info *if_list, uint64_t now_ns)
+{
+    if (!announcements_enabled || now_ns < next_interface_check_ns)
+    {
+        return;
+    }
+    int first_check = next_interface_check_ns == 0;
+    next_interface_check_ns = now_ns + ARP_INTERFACE_CHECK_NS;
+    if (first_check) /*mipd has just read the interfaces, and announces them at startup*/
+    {
+        return;
+    }
+
+    static struct interface_info fresh;
+    if (!link_refresh_interfaces(&fresh, if_list->socket_fd)) /*Try again at the next check*/
+    {
+        return;
+    }
+    int changed = fresh.num_interfaces != if_list->num_interfaces;
+    for (int i = 0; i < fresh.num_interfaces && !changed; i++)
+    {
+        changed = fresh.interface_addrs[i].sll_ifindex != if_list->interface_addrs[i].sll_ifindex ||
+                  memcmp(fresh.interface_addrs[i].sll_addr, if_list->interface_addrs[i].sll_addr, 6) != 0;
+    }
+    if (changed)
+    {
+        memcpy(if_list, &fresh, sizeof(fresh));
+        TRACE(TRACE_INFO, TRACE_ARP_INTERFACES_CHANGED, if_list->num_interfaces);
+        /*A path whose source mac address is gone would send on an interface we no longer have*/
+        for (int i = arp_cache_count - 1; i >= 0; i--)
+        {
+            if (find_interface_by_mac(if_list, arp_list[i].src_mac_address) == NULL)
+            {
+                TRACE(TRACE_WARN, TRACE_ARP_PATH_DOWN, arp_list[i].mip_address, trace_mac(arp_list[i].mac_address));
+                remove_arp_path(arp_list[i].mip_address, arp_list[i].mac_address);
+            }
+        }
+        schedule_arp_announcement();
+    } else
+    {
+        memcpy(if_list->mtu, fresh.mtu, sizeof(fresh.mtu));
+    }
+}
+
+
+uint64_t arp_announcement_deadline(void)
+{
+    if (announcement_pending)
+    {
+        return 1;
+    }
+    return announcements_enabled ? next_interface_check_ns : 0;
+}
+
+
+void set_arp_announcements(int enable)
+{
+    announcements_enabled = enable;
+}
+
+
+/*Function to find the interface a frame came on. Returns a pointer to its address, or NULL if it is not one of ours*/
+static struct sockaddr_ll *find_interface(struct interface_info *if_list, int ifindex)
+{
+    for (int i = 0; i < if_list->num_interfaces; i++)
+    {
+        if (if_list->interface_addrs[i].sll_ifindex == ifindex)
+        {
+            return &if_list->interface_addrs[i];
+        }
+    }
+    return NULL;
+}
+
+
+void handle_arp_announcement(int raw_socket, struct sockaddr_ll *so_name, uint8_t my_mip_address, uint8_t src_mip_address,
+                             uint8_t src_mac[6], struct interface_info *if_list)
+{
+    TRACE(TRACE_INFO, TRACE_ARP_ANNOUNCE_RECEIVED, src_mip_address);
+    STATS_INC(arp_announcements_received);
+    if (announcements_enabled)
+    {
+        /*The response adds the neighbour to our cache, and tells it about us*/
+        send_arp_response(raw_socket, so_name, my_mip_address, src_mip_address, if_list, src_mac);
+    } else
+    {
+        struct sockaddr_ll *iface = find_interface(if_list, so_name->sll_ifindex);
+        if (iface == NULL)
+        {
+            return;
+        }
+        add_to_arp_cache(src_mip_address, src_mac, iface->sll_addr);
+    }
+    send_pending_sdus(raw_socket, if_list, my_mip_address, src_mip_address);
+}
+
+
+void set_arp_proxy(uint64_t max_age_ns)
+{
+    proxy_max_age_ns = max_age_ns;
+}
+
+
+void send_arp_proxy_response(int raw_socket, struct sockaddr_ll *so_name, uint8_t my_mip_address, uint8_t target_mip_address,
+                             uint8_t address, struct interface_info *if_list, uint8_t dest_mac[6])
+{
+    struct sockaddr_ll *iface = find_interface(if_list, so_name->sll_ifindex);
+    if (proxy_max_age_ns == 0 || iface == NULL)
+    {
+        return;
+    }
+
+    /*Cache the requester, which is how proxies learn fresh mappings without asking for them*/
+    add_to_arp_cache(target_mip_address, dest_mac, iface->sll_addr);
+
+    /*Only a path on the interface the request came on will do, since the requester has to reach the owner directly*/
+    uint64_t now = get_time_ns();
+    struct arp_entry *path = NULL;
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        if (arp_list[i].mip_address == address && memcmp(arp_list[i].src_mac_address, iface->sll_addr, 6) == 0 &&
+            now - arp_list[i].last_heard_ns <= proxy_max_age_ns)
+        {
+            path = &arp_list[i];
+            break;
+        }
+    }
+    if (path == NULL || memcmp(path->mac_address, dest_mac, 6) == 0)
+    {
+        return;
+    }
+
+    struct mip_arp_proxy_message response;
+    response.type = MIP_ARP_PROXY_RESPONSE;
+    response.address = address;
+    memcpy(response.mac_address, path->mac_address, 6);
+    struct pdu *pdu = alloc_pdu();
+    uint8_t buffer[BUFFER_SIZE];
+    fill_pdu(pdu, iface->sll_addr, dest_mac, my_mip_address, target_mip_address, MIP_ARP, (uint8_t *)&response, sizeof(response));
+    size_t pdu_size = mip_serialize_pdu(pdu, buffer);
+    if (link_send(raw_socket, iface, buffer, pdu_size) == -1)
+    {
+        perror("link_send");
+    } else
+    {
+        TRACE(TRACE_INFO, TRACE_ARP_PROXY_RESPONSE_SENT, address, target_mip_address);
+        STATS_INC(arp_proxy_responses_sent);
+    }
+    destroy_pdu(pdu);
+}
+
+
+int add_to_pending_queue(uint8_t dst_mip_address, uint8_t sdu_type, uint8_t *sdu, size_t sdu_len)
+{
+    uint64_t now = get_time_ns();
+    int already_pending = 0;
+    int kept = 0;
+
+    for (int i = 0; i < pending_count; i++) 
+    {
+        if (now - pending_queue[i].queued_ns > PENDING_TIMEOUT_NS) /*Drop SDUs whose ARP request was never answered*/
+        {
+            TRACE(TRACE_WARN, TRACE_PENDING_TIMEOUT, pending_queue[i].dst_mip_address);
+            STATS_INC(pending_drops_timeout);
+            free(pending_queue[i].sdu);
+            continue;
+        }
+        if (pending_queue[i].dst_mip_address == dst_mip_address) /*Check if we are already waiting for this mip address*/
+        {
+            already_pending = 1;
+        }
+        pending_queue[kept++] = pending_queue[i];
+    }
+    pending_count = kept;
+
+    if (pending_count >= MAX_PENDING_SDUS) /*Check that we have room for more SDUs*/
+    {
+        TRACE(TRACE_WARN, TRACE_PENDING_FULL, dst_mip_address);
+        STATS_INC(pending_drops_full);
+        return -1;
+    }
+
+    uint8_t *copy = (uint8_t *)malloc(sdu_len);
+    if (copy == NULL)
+    {
+        perror("malloc failed");
+        return -1;
+    }
+    memcpy(copy, sdu, sdu_len);
+
+    pending_queue[pending_count].dst_mip_address = dst_mip_address;
+    pending_queue[pending_count].sdu_type = sdu_type;
+    pending_queue[pending_count].sdu_len = sdu_len;
+    pending_queue[pending_count].sdu = copy;
+    pending_queue[pending_count].queued_ns = now;
+    pending_count++;
+
+    return already_pending;
+}
+
+
+void send_pending_sdus(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address)
+{
+    struct pending_sdu ready[MAX_PENDING_SDUS];
+    int ready_count = 0;
+    int kept = 0;
+
+    /*Take the SDUs for the mip address out of the queue first, since sending may queue them again if the lookup fails*/
+    for (int i = 0; i < pending_count; i++)
+    {
+        if (pending_queue[i].dst_mip_address == dst_mip_address)
+        {
+            ready[ready_count++] = pending_queue[i];
+        } else 
+        {
+            pending_queue[kept++] = pending_queue[i];
+        }
+    }
+    pending_count = kept;
+
+    /*Send them in the order they were received*/
+    uint64_t now = get_time_ns();
+    for (int i = 0; i < ready_count; i++)
+    {
+        stats_count_latency(STATS_LATENCY_ARP, now - ready[i].queued_ns);
+        send_sdu(raw_socket, if_list, my_mip_address, ready[i].dst_mip_address, ready[i].sdu_type, ready[i].sdu, ready[i].sdu_len);
+        free(ready[i].sdu);
+    }
+}
+
+
+int drop_pending_sdus(uint8_t mip_address)
+{
+    int kept = 0;
+    for (int i = 0; i < pending_count; i++)
+    {
+        if (pending_queue[i].dst_mip_address == mip_address)
+        {
+            free(pending_queue[i].sdu);
+        } else
+        {
+            pending_queue[kept++] = pending_queue[i];
+        }
+    }
+    int dropped = pending_count - kept;
+    pending_count = kept;
+    return dropped;
+}
+
+
+int pending_queue_length(void)
+{
+    return pending_count;
+}
+
+
+void save_arp_state(struct arp_state *state)
+{
+    memcpy(state->arp_list, arp_list, arp_cache_count * sizeof(struct arp_entry));
+    state->arp_cache_count = arp_cache_count;
+    memcpy(state->pending_queue, pending_queue, pending_count * sizeof(struct pending_sdu));
+    state->pending_count = pending_count;
+}
+
+
+void load_arp_state(const struct arp_state *state)
+{
+    memcpy(arp_list, state->arp_list, state->arp_cache_count * sizeof(struct arp_entry));
+    arp_cache_count = state->arp_cache_count;
+    memcpy(pending_queue, state->pending_queue, state->pending_count * sizeof(struct pending_sdu));
+    pending_count = state->pending_count;
+}
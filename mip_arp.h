@@ -12,14 +12,37 @@
 
 #define MIP_ARP_REQUEST 0
 #define MIP_ARP_RESPONSE 1
+#define MIP_ARP_ANNOUNCE 2       /*Broadcast by a node about itself at startup or when told to (mipd -g), so the caches of its neighbours are warm*/
+#define MIP_ARP_PROXY_RESPONSE 3 /*Answer from a node which knows the address asked for (mipd -P), carries the mac address of the owner*/
 
 #define ETH_BROADCAST_ADDR {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
 
-/*Struct for an arp entry in our arp_list. Contains mip, dest mac address and source mac address.*/
+/*Max number of SDUs waiting for an ARP response at the same time*/
+#define MAX_PENDING_SDUS 64
+
+/*How long an SDU may wait for an ARP response before it is dropped, after which a new ARP request is sent*/
+#define PENDING_TIMEOUT_NS (1000ULL * 1000000ULL)
+
+/*How long a path loaded from a snapshot may be used after its first use before it has to be heard from*/
+#define ARP_VERIFY_TIMEOUT_NS (1000ULL * 1000000ULL)
+
+/*How often the interfaces are checked with announcements on, a new interface or mac address is announced at the next check*/
+#define ARP_INTERFACE_CHECK_NS (1000ULL * 1000000ULL)
+
+/*Policies for spreading the SDUs to a MIP address over its paths, set with mipd -m*/
+#define MULTIPATH_FLOW 0        /*Hash the destination, the SDU type and the application, so the SDUs of a flow keep their order*/
+#define MULTIPATH_ROUND_ROBIN 1 /*Take turns per SDU, which adds up the bandwidth of the paths for a single flow*/
+
+/*Struct for an arp entry in our arp_list. Contains mip, dest mac address and source mac address.
+A MIP address which we reach over several links, e.g. parallel links to the same node, has one entry for each path.*/
 struct arp_entry {
     uint8_t mip_address;   /*Destination MIP address*/
     uint8_t mac_address[6]; /*Destination mac address*/
     uint8_t src_mac_address[6]; /*Source mac address, the one we use to send*/ 
+    uint64_t last_heard_ns; /*Time we last received a frame on this path, for liveness detection (see keepalive.h)*/
+    uint64_t last_probe_ns; /*Time we last sent a keepalive probe on this path*/
+    uint8_t unverified;     /*1 if the entry was loaded from a snapshot (see snapshot.h) and we have not heard on the path since*/
+    uint64_t verify_deadline_ns; /*Time the path is removed if it is still unverified, 0 until it is first used*/
 } __attribute__((packed));
 
 /*Struct for a MIP-ARP message. Contains type (0 or 1), address (MIP) and reserved (padding)*/
@@ -29,6 +52,32 @@ struct mip_arp_message {
     uint32_t reserved;     /*Padding/Reserved (set to 0)*/
 } __attribute__((packed));
 
+/*Struct for a MIP-ARP proxy response. Contains type (MIP_ARP_PROXY_RESPONSE), the MIP address asked for and the mac address of its owner.
+The owner is on the same link as the node answering for it, so the requester sends to the owner directly.*/
+struct mip_arp_proxy_message {
+    uint8_t type;
+    uint8_t address;
+    uint8_t mac_address[6];
+} __attribute__((packed));
+
+/*Struct for an SDU waiting for an ARP response before it can be sent. Contains destination mip, sdu type and a copy of the sdu*/
+struct pending_sdu {
+    uint8_t dst_mip_address;
+    uint8_t sdu_type;
+    size_t sdu_len;
+    uint8_t *sdu;
+    uint64_t queued_ns; /*Monotonic time when the sdu was queued*/
+};
+
+/*Struct holding the whole state of the ARP module, the cache and the SDUs waiting for ARP responses.
+Used by the simulator, which keeps one per node and loads it before running the protocol code of that node.*/
+struct arp_state {
+    struct arp_entry arp_list[MAX_ARP_CACHE_SIZE];
+    int arp_cache_count;
+    struct pending_sdu pending_queue[MAX_PENDING_SDUS];
+    int pending_count;
+};
+
 /*Global variables for the list of arp_entries and the count of the list*/
 extern struct arp_entry arp_list[MAX_ARP_CACHE_SIZE];
 extern int arp_cache_count;
@@ -46,12 +95,63 @@ The function takes a raw socket fd, source and destination mip address and a poi
 void send_arp_request(int raw_socket, struct interface_info *if_list, uint8_t mip_address, uint8_t src_mip_address);
 
 
+/*Function to broadcast an announcement of our mip address on every interface, if one has been scheduled with schedule_arp_announcement().
+Function takes the raw socket fd, a pointer to interface_info and our mip address as parameters.*/
+void send_arp_announcement(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address);
+
+
+/*Function to schedule an announcement, which the timers of mipd send right away.*/
+void schedule_arp_announcement(void);
+
+
+/*Function to look for changes to the interfaces with announcements on, every ARP_INTERFACE_CHECK_NS. If an interface has come or gone,
+or has a new mac address, the interface list is updated, the paths on interfaces which are gone are removed,
+and an announcement is scheduled, so the neighbours learn the new mac address.
+Function takes a pointer to interface_info and the current monotonic time in nanoseconds as parameters.*/
+void check_arp_interfaces(struct interface_info *if_list, uint64_t now_ns);
+
+
+/*Function to get the time the scheduled announcement, or the next check of the interfaces, is due.
+Returns 1 if an announcement is scheduled, the time of the next check with announcements on, and 0 otherwise.*/
+uint64_t arp_announcement_deadline(void);
+
+
+/*Function to turn on answering announcements. A node which announces itself then gets a response from every neighbour
+which has announcements on, so its own cache is warm as well. Function takes 1 to turn it on as parameter.*/
+void set_arp_announcements(int enable);
+
+
+/*Function to handle an announcement from a neighbour. The neighbour is added to the cache, its waiting SDUs are sent,
+and with announcements on it gets a response. Function takes the raw socket fd, the interface it came on, our mip address,
+the mip address and mac address of the neighbour and a pointer to interface_info as parameters.*/
+void handle_arp_announcement(int raw_socket, struct sockaddr_ll *so_name, uint8_t my_mip_address, uint8_t src_mip_address,
+                             uint8_t src_mac[6], struct interface_info *if_list);
+
+
+/*Function to turn on proxy answers. A request for an address which is not ours is answered with a proxy response if we have heard
+from the address on the same interface within max_age_ns, and the mapping of every requester we hear is cached.
+Function takes the max age as parameter, 0 turns proxy answers off.*/
+void set_arp_proxy(uint64_t max_age_ns);
+
+
+/*Function to answer a request for another node on its behalf, if proxy answers are on and we know a fresh mapping.
+Function takes the raw socket fd, the interface the request came on, our mip address, the mip address of the requester, the mip address
+asked for, a pointer to interface_info and the mac address of the requester as parameters.*/
+void send_arp_proxy_response(int raw_socket, struct sockaddr_ll *so_name, uint8_t my_mip_address, uint8_t target_mip_address,
+                             uint8_t address, struct interface_info *if_list, uint8_t dest_mac[6]);
+
+
 /*Arp cache management:*/
 
 /*Function to initialize the arp_cache*/
 void initialize_arp_cache(); 
 
 
+/*Function to remove every entry from the arp cache, the addresses are learned again with ARP requests when they are next used.
+SDUs already waiting for an ARP response stay in the pending queue.*/
+void flush_arp_cache(void);
+
+
 /*Function to find the destination mac address based on the corresponding mip address in the arp list, 
 it matches the mip address given with the ones stored in arp_list and returns the destination mac address.
 Function takes a mip address as a parameter.
@@ -67,8 +167,92 @@ uint8_t *lookup_mac_src(uint8_t mip_address);
 
 
 /*Function checks if the arp_list has reaced its max number of entries, if not it adds mip address, mac dest address and mac src address.
+A path which is already in the cache is not added again, and a new mac dest address on the same interface replaces the old one.
+The path counts as heard from now, which liveness detection and proxy answers use.
 Funtion takes a mip address, mac dest address and mac source address as parameters.
+Returns a pointer to the entry, or NULL if the cache is full.
 */
-void add_to_arp_cache(uint8_t mip_address, uint8_t mac_address[6], uint8_t src_mac[6]);
+struct arp_entry *add_to_arp_cache(uint8_t mip_address, uint8_t mac_address[6], uint8_t src_mac[6]);
+
+
+/*Function to set how SDUs are spread over the paths to a mip address. Takes MULTIPATH_FLOW or MULTIPATH_ROUND_ROBIN as parameter.*/
+void set_multipath_policy(int policy);
+
+
+/*Function to choose the path for an SDU to a mip address with the multipath policy.
+Function takes the mip address, the SDU type and the flow (the class of the application in the transmit scheduler) as parameters.
+Returns a pointer to the arp entry of the path, or NULL if the mip address is not in the cache.*/
+struct arp_entry *lookup_arp_path(uint8_t mip_address, uint8_t sdu_type, int flow);
+
+
+/*Function to count the paths to a mip address. Function takes the mip address as parameter. Returns the number of paths.*/
+int count_arp_paths(uint8_t mip_address);
+
+
+/*Function to remove one path to a mip address, when its interface fails or liveness detection finds it silent.
+Function takes the mip address and the mac dest address of the path as parameters.*/
+void remove_arp_path(uint8_t mip_address, const uint8_t mac_address[6]);
+
+
+/*Function to note that we received a frame on a path, for liveness detection.
+Function takes the mip address, the mac address the frame came from and the current time as parameters.*/
+void arp_path_heard(uint8_t mip_address, const uint8_t mac_address[6], uint64_t now_ns);
+
+
+/*Function to revalidate an unverified path the first time it is used. The SDU is sent on the path right away, and an ARP request
+is sent to the cached mac address instead of broadcast. The path is verified by the response or any other frame on it,
+and removed by expire_unverified_arp_paths() if nothing is heard within ARP_VERIFY_TIMEOUT_NS.
+Function takes the raw socket fd, a pointer to interface_info, the path and our mip address as parameters.*/
+void revalidate_arp_path(int raw_socket, struct interface_info *if_list, struct arp_entry *path, uint8_t my_mip_address);
+
+
+/*Function to remove the unverified paths whose revalidation was not answered in time, so the next SDU asks with a broadcast.
+Function takes the current time as parameter. Returns the number of paths removed.*/
+int expire_unverified_arp_paths(uint64_t now_ns);
+
+
+/*Function to get the time the next revalidation times out. Returns the monotonic time in nanoseconds, or 0 if none is underway.*/
+uint64_t unverified_arp_deadline(void);
+
+
+/*Function to remove the entry of a mip address from the arp cache, used when liveness detection finds a neighbour down.
+Function takes the mip address as parameter.*/
+void remove_from_arp_cache(uint8_t mip_address);
+
+
+
+/*Pending queue management:*/
+
+/*Function to queue an SDU until we receive an ARP response for its destination. The SDU is copied, so the caller keeps ownership of its buffer.
+SDUs which have waited longer than PENDING_TIMEOUT_NS are dropped first, so an unanswered ARP request is eventually sent again.
+Function takes the destination mip address, the sdu type, a pointer to the sdu and the sdu length as parameters.
+Returns 1 if the destination already had SDUs waiting (meaning an ARP request is already underway), 0 if this is the first one, 
+and -1 if the queue is full and the SDU was dropped.*/
+int add_to_pending_queue(uint8_t dst_mip_address, uint8_t sdu_type, uint8_t *sdu, size_t sdu_len);
+
+
+/*Function to send every queued SDU for a mip address, called when we have learned its mac address.
+Function takes the raw socket fd, a pointer to interface_info, our mip address and the mip address we received a response from as parameters.*/
+void send_pending_sdus(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address);
+
+
+/*Function to drop every queued SDU for a mip address, used when liveness detection finds a neighbour down.
+Function takes the mip address as parameter. Returns the number of SDUs dropped.*/
+int drop_pending_sdus(uint8_t mip_address);
+
+
+/*Function to get the number of SDUs waiting for an ARP response.*/
+int pending_queue_length(void);
+
+
+/*Function to copy the arp cache and the pending queue into a struct arp_state. The queued SDUs are not copied, so the state
+owns them until it is loaded again. Only the used entries are copied.
+Takes a pointer to struct arp_state as parameter.*/
+void save_arp_state(struct arp_state *state);
+
+
+/*Function to replace the arp cache and the pending queue with the ones in a struct arp_state saved by save_arp_state().
+Takes a pointer to struct arp_state as parameter.*/
+void load_arp_state(const struct arp_state *state);
 
 #endif // MIP_ARP_H
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "pdu.h"
+#include "ping.h"
+#include "mip_arp.h"
+#include "local_interfaces.h"
+#include "utils.h"
+
+/*Micro benchmarks for the hot functions of the codec and the lookups.
+Built with optimisation by "make bench", and linked with --wrap for the allocation functions so that
+the number of allocations per operation can be counted. Every result is printed as one JSON line.*/
+
+#define USAGE "Usage: mip_bench [-h] [-m <min_ms>] [-o <output>] [-b <baseline>] [-t <threshold_percent>]\n" \
+              "  -m  minimum time in milliseconds each benchmark runs for (default 200)\n" \
+              "  -o  also write the results to this file, so it can be used as a baseline later\n" \
+              "  -b  compare against a baseline written with -o, exits with 1 on regressions\n" \
+              "  -t  how many percent slower than the baseline counts as a regression (default 10)"
+
+/*Max number of results that can be read from a baseline file*/
+#define MAX_BASELINE_RESULTS 128
+
+/*Struct for one benchmark result, also used for the entries of the baseline*/
+struct bench_result
+{
+    char name[64];
+    int param;
+    double ns_per_op;
+    double cycles_per_op;
+    double allocs_per_op;
+};
+
+/*Signature of a benchmark. Runs the operation the given number of times, param selects the size or fill level*/
+typedef void (*bench_fn)(long iterations, int param);
+
+/*Allocation counter updated by the wrappers below*/
+static unsigned long alloc_count = 0;
+
+/*Sink the benchmarks write to, so the compiler can not remove the measured work*/
+static volatile uintptr_t sink;
+
+static struct bench_result baseline[MAX_BASELINE_RESULTS];
+static int baseline_count = 0;
+
+static uint64_t min_time_ns = 200000000ULL;
+static double threshold_percent = 10.0;
+static int regressions = 0;
+static FILE *output_file = NULL;
+
+
+/*Wrappers for the allocation functions, enabled by linking with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc*/
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+
+/*Function to read the cycle counter. On x86 this is the time stamp counter, which counts at a constant rate
+close to the nominal clock frequency. Other architectures report 0 cycles.*/
+static inline uint64_t read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+/*Shared state of the benchmarks, set up before each one runs*/
+static struct pdu *bench_pdu;
+static uint8_t bench_buffer[BUFFER_SIZE];
+static size_t bench_buffer_len;
+static struct ping_message bench_ping;
+static struct interface_info bench_if_list;
+static uint8_t bench_mac[6];
+
+
+/*Function to fill a pdu with an sdu of the given size and serialize it into bench_buffer*/
+static void setup_pdu(int sdu_size)
+{
+    uint8_t src_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    uint8_t dst_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+    uint8_t sdu[MAX_SDU_SIZE];
+    memset(sdu, 'x', sizeof(sdu));
+
+    bench_pdu = alloc_pdu();
+    fill_pdu(bench_pdu, src_mac, dst_mac, 10, 20, PING, sdu, sdu_size);
+    bench_buffer_len = mip_serialize_pdu(bench_pdu, bench_buffer);
+}
+
+
+static void bench_serialize_pdu(long iterations, int param)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += mip_serialize_pdu(bench_pdu, bench_buffer);
+    }
+}
+
+
+static void bench_deserialize_pdu(long iterations, int param)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        struct pdu pdu;
+        sink += mip_deserialize_pdu(&pdu, bench_buffer);
+        free(pdu.ether_header);
+        free(pdu.mip_header);
+        free(pdu.sdu);
+    }
+}
+
+
+static void bench_serialize_ping(long iterations, int param)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        size_t len = sizeof(bench_buffer);
+        sink += serialize_ping_message(&bench_ping, bench_buffer, &len);
+        sink += len;
+    }
+}
+
+
+static void bench_deserialize_ping(long iterations, int param)
+{
+    struct ping_message ping;
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += deserialize_ping_message(&ping, bench_buffer, bench_buffer_len);
+        sink += ping.msg[0];
+    }
+}
+
+
+/*Looks up every address in the cache in turn, so the average position of a hit is measured*/
+static void bench_lookup_mac_dest(long iterations, int param)
+{
+    int next = 0;
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += (uintptr_t)lookup_mac_dest((uint8_t)(next + 1));
+        if (++next == param)
+        {
+            next = 0;
+        }
+    }
+}
+
+
+/*Looks up an address that is not in the cache, which is the worst case since every entry is compared*/
+static void bench_lookup_mac_miss(long iterations, int param)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += (uintptr_t)lookup_mac_dest(254);
+    }
+}
+
+
+/*Looks up the mac address of the last interface, which is the worst case of the linear search*/
+static void bench_find_interface(long iterations, int param)
+{
+    for (long i = 0; i < iterations; i++)
+    {
+        sink += (uintptr_t)find_interface_by_mac(&bench_if_list, bench_mac);
+    }
+}
+
+
+/*Function to fill the arp cache with the given number of entries, using mip addresses from 1 and upwards*/
+static void setup_arp_cache(int fill)
+{
+    memset(arp_list, 0, sizeof(arp_list));
+    arp_cache_count = 0;
+    for (int i = 0; i < fill; i++)
+    {
+        arp_list[i].mip_address = (uint8_t)(i + 1);
+        arp_list[i].mac_address[5] = (uint8_t)(i + 1);
+        arp_cache_count++;
+    }
+}
+
+
+/*Function to fill the interface list with the given number of interfaces and remember the mac of the last one*/
+static void setup_interfaces(int count)
+{
+    memset(&bench_if_list, 0, sizeof(bench_if_list));
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, (uint8_t)(i >> 8), (uint8_t)i};
+        memcpy(bench_if_list.interface_addrs[i].sll_addr, mac, 6);
+        bench_if_list.mtu[i] = DEFAULT_MTU;
+    }
+    bench_if_list.num_interfaces = count;
+    memcpy(bench_mac, bench_if_list.interface_addrs[count - 1].sll_addr, 6);
+}
+
+
+/*Function to load a baseline written by an earlier run with -o. Lines that can not be parsed are skipped.*/
+static void load_baseline(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL && baseline_count < MAX_BASELINE_RESULTS)
+    {
+        struct bench_result *entry = &baseline[baseline_count];
+        if (sscanf(line, "{\"name\":\"%63[^\"]\",\"param\":%d,\"iterations\":%*d,\"ns_per_op\":%lf,"
+                   "\"cycles_per_op\":%lf,\"allocs_per_op\":%lf",
+                   entry->name, &entry->param, &entry->ns_per_op, &entry->cycles_per_op,
+                   &entry->allocs_per_op) == 5)
+        {
+            baseline_count++;
+        }
+    }
+    fclose(file);
+}
+
+
+/*Function to find the baseline entry for a benchmark, returns NULL if there is none*/
+static struct bench_result *find_baseline(const char *name, int param)
+{
+    for (int i = 0; i < baseline_count; i++)
+    {
+        if (baseline[i].param == param && strcmp(baseline[i].name, name) == 0)
+        {
+            return &baseline[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*Function to run one benchmark. The iteration count is doubled until the run takes at least min_time_ns,
+and the last run is the one reported. Takes the name, the benchmark function and its parameter.*/
+static void run_benchmark(const char *name, bench_fn fn, int param)
+{
+    long iterations = 1000;
+    uint64_t elapsed_ns, cycles;
+    unsigned long allocs;
+
+    fn(iterations, param); /*Warm up the caches and the branch predictor*/
+    while (1)
+    {
+        alloc_count = 0;
+        uint64_t start_cycles = read_cycles();
+        uint64_t start = get_time_ns();
+        fn(iterations, param);
+        elapsed_ns = get_time_ns() - start;
+        cycles = read_cycles() - start_cycles;
+        allocs = alloc_count;
+        if (elapsed_ns >= min_time_ns || iterations >= (1L << 40))
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    struct bench_result result;
+    snprintf(result.name, sizeof(result.name), "%s", name);
+    result.param = param;
+    result.ns_per_op = (double)elapsed_ns / iterations;
+    result.cycles_per_op = (double)cycles / iterations;
+    result.allocs_per_op = (double)allocs / iterations;
+
+    char line[512];
+    int len = snprintf(line, sizeof(line),
+                       "{\"name\":\"%s\",\"param\":%d,\"iterations\":%ld,\"ns_per_op\":%.3f,"
+                       "\"cycles_per_op\":%.2f,\"allocs_per_op\":%.2f",
+                       result.name, result.param, iterations, result.ns_per_op, result.cycles_per_op,
+                       result.allocs_per_op);
+    if (output_file != NULL)
+    {
+        fprintf(output_file, "%s}\n", line);
+    }
+
+    struct bench_result *base = find_baseline(name, param);
+    if (base != NULL && base->ns_per_op > 0)
+    {
+        double delta = (result.ns_per_op - base->ns_per_op) * 100.0 / base->ns_per_op;
+        int regression = delta > threshold_percent || result.allocs_per_op > base->allocs_per_op + 0.005;
+        regressions += regression;
+        snprintf(line + len, sizeof(line) - len, ",\"baseline_ns_per_op\":%.3f,\"delta_percent\":%.1f,\"regression\":%s",
+                 base->ns_per_op, delta, regression ? "true" : "false");
+    }
+    printf("%s}\n", line);
+    fflush(stdout);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *baseline_path = NULL;
+    const char *output_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hm:o:b:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                print_help(USAGE);
+                exit(EXIT_SUCCESS);
+            case 'm':
+                min_time_ns = (uint64_t)atol(optarg) * 1000000ULL;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 't':
+                threshold_percent = atof(optarg);
+                break;
+            default:
+                print_help(USAGE);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (baseline_path != NULL)
+    {
+        load_baseline(baseline_path);
+    }
+    if (output_path != NULL)
+    {
+        output_file = fopen(output_path, "w");
+        if (output_file == NULL)
+        {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const int sdu_sizes[] = {64, 512, MAX_SDU_SIZE};
+    for (size_t i = 0; i < sizeof(sdu_sizes) / sizeof(sdu_sizes[0]); i++)
+    {
+        setup_pdu(sdu_sizes[i]);
+        run_benchmark("mip_serialize_pdu", bench_serialize_pdu, sdu_sizes[i]);
+        run_benchmark("mip_deserialize_pdu", bench_deserialize_pdu, sdu_sizes[i]);
+        destroy_pdu(bench_pdu);
+    }
+
+    const int message_sizes[] = {16, 256, MAX_SDU_SIZE - 2};
+    for (size_t i = 0; i < sizeof(message_sizes) / sizeof(message_sizes[0]); i++)
+    {
+        char message[MAX_SDU_SIZE];
+        memset(message, 'x', message_sizes[i]);
+        message[message_sizes[i]] = '\0';
+        init_ping_message(&bench_ping, 20, message);
+        bench_buffer_len = sizeof(bench_buffer);
+        serialize_ping_message(&bench_ping, bench_buffer, &bench_buffer_len);
+        run_benchmark("serialize_ping_message", bench_serialize_ping, message_sizes[i]);
+        run_benchmark("deserialize_ping_message", bench_deserialize_ping, message_sizes[i]);
+    }
+
+    const int fill_levels[] = {1, 8, 64, MAX_ARP_CACHE_SIZE};
+    for (size_t i = 0; i < sizeof(fill_levels) / sizeof(fill_levels[0]); i++)
+    {
+        setup_arp_cache(fill_levels[i]);
+        run_benchmark("lookup_mac_dest", bench_lookup_mac_dest, fill_levels[i]);
+        run_benchmark("lookup_mac_dest_miss", bench_lookup_mac_miss, fill_levels[i]);
+    }
+
+    const int interface_counts[] = {1, 4, 32, MAX_INTERFACES};
+    for (size_t i = 0; i < sizeof(interface_counts) / sizeof(interface_counts[0]); i++)
+    {
+        setup_interfaces(interface_counts[i]);
+        run_benchmark("find_interface_by_mac", bench_find_interface, interface_counts[i]);
+    }
+
+    if (output_file != NULL)
+    {
+        fclose(output_file);
+    }
+    if (baseline_path != NULL)
+    {
+        fprintf(stderr, "%d benchmark(s) regressed by more than %.1f%% compared to %s\n",
+                regressions, threshold_percent, baseline_path);
+        return regressions ? 1 : 0;
+    }
+    return 0;
+}
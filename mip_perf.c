@@ -0,0 +1,525 @@
+#define _GNU_SOURCE /*For ppoll*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include "utils.h"
+
+#define USAGE "Usage: mip_perf [-h] [-y <sdu_type>] -s <socket_lower>\n" \
+              "       mip_perf [-h] [-y <sdu_type>] -c <destination_host> [-l <bytes>] [-p <pps>] [-t <seconds>] [-i <seconds>] <socket_lower>\n" \
+              "  -s  run as server, answer every test message with a small echo\n" \
+              "  -c  run as client and send test messages to the given mip address, 255 broadcasts them\n" \
+              "  -l  payload size in bytes (default 1000, the SDU limit is 2043 without fragmentation)\n" \
+              "  -p  fixed rate in messages per second, 0 sends as fast as mipd accepts (default 0)\n" \
+              "  -t  test duration in seconds (default 10)\n" \
+              "  -i  interval between reports in seconds (default 1)\n" \
+              "  -y  register an SDU type (0, 2 or 4) with mipd and send with it, so several tests can share a daemon (default PING)"
+
+/*Magic number in front of every test message ("MPRF"), so other traffic on the socket is ignored*/
+#define PERF_MAGIC 0x4D505246
+
+#define PERF_DATA 1
+#define PERF_ECHO 2
+
+/*How long the client waits for outstanding echoes after the test has ended*/
+#define LINGER_NS 1000000000ULL
+
+/*Header at the start of every payload, all fields are in network byte order.
+The server echoes the header back with the type changed to PERF_ECHO, so the client can measure the round trip time
+and count how many bytes actually reached the server.*/
+struct perf_header
+{
+    uint32_t magic;
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t seq;
+    uint32_t length;        /*Length of the payload the server received, including this header*/
+    uint64_t timestamp_ns;  /*Send time of the client, only compared against the clock of the client*/
+} __attribute__((packed));
+
+#define PERF_HEADER_SIZE sizeof(struct perf_header)
+
+
+/*Global variable set by SIGINT so that the client can still print its summary*/
+static volatile sig_atomic_t stop_requested = 0;
+
+/*Round trip times of every echo, in nanoseconds*/
+static uint64_t *rtt_samples = NULL;
+static size_t rtt_count = 0;
+static size_t rtt_capacity = 0;
+
+/*SDU type registered with the daemon, -1 to take PING messages without registering*/
+static int sdu_type = -1;
+
+
+/*Function to handle SIGINT by stopping the test early*/
+static void handle_sigint(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+
+/*Function to convert a 64 bit integer to network byte order*/
+static uint64_t htonll(uint64_t value)
+{
+    return ((uint64_t)htonl((uint32_t)value) << 32) | htonl((uint32_t)(value >> 32));
+}
+
+
+/*Function to convert a 64 bit integer from network byte order*/
+static uint64_t ntohll(uint64_t value)
+{
+    return htonll(value);
+}
+
+
+/*Function to connect to the unix socket of the mip daemon, exits on failure*/
+static int connect_to_daemon(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int sd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sd == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    if (connect(sd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("connect");
+        close(sd);
+        exit(EXIT_FAILURE);
+    }
+
+    /*A message of a single byte registers the SDU type with the daemon*/
+    uint8_t registration = (uint8_t)sdu_type;
+    if (sdu_type != -1 && send(sd, &registration, 1, 0) == -1)
+    {
+        perror("send");
+        close(sd);
+        exit(EXIT_FAILURE);
+    }
+    return sd;
+}
+
+
+/*Function to store one round trip time sample, growing the sample array when needed*/
+static void add_rtt_sample(uint64_t rtt_ns)
+{
+    if (rtt_count == rtt_capacity)
+    {
+        size_t new_capacity = rtt_capacity ? rtt_capacity * 2 : 4096;
+        uint64_t *new_samples = realloc(rtt_samples, new_capacity * sizeof(uint64_t));
+        if (new_samples == NULL)
+        {
+            return; /*Keep the samples we have, the summary will be based on them*/
+        }
+        rtt_samples = new_samples;
+        rtt_capacity = new_capacity;
+    }
+    rtt_samples[rtt_count++] = rtt_ns;
+}
+
+
+/*Compare function for qsort of the round trip time samples*/
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*Function to get a percentile from the sorted samples using the nearest rank method, in microseconds*/
+static double percentile_us(double percent)
+{
+    if (rtt_count == 0)
+    {
+        return 0.0;
+    }
+    size_t rank = (size_t)(percent / 100.0 * rtt_count + 0.999999);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+    if (rank > rtt_count)
+    {
+        rank = rtt_count;
+    }
+    return rtt_samples[rank - 1] / 1000.0;
+}
+
+
+/*Function to run the server side. Every test message is answered with its header, so the echo stays small
+and the measured throughput is the one from the client to the server.*/
+static void run_server(const char *socket_path)
+{
+    int sd = connect_to_daemon(socket_path);
+    printf("mip_perf server connected to the MIP daemon at %s\n", socket_path);
+
+    /*Wake up every second so the reports are printed even when the traffic stops*/
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+    {
+        perror("setsockopt");
+        close(sd);
+        exit(EXIT_FAILURE);
+    }
+
+    static uint8_t buffer[MAX_MESSAGE_SIZE];
+    uint64_t interval_start = get_time_ns();
+    uint64_t interval_packets = 0;
+    uint64_t interval_bytes = 0;
+
+    while (!stop_requested)
+    {
+        ssize_t rc = recv(sd, buffer, sizeof(buffer), 0);
+        if (rc == 0)
+        {
+            printf("The MIP daemon closed the connection\n");
+            break;
+        } else if (rc > 0 && (size_t)rc >= 1 + PERF_HEADER_SIZE)
+        {
+            struct perf_header *header = (struct perf_header *)(buffer + 1);
+            if (ntohl(header->magic) == PERF_MAGIC && header->type == PERF_DATA)
+            {
+                interval_packets++;
+                interval_bytes += rc - 1;
+
+                /*Answer with the header only, byte 0 already holds the mip address of the client*/
+                header->type = PERF_ECHO;
+                header->length = htonl((uint32_t)(rc - 1));
+                if (send(sd, buffer, 1 + PERF_HEADER_SIZE, 0) == -1)
+                {
+                    perror("send");
+                }
+            }
+        } else if (rc == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            perror("recv");
+            break;
+        }
+
+        uint64_t now = get_time_ns();
+        if (now - interval_start >= 1000000000ULL)
+        {
+            if (interval_packets > 0)
+            {
+                double seconds = (now - interval_start) / 1e9;
+                printf("server: %8.2f Mbit/s %10.0f pps\n", interval_bytes * 8 / seconds / 1e6,
+                       interval_packets / seconds);
+                fflush(stdout);
+            }
+            interval_start = now;
+            interval_packets = 0;
+            interval_bytes = 0;
+        }
+    }
+    close(sd);
+}
+
+
+/*Function to receive all echoes waiting on the socket and update the counters of the client*/
+static void receive_echoes(int sd, uint64_t *received, uint64_t *received_bytes, uint32_t *highest_seq,
+                           uint64_t *reordered, uint64_t *interval_rtt_sum, uint64_t *interval_rtt_max)
+{
+    uint8_t buffer[BUFFER_SIZE];
+    while (1)
+    {
+        ssize_t rc = recv(sd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (rc <= 0)
+        {
+            return;
+        }
+        if ((size_t)rc < 1 + PERF_HEADER_SIZE)
+        {
+            continue;
+        }
+
+        struct perf_header *header = (struct perf_header *)(buffer + 1);
+        if (ntohl(header->magic) != PERF_MAGIC || header->type != PERF_ECHO)
+        {
+            continue;
+        }
+
+        uint64_t rtt = get_time_ns() - ntohll(header->timestamp_ns);
+        uint32_t seq = ntohl(header->seq);
+
+        if (*received > 0 && seq < *highest_seq)
+        {
+            (*reordered)++;
+        } else
+        {
+            *highest_seq = seq;
+        }
+        (*received)++;
+        *received_bytes += ntohl(header->length);
+        *interval_rtt_sum += rtt;
+        if (rtt > *interval_rtt_max)
+        {
+            *interval_rtt_max = rtt;
+        }
+        add_rtt_sample(rtt);
+    }
+}
+
+
+/*Function to run the client side. Takes the socket path, the destination, the payload size, the rate in messages
+per second (0 for max rate), the duration and the report interval as parameters.*/
+static void run_client(const char *socket_path, uint8_t destination, size_t payload_size, uint64_t rate,
+                       double duration, double interval)
+{
+    int sd = connect_to_daemon(socket_path);
+    printf("mip_perf client connected to the MIP daemon at %s, sending %zu byte payloads to MIP address %u %s\n",
+           socket_path, payload_size, destination, rate ? "at a fixed rate" : "at max rate");
+
+    uint8_t *message = malloc(1 + payload_size);
+    if (message == NULL)
+    {
+        perror("malloc");
+        close(sd);
+        exit(EXIT_FAILURE);
+    }
+
+    /*Fill the payload with a pattern once, only the header changes between messages*/
+    message[0] = destination;
+    for (size_t i = 1 + PERF_HEADER_SIZE; i < 1 + payload_size; i++)
+    {
+        message[i] = (uint8_t)i;
+    }
+    struct perf_header *header = (struct perf_header *)(message + 1);
+    memset(header, 0, PERF_HEADER_SIZE);
+    header->magic = htonl(PERF_MAGIC);
+    header->type = PERF_DATA;
+    header->length = htonl((uint32_t)payload_size);
+
+    uint64_t period_ns = rate ? 1000000000ULL / rate : 0;
+    uint64_t interval_ns = (uint64_t)(interval * 1e9);
+    uint64_t start = get_time_ns();
+    uint64_t end = start + (uint64_t)(duration * 1e9);
+    uint64_t next_send = start;
+    uint64_t next_report = start + interval_ns;
+    uint64_t send_end = end;
+
+    uint64_t sent = 0, received = 0, received_bytes = 0, reordered = 0;
+    uint32_t highest_seq = 0;
+    uint64_t last_sent = 0, last_received = 0, last_received_bytes = 0;
+    uint64_t interval_rtt_sum = 0, interval_rtt_max = 0;
+    int sending = 1;
+
+    while (1)
+    {
+        uint64_t now = get_time_ns();
+
+        if (sending && (now >= end || stop_requested))
+        {
+            sending = 0;
+            send_end = now;
+            end = now + LINGER_NS;
+        }
+        if (!sending && (received == sent || now >= end))
+        {
+            break;
+        }
+
+        /*Send as many messages as the rate allows, or until the daemon stops taking them*/
+        int blocked = 0;
+        while (sending && (rate == 0 || now >= next_send))
+        {
+            header->seq = htonl((uint32_t)sent);
+            header->timestamp_ns = htonll(get_time_ns());
+            if (send(sd, message, 1 + payload_size, MSG_DONTWAIT) == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    blocked = 1;
+                    break;
+                }
+                perror("send");
+                sending = 0;
+                break;
+            }
+            sent++;
+            next_send += period_ns;
+            if (rate == 0 && sent % 64 == 0)
+            {
+                break; /*Give the echoes a chance to be read while running at max rate*/
+            }
+        }
+
+        receive_echoes(sd, &received, &received_bytes, &highest_seq, &reordered, &interval_rtt_sum,
+                       &interval_rtt_max);
+
+        now = get_time_ns();
+        if (now >= next_report && sending)
+        {
+            double from = (next_report - interval_ns - start) / 1e9;
+            double to = (next_report - start) / 1e9;
+            uint64_t packets = received - last_received;
+            printf("[%6.2f-%6.2f s] sent %8lu recv %8lu %8.2f Mbit/s %10.0f pps rtt avg %8.1f us max %8.1f us\n",
+                   from, to, sent - last_sent, packets,
+                   (received_bytes - last_received_bytes) * 8 / interval / 1e6, packets / interval,
+                   packets ? interval_rtt_sum / (double)packets / 1000.0 : 0.0, interval_rtt_max / 1000.0);
+            fflush(stdout);
+            last_sent = sent;
+            last_received = received;
+            last_received_bytes = received_bytes;
+            interval_rtt_sum = 0;
+            interval_rtt_max = 0;
+            next_report += interval_ns;
+        }
+
+        /*Sleep until something can be done, with nanosecond precision since fixed rates can be high*/
+        if (rate == 0 && sending && !blocked)
+        {
+            continue;
+        }
+        uint64_t wake = sending ? next_report : end;
+        if (sending && rate && next_send < wake)
+        {
+            wake = next_send;
+        }
+        if (sending && end < wake)
+        {
+            wake = end;
+        }
+        now = get_time_ns();
+        uint64_t wait = wake > now ? wake - now : 0;
+        struct timespec timeout = { .tv_sec = wait / 1000000000ULL, .tv_nsec = wait % 1000000000ULL };
+        struct pollfd pfd = { .fd = sd, .events = POLLIN | (blocked ? POLLOUT : 0) };
+        if (ppoll(&pfd, 1, &timeout, NULL) == -1 && errno != EINTR)
+        {
+            perror("ppoll");
+            break;
+        }
+        if (pfd.revents & (POLLHUP | POLLERR))
+        {
+            printf("The MIP daemon closed the connection\n");
+            break;
+        }
+    }
+
+    double elapsed = (send_end - start) / 1e9;
+    uint64_t lost = received < sent ? sent - received : 0; /*A broadcast is echoed by every node which got it*/
+    double rtt_sum = 0;
+    for (size_t i = 0; i < rtt_count; i++)
+    {
+        rtt_sum += rtt_samples[i];
+    }
+    qsort(rtt_samples, rtt_count, sizeof(uint64_t), compare_u64);
+
+    /*The summary is printed on a single line so that it can be picked up by scripts*/
+    printf("{\"mode\":\"%s\",\"destination\":%u,\"payload_bytes\":%zu,\"rate_pps\":%lu,\"duration_s\":%.3f,"
+           "\"sent\":%lu,\"received\":%lu,\"lost\":%lu,\"loss_percent\":%.3f,\"reordered\":%lu,"
+           "\"throughput_bps\":%.0f,\"pps\":%.1f,"
+           "\"rtt_us\":{\"min\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+           rate ? "fixed" : "max", destination, payload_size, rate, elapsed,
+           sent, received, lost, sent ? lost * 100.0 / sent : 0.0, reordered,
+           elapsed > 0 ? received_bytes * 8 / elapsed : 0.0, elapsed > 0 ? received / elapsed : 0.0,
+           rtt_count ? rtt_samples[0] / 1000.0 : 0.0, rtt_count ? rtt_sum / rtt_count / 1000.0 : 0.0,
+           percentile_us(50), percentile_us(90), percentile_us(99),
+           rtt_count ? rtt_samples[rtt_count - 1] / 1000.0 : 0.0);
+
+    free(message);
+    free(rtt_samples);
+    close(sd);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int server = 0;
+    int client = 0;
+    uint8_t destination = 0;
+    size_t payload_size = 1000;
+    uint64_t rate = 0;
+    double duration = 10.0;
+    double interval = 1.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hsc:l:p:t:i:y:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                print_help(USAGE);
+                exit(EXIT_SUCCESS);
+            case 's':
+                server = 1;
+                break;
+            case 'c':
+                client = 1;
+                destination = (uint8_t)atoi(optarg);
+                break;
+            case 'l':
+                payload_size = (size_t)atol(optarg);
+                break;
+            case 'p':
+                rate = (uint64_t)atoll(optarg);
+                break;
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'i':
+                interval = atof(optarg);
+                break;
+            case 'y':
+                sdu_type = atoi(optarg);
+                break;
+            default:
+                print_help(USAGE);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind != argc - 1 || server == client) /*Exactly one mode and the socket path is needed*/
+    {
+        print_help(USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (payload_size < PERF_HEADER_SIZE || payload_size > MAX_MESSAGE_SIZE - 1)
+    {
+        printf("Payload size must be between %zu and %d bytes\n", PERF_HEADER_SIZE, MAX_MESSAGE_SIZE - 1);
+        exit(EXIT_FAILURE);
+    }
+    if (sdu_type < -1 || sdu_type > 7)
+    {
+        printf("SDU type must be between 0 and 7\n");
+        exit(EXIT_FAILURE);
+    }
+    if (duration <= 0 || interval <= 0)
+    {
+        printf("Duration and interval must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (rate > 1000000000ULL)
+    {
+        printf("Rate can be at most 1000000000 messages per second\n");
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGINT, handle_sigint);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (server)
+    {
+        run_server(argv[optind]);
+    } else
+    {
+        run_client(argv[optind], destination, payload_size, rate, duration, interval);
+    }
+    return 0;
+}
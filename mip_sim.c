@@ -0,0 +1,786 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "raw_socket.h"
+#include "mip_arp.h"
+#include "local_interfaces.h"
+#include "pdu.h"
+#include "link.h"
+#include "utils.h"
+
+/*Discrete event simulator for networks of mip daemons. All nodes run in this process on a virtual clock,
+using the real protocol code: send_sdu() for application messages and handle_received_pdu() for frames.
+Frames are carried between the nodes by a link layer plugged in with link_set_ops(), and the state of the ARP module
+is saved and loaded every time the simulator switches to another node.
+
+The simulated nodes send plain SDUs, so messages must fit in one SDU and the aggregation and reliable transport are not used.*/
+
+#define USAGE "Usage: mip_sim [-h] [-v] [-n <nodes>] [-t chain|star|mesh|random] [-k <degree>] [-m <messages>] [-r <rate>]\n" \
+              "               [-p neighbour|any|hotspot] [-s <bytes>] [-D <delay_us>] [-b <mbit>] [-L <loss>] [-M <mtu>]\n" \
+              "               [-f <trace>] [-S <seed>] [-j <file>]\n" \
+              "  -n  number of nodes, which get mip address 1 to n (default 16, at most 254)\n" \
+              "  -t  topology (default chain), random starts from a chain and adds links up to an average degree of -k (default 4)\n" \
+              "  -m  number of application messages to send (default 10000)\n" \
+              "  -r  messages per second of virtual time, summed over all nodes (default 1000)\n" \
+              "  -p  destinations: a random neighbour, any other node (also unreachable ones), or node 1 (default neighbour)\n" \
+              "  -s  message size in bytes including the mip address, must fit in one SDU (default 64)\n" \
+              "  -D  propagation delay of every link in microseconds (default 100)\n" \
+              "  -b  bandwidth of every link in Mbit/s, 0 is unlimited (default 100)\n" \
+              "  -L  percent of frames lost on the links (default 0)\n" \
+              "  -M  MTU of every interface (default 1500)\n" \
+              "  -f  replay a trace instead, with lines of \"<time_us> <src> <dst> <bytes>\"\n" \
+              "  -S  seed of the random generator (default 1)\n" \
+              "  -j  write the statistics of every node as JSON to this file\n" \
+              "  -v  show the output of the protocol code, which is discarded by default"
+
+#define EV_FRAME 0  /*A frame arrives at a node*/
+#define EV_SEND 1   /*The application of a node sends a message*/
+
+/*Size of the header the simulator puts in front of every message: mip address, virtual send time and sequence number*/
+#define SIM_MESSAGE_HEADER 13
+
+/*Struct for an event in the queue*/
+struct sim_event {
+    uint64_t time_ns;
+    uint64_t seq;       /*Order of insertion, so events at the same time run in the order they were scheduled*/
+    int type;
+    int node;
+    int ifindex;        /*Interface a frame arrives on, or the destination mip of a send*/
+    size_t len;
+    uint8_t *frame;
+};
+
+/*Struct for a simulated node, with the state the protocol code needs and the statistics we collect*/
+struct sim_node {
+    struct interface_info if_list;
+    struct arp_state arp;
+    int peer_node[MAX_INTERFACES];      /*Node at the other end of each interface*/
+    int peer_ifindex[MAX_INTERFACES];   /*Ifindex of the interface at the other end*/
+    uint64_t tx_free_ns[MAX_INTERFACES]; /*When each interface is done sending the frames queued on it*/
+
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t broadcasts_sent;
+    uint64_t arp_requests_received;
+    uint64_t arp_responses_sent;
+    uint64_t frames_received;
+    uint64_t frames_lost;
+    uint64_t messages_sent;
+    uint64_t messages_delivered;
+    uint64_t arp_hits;
+    uint64_t arp_misses;
+    int max_pending;
+    uint64_t pending_sum;
+    uint64_t pending_samples;
+    int max_arp_entries;
+    uint64_t max_tx_backlog_ns;
+    uint64_t cpu_ns;
+};
+
+/*Settings*/
+static int node_count = 16;
+static const char *topology = "chain";
+static int degree = 4;
+static long message_count = 10000;
+static double message_rate = 1000.0;
+static const char *pattern = "neighbour";
+static size_t message_size = 64;
+static uint64_t link_delay_ns = 100000;
+static double bandwidth_mbit = 100.0;
+static double loss_percent = 0.0;
+static int mtu = DEFAULT_MTU;
+static const char *trace_path = NULL;
+static unsigned int seed = 1;
+
+/*State of the simulation*/
+static struct sim_node *nodes;          /*Indexed by mip address, index 0 is unused*/
+static int current_node = -1;           /*Node whose ARP state is loaded*/
+static uint64_t now_ns;
+static struct sim_event *heap = NULL;
+static size_t heap_size = 0;
+static size_t heap_capacity = 0;
+static size_t max_heap_size = 0;
+static uint64_t event_seq = 0;
+static struct sim_event *delivering = NULL; /*The frame handle_received_pdu() is receiving*/
+static int app_fds[2];                   /*Socket pair standing in for the application connection of every node*/
+
+static long messages_generated = 0;
+static FILE *trace_file = NULL;
+static uint64_t *latencies = NULL;
+static size_t latency_count = 0;
+static size_t link_count = 0;
+
+
+/*Function to compare two events, returns 1 if a should run before b*/
+static int event_before(struct sim_event *a, struct sim_event *b)
+{
+    return a->time_ns < b->time_ns || (a->time_ns == b->time_ns && a->seq < b->seq);
+}
+
+
+/*Function to add an event to the queue, which is a binary heap ordered by time*/
+static void push_event(struct sim_event event)
+{
+    if (heap_size == heap_capacity)
+    {
+        heap_capacity = heap_capacity ? heap_capacity * 2 : 1024;
+        heap = realloc(heap, heap_capacity * sizeof(struct sim_event));
+        if (heap == NULL)
+        {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    event.seq = event_seq++;
+    size_t i = heap_size++;
+    while (i > 0 && event_before(&event, &heap[(i - 1) / 2]))
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = event;
+    if (heap_size > max_heap_size)
+    {
+        max_heap_size = heap_size;
+    }
+}
+
+
+/*Function to take the earliest event out of the queue*/
+static struct sim_event pop_event(void)
+{
+    struct sim_event first = heap[0];
+    struct sim_event last = heap[--heap_size];
+    size_t i = 0;
+    while (1)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= heap_size)
+        {
+            break;
+        }
+        if (child + 1 < heap_size && event_before(&heap[child + 1], &heap[child]))
+        {
+            child++;
+        }
+        if (!event_before(&heap[child], &last))
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return first;
+}
+
+
+/*Function to make a node the current one, so the protocol code works on its ARP cache and pending queue*/
+static void switch_to_node(int node)
+{
+    if (node == current_node)
+    {
+        return;
+    }
+    if (current_node > 0)
+    {
+        save_arp_state(&nodes[current_node].arp);
+    }
+    load_arp_state(&nodes[node].arp);
+    current_node = node;
+}
+
+
+/*Link layer carrying frames between the simulated nodes. Sending schedules the arrival at the other end of the link,
+after the frames already queued on the interface, the serialization time and the propagation delay.*/
+static int sim_open(void)
+{
+    return -1;
+}
+
+
+static void sim_get_interfaces(struct interface_info *if_list, int fd)
+{
+    *if_list = nodes[current_node].if_list;
+}
+
+
+static ssize_t sim_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    struct sim_node *node = &nodes[current_node];
+    int i = iface->sll_ifindex - 1;
+    if (i < 0 || i >= node->if_list.num_interfaces)
+    {
+        errno = ENXIO;
+        return -1;
+    }
+
+    node->frames_sent++;
+    node->bytes_sent += len;
+    if (frame[0] == 0xff && frame[1] == 0xff && frame[2] == 0xff && frame[3] == 0xff && frame[4] == 0xff && frame[5] == 0xff)
+    {
+        node->broadcasts_sent++;
+    } else if (len > sizeof(struct ether_frame) + MIP_HEADER_SIZE && (frame[sizeof(struct ether_frame) + 3] & 0x7) == MIP_ARP)
+    {
+        node->arp_responses_sent++;
+    }
+
+    if (loss_percent > 0.0 && rand() / ((double)RAND_MAX + 1.0) * 100.0 < loss_percent)
+    {
+        node->frames_lost++;
+        return (ssize_t)len;
+    }
+
+    uint64_t start = node->tx_free_ns[i] > now_ns ? node->tx_free_ns[i] : now_ns;
+    uint64_t serialization = bandwidth_mbit > 0 ? (uint64_t)(len * 8 * 1000.0 / bandwidth_mbit) : 0;
+    node->tx_free_ns[i] = start + serialization;
+    if (start - now_ns > node->max_tx_backlog_ns)
+    {
+        node->max_tx_backlog_ns = start - now_ns;
+    }
+
+    struct sim_event event;
+    memset(&event, 0, sizeof(event));
+    event.time_ns = start + serialization + link_delay_ns;
+    event.type = EV_FRAME;
+    event.node = node->peer_node[i];
+    event.ifindex = node->peer_ifindex[i];
+    event.len = len;
+    event.frame = malloc(len);
+    if (event.frame == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(event.frame, frame, len);
+    push_event(event);
+    return (ssize_t)len;
+}
+
+
+static ssize_t sim_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface)
+{
+    size_t copy = delivering->len < len ? delivering->len : len;
+    memcpy(frame, delivering->frame, copy);
+    memset(iface, 0, sizeof(*iface));
+    iface->sll_family = AF_PACKET;
+    iface->sll_protocol = htons(ETH_P_MIP);
+    iface->sll_ifindex = delivering->ifindex;
+    return (ssize_t)copy;
+}
+
+
+static const struct link_ops sim_link = { "sim", sim_open, sim_get_interfaces, sim_send, sim_recv };
+
+
+/*Function to add an interface to a node. The mac address holds the node and the interface index, so it is unique.*/
+static int add_interface(int node)
+{
+    struct interface_info *if_list = &nodes[node].if_list;
+    if (if_list->num_interfaces == MAX_INTERFACES)
+    {
+        fprintf(stderr, "Node %d has more than %d interfaces\n", node, MAX_INTERFACES);
+        exit(EXIT_FAILURE);
+    }
+    int i = if_list->num_interfaces++;
+    struct sockaddr_ll *sll = &if_list->interface_addrs[i];
+    sll->sll_family = AF_PACKET;
+    sll->sll_protocol = htons(ETH_P_MIP);
+    sll->sll_ifindex = i + 1;
+    sll->sll_halen = 6;
+    uint8_t mac[6] = {0x02, 0x00, 0x00, (uint8_t)node, 0x00, (uint8_t)i};
+    memcpy(sll->sll_addr, mac, 6);
+    if_list->mtu[i] = mtu;
+    return i;
+}
+
+
+/*Function to connect two nodes with a link, unless they are already connected*/
+static void add_link(int a, int b)
+{
+    for (int i = 0; i < nodes[a].if_list.num_interfaces; i++)
+    {
+        if (nodes[a].peer_node[i] == b)
+        {
+            return;
+        }
+    }
+    int ia = add_interface(a);
+    int ib = add_interface(b);
+    nodes[a].peer_node[ia] = b;
+    nodes[a].peer_ifindex[ia] = ib + 1;
+    nodes[b].peer_node[ib] = a;
+    nodes[b].peer_ifindex[ib] = ia + 1;
+    link_count++;
+}
+
+
+static void build_topology(void)
+{
+    if (strcmp(topology, "chain") == 0 || strcmp(topology, "random") == 0)
+    {
+        for (int i = 1; i < node_count; i++)
+        {
+            add_link(i, i + 1);
+        }
+    } else if (strcmp(topology, "star") == 0)
+    {
+        for (int i = 2; i <= node_count; i++)
+        {
+            add_link(1, i);
+        }
+    } else if (strcmp(topology, "mesh") == 0)
+    {
+        for (int i = 1; i <= node_count; i++)
+        {
+            for (int j = i + 1; j <= node_count; j++)
+            {
+                add_link(i, j);
+            }
+        }
+    } else
+    {
+        fprintf(stderr, "Unknown topology %s\n", topology);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(topology, "random") == 0)
+    {
+        /*Add random links until the average degree is reached, the chain keeps the network connected*/
+        size_t wanted = (size_t)node_count * degree / 2;
+        size_t max_links = (size_t)node_count * (node_count - 1) / 2;
+        if (wanted > max_links)
+        {
+            wanted = max_links;
+        }
+        while (link_count < wanted)
+        {
+            int a = 1 + rand() % node_count;
+            int b = 1 + rand() % node_count;
+            if (a != b)
+            {
+                add_link(a, b);
+            }
+        }
+    }
+}
+
+
+/*Function to schedule the next message of the traffic pattern or the trace. Returns 0 when there are no more messages.*/
+static int schedule_next_message(void)
+{
+    struct sim_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = EV_SEND;
+
+    if (trace_file != NULL)
+    {
+        unsigned long long time_us;
+        int src, dst;
+        size_t bytes;
+        char line[256];
+        while (fgets(line, sizeof(line), trace_file) != NULL)
+        {
+            if (sscanf(line, "%llu %d %d %zu", &time_us, &src, &dst, &bytes) != 4 || src < 1 || src > node_count ||
+                dst < 1 || dst > 254 || bytes < SIM_MESSAGE_HEADER)
+            {
+                continue; /*Skip comments and lines we can not use*/
+            }
+            event.time_ns = 1000000000ULL + time_us * 1000ULL;
+            event.node = src;
+            event.ifindex = dst;
+            event.len = bytes;
+            push_event(event);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (messages_generated == message_count)
+    {
+        return 0;
+    }
+    messages_generated++;
+
+    /*Exponential time between messages, so the arrivals are a poisson process*/
+    double u = (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+    static double next_time_s = 1.0;
+    next_time_s += -log(u) / message_rate;
+    event.time_ns = (uint64_t)(next_time_s * 1e9);
+    event.len = message_size;
+
+    if (strcmp(pattern, "hotspot") == 0)
+    {
+        event.ifindex = 1;
+        event.node = nodes[1].peer_node[rand() % nodes[1].if_list.num_interfaces];
+    } else
+    {
+        event.node = 1 + rand() % node_count;
+        if (strcmp(pattern, "any") == 0)
+        {
+            do
+            {
+                event.ifindex = 1 + rand() % node_count;
+            } while (event.ifindex == event.node);
+        } else
+        {
+            struct sim_node *src = &nodes[event.node];
+            event.ifindex = src->peer_node[rand() % src->if_list.num_interfaces];
+        }
+    }
+    push_event(event);
+    return 1;
+}
+
+
+/*Function to receive the messages the protocol code delivered to the application of the current node*/
+static void collect_deliveries(void)
+{
+    uint8_t buffer[MAX_MESSAGE_SIZE];
+    while (1)
+    {
+        ssize_t rc = recv(app_fds[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (rc < SIM_MESSAGE_HEADER)
+        {
+            return;
+        }
+        uint64_t sent_ns;
+        memcpy(&sent_ns, buffer + 1, sizeof(sent_ns));
+        nodes[current_node].messages_delivered++;
+        latencies[latency_count++] = now_ns - sent_ns;
+    }
+}
+
+
+/*Function to run one event, on the node it belongs to*/
+static void run_event(struct sim_event *event)
+{
+    struct sim_node *node = &nodes[event->node];
+    now_ns = event->time_ns;
+    set_virtual_time(now_ns);
+    switch_to_node(event->node);
+
+    uint64_t start = get_real_time_ns();
+    if (event->type == EV_FRAME)
+    {
+        node->frames_received++;
+        if (event->len > sizeof(struct ether_frame) + MIP_HEADER_SIZE + 1 && event->frame[0] == 0xff &&
+            (event->frame[sizeof(struct ether_frame) + 3] & 0x7) == MIP_ARP)
+        {
+            node->arp_requests_received++;
+        }
+        delivering = event;
+        handle_received_pdu(-1, &node->if_list, (uint8_t)event->node, app_fds[0]);
+        delivering = NULL;
+        free(event->frame);
+    } else
+    {
+        uint8_t message[MAX_SDU_SIZE];
+        uint8_t dst = (uint8_t)event->ifindex;
+        uint32_t seq = (uint32_t)node->messages_sent;
+        memset(message, 0, event->len);
+        message[0] = dst;
+        memcpy(message + 1, &now_ns, sizeof(now_ns));
+        memcpy(message + 9, &seq, sizeof(seq));
+
+        if (lookup_mac_dest(dst) != NULL)
+        {
+            node->arp_hits++;
+        } else
+        {
+            node->arp_misses++;
+        }
+        node->messages_sent++;
+        send_sdu(-1, &node->if_list, (uint8_t)event->node, dst, PING, message, event->len);
+        schedule_next_message();
+    }
+    node->cpu_ns += get_real_time_ns() - start;
+
+    collect_deliveries();
+
+    int pending = pending_queue_length();
+    if (pending > node->max_pending)
+    {
+        node->max_pending = pending;
+    }
+    node->pending_sum += pending;
+    node->pending_samples++;
+    if (arp_cache_count > node->max_arp_entries)
+    {
+        node->max_arp_entries = arp_cache_count;
+    }
+}
+
+
+/*Compare function for qsort of the latencies*/
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*Function to get a percentile of the sorted latencies in microseconds, using the nearest rank method*/
+static double latency_percentile_us(double percent)
+{
+    if (latency_count == 0)
+    {
+        return 0.0;
+    }
+    size_t rank = (size_t)(percent / 100.0 * latency_count + 0.999999);
+    rank = rank < 1 ? 1 : (rank > latency_count ? latency_count : rank);
+    return latencies[rank - 1] / 1000.0;
+}
+
+
+/*Function to write the statistics of every node as a JSON array*/
+static void write_node_json(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror("fopen");
+        return;
+    }
+    fprintf(file, "[\n");
+    for (int n = 1; n <= node_count; n++)
+    {
+        struct sim_node *node = &nodes[n];
+        uint64_t lookups = node->arp_hits + node->arp_misses;
+        fprintf(file, "  {\"node\":%d,\"interfaces\":%d,\"frames_sent\":%lu,\"bytes_sent\":%lu,\"broadcasts_sent\":%lu,"
+                "\"arp_requests_received\":%lu,\"arp_responses_sent\":%lu,\"frames_received\":%lu,\"frames_lost\":%lu,"
+                "\"messages_sent\":%lu,\"messages_delivered\":%lu,\"arp_hit_rate\":%.4f,\"max_pending\":%d,"
+                "\"mean_pending\":%.3f,\"max_arp_entries\":%d,\"max_tx_backlog_us\":%.1f,\"cpu_us\":%.1f}%s\n",
+                n, node->if_list.num_interfaces, node->frames_sent, node->bytes_sent, node->broadcasts_sent,
+                node->arp_requests_received, node->arp_responses_sent, node->frames_received, node->frames_lost,
+                node->messages_sent, node->messages_delivered, lookups ? (double)node->arp_hits / lookups : 0.0,
+                node->max_pending, node->pending_samples ? (double)node->pending_sum / node->pending_samples : 0.0,
+                node->max_arp_entries, node->max_tx_backlog_ns / 1000.0, node->cpu_ns / 1000.0,
+                n < node_count ? "," : "");
+    }
+    fprintf(file, "]\n");
+    fclose(file);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *json_path = NULL;
+    int verbose = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hvn:t:k:m:r:p:s:D:b:L:M:f:S:j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                print_help(USAGE);
+                exit(EXIT_SUCCESS);
+            case 'v':
+                verbose = 1;
+                break;
+            case 'n':
+                node_count = atoi(optarg);
+                break;
+            case 't':
+                topology = optarg;
+                break;
+            case 'k':
+                degree = atoi(optarg);
+                break;
+            case 'm':
+                message_count = atol(optarg);
+                break;
+            case 'r':
+                message_rate = atof(optarg);
+                break;
+            case 'p':
+                pattern = optarg;
+                break;
+            case 's':
+                message_size = (size_t)atol(optarg);
+                break;
+            case 'D':
+                link_delay_ns = strtoull(optarg, NULL, 10) * 1000ULL;
+                break;
+            case 'b':
+                bandwidth_mbit = atof(optarg);
+                break;
+            case 'L':
+                loss_percent = atof(optarg);
+                break;
+            case 'M':
+                mtu = atoi(optarg);
+                break;
+            case 'f':
+                trace_path = optarg;
+                break;
+            case 'S':
+                seed = (unsigned int)atoi(optarg);
+                break;
+            case 'j':
+                json_path = optarg;
+                break;
+            default:
+                print_help(USAGE);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (optind != argc || node_count < 2 || node_count > 254 || message_rate <= 0 || mtu < MIP_HEADER_SIZE + SIM_MESSAGE_HEADER ||
+        (strcmp(pattern, "neighbour") != 0 && strcmp(pattern, "any") != 0 && strcmp(pattern, "hotspot") != 0))
+    {
+        print_help(USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    /*The largest SDU of an interface, which the messages must fit in since they are not fragmented*/
+    size_t max_sdu = ((size_t)mtu - MIP_HEADER_SIZE) & ~(size_t)3;
+    if (max_sdu > MAX_SDU_SIZE)
+    {
+        max_sdu = MAX_SDU_SIZE;
+    }
+    if (message_size < SIM_MESSAGE_HEADER || message_size > max_sdu)
+    {
+        fprintf(stderr, "Message size must be between %d and %zu bytes\n", SIM_MESSAGE_HEADER, max_sdu);
+        exit(EXIT_FAILURE);
+    }
+    if (trace_path != NULL)
+    {
+        trace_file = fopen(trace_path, "r");
+        if (trace_file == NULL)
+        {
+            perror("fopen");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /*The report goes to the real stdout, the output of the protocol code is discarded unless -v is given*/
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || (!verbose && freopen("/dev/null", "w", stdout) == NULL))
+    {
+        perror("stdout");
+        exit(EXIT_FAILURE);
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, app_fds) == -1)
+    {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+
+    srand(seed);
+    nodes = calloc(node_count + 1, sizeof(struct sim_node));
+    if (nodes == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    build_topology();
+    link_set_ops(&sim_link);
+    memset(arp_list, 0, sizeof(arp_list));
+    arp_cache_count = 0;
+
+    /*Every message can be delivered at most once, unless it is duplicated*/
+    size_t latency_capacity = trace_file != NULL ? 1 << 20 : (size_t)message_count + 1;
+    latencies = malloc(latency_capacity * sizeof(uint64_t));
+    if (latencies == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t wall_start = get_real_time_ns();
+    schedule_next_message();
+    while (heap_size > 0)
+    {
+        struct sim_event event = pop_event();
+        if (latency_count == latency_capacity)
+        {
+            latency_capacity *= 2;
+            latencies = realloc(latencies, latency_capacity * sizeof(uint64_t));
+            if (latencies == NULL)
+            {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        run_event(&event);
+    }
+    uint64_t wall_ns = get_real_time_ns() - wall_start;
+    fflush(stdout);
+
+    /*Sum up the statistics of the nodes*/
+    uint64_t frames = 0, bytes = 0, broadcasts = 0, arp_responses = 0, lost = 0, sent = 0, delivered = 0;
+    uint64_t hits = 0, misses = 0, cpu_ns = 0, max_cpu_ns = 0, pending_sum = 0, pending_samples = 0, max_backlog = 0;
+    int max_pending = 0, max_arp_entries = 0, busiest = 1;
+    for (int n = 1; n <= node_count; n++)
+    {
+        struct sim_node *node = &nodes[n];
+        frames += node->frames_sent;
+        bytes += node->bytes_sent;
+        broadcasts += node->broadcasts_sent;
+        arp_responses += node->arp_responses_sent;
+        lost += node->frames_lost;
+        sent += node->messages_sent;
+        delivered += node->messages_delivered;
+        hits += node->arp_hits;
+        misses += node->arp_misses;
+        cpu_ns += node->cpu_ns;
+        pending_sum += node->pending_sum;
+        pending_samples += node->pending_samples;
+        if (node->cpu_ns > max_cpu_ns)
+        {
+            max_cpu_ns = node->cpu_ns;
+            busiest = n;
+        }
+        max_pending = node->max_pending > max_pending ? node->max_pending : max_pending;
+        max_arp_entries = node->max_arp_entries > max_arp_entries ? node->max_arp_entries : max_arp_entries;
+        max_backlog = node->max_tx_backlog_ns > max_backlog ? node->max_tx_backlog_ns : max_backlog;
+    }
+    qsort(latencies, latency_count, sizeof(uint64_t), compare_u64);
+    double virtual_s = now_ns > 1000000000ULL ? (now_ns - 1000000000ULL) / 1e9 : 0.0;
+
+    fprintf(report, "Simulated %d nodes and %zu links (%s) for %.3f s of virtual time in %.3f s\n",
+            node_count, link_count, trace_file ? "trace" : topology, virtual_s, wall_ns / 1e9);
+    fprintf(report, "Messages: %lu sent, %lu delivered, ARP cache hit rate %.2f%%\n",
+            sent, delivered, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+    fprintf(report, "Frames: %lu sent (%lu broadcast, %lu ARP responses, %lu lost), peak %zu frames in flight\n",
+            frames, broadcasts, arp_responses, lost, max_heap_size);
+    fprintf(report, "Pending queue: max %d, mean %.3f. Largest ARP cache %d entries. Largest interface backlog %.1f us\n",
+            max_pending, pending_samples ? (double)pending_sum / pending_samples : 0.0, max_arp_entries, max_backlog / 1000.0);
+    fprintf(report, "CPU: %.3f ms in total, %.3f us per node on average, busiest node %d with %.3f ms\n",
+            cpu_ns / 1e6, cpu_ns / 1e3 / node_count, busiest, max_cpu_ns / 1e6);
+
+    fprintf(report, "{\"nodes\":%d,\"links\":%zu,\"topology\":\"%s\",\"pattern\":\"%s\",\"virtual_s\":%.6f,\"wall_s\":%.6f,"
+            "\"speedup\":%.1f,\"messages_sent\":%lu,\"messages_delivered\":%lu,\"delivery_ratio\":%.4f,"
+            "\"frames_sent\":%lu,\"bytes_sent\":%lu,\"broadcasts_sent\":%lu,\"arp_responses_sent\":%lu,\"frames_lost\":%lu,"
+            "\"arp_hit_rate\":%.4f,\"max_pending\":%d,\"mean_pending\":%.4f,\"max_arp_entries\":%d,\"max_events\":%zu,"
+            "\"max_tx_backlog_us\":%.1f,\"cpu_total_ms\":%.3f,\"cpu_max_node_ms\":%.3f,"
+            "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+            node_count, link_count, topology, trace_file ? "trace" : pattern, virtual_s, wall_ns / 1e9,
+            wall_ns ? virtual_s * 1e9 / wall_ns : 0.0, sent, delivered, sent ? (double)delivered / sent : 0.0,
+            frames, bytes, broadcasts, arp_responses, lost, hits + misses ? (double)hits / (hits + misses) : 0.0,
+            max_pending, pending_samples ? (double)pending_sum / pending_samples : 0.0, max_arp_entries, max_heap_size,
+            max_backlog / 1000.0, cpu_ns / 1e6, max_cpu_ns / 1e6,
+            latency_percentile_us(50), latency_percentile_us(90), latency_percentile_us(99),
+            latency_count ? latencies[latency_count - 1] / 1000.0 : 0.0);
+    fclose(report);
+
+    if (json_path != NULL)
+    {
+        write_node_json(json_path);
+    }
+    if (trace_file != NULL)
+    {
+        fclose(trace_file);
+    }
+    return 0;
+}
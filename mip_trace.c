@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "trace.h"
+#include "utils.h"
+
+#define USAGE "Usage: mip_trace [-h] <trace>\n" \
+              "  prints the binary log written by mipd -t <trace> as text, with the time relative to the first record"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2 || strcmp(argv[1], "-h") == 0) /*Check that we got a file, or if user specified help*/
+    {
+        print_help(USAGE);
+        exit(argc == 2 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+
+    /*The file starts with the magic number and the size of a record, so we do not misread a file from another version*/
+    uint32_t header[2];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != TRACE_FILE_MAGIC || header[1] != sizeof(struct trace_record))
+    {
+        printf("%s is not a trace written by this version of mipd\n", argv[1]);
+        fclose(file);
+        exit(EXIT_FAILURE);
+    }
+
+    static const char *const levels[] = { "error", "warn", "info", "debug" };
+    struct trace_record record;
+    uint64_t first_ns = 0;
+    unsigned long count = 0;
+    char line[256];
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (count++ == 0)
+        {
+            first_ns = record.timestamp_ns;
+        }
+        uint64_t since = record.timestamp_ns - first_ns;
+        trace_format(&record, line, sizeof(line));
+        printf("[%lu.%09lu] %s: %s\n", (unsigned long)(since / 1000000000ULL), (unsigned long)(since % 1000000000ULL),
+               levels[record.level & 3], line);
+    }
+    fclose(file);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "control.h"
+#include "utils.h"
+
+#define USAGE "Usage: mipctl [-h] <control_socket> <command> [arguments...]\n" \
+              "  sends a command to the control socket of mipd (mipd -c <control_socket>), run 'mipctl <control_socket> help' for the commands"
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "-h") == 0) /*Check if user specified help*/
+    {
+        print_help(USAGE);
+        exit(EXIT_SUCCESS);
+    }
+    if (argc < 3) /*Check that we got a socket and a command*/
+    {
+        print_help(USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    /*Join the command and its arguments into one line*/
+    char command[CONTROL_MAX_MESSAGE];
+    size_t len = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        int rc = snprintf(command + len, sizeof(command) - len, "%s%s", i > 2 ? " " : "", argv[i]);
+        if (rc < 0 || len + rc >= sizeof(command))
+        {
+            printf("Command is too long\n");
+            exit(EXIT_FAILURE);
+        }
+        len += rc;
+    }
+
+    int control_socket = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (control_socket == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    if (connect(control_socket, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("connect");
+        close(control_socket);
+        exit(EXIT_FAILURE);
+    }
+
+    if (send(control_socket, command, len, 0) == -1)
+    {
+        perror("send");
+        close(control_socket);
+        exit(EXIT_FAILURE);
+    }
+
+    char reply[CONTROL_MAX_MESSAGE + 1];
+    ssize_t rc = recv(control_socket, reply, sizeof(reply) - 1, 0);
+    close(control_socket);
+    if (rc <= 0)
+    {
+        perror("recv");
+        exit(EXIT_FAILURE);
+    }
+    reply[rc] = '\0';
+    fputs(reply, stdout);
+    return strncmp(reply, "error:", 6) == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
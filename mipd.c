@@ -1,56 +1,664 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/epoll.h>
 #include <stdint.h>
+#include <getopt.h>
+#include <signal.h>
 #include "raw_socket.h"  // Include raw socket header for our functions
 #include "mip_arp.h"
 #include "local_interfaces.h"
 #include "pdu.h"
 #include "ping.h"
+#include "fragment.h"
+#include "aggregate.h"
+#include "rdt.h"
+#include "link.h"
+#include "replay.h"
+#include "control.h"
+#include "capture.h"
+#include "trace.h"
+#include "stats.h"
+#include "sched.h"
+#include "shaper.h"
+#include "keepalive.h"
+#include "snapshot.h"
+#include "upgrade.h"
+#include "dispatch.h"
+#include "broadcast.h"
 #include "utils.h" /*print_help & create_unix_socket*/
 
+/*Usage message for mipd*/
+#define USAGE "Usage: mipd [-h] [-d] [-a <window_us>] [-r] [-l <link>] [-c <control>] [-t <trace>] [-b <budget_us>] [-p <cpu>]\n" \
+              "            [-q <limits>] [-s <shaper>] [-k <keepalive>] [-m <multipath>]\n" \
+              "            [-g] [-P <max_age_ms>] [-S <snapshot>] [-B <ifindex>[,<ifindex>...]]\n" \
+              "            <socket_upper> <MIP address>\n" \
+              "       mipd [-d] [-a <window_us>] [-r] --replay <in.pcap> [--replay-output <out.pcap>] [--replay-timing] <MIP address>\n" \
+              "  -d              log every packet (the debug level of the trace, see trace.h)\n" \
+              "  -a <window_us>  aggregate small messages to the same MIP address for up to window_us microseconds\n" \
+              "  -r              send application messages over the reliable transport\n" \
+              "  -l <link>       link layer to send frames over (default packet), see link.h:\n" \
+              "                  packet | udp,local=<host:port>,peer=<host:port>,... | unix,local=<path>,peer=<path>,...\n" \
+              "                  with the options delay_us=<us>, loss=<percent> and mtu=<bytes>,\n" \
+              "                  or xdp,queue=<n>,mode=auto|skb|native when built with make XDP=1\n" \
+              "  -c <control>    create a control socket at this path, use mipctl to send it commands (see control.h)\n" \
+              "  -t <trace>      write the log as binary records to this file instead of text on stdout, decode it with mip_trace\n" \
+              "  -b <budget_us>  busy poll: spin on non-blocking waits for up to budget_us microseconds before blocking in epoll,\n" \
+              "                  and let the kernel busy poll the link socket (SO_BUSY_POLL, SO_PREFER_BUSY_POLL)\n" \
+              "  -p <cpu>        pin the thread which handles frames to a CPU, the log and capture threads keep the other CPUs\n" \
+              "  -q <limits>     queue limits in frames of the transmit scheduler (see sched.h), default\n" \
+              "                  control=256,daemon=1024,client=256\n" \
+              "  -s <shaper>     token buckets per destination and interface (see shaper.h), e.g. dest=5m,iface=10m,policy=queue:\n" \
+              "                  dest=<rate>[/<burst>] | dest.<mip>=... | iface=... | iface.<ifindex>=... | policy=queue|drop | limit=<frames>\n" \
+              "  -k <keepalive>  detect dead neighbours with probes (see keepalive.h), interval_us=<us>,misses=<n>, default\n" \
+              "                  interval_us=100000,misses=3\n" \
+              "  -m <multipath>  how SDUs are spread over several paths to a MIP address (see mip_arp.h): flow (default), each\n" \
+              "                  application and SDU type keeps to one path, or rr, round robin over the paths\n" \
+              "  -g              announce our MIP address to the neighbours at startup, when the interfaces or their mac\n" \
+              "                  addresses change (and with mipctl arp announce), and answer their announcements,\n" \
+              "                  so the ARP caches are warm before the first SDU\n" \
+              "  -P <max_age_ms> answer ARP requests for neighbours we heard from within max_age_ms on the same link,\n" \
+              "                  and cache the mapping of every requester\n" \
+              "  -S <snapshot>   keep a snapshot of the ARP cache in this file and load it at startup, so a restarted daemon\n" \
+              "                  sends to its neighbours at once and revalidates the entries as they are used (see snapshot.h)\n" \
+              "  -B <ifindexes>  send the broadcasts of the applications (to MIP address 255) only on these interfaces, default all\n" \
+              "                  (see broadcast.h)\n" \
+              "  --replay <in.pcap>          feed the MIP frames of a capture to the daemon and report the processing time per frame\n" \
+              "  --replay-output <out.pcap>  write the frames the daemon sends during the replay to a pcap file\n" \
+              "  --replay-timing             replay the frames at their recorded timing instead of as fast as possible\n" \
+              "SIGUSR2 or mipctl upgrade [binary] hands the sockets and the ARP cache to a new mipd without closing them (see upgrade.h),\n" \
+              "which the running daemon starts with its own arguments and --upgrade-fd <fd>"
+
 /*Define max events on our epoll, I assume we do not need to many, however this can easily be changed here.*/
 #define MAX_EVENTS 20
 
+/*Values returned by getopt_long for the options which only have a long name*/
+#define OPT_REPLAY 256
+#define OPT_REPLAY_OUTPUT 257
+#define OPT_REPLAY_TIMING 258
+#define OPT_UPGRADE_FD 259
+
+/*Buffer for messages from the application, which can be larger than one SDU since we fragment them*/
+static uint8_t app_buffer[MAX_MESSAGE_SIZE];
+
+/*Struct for an application connection. Every connection has its own class in the transmit scheduler (see sched.h).
+While a message is blocked we stop reading from the application, so it is held back until the receiver has acked enough data.*/
+struct app_connection {
+    int fd;             /*-1 if the slot is free*/
+    int reading;        /*1 while epoll reports messages from the application*/
+    int writing;        /*1 while epoll reports room on the socket, since messages are waiting to be delivered (see dispatch.h)*/
+    uint64_t accepted;  /*Order the connections were accepted in, messages from the network go to the newest one*/
+    int blocked_len;    /*Length of the message the reliable transport did not have room for, 0 if there is none*/
+    uint8_t *blocked;   /*The blocked message, allocated the first time a message of the connection is blocked*/
+    uint8_t sdu_types;  /*Bit mask of the SDU types the application registered, 0 if it takes PING messages (see dispatch.h)*/
+    uint8_t sdu_type;   /*Type its messages are sent with, the first type it registered*/
+};
+
+static struct app_connection connections[SCHED_MAX_CLIENTS];
+static uint64_t accept_count = 0;
+
+/*Set by SIGTERM and SIGINT, so the daemon leaves its loop and writes the ARP snapshot before it exits*/
+static volatile sig_atomic_t stopping = 0;
+
+/*Set by SIGUSR2, so the main loop starts an upgrade*/
+static volatile sig_atomic_t upgrade_signal = 0;
+
+
+/*Function to handle SIGTERM and SIGINT by stopping the daemon*/
+static void handle_stop_signal(int signal_number)
+{
+    (void)signal_number;
+    stopping = 1;
+}
+
+
+/*Function to handle SIGUSR2 by asking for an upgrade*/
+static void handle_upgrade_signal(int signal_number)
+{
+    (void)signal_number;
+    upgrade_signal = 1;
+}
+
+
+/*Function to hand the sockets, the connections and the ARP cache to the new daemon, which has said it is ready.
+Takes the socketpair to the new daemon, the link and application sockets, our mip address and the generation of this daemon as parameters.
+Returns 1 if the new daemon has taken over, and 0 if we should go on.*/
+static int hand_over(int upgrade_fd, int raw_socket, int unix_socket, uint8_t mip_address, uint32_t generation)
+{
+    uint8_t ready;
+    if (read(upgrade_fd, &ready, 1) != 1 || ready != UPGRADE_READY)
+    {
+        printf("The new daemon failed to start, going on.\n");
+        return 0;
+    }
+
+    static struct upgrade_state state;
+    memset(&state, 0, sizeof(state));
+    state.stop_ns = get_real_time_ns(); /*From here on nobody handles traffic until the new daemon is in its loop*/
+    state.mip_address = mip_address;
+    state.generation = generation + 1;
+    state.raw_socket = raw_socket;
+    state.unix_socket = unix_socket;
+    state.control_socket = control_get_socket();
+    state.accept_count = accept_count;
+    for (int i = 0; i < SCHED_MAX_CLIENTS; i++)
+    {
+        if (connections[i].fd != -1)
+        {
+            struct upgrade_connection *connection = &state.connections[state.connection_count++];
+            connection->fd = connections[i].fd;
+            connection->slot = i;
+            connection->accepted = connections[i].accepted;
+            connection->blocked_len = connections[i].blocked_len;
+            connection->blocked = connections[i].blocked;
+            connection->sdu_types = connections[i].sdu_types;
+            connection->sdu_type = connections[i].sdu_type;
+        }
+    }
+    if (!upgrade_send(upgrade_fd, &state))
+    {
+        printf("Could not hand over to the new daemon, going on.\n");
+        return 0;
+    }
+    printf("Handed over to the new daemon, exiting.\n");
+    return 1;
+}
+
+
+/*Function to wait for events on epoll. With a busy poll budget we first spin on epoll without blocking, which saves the wakeup
+of a blocked thread when the next event comes within the budget, at the cost of a CPU spinning while the link is idle.
+Takes the epoll fd, the array for the events and the budget in nanoseconds (0 to block right away) as parameters.
+Returns the number of events, or -1 on error.*/
+static int wait_for_events(int epoll_fd, struct epoll_event *events, uint64_t budget_ns)
+{
+    if (budget_ns > 0)
+    {
+        uint64_t end = get_real_time_ns() + budget_ns;
+        do
+        {
+            int rc = epoll_wait(epoll_fd, events, MAX_EVENTS, 0);
+            if (rc != 0)
+            {
+                if (rc > 0)
+                {
+                    STATS_INC(busy_poll_hits);
+                }
+                return rc;
+            }
+        } while (get_real_time_ns() < end);
+        STATS_INC(busy_poll_fallbacks);
+    }
+    return epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+}
+
+
+/*Function to find the earliest of the deadlines of the reassembly table, the aggregates, the reliable transport, the keepalives,
+a scheduled ARP announcement or check of the interfaces, the ARP snapshot and the delayed frames of the link.
+Returns the monotonic time in nanoseconds, or 0 if there is no deadline.*/
+static uint64_t next_deadline(void)
+{
+    uint64_t deadlines[] = { next_reassembly_expiry(), next_aggregation_deadline(), rdt_next_deadline(), keepalive_next_deadline(),
+                             arp_announcement_deadline(), snapshot_next_deadline(), link_next_deadline() };
+    uint64_t next = 0;
+    for (size_t i = 0; i < sizeof(deadlines) / sizeof(deadlines[0]); i++)
+    {
+        if (deadlines[i] != 0 && (next == 0 || deadlines[i] < next))
+        {
+            next = deadlines[i];
+        }
+    }
+    return next;
+}
+
+
+/*Function to handle every deadline which has passed, of the reassembly table, the aggregates, the reliable transport, the keepalives and the link.
+Takes the raw socket, interface list, our mip address and the current time in nanoseconds as parameters.*/
+static void handle_timers(int raw_socket, struct interface_info *if_list, uint8_t mip_address, uint64_t now)
+{
+    expire_reassembly_entries(now);
+    flush_expired_aggregates(raw_socket, if_list, mip_address, now);
+    rdt_handle_timers(raw_socket, if_list, mip_address, now);
+    keepalive_handle_timers(raw_socket, if_list, mip_address, now);
+    check_arp_interfaces(if_list, now);
+    send_arp_announcement(raw_socket, if_list, mip_address);
+    snapshot_handle_timers(now);
+    link_flush_delayed(raw_socket, now);
+}
+
+
+/*Function to set whether epoll should report messages from an application connection, and room on its socket. The connection is removed
+from epoll while both are disabled, since epoll would otherwise keep reporting it if the application hangs up.
+Takes the epoll fd, the connection, and 1 to enable or 0 to disable reading and writing as parameters.*/
+static void set_connection_events(int epoll_fd, struct app_connection *connection, int reading, int writing)
+{
+    if (connection->reading == reading && connection->writing == writing)
+    {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0);
+    ev.data.fd = connection->fd;
+    int op = ev.events == 0 ? EPOLL_CTL_DEL : connection->reading || connection->writing ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(epoll_fd, op, connection->fd, &ev) == -1)
+    {
+        perror("epoll_ctl: connection_socket");
+        return;
+    }
+    connection->reading = reading;
+    connection->writing = writing;
+}
+
+
+/*Function to set whether epoll should report messages from an application connection.
+Takes the epoll fd, the connection and 1 to enable or 0 to disable as parameters.*/
+static void set_connection_reading(int epoll_fd, struct app_connection *connection, int enable)
+{
+    set_connection_events(epoll_fd, connection, enable, connection->writing);
+}
+
+
+/*Function to find the connection of an fd. Takes the fd as parameter. Returns the index of the connection, or -1 if there is none.*/
+static int find_connection(int fd)
+{
+    for (int i = 0; i < SCHED_MAX_CLIENTS; i++)
+    {
+        if (connections[i].fd != -1 && connections[i].fd == fd)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/*Function to find the application which PING messages nobody registered are delivered to, the connection accepted last
+of those which have not registered any type. Returns its socket, or -1 if there is none.*/
+static int delivery_socket(void)
+{
+    int newest = -1;
+    for (int i = 0; i < SCHED_MAX_CLIENTS; i++)
+    {
+        if (connections[i].fd != -1 && connections[i].sdu_types == 0 &&
+            (newest == -1 || connections[i].accepted > connections[newest].accepted))
+        {
+            newest = i;
+        }
+    }
+    return newest == -1 ? -1 : connections[newest].fd;
+}
+
+
+/*Function to remove an application connection from epoll and close it.
+Takes the epoll fd and the connection as parameters.*/
+static void close_connection(int epoll_fd, struct app_connection *connection)
+{
+    set_connection_events(epoll_fd, connection, 0, 0);
+    printf("Removed connection from epoll.\n");
+    dispatch_unregister(connection->fd);
+    close(connection->fd);
+    connection->fd = -1;
+    connection->blocked_len = 0;
+    connection->sdu_types = 0;
+    connection->sdu_type = PING;
+}
+
+
+/*Function to register an SDU type for an application connection, so it gets the messages of the type and sends with the first
+type it registered. Takes the connection and the SDU type as parameters.*/
+static void register_sdu_type(struct app_connection *connection, uint8_t sdu_type)
+{
+    if (!dispatch_register(connection->fd, sdu_type))
+    {
+        printf("Application can not register SDU type %u, it is used by the daemon.\n", sdu_type);
+        return;
+    }
+    if (connection->sdu_types == 0)
+    {
+        connection->sdu_type = sdu_type;
+    }
+    connection->sdu_types |= 1 << sdu_type;
+    if (debug_mode)
+    {
+        printf("Application registered SDU type %u.\n", sdu_type);
+    }
+}
+
+
+/*Function to handle a message from the application. The first byte of the message is the destination mip address, and the message
+is sent as the SDU of a pdu of the type of the connection (fragmented if it is too large for the interface), or broadcast in one frame
+on every interface if the mip address is MIP_BROADCAST. A message of a single byte
+registers the SDU type it holds instead. The frames are sent in the class of the connection.
+Function takes the connection, raw socket, interface list and our mip address as parameters.
+Returns the return value of recv, so the caller can close the connection on 0 or -1.*/
+static int handle_application_message(struct app_connection *connection, int raw_socket, struct interface_info *if_list, uint8_t mip_address)
+{
+    int rc = recv(connection->fd, app_buffer, sizeof(app_buffer), MSG_TRUNC); /*MSG_TRUNC makes recv return the real length of the message*/
+
+    if (rc > (int)sizeof(app_buffer)) /*The message is larger than we are able to fragment*/
+    {
+        printf("Message of %d bytes from application exceeds the maximum message size of %d bytes, dropping it.\n", rc, MAX_MESSAGE_SIZE);
+        return rc;
+    }
+    if (rc == 1) /*A registration, since a message has content after the mip address*/
+    {
+        register_sdu_type(connection, app_buffer[0]);
+        return rc;
+    }
+    if (rc < 1) /*Error or closed connection*/
+    {
+        return rc;
+    }
+
+    uint8_t dst_mip_address = app_buffer[0];
+    TRACE(TRACE_DEBUG, TRACE_APP_MESSAGE, rc, dst_mip_address);
+    STATS_INC(app_messages_in);
+
+    /*The whole message is the sdu, the receiving daemon replaces the mip address with ours before delivering it*/
+    sched_set_class(SCHED_FIRST_CLIENT + (int)(connection - connections));
+    if (dst_mip_address == MIP_BROADCAST) /*Neither acked nor fragmented, see broadcast.h*/
+    {
+        broadcast_send(raw_socket, if_list, mip_address, connection->sdu_type, app_buffer, rc);
+    } else if (reliable_mode)
+    {
+        if (!rdt_send(raw_socket, if_list, mip_address, dst_mip_address, connection->sdu_type, app_buffer, rc))
+        {
+            /*Try again when the window has moved*/
+            if (connection->blocked == NULL && (connection->blocked = malloc(MAX_MESSAGE_SIZE)) == NULL)
+            {
+                perror("malloc");
+            } else
+            {
+                memcpy(connection->blocked, app_buffer, rc);
+                connection->blocked_len = rc;
+            }
+        }
+    } else if (aggregation_window_ns > 0)
+    {
+        aggregate_sdu(raw_socket, if_list, mip_address, dst_mip_address, connection->sdu_type, app_buffer, rc);
+    } else 
+    {
+        send_sdu(raw_socket, if_list, mip_address, dst_mip_address, connection->sdu_type, app_buffer, rc);
+    }
+    sched_set_class(SCHED_DAEMON);
+    return rc;
+}
+
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*Function to replay a capture opened with replay_open() through handle_received_pdu(), and report how long each frame took.
+Deadlines which pass between two frames are handled before the next frame, like the timer would in the epoll loop.
+Messages delivered to the application are read from a socketpair and counted.
+Takes our mip address as parameter. Returns 0 on success and -1 on failure.*/
+static int run_replay(uint8_t mip_address)
+{
+    struct interface_info if_list;
+    int app_fds[2];
+    uint8_t delivered[BUFFER_SIZE];
+    uint64_t delivered_count = 0;
+    uint64_t type_count[SDU_TYPES] = {0}, type_ns[SDU_TYPES] = {0};
+    uint64_t *times = NULL;
+    size_t count = 0, capacity = 0;
+    uint8_t sdu_type;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, app_fds) == -1)
+    {
+        perror("socketpair");
+        return -1;
+    }
+    link_get_interfaces(&if_list, -1);
+
+    uint64_t replay_start = get_real_time_ns();
+    while (replay_next_frame(&sdu_type))
+    {
+        uint64_t now = get_time_ns();
+        uint64_t deadline = next_deadline();
+        if (deadline != 0 && deadline <= now)
+        {
+            handle_timers(-1, &if_list, mip_address, now);
+        }
+
+        uint64_t start = get_real_time_ns();
+        handle_received_pdu(-1, &if_list, mip_address, app_fds[0]);
+        uint64_t elapsed = get_real_time_ns() - start;
+
+        while (recv(app_fds[1], delivered, sizeof(delivered), MSG_DONTWAIT) > 0)
+        {
+            delivered_count++;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            uint64_t *grown = realloc(times, capacity * sizeof(uint64_t));
+            if (grown == NULL)
+            {
+                perror("realloc");
+                break;
+            }
+            times = grown;
+        }
+        times[count++] = elapsed;
+        type_count[sdu_type]++;
+        type_ns[sdu_type] += elapsed;
+    }
+    uint64_t replay_ns = get_real_time_ns() - replay_start;
+
+    /*Report the processing time per frame*/
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        total += times[i];
+    }
+    qsort(times, count, sizeof(uint64_t), compare_u64);
+    uint64_t mean = count ? total / count : 0;
+    uint64_t p50 = count ? times[count * 50 / 100] : 0;
+    uint64_t p90 = count ? times[count * 90 / 100] : 0;
+    uint64_t p99 = count ? times[count * 99 / 100] : 0;
+    uint64_t max = count ? times[count - 1] : 0;
+
+    printf("Replayed %zu frames in %.3f ms (%lu read, %lu skipped, %lu sent, %lu delivered to the application)\n",
+           count, replay_ns / 1e6, (unsigned long)replay_stats.frames_read, (unsigned long)replay_stats.frames_skipped,
+           (unsigned long)replay_stats.frames_sent, (unsigned long)delivered_count);
+    printf("Processing time per frame: mean %lu ns, p50 %lu ns, p90 %lu ns, p99 %lu ns, max %lu ns\n",
+           (unsigned long)mean, (unsigned long)p50, (unsigned long)p90, (unsigned long)p99, (unsigned long)max);
+    for (int t = 0; t < SDU_TYPES; t++)
+    {
+        if (type_count[t] > 0)
+        {
+            printf("  SDU type 0x%02x: %lu frames, mean %lu ns\n", t, (unsigned long)type_count[t], (unsigned long)(type_ns[t] / type_count[t]));
+        }
+    }
+    printf("{\"frames\":%zu,\"read\":%lu,\"skipped\":%lu,\"sent\":%lu,\"delivered\":%lu,\"total_ns\":%lu,"
+           "\"mean_ns\":%lu,\"p50_ns\":%lu,\"p90_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu}\n",
+           count, (unsigned long)replay_stats.frames_read, (unsigned long)replay_stats.frames_skipped,
+           (unsigned long)replay_stats.frames_sent, (unsigned long)delivered_count, (unsigned long)total,
+           (unsigned long)mean, (unsigned long)p50, (unsigned long)p90, (unsigned long)p99, (unsigned long)max);
+
+    free(times);
+    close(app_fds[0]);
+    close(app_fds[1]);
+    return 0;
+}
+
+
 int main(int argc, char *argv[]) 
 {
     /*Prepare values*/
     int first = 0; /*Value for calling get_local_interfaces*/
-    int raw_socket, unix_socket, connection_socket = -1; /*Sockets*/
+    int raw_socket, unix_socket; /*Sockets*/
     char *socket_upper = NULL; /*Upper socket, given from command line*/
+    char *control_path = NULL; /*Control socket, given from command line*/
+    char *trace_path = NULL; /*Binary trace file, given from command line*/
     int mip_address = 0;
+    uint64_t busy_poll_ns = 0; /*Spin budget of the busy poll mode, 0 when it is off*/
+    int cpu = -1; /*CPU to pin the daemon thread to, -1 to not pin it*/
     memset(arp_list, 0, sizeof(arp_list));
     int rc;
 
     struct interface_info if_list; /*Struct to hold our interfaces*/
+    char *replay_input = NULL, *replay_output = NULL; /*Capture to replay instead of running on the network, and where to write what we send*/
+    int replay_timing = 0;
+    char *snapshot_path = NULL; /*File for the snapshot of the ARP cache, given from command line*/
+    int upgrade_fd = -1; /*Socketpair to the daemon we take over from, or to the one taking over from us*/
+    uint32_t generation = 0; /*Number of upgrades since the first daemon was started*/
+    static struct upgrade_state upgrade;
+
+    static const struct option long_options[] = {
+        { "replay", required_argument, NULL, OPT_REPLAY },
+        { "replay-output", required_argument, NULL, OPT_REPLAY_OUTPUT },
+        { "replay-timing", no_argument, NULL, OPT_REPLAY_TIMING },
+        { "upgrade-fd", required_argument, NULL, OPT_UPGRADE_FD },
+        { NULL, 0, NULL, 0 }
+    };
 
     /*Check arguments*/
     int opt;
-    while ((opt = getopt(argc, argv, "hd")) != -1) 
+    while ((opt = getopt_long(argc, argv, "hda:rl:c:t:b:p:q:s:k:m:gP:S:B:", long_options, NULL)) != -1) 
     {
         switch (opt) 
         {
+            case OPT_REPLAY: /*Case where user wants to replay a capture*/
+                replay_input = optarg;
+                break;
+            case OPT_REPLAY_OUTPUT:
+                replay_output = optarg;
+                break;
+            case OPT_REPLAY_TIMING:
+                replay_timing = 1;
+                break;
+            case OPT_UPGRADE_FD: /*Case where we were started by a running daemon to take over from it*/
+                upgrade_fd = atoi(optarg);
+                break;
+            case 'r': /*Case where user wants application messages delivered reliably*/
+                reliable_mode = 1;
+                break;
+            case 'a': /*Case where user wants small messages aggregated*/
+                aggregation_window_ns = strtoull(optarg, NULL, 10) * 1000ULL;
+                break;
+            case 'l': /*Case where user wants another link layer than AF_PACKET*/
+                if (!link_configure(optarg))
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't': /*Case where user wants the log as binary records*/
+                trace_path = optarg;
+                break;
+            case 'c': /*Case where user wants a control socket*/
+                control_path = optarg;
+                break;
+            case 'b': /*Case where user wants to busy poll for low latency*/
+                busy_poll_ns = strtoull(optarg, NULL, 10) * 1000ULL;
+                break;
+            case 'p': /*Case where user wants the daemon pinned to a CPU*/
+                cpu = atoi(optarg);
+                break;
+            case 'q': /*Case where user wants other queue limits in the transmit scheduler*/
+                if (!sched_configure(optarg))
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's': /*Case where user wants the traffic shaped*/
+                if (!shaper_configure(optarg))
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'k': /*Case where user wants dead neighbours detected*/
+                if (!keepalive_configure(optarg))
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm': /*Case where user wants to choose how the paths to a MIP address are used*/
+                if (strcmp(optarg, "flow") == 0)
+                {
+                    set_multipath_policy(MULTIPATH_FLOW);
+                } else if (strcmp(optarg, "rr") == 0)
+                {
+                    set_multipath_policy(MULTIPATH_ROUND_ROBIN);
+                } else
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g': /*Case where user wants gratuitous announcements*/
+                set_arp_announcements(1);
+                schedule_arp_announcement();
+                break;
+            case 'P': /*Case where user wants to answer ARP requests for the neighbours*/
+                if (atoi(optarg) < 1)
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                set_arp_proxy((uint64_t)atoi(optarg) * 1000000ULL);
+                break;
+            case 'S': /*Case where user wants the ARP cache kept across restarts*/
+                snapshot_path = optarg;
+                break;
+            case 'B': /*Case where user wants the broadcasts of the applications on some interfaces only*/
+                if (!broadcast_configure(optarg))
+                {
+                    print_help(USAGE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'h': /*Case where user wants help*/
-                print_help("Usage: mipd [-h] [-d] <socket_upper> <MIP address>");
+                print_help(USAGE);
                 exit(EXIT_SUCCESS);
             case 'd': /*Case where user wants debug mode*/
                 debug_mode = 1;
+                atomic_store(&trace_level, TRACE_DEBUG);
                 break;
             default: /*Case where user did something wrong*/
-                print_help("Usage: mipd [-h] [-d] <socket_upper> <MIP address>");
+                print_help(USAGE);
                 exit(EXIT_FAILURE);
         }
     }
 
+    /*A replay only needs our mip address, since there is no application to connect*/
+    if (replay_input != NULL)
+    {
+        if (optind + 1 != argc)
+        {
+            fprintf(stderr, "Error: Missing required arguments.\n");
+            print_help(USAGE);
+            exit(EXIT_FAILURE);
+        }
+        mip_address = atoi(argv[optind]);
+        initialize_arp_cache();
+        if (!replay_open(replay_input, replay_output, mip_address, replay_timing) || !trace_start(trace_path))
+        {
+            exit(EXIT_FAILURE);
+        }
+        rc = run_replay(mip_address);
+        trace_stop();
+        replay_close();
+        return rc;
+    }
+
     /*Ensure only two arguments exist*/
     if (optind + 2 != argc) 
     {
         fprintf(stderr, "Error: Missing required arguments.\n");
-        print_help("Usage: mipd [-h] [-d] <socket_upper> <MIP address>");
+        print_help(USAGE);
         exit(EXIT_FAILURE);
     }
 
@@ -66,12 +674,53 @@ int main(int argc, char *argv[])
         printf("MIP address: %d\n", mip_address);
     }
 
-    /*Initialize the empty ARP cache*/
+    /*Initialize the empty ARP cache and the table of application connections*/
     initialize_arp_cache();
+    if (snapshot_path != NULL && !snapshot_open(snapshot_path, mip_address))
+    {
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < SCHED_MAX_CLIENTS; i++)
+    {
+        connections[i].fd = -1;
+        connections[i].sdu_type = PING;
+    }
+
+    /*Start the thread which writes the log, so the packet path only copies records into a ring*/
+    if (!trace_start(trace_path))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    /*Pin the thread which handles frames after the log thread is started, so the log thread is not on the same CPU*/
+    if (cpu >= 0 && !pin_to_cpu(cpu))
+    {
+        fprintf(stderr, "Error: Could not pin mipd to CPU %d.\n", cpu);
+        exit(EXIT_FAILURE);
+    }
 
     /*Create UNIX- and raw sockets*/
-    unix_socket = create_unix_socket(socket_upper);
-    raw_socket = create_raw_socket();
+    if (upgrade_fd != -1) /*The old daemon hands us its sockets, which already have their options*/
+    {
+        if (!upgrade_receive(upgrade_fd, &upgrade) || upgrade.mip_address != mip_address)
+        {
+            fprintf(stderr, "Error: Could not take over from the old daemon.\n");
+            exit(EXIT_FAILURE);
+        }
+        close(upgrade_fd);
+        upgrade_fd = -1;
+        unix_socket = upgrade.unix_socket;
+        raw_socket = upgrade.raw_socket;
+        generation = upgrade.generation;
+    } else
+    {
+        unix_socket = create_unix_socket(socket_upper);
+        raw_socket = link_open();
+    }
+    if (busy_poll_ns > 0 && generation == 0)
+    {
+        link_set_busy_poll(raw_socket, (int)(busy_poll_ns / 1000));
+    }
 
     /*Create epoll*/
     int epoll_fd = epoll_create1(0);
@@ -107,158 +756,268 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    uint8_t buf[BUFFER_SIZE];
+    /*Create the control socket, which adds itself to epoll*/
+    if (generation > 0 && upgrade.control_socket != -1)
+    {
+        control_adopt(upgrade.control_socket, epoll_fd);
+    } else if (control_path != NULL)
+    {
+        control_open(control_path, epoll_fd);
+    }
+
+    /*Take over the connections of the old daemon, in the same slots so they keep their classes*/
+    for (int i = 0; generation > 0 && i < upgrade.connection_count; i++)
+    {
+        struct app_connection *connection = &connections[upgrade.connections[i].slot];
+        connection->fd = upgrade.connections[i].fd;
+        connection->reading = 0;
+        connection->writing = 0;
+        connection->accepted = upgrade.connections[i].accepted;
+        connection->blocked_len = upgrade.connections[i].blocked_len;
+        connection->blocked = upgrade.connections[i].blocked;
+        connection->sdu_types = 0;
+        connection->sdu_type = PING;
+        if (upgrade.connections[i].sdu_types != 0) /*The type it sends with first, so it stays the first one registered*/
+        {
+            register_sdu_type(connection, upgrade.connections[i].sdu_type);
+        }
+        for (int t = 0; t < SDU_TYPES; t++)
+        {
+            if (upgrade.connections[i].sdu_types & (1 << t))
+            {
+                register_sdu_type(connection, t);
+            }
+        }
+        set_connection_reading(epoll_fd, connection, connection->blocked_len == 0);
+    }
+    accept_count = generation > 0 ? upgrade.accept_count : 0;
+
+    /*Add the timer to epoll, it is armed to the next deadline of the reassembly table, the aggregates, the reliable transport or the link*/
+    int timer_fd = create_timer();
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) 
+    {
+        perror("epoll_ctl: timer_fd");
+        close(unix_socket);
+        close(raw_socket);
+        close(timer_fd);
+        return -1;
+    }
+
+    /*Leave the loop on SIGTERM and SIGINT, without SA_RESTART so epoll_wait returns when the signal comes*/
+    struct sigaction stop_action;
+    memset(&stop_action, 0, sizeof(stop_action));
+    stop_action.sa_handler = handle_stop_signal;
+    sigaction(SIGTERM, &stop_action, NULL);
+    sigaction(SIGINT, &stop_action, NULL);
+    struct sigaction upgrade_action;
+    memset(&upgrade_action, 0, sizeof(upgrade_action));
+    upgrade_action.sa_handler = handle_upgrade_signal;
+    sigaction(SIGUSR2, &upgrade_action, NULL);
+    int handed_over = 0;
+
+    /*Arm the timer before the first event, so an announcement or the snapshot is handled right away*/
+    arm_timer(timer_fd, next_deadline());
+
+    if (generation > 0) /*Everything is set up, so the traffic gap of the upgrade ends here*/
+    {
+        uint64_t gap_ns = get_real_time_ns() - upgrade.stop_ns;
+        upgrade_set_result(generation, gap_ns);
+        printf("Took over from the old daemon with %d connections and %d ARP entries, traffic gap %.1f us.\n",
+               upgrade.connection_count, arp_cache_count, gap_ns / 1000.0);
+    }
 
-    while (1) 
+    while (!stopping) 
     {
-        rc = epoll_wait(epoll_fd, events, MAX_EVENTS, -1); /*Wait for incoming traffic*/
+        rc = wait_for_events(epoll_fd, events, busy_poll_ns); /*Wait for incoming traffic*/
         if (rc == -1) 
         {
+            if (errno == EINTR) /*A signal, e.g. when the daemon was stopped and continued, or told to stop*/
+            {
+                continue;
+            }
             perror("epoll_wait");
             break;
         }
+        stats_count_batch(rc);
         if(first == 0)
         {
             /*I assume that the user creates all nodes/hosts first then call .ping_client, therefore we get interfaces after we have received a message once.*/
-            get_local_interfaces(&if_list, raw_socket);
+            link_get_interfaces(&if_list, raw_socket);
+            snapshot_load(&if_list);
             first = 1;
         }
-        if (events->data.fd == unix_socket) /*Handle connection message from unix socket*/
+
+        /*Handle every event epoll returned*/
+        for (int i = 0; i < rc; i++)
         {
-            struct sockaddr_un client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
-            connection_socket = accept(unix_socket, (struct sockaddr *)&client_addr, &client_addr_len);
-            
-            if (connection_socket == -1) /*Error handleing*/
+            int fd = events[i].data.fd;
+
+            if (control_handle_event(epoll_fd, fd)) /*A command or a new connection on the control socket*/
             {
-                perror("accept");
                 continue;
             }
 
-            /*Add the new connection to the epoll table*/
-            ev.events = EPOLLIN;
-            ev.data.fd = connection_socket;
-            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection_socket, &ev) == -1)
+            if (fd == upgrade_fd) /*The new daemon is ready to take over, or failed to start*/
             {
-                perror("epoll_ctl: connection_socket");
-                close(connection_socket);
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, upgrade_fd, NULL);
+                handed_over = hand_over(upgrade_fd, raw_socket, unix_socket, mip_address, generation);
+                close(upgrade_fd);
+                upgrade_fd = -1;
+                if (handed_over)
+                {
+                    break;
+                }
                 continue;
             }
-            if(debug_mode)
+
+            if (fd == unix_socket) /*Handle connection message from unix socket*/
             {
-                printf("Accepted new connection on UNIX socket.\n");
-            }
-        } else if (events->data.fd == connection_socket) /*Handle message from application*/
-        {
-            memset(buf, 0, BUFFER_SIZE);
-            rc = recv(connection_socket, buf, BUFFER_SIZE, 0);
-            
-            if (rc > 0) /*Recv was a success, handleing incomming message*/
+                struct sockaddr_un client_addr;
+                socklen_t client_addr_len = sizeof(client_addr);
+                int connection_socket = accept(unix_socket, (struct sockaddr *)&client_addr, &client_addr_len);
+                
+                if (connection_socket == -1) /*Error handleing*/
+                {
+                    perror("accept");
+                    continue;
+                }
+
+                int slot = 0;
+                while (slot < SCHED_MAX_CLIENTS && connections[slot].fd != -1)
+                {
+                    slot++;
+                }
+                if (slot == SCHED_MAX_CLIENTS)
+                {
+                    printf("Already %d applications connected, closing the new connection.\n", SCHED_MAX_CLIENTS);
+                    close(connection_socket);
+                    continue;
+                }
+
+                /*Add the new connection to the epoll table*/
+                struct app_connection *connection = &connections[slot];
+                connection->fd = connection_socket;
+                connection->reading = 0;
+                connection->writing = 0;
+                connection->accepted = ++accept_count;
+                connection->blocked_len = 0;
+                connection->sdu_types = 0;
+                connection->sdu_type = PING;
+                set_connection_reading(epoll_fd, connection, 1);
+                if (!connection->reading)
+                {
+                    close(connection_socket);
+                    connection->fd = -1;
+                    continue;
+                }
+                if(debug_mode)
+                {
+                    printf("Accepted new connection on UNIX socket.\n");
+                }
+            } else if (find_connection(fd) != -1) /*Handle message from application*/
             {
-                /*Deserialize ping message*/
-                struct ping_message *received_ping = (struct ping_message *)malloc(sizeof(struct ping_message));
-                if (deserialize_ping_message(received_ping, buf, rc) == 1) 
+                struct app_connection *connection = &connections[find_connection(fd)];
+                if (connection->writing && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) /*Room for the messages waiting for it*/
                 {
-                    if(debug_mode)
-                    {
-                        printf("Received ping_message from UNIX connection socket:\nMIP Address: %u\nMessage: %s\n", 
-                            received_ping->mip_address, received_ping->msg);
-                    }
-                    /*Store the ping message in global variable*/
-                    store_ping_message(received_ping);
-                    
-                    /*Lookup the destination mac address*/
-                    uint8_t* mac_ad = lookup_mac_dest(received_ping->mip_address);
-		    
-
-                    if (mac_ad == NULL) /*If we dont find a mac, we have to send arp request*/
+                    dispatch_flush(fd);
+                }
+                if (!connection->reading || !(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                {
+                    continue;
+                }
+                int bytes = handle_application_message(connection, raw_socket, &if_list, mip_address);
+                if (connection->blocked_len > 0) /*Stop reading until the reliable transport has room for the message*/
+                {
+                    set_connection_reading(epoll_fd, connection, 0);
+                } else if (bytes <= 0) /*The connection to the application has been closed, or we failed to receive from it*/
+                {
+                    if (bytes == 0)
                     {
-                        if(debug_mode){
-                            printf("Can not find mac destination, sending arp request.\n");
-                        }
-                        send_arp_request(raw_socket, &if_list, received_ping->mip_address, mip_address);
-			free(received_ping);
-                    } else /*We found the correct mac address*/
+                        printf("Application has closed its connection\n");
+                    } else 
                     {
-                        /**/
-                        uint8_t* mac_src = lookup_mac_src(received_ping->mip_address);
-                        if (mac_src == NULL) /*If we cant find the source address, then we print error*/
-                        {
-                            printf("Can not find mac source, can not send pdu.\n");
-			    free(received_ping);
-                        } else 
-                        {
-                            if(debug_mode)
-                            {
-                                print_ping_message(received_ping);
-                            }
-                            /*Prepare buffer*/
-                            uint8_t ping_buffer[sizeof(struct ping_message)];
-                            size_t ping_buffer_len = sizeof(ping_buffer);
-
-                            if(!serialize_ping_message(stored_ping, ping_buffer, &ping_buffer_len)) 
-                            {
-                                printf("Failed to serialize message");
-				free(received_ping);
-                            } else 
-                            {
-                                /*Allocate and fill pdu*/
-                                struct pdu *send_pdu = alloc_pdu();
-                        
-                                fill_pdu(send_pdu, 
-                                        mac_src,                   // Source MAC
-                                        mac_ad,                    // Destination MAC
-                                        mip_address,               // Source MIP address
-                                        received_ping->mip_address, // Destination MIP address
-                                        PING,                      // SDU type
-                                        ping_buffer,  // SDU content
-                                        ping_buffer_len);    // SDU size
-                                /*Send pdu over raw socket*/
-                                send_pdu_to_raw_socket(raw_socket, send_pdu, &if_list);
-				destroy_pdu(send_pdu);
-				free(received_ping);
-                            }
-                        }
+                        perror("recv: connection_socket");
                     }
-                } else /*Deserialize fail*/
-                {
-                    printf("Failed to deserialize the ping_message.\n");
-		    free(received_ping);
+                    close_connection(epoll_fd, connection);
                 }
-            } else if(rc == 0) /*The connection to the application has been closed*/
+            } else if (fd == raw_socket) /*Handle message from raw socket*/
             {
-                printf("Application has closed its connection\n");
-
-                if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection_socket, NULL) == -1) /*Remove the connection from the epoll table*/
+                handle_received_pdu(raw_socket, &if_list, mip_address, delivery_socket());
+            } else if (fd == timer_fd) /*A reassembly, aggregation, retransmission or link delay deadline has passed*/
+            {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == -1)
                 {
-                    perror("epoll_ctl: EPOLL_CTL_DEL");
+                    perror("read: timer_fd");
                 }
-                printf("Removed connection from epoll.\n");
-                close(connection_socket); /*Close socket*/
-                connection_socket = -1;
-            } else /*Error in receiving from the applucation*/
-            {
-                perror("recv: connection_socket"); 
+                handle_timers(raw_socket, &if_list, mip_address, get_time_ns());
+            }
+        }
 
-                if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection_socket, NULL) == -1) /*Remove the connection from the epoll table*/
+        if (handed_over) /*The new daemon owns the sockets now, so we must not send anything more*/
+        {
+            break;
+        }
+
+        for (int c = 0; c < SCHED_MAX_CLIENTS; c++)
+        {
+            /*Retry the message the reliable transport did not have room for, and start reading from the application again if it fits*/
+            struct app_connection *connection = &connections[c];
+            if (connection->fd != -1 && connection->blocked_len > 0)
+            {
+                sched_set_class(SCHED_FIRST_CLIENT + c);
+                if (rdt_send(raw_socket, &if_list, mip_address, connection->blocked[0], connection->sdu_type, connection->blocked, connection->blocked_len))
                 {
-                    perror("epoll_ctl: EPOLL_CTL_DEL");
+                    connection->blocked_len = 0;
+                    set_connection_reading(epoll_fd, connection, 1);
                 }
-                printf("Removed connection from epoll.\n");
-                close(connection_socket); /*Close socket*/
-                connection_socket = -1;
+                sched_set_class(SCHED_DAEMON);
             }
-        } else if (events->data.fd == raw_socket) /*Handle message from raw socket*/
+
+            /*Ask epoll for room on the socket while messages are waiting to be delivered to the application*/
+            size_t delivery_bytes = connection->fd == -1 ? 0 : dispatch_queued(connection->fd);
+            if (connection->fd != -1)
+            {
+                set_connection_events(epoll_fd, connection, connection->reading, delivery_bytes > 0);
+            }
+
+            /*Publish the queue depth of the application for the stats command of the control socket*/
+            client_stats[c].fd = connection->fd;
+            client_stats[c].queued_bytes = connection->blocked_len;
+            client_stats[c].delivery_bytes = (int)delivery_bytes;
+            client_stats[c].sdu_types = connection->sdu_types;
+        }
+
+        /*Start the new daemon of an upgrade, which tells us on the socketpair when it is ready*/
+        if (upgrade_signal)
         {
-            handle_received_pdu(raw_socket, &if_list, mip_address, connection_socket);
+            upgrade_signal = 0;
+            upgrade_request(NULL);
         }
-        
+        if (upgrade_requested() && upgrade_fd == -1 && (upgrade_fd = upgrade_start(argv)) != -1)
+        {
+            ev.events = EPOLLIN;
+            ev.data.fd = upgrade_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, upgrade_fd, &ev) == -1)
+            {
+                perror("epoll_ctl: upgrade_fd");
+                close(upgrade_fd);
+                upgrade_fd = -1;
+            }
+        }
+
+        /*Arm the timer to the next deadline, or disarm it if there is none*/
+        arm_timer(timer_fd, next_deadline());
     }
 
-    /*Free stored memory*/
-    free(stored_ping);
+    snapshot_close();
+    capture_stop();
+    control_close();
+    trace_stop();
+    close(timer_fd);
     close(unix_socket);
     close(raw_socket);
     return 0;
 }
-
@@ -0,0 +1,363 @@
+#!/usr/bin/env python3
+
+""" Headless end-to-end benchmark of mipd using network namespaces and veth pairs """
+
+import argparse
+import json
+import os
+import re
+import shlex
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+# Usage example (as root, after running make):
+# ./netns-bench.py --topology chain --nodes 3 --netem "delay 10ms"
+# ./netns-bench.py --topology mesh --nodes 12 --duration 2 --report mesh.json
+# ./netns-bench.py --rate 1000 --modes "" "-b 50" "-b 50 -p {cpu}"
+# ./netns-bench.py --payload 64 --modes "" "-l xdp,mode=skb" "-l xdp"    (after make XDP=1)
+#
+# With --modes the benchmark runs once for each set of mipd options and ends with a table of
+# the RTT percentiles against the cpu time of mipd, to compare e.g. the busy poll mode with epoll.
+# {cpu} in a mode is replaced with a cpu number per node, so the daemons are spread over the cpus.
+#
+# Every node gets its own namespace and mipd, with MIP address equal to the node number.
+# mipd only talks to direct neighbours, so the tests run over every link of the topology.
+# Links that do not share a node are tested at the same time, and mipd only serves one
+# application at a time, so every node takes part in at most one test per round.
+
+NS_PREFIX = "mipbench"
+CLK_TCK = os.sysconf("SC_CLK_TCK")
+
+
+def run(cmd, check=True):
+    "Run a command and return its output, raising on failure if check is set."
+    result = subprocess.run(cmd, shell=isinstance(cmd, str), stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    if check and result.returncode != 0:
+        raise RuntimeError("%s failed: %s" % (cmd, result.stdout.strip()))
+    return result.stdout
+
+
+def ns_name(node):
+    return "%s%d" % (NS_PREFIX, node)
+
+
+def ns_cmd(node, cmd):
+    "Prefix a command so it runs inside the namespace of the node."
+    return ["ip", "netns", "exec", ns_name(node)] + cmd
+
+
+def build_links(topology, nodes):
+    "Return the list of links (a, b) of the topology, the nodes are numbered from 1."
+    if topology == "chain":
+        return [(i, i + 1) for i in range(1, nodes)]
+    if topology == "star":
+        return [(1, i) for i in range(2, nodes + 1)]
+    if topology == "mesh":
+        return [(i, j) for i in range(1, nodes + 1) for j in range(i + 1, nodes + 1)]
+    raise ValueError("unknown topology %s" % topology)
+
+
+def schedule_rounds(links):
+    "Split the links into rounds where no node takes part in more than one link."
+    rounds = []
+    remaining = list(links)
+    while remaining:
+        used = set()
+        current = []
+        for link in list(remaining):
+            if link[0] not in used and link[1] not in used:
+                current.append(link)
+                used.update(link)
+                remaining.remove(link)
+        rounds.append(current)
+    return rounds
+
+
+def cleanup_namespaces():
+    "Delete every namespace left behind by an earlier run, which also removes the veth pairs."
+    for line in run("ip netns list", check=False).splitlines():
+        name = line.split()[0] if line.split() else ""
+        if re.match(r"^%s\d+$" % NS_PREFIX, name):
+            run(["ip", "netns", "del", name], check=False)
+
+
+def create_topology(nodes, links, netem):
+    "Create a namespace per node and a veth pair per link, optionally shaped with netem."
+    for node in range(1, nodes + 1):
+        run(["ip", "netns", "add", ns_name(node)])
+        run(ns_cmd(node, ["ip", "link", "set", "lo", "up"]))
+    for a, b in links:
+        if_a = "m%d-%d" % (a, b)
+        if_b = "m%d-%d" % (b, a)
+        run(["ip", "link", "add", if_a, "netns", ns_name(a), "type", "veth",
+             "peer", "name", if_b, "netns", ns_name(b)])
+        for node, ifname in ((a, if_a), (b, if_b)):
+            run(ns_cmd(node, ["ip", "link", "set", ifname, "up"]))
+            if netem:
+                run(ns_cmd(node, ["tc", "qdisc", "add", "dev", ifname, "root", "netem"] + shlex.split(netem)))
+
+
+def cpu_seconds(pid):
+    "Return the user and system cpu time of a process in seconds, read from /proc."
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / CLK_TCK
+    except (OSError, IndexError, ValueError):
+        return 0.0
+
+
+def percentile(samples, percent):
+    "Nearest rank percentile of a list of samples."
+    if not samples:
+        return None
+    ordered = sorted(samples)
+    rank = max(1, min(len(ordered), int(-(-percent * len(ordered) // 100))))
+    return ordered[rank - 1]
+
+
+def stop(process):
+    "Stop a process started with Popen and wait for it."
+    if process.poll() is None:
+        process.send_signal(signal.SIGINT)
+        try:
+            process.wait(timeout=2)
+        except subprocess.TimeoutExpired:
+            process.kill()
+            process.wait()
+
+
+class Harness:
+    def __init__(self, args, mipd_opts):
+        self.args = args
+        self.mipd_opts = mipd_opts
+        self.bindir = os.path.abspath(args.bindir)
+        self.workdir = tempfile.mkdtemp(prefix="mip-netns-bench-")
+        self.daemons = {}
+        self.cpu_start = {}
+
+    def socket(self, node):
+        return os.path.join(self.workdir, "usock%d" % node)
+
+    def log(self, name):
+        return open(os.path.join(self.workdir, name), "w")
+
+    def start_daemons(self, nodes):
+        "Start one mipd per node, the interfaces must exist before mipd gets its first event."
+        for node in range(1, nodes + 1):
+            opts = self.mipd_opts.replace("{cpu}", str((node - 1) % os.cpu_count()))
+            cmd = [os.path.join(self.bindir, "mipd")] + shlex.split(opts) + [self.socket(node), str(node)]
+            self.daemons[node] = subprocess.Popen(ns_cmd(node, cmd), stdout=self.log("mipd%d.log" % node),
+                                                  stderr=subprocess.STDOUT)
+        deadline = time.time() + 5
+        while not all(os.path.exists(self.socket(node)) for node in self.daemons):
+            if time.time() > deadline:
+                raise RuntimeError("mipd did not create its unix sockets, see the logs in %s" % self.workdir)
+            time.sleep(0.05)
+        for node, process in self.daemons.items():
+            self.cpu_start[node] = cpu_seconds(process.pid)
+        self.start_time = time.time()
+
+    def ping_round(self, links):
+        "Run ping_server on one end of each link and ping_client a number of times on the other end."
+        servers = [subprocess.Popen(ns_cmd(b, [os.path.join(self.bindir, "ping_server"), self.socket(b)]),
+                                    stdout=self.log("ping_server%d.log" % b), stderr=subprocess.STDOUT)
+                   for a, b in links]
+        time.sleep(0.2)
+        results = {link: {"rtt_ms": [], "timeouts": 0} for link in links}
+        for i in range(self.args.pings):
+            clients = {(a, b): subprocess.Popen(ns_cmd(a, [os.path.join(self.bindir, "ping_client"), self.socket(a),
+                                                           str(b), "bench %d" % i]),
+                                                stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                                universal_newlines=True)
+                       for a, b in links}
+            for link, client in clients.items():
+                output = client.communicate()[0]
+                match = re.search(r"Round-trip time: ([0-9.]+) seconds", output)
+                if match:
+                    results[link]["rtt_ms"].append(float(match.group(1)) * 1000)
+                else:
+                    results[link]["timeouts"] += 1
+        for server in servers:
+            stop(server)
+        return results
+
+    def perf_round(self, links):
+        "Run mip_perf between the ends of each link at the same time."
+        servers = [subprocess.Popen(ns_cmd(b, [os.path.join(self.bindir, "mip_perf"), "-s", self.socket(b)]),
+                                    stdout=self.log("mip_perf_server%d.log" % b), stderr=subprocess.STDOUT)
+                   for a, b in links]
+        time.sleep(0.2)
+        cmd = ["-l", str(self.args.payload), "-t", str(self.args.duration), "-p", str(self.args.rate)]
+        clients = {(a, b): subprocess.Popen(ns_cmd(a, [os.path.join(self.bindir, "mip_perf"), "-c", str(b)] + cmd +
+                                                   [self.socket(a)]),
+                                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+                   for a, b in links}
+        results = {}
+        for link, client in clients.items():
+            output = client.communicate()[0]
+            summary = None
+            for line in output.splitlines():
+                if line.startswith("{"):
+                    summary = json.loads(line)
+            results[link] = summary
+        for server in servers:
+            stop(server)
+        return results
+
+    def daemon_usage(self):
+        "Return cpu usage of every mipd since they were started, and whether they are still running."
+        elapsed = time.time() - self.start_time
+        usage = {}
+        for node, process in self.daemons.items():
+            seconds = cpu_seconds(process.pid) - self.cpu_start[node]
+            usage[node] = {"cpu_seconds": round(seconds, 3),
+                           "cpu_percent": round(100.0 * seconds / elapsed, 2) if elapsed > 0 else 0.0,
+                           "alive": process.poll() is None}
+        return usage
+
+    def stop_daemons(self):
+        for process in self.daemons.values():
+            stop(process)
+
+
+def run_benchmark(args, links, rounds, mipd_opts):
+    "Run the pings and mip_perf over every link with one set of mipd options, print the results and return the report."
+    harness = Harness(args, mipd_opts)
+
+    cleanup_namespaces()
+    try:
+        create_topology(args.nodes, links, args.netem)
+        harness.start_daemons(args.nodes)
+        print("%s topology with %d nodes and %d links, tested in %d rounds" %
+              (args.topology, args.nodes, len(links), len(rounds)))
+
+        link_results = {}
+        for number, current in enumerate(rounds, 1):
+            pings = harness.ping_round(current) if args.pings > 0 else {}
+            perf = harness.perf_round(current) if args.duration > 0 else {}
+            for link in current:
+                link_results[link] = {"ping": pings.get(link), "perf": perf.get(link)}
+            print("round %d/%d done" % (number, len(rounds)))
+        usage = harness.daemon_usage()
+    finally:
+        harness.stop_daemons()
+        if not args.keep:
+            cleanup_namespaces()
+
+    report = {"topology": args.topology, "nodes": args.nodes, "netem": args.netem, "mipd_opts": mipd_opts,
+              "links": [], "daemons": []}
+    print("\n%-10s %10s %8s %8s %8s %8s %12s %8s %10s" %
+          ("link", "pings", "p50 ms", "p90 ms", "p99 ms", "timeout", "Mbit/s", "loss %", "rtt p99 us"))
+    for (a, b), result in sorted(link_results.items()):
+        ping = result["ping"] or {"rtt_ms": [], "timeouts": 0}
+        perf = result["perf"] or {}
+        entry = {"from": a, "to": b,
+                 "ping_rtt_ms": {"count": len(ping["rtt_ms"]), "timeouts": ping["timeouts"],
+                                 "p50": percentile(ping["rtt_ms"], 50), "p90": percentile(ping["rtt_ms"], 90),
+                                 "p99": percentile(ping["rtt_ms"], 99)},
+                 "perf": perf or None}
+        report["links"].append(entry)
+        rtt = entry["ping_rtt_ms"]
+        print("%-10s %10d %8s %8s %8s %8d %12s %8s %10s" %
+              ("%d-%d" % (a, b), rtt["count"],
+               "%.3f" % rtt["p50"] if rtt["p50"] is not None else "-",
+               "%.3f" % rtt["p90"] if rtt["p90"] is not None else "-",
+               "%.3f" % rtt["p99"] if rtt["p99"] is not None else "-",
+               rtt["timeouts"],
+               "%.2f" % (perf["throughput_bps"] / 1e6) if perf else "-",
+               "%.2f" % perf["loss_percent"] if perf else "-",
+               "%.1f" % perf["rtt_us"]["p99"] if perf else "-"))
+
+    print("\n%-6s %12s %8s %6s" % ("mipd", "cpu seconds", "cpu %", "alive"))
+    for node, entry in sorted(usage.items()):
+        report["daemons"].append(dict(node=node, **entry))
+        print("%-6d %12.3f %8.2f %6s" % (node, entry["cpu_seconds"], entry["cpu_percent"], entry["alive"]))
+
+    if args.keep:
+        print("Namespaces and logs kept, logs are in %s" % harness.workdir)
+    else:
+        shutil.rmtree(harness.workdir, ignore_errors=True)
+    return report
+
+
+def print_comparison(reports):
+    "Print the mip_perf rate and the RTT percentiles over every link against the mean cpu usage of mipd for each set of options."
+    print("\n%-24s %10s %10s %10s %12s %12s %8s" %
+          ("mipd options", "perf pps", "ping p50", "ping p99", "perf p50 us", "perf p99 us", "cpu %"))
+    for report in reports:
+        pings = [entry["ping_rtt_ms"] for entry in report["links"] if entry["ping_rtt_ms"]["count"] > 0]
+        perfs = [entry["perf"] for entry in report["links"] if entry["perf"]]
+        cpu = [entry["cpu_percent"] for entry in report["daemons"]]
+
+        def mean(values):
+            return sum(values) / len(values) if values else None
+
+        columns = [mean([p["p50"] for p in pings]), mean([p["p99"] for p in pings]),
+                   mean([p["rtt_us"]["p50"] for p in perfs]), mean([p["rtt_us"]["p99"] for p in perfs])]
+        pps = mean([p["pps"] for p in perfs])
+        print("%-24s %10s %10s %10s %12s %12s %8.2f" %
+              ((report["mipd_opts"] or "(none)")[:24],
+               "%.0f" % pps if pps is not None else "-",
+               "%.3f" % columns[0] if columns[0] is not None else "-",
+               "%.3f" % columns[1] if columns[1] is not None else "-",
+               "%.1f" % columns[2] if columns[2] is not None else "-",
+               "%.1f" % columns[3] if columns[3] is not None else "-",
+               mean(cpu) or 0.0))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run mipd, ping_server/ping_client and mip_perf over a topology of network namespaces.")
+    parser.add_argument("--topology", choices=["chain", "star", "mesh"], default="chain")
+    parser.add_argument("--nodes", type=int, default=3, help="number of nodes, at most 254")
+    parser.add_argument("--netem", default="", help="netem options for every link, e.g. \"delay 10ms loss 1%%\"")
+    parser.add_argument("--pings", type=int, default=20, help="ping_client runs per link")
+    parser.add_argument("--duration", type=float, default=3.0, help="seconds of mip_perf per link")
+    parser.add_argument("--payload", type=int, default=1000, help="mip_perf payload size in bytes")
+    parser.add_argument("--rate", type=int, default=0, help="mip_perf rate in messages per second, 0 is max rate")
+    parser.add_argument("--mipd-opts", default="", help="extra options for every mipd, e.g. --mipd-opts=\"-r\"")
+    parser.add_argument("--modes", nargs="+", metavar="OPTS",
+                        help="run once per set of mipd options (added to --mipd-opts) and compare RTT with cpu time")
+    parser.add_argument("--bindir", default=os.path.dirname(os.path.abspath(__file__)),
+                        help="directory holding mipd, ping_client, ping_server and mip_perf")
+    parser.add_argument("--report", help="write the report as JSON to this file")
+    parser.add_argument("--keep", action="store_true", help="keep the namespaces and logs after the run")
+    args = parser.parse_args()
+
+    if os.geteuid() != 0:
+        sys.exit("netns-bench.py must run as root to create network namespaces")
+    if not 2 <= args.nodes <= 254:
+        sys.exit("--nodes must be between 2 and 254")
+    for binary in ("mipd", "ping_client", "ping_server", "mip_perf"):
+        if not os.access(os.path.join(args.bindir, binary), os.X_OK):
+            sys.exit("%s not found in %s, run make first" % (binary, args.bindir))
+
+    links = build_links(args.topology, args.nodes)
+    rounds = schedule_rounds(links)
+    modes = args.modes if args.modes else [""]
+
+    reports = []
+    for mode in modes:
+        mipd_opts = (args.mipd_opts + " " + mode).strip()
+        if len(modes) > 1:
+            print("\n=== mipd options: %s ===" % (mipd_opts or "(none)"))
+        reports.append(run_benchmark(args, links, rounds, mipd_opts))
+
+    if len(reports) > 1:
+        print_comparison(reports)
+    if args.report:
+        with open(args.report, "w") as f:
+            json.dump(reports[0] if len(reports) == 1 else {"modes": reports}, f, indent=2)
+        print("\nReport written to %s" % args.report)
+
+    failed = [e for report in reports for e in report["daemons"] if not e["alive"]]
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcap.h"
+
+
+int pcap_open_reader(struct pcap_reader *reader, const char *path)
+{
+    struct pcap_file_header header;
+    memset(reader, 0, sizeof(*reader));
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL)
+    {
+        perror("fopen");
+        return 0;
+    }
+    if (fread(&header, sizeof(header), 1, reader->file) != 1)
+    {
+        printf("%s is too short to be a pcap file\n", path);
+        pcap_close_reader(reader);
+        return 0;
+    }
+
+    if (header.magic == PCAP_MAGIC_US || header.magic == PCAP_MAGIC_NS)
+    {
+        reader->nanosecond = header.magic == PCAP_MAGIC_NS;
+    } else if (header.magic == __builtin_bswap32(PCAP_MAGIC_US) || header.magic == __builtin_bswap32(PCAP_MAGIC_NS))
+    {
+        reader->swapped = 1;
+        reader->nanosecond = header.magic == __builtin_bswap32(PCAP_MAGIC_NS);
+    } else
+    {
+        printf("%s is not a pcap file (pcapng is not supported)\n", path);
+        pcap_close_reader(reader);
+        return 0;
+    }
+    reader->linktype = reader->swapped ? __builtin_bswap32(header.linktype) : header.linktype;
+    return 1;
+}
+
+
+int pcap_read_packet(struct pcap_reader *reader, uint8_t *buffer, size_t buffer_size, size_t *len, uint64_t *timestamp_ns)
+{
+    struct pcap_packet_header header;
+    if (fread(&header, sizeof(header), 1, reader->file) != 1)
+    {
+        return 0;
+    }
+    if (reader->swapped)
+    {
+        header.ts_sec = __builtin_bswap32(header.ts_sec);
+        header.ts_frac = __builtin_bswap32(header.ts_frac);
+        header.caplen = __builtin_bswap32(header.caplen);
+        header.len = __builtin_bswap32(header.len);
+    }
+    if (header.caplen > PCAP_SNAPLEN * 4) /*No sane capture has packets this large, the file must be damaged*/
+    {
+        return -1;
+    }
+
+    size_t copy = header.caplen < buffer_size ? header.caplen : buffer_size;
+    if (fread(buffer, 1, copy, reader->file) != copy)
+    {
+        return -1;
+    }
+    if (copy < header.caplen && fseek(reader->file, header.caplen - copy, SEEK_CUR) != 0) /*Skip the part that did not fit*/
+    {
+        return -1;
+    }
+
+    *len = copy;
+    *timestamp_ns = (uint64_t)header.ts_sec * 1000000000ULL + (uint64_t)header.ts_frac * (reader->nanosecond ? 1 : 1000);
+    return 1;
+}
+
+
+void pcap_close_reader(struct pcap_reader *reader)
+{
+    if (reader->file != NULL)
+    {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
+
+
+FILE *pcap_open_writer(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        perror("fopen");
+        return NULL;
+    }
+
+    struct pcap_file_header header = {
+        .magic = PCAP_MAGIC_NS,
+        .version_major = 2,
+        .version_minor = 4,
+        .thiszone = 0,
+        .sigfigs = 0,
+        .snaplen = PCAP_SNAPLEN,
+        .linktype = PCAP_LINKTYPE_ETHERNET,
+    };
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        perror("fwrite");
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+
+int pcap_write_packet(FILE *file, const uint8_t *frame, size_t len, uint64_t timestamp_ns)
+{
+    struct pcap_packet_header header = {
+        .ts_sec = (uint32_t)(timestamp_ns / 1000000000ULL),
+        .ts_frac = (uint32_t)(timestamp_ns % 1000000000ULL),
+        .caplen = (uint32_t)len,
+        .len = (uint32_t)len,
+    };
+    return fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(frame, 1, len, file) == len;
+}
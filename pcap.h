@@ -0,0 +1,71 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*Magic numbers of the classic pcap file format, with micro- or nanosecond timestamps*/
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+/*Link type of ethernet frames*/
+#define PCAP_LINKTYPE_ETHERNET 1
+
+/*Largest frame we write, a full MIP frame fits*/
+#define PCAP_SNAPLEN 65535
+
+/*Struct for the file header of a pcap file*/
+struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} __attribute__((packed));
+
+/*Struct for the header in front of every packet in a pcap file*/
+struct pcap_packet_header {
+    uint32_t ts_sec;
+    uint32_t ts_frac;   /*Micro- or nanoseconds, depending on the magic number*/
+    uint32_t caplen;
+    uint32_t len;
+} __attribute__((packed));
+
+/*Struct for a pcap file being read*/
+struct pcap_reader {
+    FILE *file;
+    int swapped;     /*The file was written on a machine with the other byte order*/
+    int nanosecond;  /*The timestamps are in nanoseconds instead of microseconds*/
+    uint32_t linktype;
+};
+
+
+/*Function to open a pcap file for reading and check its header.
+Takes a pointer to struct pcap_reader and the path as parameters. Returns 1 on success and 0 on failure.*/
+int pcap_open_reader(struct pcap_reader *reader, const char *path);
+
+
+/*Function to read the next packet of a pcap file. Packets larger than the buffer are truncated.
+Takes a pointer to struct pcap_reader, a buffer, the size of the buffer, and pointers to the length and timestamp in nanoseconds as parameters.
+Returns 1 if a packet was read, 0 at the end of the file and -1 if the file is damaged.*/
+int pcap_read_packet(struct pcap_reader *reader, uint8_t *buffer, size_t buffer_size, size_t *len, uint64_t *timestamp_ns);
+
+
+/*Function to close a pcap file opened with pcap_open_reader().*/
+void pcap_close_reader(struct pcap_reader *reader);
+
+
+/*Function to create a pcap file with nanosecond timestamps for ethernet frames.
+Takes the path as parameter. Returns the file, or NULL on failure.*/
+FILE *pcap_open_writer(const char *path);
+
+
+/*Function to write a frame to a pcap file created with pcap_open_writer().
+Takes the file, a pointer to the frame, the length of the frame and the timestamp in nanoseconds as parameters.
+Returns 1 on success and 0 on failure.*/
+int pcap_write_packet(FILE *file, const uint8_t *frame, size_t len, uint64_t timestamp_ns);
+
+#endif
@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <arpa/inet.h> // htons
 #include "pdu.h"
 #include "raw_socket.h"
 #include "local_interfaces.h"
+#include "link.h"
 #include "ping.h"
+#include "trace.h"
 #include "utils.h"
 
 /*This file is inspired by the github repository we gained access to in learning, p4*/
@@ -94,15 +97,21 @@ void print_pdu_content(struct pdu *pdu)
 }
 
 
-void fill_pdu(struct pdu *pdu,
+int fill_pdu(struct pdu *pdu,
               uint8_t *src_mac_addr,
               uint8_t *dst_mac_addr,
               uint8_t src_mip_addr,
               uint8_t dst_mip_addr,
               uint8_t type,
               uint8_t *sdu,
-              uint8_t sdu_len_bytes) 
+              size_t sdu_len_bytes) 
 {
+    /*The sdu length field is 9 bits, so we can not represent anything larger than MAX_SDU_SIZE*/
+    if (sdu_len_bytes > MAX_SDU_SIZE)
+    {
+        printf("SDU of %zu bytes exceeds the maximum SDU size of %d bytes\n", sdu_len_bytes, MAX_SDU_SIZE);
+        return 0;
+    }
 
     /* Fill ethernet header */
     memcpy(pdu->ether_header->dst_addr, dst_mac_addr, 6);
@@ -113,7 +122,7 @@ void fill_pdu(struct pdu *pdu,
     pdu->mip_header->src_addr = src_mip_addr;
     pdu->mip_header->sdu_type = type;
     pdu->ether_header->eth_proto = htons(ETH_P_MIP);
-    uint8_t length_sdu = sdu_len_bytes;
+    size_t length_sdu = sdu_len_bytes;
 
     /* Ensure the length is 32-bit aligned */
     if (length_sdu % 4 != 0) 
@@ -136,6 +145,7 @@ void fill_pdu(struct pdu *pdu,
 
     /* Copy the actual SDU data */
     memcpy(pdu->sdu, sdu, sdu_len_bytes);
+    return 1;
 }
 
 
@@ -202,13 +212,11 @@ size_t mip_deserialize_pdu(struct pdu *pdu, uint8_t *buffer)
 }
 
 
-void send_pdu_to_raw_socket(int raw_socket, struct pdu *send_pdu, struct interface_info *if_list) 
+int send_pdu_to_raw_socket(int raw_socket, struct pdu *send_pdu, struct interface_info *if_list) 
 {
     /*Prepare buffer for sending*/
     uint8_t buffer[BUFFER_SIZE];
     size_t pdu_size = mip_serialize_pdu(send_pdu, buffer);
-    struct msghdr *msg;
-    struct iovec msgvec[1];
 
     /*Find the interface based on the mac address*/
     struct sockaddr_ll *dest = find_interface_by_mac(if_list, send_pdu->ether_header->src_addr);
@@ -216,34 +224,29 @@ void send_pdu_to_raw_socket(int raw_socket, struct pdu *send_pdu, struct interfa
     if (dest == NULL) 
     {
         printf("Error: Could not find MAC in the interface list\n");
-        return;
+        errno = 0;
+        return -1;
     }
 
-    /*Prepare for sending*/
-    msgvec[0].iov_base = buffer;
-    msgvec[0].iov_len = pdu_size;
-
-    msg = (struct msghdr *)calloc(1, sizeof(struct msghdr));
-
-    msg->msg_name = dest;
-    msg->msg_namelen = sizeof(struct sockaddr_ll);
-    msg->msg_iov = msgvec;
-    msg->msg_iovlen = 1;
-
-    if(debug_mode)
+    /*Make sure the sdu fits within the MTU of the interface we are sending on*/
+    if ((size_t)send_pdu->mip_header->sdu_len * 4 > get_max_sdu_size(if_list, dest))
     {
-        print_pdu_content(send_pdu);
+        printf("Error: SDU of %d bytes exceeds the MTU of the outgoing interface\n", send_pdu->mip_header->sdu_len * 4);
+        errno = 0;
+        return -1;
     }
 
-    /*Send the pdu over raw socket*/
-    if (sendmsg(raw_socket, msg, 0) == -1) 
-    {
-        perror("sendmsg");
-    } else 
+    /*Send the pdu over the link layer*/
+    if (link_send(raw_socket, dest, buffer, pdu_size) == -1) 
     {
-        printf("PDU sent over raw socket\n");
+        int saved_errno = errno;
+        TRACE(TRACE_ERROR, TRACE_SEND_FAILED, pdu_size, send_pdu->mip_header->dest_addr, saved_errno);
+        errno = saved_errno;
+        return -1;
     }
-    free(msg);
+    TRACE(TRACE_DEBUG, TRACE_PDU_SENT, trace_mac(send_pdu->ether_header->src_addr), trace_mac(send_pdu->ether_header->dst_addr),
+          send_pdu->mip_header->src_addr, send_pdu->mip_header->dest_addr, send_pdu->mip_header->sdu_len * 4, send_pdu->mip_header->sdu_type);
+    return 0;
 }
 
 
@@ -9,6 +9,17 @@
 /*Types of messages*/
 #define PING 0x02
 #define MIP_ARP 0x01
+#define MIP_FRAG 0x03 /*Fragment of a message which is too large for a single SDU, see fragment.h*/
+#define MIP_AGGR 0x05 /*Several small messages packed into one SDU, see aggregate.h*/
+#define MIP_RDT 0x06 /*Segment of the reliable transport, see rdt.h*/
+#define MIP_KEEPALIVE 0x07 /*Probe or echo of the liveness detection, see keepalive.h*/
+
+/*MIP address of every node, for ARP requests and the broadcasts of the applications (see broadcast.h)*/
+#define MIP_BROADCAST 0xFF
+
+/*Number of SDU types, since the type field of the mip header is 3 bits. The types the daemon does not use itself are for
+the applications, see dispatch.h*/
+#define SDU_TYPES 8
 
 /*Struct for PDU, containing the ether header, mip header and an SDU.*/
 struct pdu {
@@ -24,16 +35,18 @@ struct pdu *alloc_pdu(void);
 
 /*Function to fill the pdu with details given as parameters.
 Function takes a pointer to a struct pdu, a pointer to the source mac address, a pointer to the dest mac address, 
-the source mip address, the destination mip address, the type (PING/MIP_ARP), a pointer to the sdu and the pdu size as parameters.
+the source mip address, the destination mip address, the type (PING/MIP_ARP), a pointer to the sdu and the sdu size in bytes as parameters.
+The sdu size can be up to MAX_SDU_SIZE (2044 bytes), which is the most the 9 bit sdu length can represent.
+Returns 1 on success and 0 if the sdu is too large.
 */
-void fill_pdu(struct pdu *pdu,
+int fill_pdu(struct pdu *pdu,
 	      uint8_t *src_mac_addr,
 	      uint8_t *dst_mac_addr,
 	      uint8_t src_mip_addr,
 	      uint8_t dst_mip_addr,
           uint8_t type,
 	      uint8_t *sdu, /*Must be 32 bit alligned*/
-          uint8_t pdu_size);
+          size_t sdu_size);
 
 
 /*Function to serialize PDU into a byte stream for sending. 
@@ -68,9 +81,10 @@ void print_mac_addr(uint8_t *mac_addr, size_t length);
 
 
 /*Takes a raw socket fd, a pointer to a pdu struct and a pointer to an interface_info struct as parameters.
-Dependent on the global variable for debug_mode.
-If debug_mode is activated then it calls print_pdu_content.
+Every PDU sent is logged as a TRACE_DEBUG event, see trace.h.
+The pdu is not sent if the sdu does not fit within the MTU of the outgoing interface.
+Returns 0 on success, and -1 if the pdu was not sent, with errno set if the link layer failed to send it.
 */
-void send_pdu_to_raw_socket(int raw_socket, struct pdu *send_pdu, struct interface_info *if_list);
+int send_pdu_to_raw_socket(int raw_socket, struct pdu *send_pdu, struct interface_info *if_list);
 
 #endif /* _PDU_H_ */
\ No newline at end of file
@@ -2,10 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ping.h"
+#include "trace.h"
 #include "utils.h"
 
-struct ping_message *stored_ping = NULL;
-
 void init_ping_message(struct ping_message *ping, uint8_t mip_address, const char *message) 
 {
     /*Set mip address*/
@@ -71,17 +70,21 @@ void send_ping_message_unix(int unix_socket, uint8_t mip_address, const char *me
     ping.mip_address = mip_address;
     snprintf(ping.msg, sizeof(ping.msg), "%s", message);
 
-    if (send(unix_socket, &ping, strlen(message) + 3, 0) == -1) /*Send ping message over unix socket*/
+    /*Serialize the ping so we only send the mip address, the message and the null byte*/
+    uint8_t buffer[BUFFER_SIZE];
+    size_t buffer_len = sizeof(buffer);
+    if (!serialize_ping_message(&ping, buffer, &buffer_len))
+    {
+        printf("Failed to serialize ping message for the application.\n");
+        return;
+    }
+
+    if (send(unix_socket, buffer, buffer_len, 0) == -1) /*Send ping message over unix socket*/
     {
-        if(debug_mode)
-        {
-            printf("Error in send_ping_message_unix()");
-        }
         perror("send");
     } else 
     {
-        printf("Ping message succesfully sent from mip daemon to application.\n");
-        printf("Sent ping message: %s from MIP address: %d\n", message, mip_address);
+        TRACE(TRACE_DEBUG, TRACE_DELIVERED, buffer_len, mip_address);
     }
 }
 
@@ -97,32 +100,3 @@ void print_ping_message(struct ping_message *ping)
     printf("Message: %s\n", ping->msg); /*Print content (sdu)*/
   }
 }
-
-
-void store_ping_message(struct ping_message *ping) 
-{
-    if(ping == NULL)
-    {
-        printf("Error in store_ping_message: the struct provided is null.\n"); /*Prints error msg*/
-    } else 
-    {
-        if (stored_ping != NULL) /*Free stored ping message if it exists*/
-        {
-            free(stored_ping);
-	    stored_ping = NULL;
-        }
-        /*Allocate memory for the stored_ping*/
-        stored_ping = (struct ping_message *)malloc(sizeof(struct ping_message));
-        if (stored_ping != NULL) 
-        {
-            memcpy(stored_ping, ping, sizeof(struct ping_message)); /*Copy new ping_message into global variable stored_ping*/
-            if(debug_mode) 
-            {
-                printf("Storing completed, stored ping_message: MIP Address: %u, Message: %s\n", stored_ping->mip_address, stored_ping->msg);
-            }
-        } else 
-        {
-            perror("malloc failed");
-        }
-    }
-}
@@ -3,17 +3,15 @@
 
 #include <stdint.h>
 #include "pdu.h"
+#include "utils.h"
 
 /*Struct for a ping message, includes the mip address and message*/
 struct ping_message 
 {
     uint8_t mip_address;  /*MIP address of the sender/receiver*/
-    char msg[256];        /*Message content (e.g., "PING:<message>")*/
+    char msg[MAX_SDU_SIZE - 1]; /*Message content (e.g., "PING:<message>"), the serialized message (mip address + msg) fits in one SDU*/
 };
 
-/*Global variable for containing the PING message received from client/server*/
-extern struct ping_message *stored_ping;
-
 /*Function to initialize a ping message. Function fills the appropriate values with values provided by caller.
 Takes a pointer to a struct ping_message, a mip address and a const char *message as parameters.
 Returns nothing. */
@@ -42,12 +40,4 @@ void send_ping_message_unix(int unix_socket, uint8_t mip_address, const char *me
 Takes a pointer to ping_message struct as parameter.*/
 void print_ping_message(struct ping_message *ping);
 
-
-/*Function to store a given struct ping_message into the global variable stored_ping.
-It frees the previously stored ping_message and allocates memory for the new ping_message and stores it in stored_message.
-Takes a pointer to a struct ping_message as parameter.
-Dependent on global variable stored_ping and debug_mode.
-Returns nothing but prints appropriate error messages.*/
-void store_ping_message(struct ping_message *msg);
-
 #endif // PING_H
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/socket.h>
 #include <linux/if_packet.h>    /* AF_PACKET */
 #include <net/ethernet.h>       /* ETH_P_ALL */
@@ -13,6 +14,16 @@
 #include "pdu.h"
 #include "ping.h"
 #include "raw_socket.h"
+#include "fragment.h"
+#include "aggregate.h"
+#include "rdt.h"
+#include "keepalive.h"
+#include "dispatch.h"
+#include "broadcast.h"
+#include "sched.h"
+#include "link.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
 int create_raw_socket(void)
@@ -35,105 +46,119 @@ int create_raw_socket(void)
 
 void handle_received_pdu(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, int unix_socket) 
 {
-  struct pdu *received_pdu = (struct pdu *)malloc(sizeof(struct pdu)); /*Allocate pdu structure to hold the data*/
-    /*Prepare structures for receiving data*/
-    struct msghdr *msg;
-    struct iovec msgvec[1];
+    struct pdu *received_pdu = (struct pdu *)calloc(1, sizeof(struct pdu)); /*Allocate pdu structure to hold the data, zeroed so destroy_pdu is safe*/
     uint8_t buffer[BUFFER_SIZE];
-
     struct sockaddr_ll src_addr;
-    
-    /*The buffer we want to receive to*/
-    msgvec[0].iov_base = buffer;
-    msgvec[0].iov_len = sizeof(buffer);
-    
-    msg = (struct msghdr *)calloc(1,sizeof(struct msghdr));
-    /*Set up the msghdr structure*/
-   
-    msg->msg_name = &src_addr;
-    msg->msg_namelen = sizeof(struct sockaddr_ll);
-    msg->msg_iov = msgvec;
-    msg->msg_iovlen = 1;
-
-     /*Receive data from the raw socket */
-    ssize_t recv_len = recvmsg(raw_socket, msg, 0);
-    free(msg);
+
+    /*Receive a frame from the link layer, which also tells us the interface it came from*/
+    ssize_t recv_len = link_recv(raw_socket, buffer, sizeof(buffer), &src_addr);
     if (recv_len == -1) 
     {
-        perror("recvmsg");
-	destroy_pdu(received_pdu);
+        perror("link_recv");
+        destroy_pdu(received_pdu);
+        return;
+    }
+    if (recv_len == 0) /*The link layer ignored the frame*/
+    {
+        destroy_pdu(received_pdu);
         return;
     }
+    uint64_t dispatch_ns = get_real_time_ns(); /*Start of the dispatch stage, measured with the real clock even when the time is virtual*/
 
-    /*Deserialize the received data into a PDU structure*/
-    size_t pdu_size = mip_deserialize_pdu(received_pdu, buffer);
-    if(pdu_size < 0) 
+    /*Make sure we received at least the ethernet and mip header*/
+    if ((size_t)recv_len < sizeof(struct ether_frame) + MIP_HEADER_SIZE)
     {
-        printf("Error deserializing the pdu\n");
+        TRACE(TRACE_WARN, TRACE_SHORT_FRAME, recv_len);
         destroy_pdu(received_pdu);
         return;
     }
 
-    if(debug_mode)
+    /*Deserialize the received data into a PDU structure*/
+    size_t pdu_size = mip_deserialize_pdu(received_pdu, buffer);
+    if(pdu_size > (size_t)recv_len) /*The sdu length in the header claims more data than we received*/
     {
-        print_pdu_content(received_pdu);
+        TRACE(TRACE_WARN, TRACE_BAD_SDU_LENGTH, pdu_size, recv_len);
+        destroy_pdu(received_pdu);
+        return;
     }
 
-    if (received_pdu->mip_header->sdu_type == MIP_ARP) /*Handle an arp message*/
+    TRACE(TRACE_DEBUG, TRACE_PDU_RECEIVED, trace_mac(received_pdu->ether_header->src_addr), trace_mac(received_pdu->ether_header->dst_addr),
+          received_pdu->mip_header->src_addr, received_pdu->mip_header->dest_addr, received_pdu->mip_header->sdu_len * 4,
+          received_pdu->mip_header->sdu_type);
+
+    /*Any pdu from a neighbour shows that it is alive*/
+    uint64_t now = get_time_ns();
+    keepalive_heard(received_pdu->mip_header->src_addr, now);
+    arp_path_heard(received_pdu->mip_header->src_addr, received_pdu->ether_header->src_addr, now);
+
+    if (received_pdu->mip_header->sdu_type == MIP_ARP &&
+        received_pdu->mip_header->sdu_len * 4 < sizeof(struct mip_arp_message)) /*Too short to hold any arp message*/
+    {
+        TRACE(TRACE_WARN, TRACE_BAD_ARP_MESSAGE, received_pdu->mip_header->sdu_len * 4, received_pdu->mip_header->src_addr);
+    } else if (received_pdu->mip_header->sdu_type == MIP_ARP) /*Handle an arp message*/
     {
         /*Cast the pdu to a mip_arp_message struct*/
         struct mip_arp_message *arp_msg = (struct mip_arp_message *)received_pdu->sdu;
 
         if (arp_msg->type == MIP_ARP_REQUEST) /*Hanlde request*/
         {
-            printf("Received MIP-ARP request for MIP address %u\n", arp_msg->address);
+            TRACE(TRACE_INFO, TRACE_ARP_REQUEST_RECEIVED, arp_msg->address, received_pdu->mip_header->src_addr);
+            STATS_INC(arp_requests_received);
             if(my_mip_address == arp_msg->address) /*We only send a response if the message was ment for us*/
             {
                 send_arp_response(raw_socket, &src_addr, my_mip_address, received_pdu->mip_header->src_addr, if_list, received_pdu->ether_header->src_addr); /*Includes add to cache*/
+                /*The requester might have SDUs waiting for us as well*/
+                send_pending_sdus(raw_socket, if_list, my_mip_address, received_pdu->mip_header->src_addr);
+            } else /*With proxy answers on, we answer for the owner if we know it*/
+            {
+                send_arp_proxy_response(raw_socket, &src_addr, my_mip_address, received_pdu->mip_header->src_addr, arp_msg->address,
+                                        if_list, received_pdu->ether_header->src_addr);
+            }
+        } else if (arp_msg->type == MIP_ARP_ANNOUNCE) /*Handle a neighbour announcing itself*/
+        {
+            handle_arp_announcement(raw_socket, &src_addr, my_mip_address, received_pdu->mip_header->src_addr,
+                                    received_pdu->ether_header->src_addr, if_list);
+        } else if (arp_msg->type == MIP_ARP_PROXY_RESPONSE &&
+                   received_pdu->mip_header->sdu_len * 4 >= sizeof(struct mip_arp_proxy_message)) /*Handle a response on behalf of the owner*/
+        {
+            struct mip_arp_proxy_message *proxy_msg = (struct mip_arp_proxy_message *)received_pdu->sdu;
+            TRACE(TRACE_INFO, TRACE_ARP_PROXY_RESPONSE_RECEIVED, proxy_msg->address, received_pdu->mip_header->src_addr);
+            STATS_INC(arp_proxy_responses_received);
+            if (proxy_msg->address != my_mip_address)
+            {
+                /*The owner is reached directly, from the interface the response came on*/
+                add_to_arp_cache(proxy_msg->address, proxy_msg->mac_address, received_pdu->ether_header->dst_addr);
+                send_pending_sdus(raw_socket, if_list, my_mip_address, proxy_msg->address);
             }
         } else if (arp_msg->type == MIP_ARP_RESPONSE) /*Handle response*/
         {
-            /*When we receive a response, we know that we have found the target mip address, therfore we can send the ping message*/
-            printf("Received MIP-ARP response for MIP address %u\n", arp_msg->address);
+            /*When we receive a response, we know that we have found the target mip address, therfore we can send the waiting SDUs*/
+            TRACE(TRACE_INFO, TRACE_ARP_RESPONSE_RECEIVED, arp_msg->address);
+            STATS_INC(arp_responses_received);
             /*We add the details to our cache*/
             add_to_arp_cache(received_pdu->mip_header->src_addr, /*Mip address*/
                             received_pdu->ether_header->src_addr, /*The src-mac address of the message is our dest-mac for the mip*/
                             received_pdu->ether_header->dst_addr); /*The dest-mac address of the message is out src-mac for the mip*/
-            /*Allocate pdu for sening and preparing buffer*/
-            struct pdu *send_pdu = alloc_pdu();
 
-            uint8_t ping_buffer[sizeof(struct ping_message)];
-            size_t ping_buffer_len = sizeof(ping_buffer);
-            if(!serialize_ping_message(stored_ping, ping_buffer, &ping_buffer_len)) /* Serialize the stored ping message*/
-            {
-                printf("Failed to serialize ping");
-		destroy_pdu(send_pdu);
-                return;
-            }
-            /*Fill the pdu which we are about to send*/
-            fill_pdu(
-                send_pdu, 
-                received_pdu->ether_header->dst_addr, 
-                received_pdu->ether_header->src_addr, 
-                my_mip_address, 
-                received_pdu->mip_header->src_addr, 
-                PING, 
-                ping_buffer,
-                ping_buffer_len);
-
-            send_pdu_to_raw_socket(raw_socket, send_pdu, if_list); /*Send PDU to correct mip address*/
-            
-            destroy_pdu(send_pdu);
+            send_pending_sdus(raw_socket, if_list, my_mip_address, received_pdu->mip_header->src_addr);
         }
-    } else if (received_pdu->mip_header->sdu_type == PING) 
+    } else if (dispatch_is_upper_type(received_pdu->mip_header->sdu_type)) 
     {
         if(received_pdu->mip_header->dest_addr == my_mip_address) /*Check if message was for our mip address*/
         {
-            /*Because we only send pings to direct neighbours*/
-            struct ping_message *ping = (struct ping_message*)received_pdu->sdu;
-            print_ping_message(ping);
-            send_ping_message_unix(unix_socket, received_pdu->mip_header->src_addr, ping->msg);
-            
+            /*The SDU is handed to the applications as it is, so binary payloads and trailing padding are kept intact*/
+            handle_upper_sdu(unix_socket, received_pdu->mip_header->src_addr, received_pdu->mip_header->sdu_type,
+                             received_pdu->sdu, received_pdu->mip_header->sdu_len * 4);
+        } else if (received_pdu->mip_header->dest_addr == MIP_BROADCAST) /*A broadcast of an application, see broadcast.h*/
+        {
+            if (received_pdu->mip_header->src_addr != my_mip_address &&
+                !broadcast_is_duplicate(received_pdu->mip_header->src_addr, src_addr.sll_ifindex, received_pdu->mip_header->sdu_type,
+                                        received_pdu->sdu, received_pdu->mip_header->sdu_len * 4, get_time_ns()))
+            {
+                STATS_INC(broadcasts_received);
+                handle_upper_sdu(unix_socket, received_pdu->mip_header->src_addr, received_pdu->mip_header->sdu_type,
+                                 received_pdu->sdu, received_pdu->mip_header->sdu_len * 4);
+            }
         } else 
         {
             uint8_t* mac_ad = lookup_mac_dest(received_pdu->mip_header->dest_addr);
@@ -145,8 +170,136 @@ void handle_received_pdu(int raw_socket, struct interface_info *if_list, uint8_t
                 /*Set up for future program where we send messages via other mip daemons, modify pdu call send_pdu_to_raw_socket()*/
             }
         }
+    } else if (received_pdu->mip_header->sdu_type == MIP_FRAG) 
+    {
+        if(received_pdu->mip_header->dest_addr == my_mip_address) /*Check if the fragment was for our mip address*/
+        {
+            handle_fragment(raw_socket, if_list, my_mip_address, unix_socket, received_pdu);
+        }
+    } else if (received_pdu->mip_header->sdu_type == MIP_AGGR) 
+    {
+        if(received_pdu->mip_header->dest_addr == my_mip_address) /*Check if the messages were for our mip address*/
+        {
+            handle_aggregate(unix_socket, received_pdu->mip_header->src_addr, received_pdu->sdu, received_pdu->mip_header->sdu_len * 4);
+        }
+    } else if (received_pdu->mip_header->sdu_type == MIP_RDT) 
+    {
+        if(received_pdu->mip_header->dest_addr == my_mip_address) /*Check if the segment was for our mip address*/
+        {
+            rdt_handle_segment(raw_socket, if_list, my_mip_address, unix_socket, received_pdu->mip_header->src_addr,
+                               received_pdu->sdu, received_pdu->mip_header->sdu_len * 4);
+        }
+    } else if (received_pdu->mip_header->sdu_type == MIP_KEEPALIVE) 
+    {
+        if(received_pdu->mip_header->dest_addr == my_mip_address) /*Check if the probe or echo was for our mip address*/
+        {
+            keepalive_handle_message(raw_socket, if_list, my_mip_address, received_pdu);
+        }
     }
     /*Free any dynamically allocated memory for the received pdu*/
     destroy_pdu(received_pdu);
+    stats_count_latency(STATS_LATENCY_DISPATCH, get_real_time_ns() - dispatch_ns);
 }
 
+
+void send_sdu(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+              uint8_t sdu_type, uint8_t *sdu, size_t sdu_len)
+{
+    /*Lookup the path, the destination and source mac address, with the multipath policy if there are several*/
+    struct arp_entry *path = lookup_arp_path(dst_mip_address, sdu_type, sched_get_class());
+
+    if (path == NULL) /*If we dont find a mac, we queue the sdu and send an arp request*/
+    {
+        STATS_INC(arp_misses);
+        if (keepalive_fail_fast(raw_socket, if_list, my_mip_address, dst_mip_address)) /*Drop it at once if the neighbour is down*/
+        {
+            return;
+        }
+        int rc = add_to_pending_queue(dst_mip_address, sdu_type, sdu, sdu_len);
+        if (rc == 0) /*Only send a request if there is not one underway already*/
+        {
+            TRACE(TRACE_DEBUG, TRACE_ARP_MISS, dst_mip_address);
+            send_arp_request(raw_socket, if_list, dst_mip_address, my_mip_address);
+        }
+        return;
+    }
+
+    STATS_INC(arp_hits);
+    if (path->unverified) /*Loaded from a snapshot, so we use it and check it at the same time*/
+    {
+        revalidate_arp_path(raw_socket, if_list, path, my_mip_address);
+    }
+    uint8_t *mac_dst = path->mac_address;
+    uint8_t *mac_src = path->src_mac_address;
+
+    /*Find the largest SDU we can send on the interface*/
+    size_t max_sdu = get_max_sdu_size(if_list, find_interface_by_mac(if_list, mac_src));
+
+    if (sdu_len > max_sdu) /*The sdu does not fit in one pdu, so we send it in fragments*/
+    {
+        send_fragmented_sdu(raw_socket, if_list, mac_src, mac_dst, my_mip_address, dst_mip_address, sdu_type, sdu, sdu_len, max_sdu);
+        return;
+    }
+
+    /*Allocate and fill pdu*/
+    struct pdu *send_pdu = alloc_pdu();
+    int failed = 0;
+    if (fill_pdu(send_pdu, mac_src, mac_dst, my_mip_address, dst_mip_address, sdu_type, sdu, sdu_len))
+    {
+        /*Send pdu over raw socket*/
+        failed = send_pdu_to_raw_socket(raw_socket, send_pdu, if_list) == -1 && (errno == ENETDOWN || errno == ENXIO || errno == ENODEV);
+    }
+    destroy_pdu(send_pdu);
+
+    /*The interface of the path is gone or down, so we fail over to another path to the mip address if there is one*/
+    if (failed && count_arp_paths(dst_mip_address) > 1)
+    {
+        uint8_t dead_mac[6];
+        memcpy(dead_mac, mac_dst, 6);
+        remove_arp_path(dst_mip_address, dead_mac);
+        STATS_INC(arp_path_failovers);
+        TRACE(TRACE_WARN, TRACE_ARP_PATH_DOWN, dst_mip_address, trace_mac(dead_mac));
+        send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, sdu_type, sdu, sdu_len);
+    }
+}
+
+
+void handle_upper_sdu(int unix_socket, uint8_t src_mip_address, uint8_t sdu_type, uint8_t *sdu, size_t sdu_len)
+{
+    if (dispatch_is_upper_type(sdu_type))
+    {
+        /*Every application which registered the type gets the message, PING goes to the given socket if none registered it*/
+        const int *fds;
+        int count = dispatch_lookup(sdu_type, &fds);
+        if (count == 0 && sdu_type == PING && unix_socket != -1)
+        {
+            fds = &unix_socket;
+            count = 1;
+        }
+        if (count == 0 || sdu_len == 0)
+        {
+            TRACE(TRACE_WARN, TRACE_NO_APPLICATION, src_mip_address);
+            STATS_INC(app_drops);
+            return;
+        }
+        /*The first byte of the message is the mip address, which for the application is the one it came from*/
+        sdu[0] = src_mip_address;
+        for (int i = 0; i < count; i++)
+        {
+            uint64_t start = get_real_time_ns();
+            int delivered = dispatch_deliver(fds[i], sdu, sdu_len); /*Never blocks, the message waits if the socket is full*/
+            stats_count_latency(STATS_LATENCY_UNIX, get_real_time_ns() - start);
+            if (delivered)
+            {
+                TRACE(TRACE_DEBUG, TRACE_DELIVERED, sdu_len, src_mip_address);
+                STATS_INC(app_messages_out);
+            }
+        }
+    } else if (sdu_type == MIP_AGGR)
+    {
+        handle_aggregate(unix_socket, src_mip_address, sdu, sdu_len);
+    } else 
+    {
+        TRACE(TRACE_WARN, TRACE_UNKNOWN_SDU_TYPE, sdu_type);
+    }
+}
@@ -34,15 +34,37 @@ Uses ETH_P_MIP which is defined in raw_socket.h.*/
 int create_raw_socket(void);
 
 
-/*Function allocates a PDU and receives data via raw socket from another MIP which it deserializes into the PDU, it differenciates between different type of
+/*Function allocates a PDU and receives a frame from another MIP through the link layer (see link.h), which it deserializes into the PDU, it differenciates between different type of
 SDUs and performs actions accordingly. If the data received is of type MIP-ARP, it checks whether it is a request or a response.
 For request it checks if the request was for its MIP-address and if so it calls send_arp_response().
 For response, it is implied that the response is an answere to a request we have sent, and also that we only get a response if we sent to correct MIP, 
-meaning we can send our PING packet.
-Therefore we call add_to_arp_cache(), prepare a PDU for sending, fills it with the stored_ping, call send_pdu_to_raw_socket() and call destroy() for PDU.
-For PING message it prepares a ping, and call send_ping_unix_socket().
-Function takes the raw_socket, interface list, the mip address of the host's MIP and the unix_socket fd for sending over unix as parameters.
+meaning we can send the SDUs waiting for it.
+Therefore we call add_to_arp_cache() and send_pending_sdus().
+For PING message, and the other types of the applications (see dispatch.h), it calls handle_upper_sdu(), for broadcasts only once
+if they arrive on several interfaces (see broadcast.h).
+For MIP_FRAG message it calls handle_fragment(), which delivers the message to the application, or a reliable segment to
+rdt_handle_segment(), when it is complete.
+For MIP_AGGR message it calls handle_aggregate(), which delivers each of the packed messages.
+For MIP_RDT message it calls rdt_handle_segment(), which handles acks and delivers messages in order.
+Function takes the raw_socket, interface list, the mip address of the host's MIP and the unix_socket fd for PING messages
+no application has registered as parameters.
 Dependent on the global variable debug_mode.*/
 void handle_received_pdu(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, int unix_socket);
 
+/*Function to send an SDU to a directly connected mip. It looks up the mac address in the arp cache, and if it is not found the SDU is queued
+and an ARP request is sent. If the SDU is larger than what fits within the MTU of the outgoing interface it is sent in fragments.
+Function takes the raw socket fd, a pointer to interface_info, our mip address, the destination mip address, the sdu type,
+a pointer to the sdu and the length of the sdu (up to MAX_MESSAGE_SIZE) as parameters.*/
+void send_sdu(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+              uint8_t sdu_type, uint8_t *sdu, size_t sdu_len);
+
+
+/*Function to hand an SDU for our mip address to the upper layer, used for messages which have been reassembled or unpacked.
+Messages of the application types are delivered with a single send to every application which registered the type (see dispatch.h),
+without blocking, so they wait in the queue of an application whose socket is full (see dispatch_deliver()),
+and PING messages nobody registered to unix_socket. The first byte (the mip address) is replaced with the source mip address,
+meaning the sdu buffer is modified. MIP_AGGR messages are unpacked and each message is handled in turn.
+Function takes the unix socket fd, the source mip address, the sdu type, a pointer to the sdu and the sdu length as parameters.*/
+void handle_upper_sdu(int unix_socket, uint8_t src_mip_address, uint8_t sdu_type, uint8_t *sdu, size_t sdu_len);
+
 #endif
@@ -0,0 +1,642 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>  // htons, htonl, ntohs and ntohl
+#include "rdt.h"
+#include "mip_arp.h"
+#include "raw_socket.h"
+#include "trace.h"
+#include "utils.h"
+
+/*Comparison of sequence numbers which handles wrap around*/
+#define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+
+int reliable_mode = 0;
+
+/*Struct for a segment held by the sender until it is acked, or by the receiver until the segments before it have arrived*/
+struct rdt_segment {
+    uint16_t len;           /*Length of the payload*/
+    uint8_t flags;          /*RDT_FLAG_EOM if it is the last segment of a message*/
+    uint8_t inner_type;     /*SDU type of the message*/
+    uint8_t sacked;         /*Sender: the receiver holds the segment*/
+    uint8_t retransmitted;  /*Sender: the segment has been sent more than once, so it can not be used to measure the round trip time*/
+    uint32_t lost_epoch;    /*Sender: the recovery in which the segment was retransmitted as lost*/
+    uint64_t sent_ns;       /*Sender: monotonic time the segment was last sent*/
+    uint8_t data[RDT_MAX_PAYLOAD];
+};
+
+/*Struct for the state of the reliable transport towards one mip address, both as sender and receiver*/
+struct rdt_connection {
+    /*Sender*/
+    uint32_t iss;               /*Initial sequence number*/
+    uint32_t snd_una;           /*Oldest segment not acked*/
+    int una_message_start;      /*snd_una is the first segment of a message*/
+    uint32_t snd_nxt;           /*Next segment to send*/
+    uint32_t snd_max;           /*Highest segment sent + 1, snd_nxt goes back to snd_una after a timeout*/
+    uint32_t snd_end;           /*Next sequence number to give a queued segment*/
+    uint32_t cwnd;              /*Congestion window in segments*/
+    uint32_t ssthresh;          /*Slow start threshold in segments*/
+    uint32_t cwnd_acc;          /*Segments acked since the congestion window was last increased*/
+    uint16_t peer_window;       /*Window advertised by the receiver*/
+    int dupacks;                /*Number of duplicate acks in a row*/
+    int in_recovery;            /*Whether we are recovering from a loss*/
+    uint32_t recover;           /*snd_nxt when the recovery started, the recovery ends when this is acked*/
+    uint32_t recovery_epoch;    /*Counts recoveries, so a lost segment is only retransmitted once per recovery*/
+    uint64_t srtt_ns;           /*Smoothed round trip time, 0 until we have a measurement*/
+    uint64_t rttvar_ns;         /*Round trip time variation*/
+    uint64_t rto_ns;            /*Retransmission timeout*/
+    uint64_t rto_deadline_ns;   /*When the oldest segment in flight times out, 0 if nothing is in flight*/
+    struct rdt_segment *send_buffer;
+
+    /*Receiver*/
+    int synced;                 /*Whether we have received the first segment and know where the sequence numbers start*/
+    uint32_t rcv_nxt;           /*Next segment we expect*/
+    uint8_t present[RDT_WINDOW];
+    struct rdt_segment *recv_buffer;
+    uint8_t *message;           /*The message being assembled from the segments, delivered with a single send*/
+    size_t message_len;
+    int message_overflow;       /*The message is larger than MAX_MESSAGE_SIZE and is dropped when complete*/
+
+    /*Statistics*/
+    uint64_t segments_sent;
+    uint64_t retransmissions;
+    uint64_t timeouts;
+};
+
+/*One connection for each mip address, allocated the first time we send to or receive from it*/
+static struct rdt_connection *connections[256];
+
+
+/*Helper function to get the connection for a mip address, allocating it if it does not exist.
+Returns a pointer to the connection or NULL if we are out of memory.*/
+static struct rdt_connection *get_connection(uint8_t mip_address)
+{
+    struct rdt_connection *conn = connections[mip_address];
+    if (conn != NULL)
+    {
+        return conn;
+    }
+
+    conn = (struct rdt_connection *)calloc(1, sizeof(struct rdt_connection));
+    if (conn == NULL)
+    {
+        perror("calloc failed");
+        return NULL;
+    }
+    conn->send_buffer = (struct rdt_segment *)calloc(RDT_SEND_BUFFER, sizeof(struct rdt_segment));
+    conn->recv_buffer = (struct rdt_segment *)calloc(RDT_WINDOW, sizeof(struct rdt_segment));
+    conn->message = (uint8_t *)malloc(MAX_MESSAGE_SIZE);
+    if (conn->send_buffer == NULL || conn->recv_buffer == NULL || conn->message == NULL)
+    {
+        perror("calloc failed");
+        free(conn->send_buffer);
+        free(conn->recv_buffer);
+        free(conn->message);
+        free(conn);
+        return NULL;
+    }
+
+    /*A random initial sequence number, so a restarted daemon is not mistaken for old segments*/
+    conn->iss = ((uint32_t)random() << 16) ^ (uint32_t)random() ^ (uint32_t)get_time_ns();
+    conn->snd_una = conn->iss;
+    conn->snd_nxt = conn->iss;
+    conn->snd_max = conn->iss;
+    conn->snd_end = conn->iss;
+    conn->una_message_start = 1;
+    conn->cwnd = 2;
+    conn->ssthresh = RDT_WINDOW;
+    conn->peer_window = RDT_WINDOW;
+    conn->rto_ns = RDT_INITIAL_RTO_NS;
+
+    connections[mip_address] = conn;
+    return conn;
+}
+
+
+/*Helper function to send a data segment, and keep track of retransmissions*/
+static void transmit_segment(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                             struct rdt_connection *conn, uint32_t seq)
+{
+    struct rdt_segment *seg = &conn->send_buffer[seq % RDT_SEND_BUFFER];
+    uint8_t sdu[MAX_SDU_SIZE];
+    struct rdt_header header;
+
+    header.flags = RDT_FLAG_DATA | seg->flags | (seq == conn->iss ? RDT_FLAG_SYN : 0);
+    header.inner_type = seg->inner_type;
+    header.window = 0;
+    header.len = htons(seg->len);
+    header.reserved = 0;
+    header.seq = htonl(seq);
+    header.ack = 0;
+    header.sack = 0;
+
+    memcpy(sdu, &header, sizeof(header));
+    memcpy(sdu + sizeof(header), seg->data, seg->len);
+
+    if (seg->sent_ns != 0) /*The segment has been sent before*/
+    {
+        seg->retransmitted = 1;
+        conn->retransmissions++;
+    }
+    seg->sent_ns = get_time_ns();
+    conn->segments_sent++;
+
+    send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, MIP_RDT, sdu, sizeof(header) + seg->len);
+}
+
+
+/*Helper function to send new segments as long as the window allows it*/
+static void rdt_output(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                       struct rdt_connection *conn)
+{
+    uint32_t window = conn->cwnd < conn->peer_window ? conn->cwnd : conn->peer_window;
+    if (window > RDT_WINDOW)
+    {
+        window = RDT_WINDOW;
+    }
+    if (window == 0) /*Always allow one segment, so we learn when the receiver has room again*/
+    {
+        window = 1;
+    }
+
+    while (conn->snd_nxt != conn->snd_end && conn->snd_nxt - conn->snd_una < window)
+    {
+        struct rdt_segment *seg = &conn->send_buffer[conn->snd_nxt % RDT_SEND_BUFFER];
+        if (!seg->sacked) /*After a timeout we go back to snd_una, but skip what the receiver already holds*/
+        {
+            transmit_segment(raw_socket, if_list, my_mip_address, dst_mip_address, conn, conn->snd_nxt);
+        }
+        conn->snd_nxt++;
+        if (SEQ_GT(conn->snd_nxt, conn->snd_max))
+        {
+            conn->snd_max = conn->snd_nxt;
+        }
+    }
+
+    if (conn->rto_deadline_ns == 0 && conn->snd_nxt != conn->snd_una) /*Start the retransmission timer*/
+    {
+        conn->rto_deadline_ns = get_time_ns() + conn->rto_ns;
+    }
+}
+
+
+int rdt_send(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+             uint8_t inner_type, uint8_t *data, size_t data_len)
+{
+    struct rdt_connection *conn = get_connection(dst_mip_address);
+    if (conn == NULL || data_len == 0)
+    {
+        return 1; /*Nothing we can do with the message, so it is dropped*/
+    }
+
+    /*Size the segments so they fit in one pdu on the interface, if we do not know the interface yet we assume the default MTU*/
+    uint8_t *mac_src = lookup_mac_src(dst_mip_address);
+    size_t max_sdu = mac_src == NULL ? (DEFAULT_MTU - MIP_HEADER_SIZE) & ~3 : get_max_sdu_size(if_list, find_interface_by_mac(if_list, mac_src));
+    if (max_sdu > MAX_SDU_SIZE)
+    {
+        max_sdu = MAX_SDU_SIZE;
+    }
+    if (max_sdu <= RDT_HEADER_SIZE)
+    {
+        TRACE(TRACE_WARN, TRACE_RDT_MTU_TOO_SMALL, max_sdu, dst_mip_address);
+        return 1;
+    }
+    size_t payload = max_sdu - RDT_HEADER_SIZE;
+
+    size_t needed = (data_len + payload - 1) / payload;
+    if (needed > RDT_SEND_BUFFER) /*The message would never fit, even with the send buffer empty*/
+    {
+        TRACE(TRACE_WARN, TRACE_RDT_TOO_MANY_SEGMENTS, data_len, dst_mip_address, needed);
+        return 1;
+    }
+    if (needed > RDT_SEND_BUFFER - (conn->snd_end - conn->snd_una)) /*Not enough room in the send buffer yet*/
+    {
+        return 0;
+    }
+
+    /*Split the message into segments*/
+    for (size_t offset = 0; offset < data_len; offset += payload)
+    {
+        struct rdt_segment *seg = &conn->send_buffer[conn->snd_end % RDT_SEND_BUFFER];
+        size_t len = data_len - offset < payload ? data_len - offset : payload;
+
+        seg->len = (uint16_t)len;
+        seg->flags = offset + len == data_len ? RDT_FLAG_EOM : 0;
+        seg->inner_type = inner_type;
+        seg->sacked = 0;
+        seg->retransmitted = 0;
+        seg->lost_epoch = 0;
+        seg->sent_ns = 0;
+        memcpy(seg->data, data + offset, len);
+        conn->snd_end++;
+    }
+
+    rdt_output(raw_socket, if_list, my_mip_address, dst_mip_address, conn);
+    return 1;
+}
+
+
+/*Helper function to update the round trip time estimate with a new measurement, as described in RFC 6298*/
+static void update_rtt(struct rdt_connection *conn, uint64_t rtt_ns)
+{
+    if (conn->srtt_ns == 0) /*First measurement*/
+    {
+        conn->srtt_ns = rtt_ns;
+        conn->rttvar_ns = rtt_ns / 2;
+    } else
+    {
+        uint64_t diff = conn->srtt_ns > rtt_ns ? conn->srtt_ns - rtt_ns : rtt_ns - conn->srtt_ns;
+        conn->rttvar_ns = (3 * conn->rttvar_ns + diff) / 4;
+        conn->srtt_ns = (7 * conn->srtt_ns + rtt_ns) / 8;
+    }
+
+    conn->rto_ns = conn->srtt_ns + 4 * conn->rttvar_ns;
+    if (conn->rto_ns < RDT_MIN_RTO_NS)
+    {
+        conn->rto_ns = RDT_MIN_RTO_NS;
+    } else if (conn->rto_ns > RDT_MAX_RTO_NS)
+    {
+        conn->rto_ns = RDT_MAX_RTO_NS;
+    }
+}
+
+
+/*Helper function to retransmit the segments the acks show are lost. A segment is lost if the receiver holds RDT_DUPACK_THRESHOLD
+segments above it, or if it is the oldest segment and we have received RDT_DUPACK_THRESHOLD duplicate acks.*/
+static void retransmit_lost(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                            struct rdt_connection *conn)
+{
+    int sacked_above = 0;
+
+    for (uint32_t seq = conn->snd_nxt - 1; SEQ_LEQ(conn->snd_una, seq); seq--)
+    {
+        struct rdt_segment *seg = &conn->send_buffer[seq % RDT_SEND_BUFFER];
+        if (seg->sacked)
+        {
+            sacked_above++;
+            continue;
+        }
+
+        int lost = sacked_above >= RDT_DUPACK_THRESHOLD || (seq == conn->snd_una && conn->dupacks >= RDT_DUPACK_THRESHOLD);
+        if (!lost)
+        {
+            continue;
+        }
+        if (!conn->in_recovery) /*First loss in this window, halve the congestion window*/
+        {
+            uint32_t flight = conn->snd_nxt - conn->snd_una;
+            conn->ssthresh = flight / 2 > 2 ? flight / 2 : 2;
+            conn->cwnd = conn->ssthresh;
+            conn->cwnd_acc = 0;
+            conn->in_recovery = 1;
+            conn->recover = conn->snd_nxt;
+            conn->recovery_epoch++;
+        }
+        if (seg->lost_epoch != conn->recovery_epoch) /*Only retransmit a lost segment once per recovery*/
+        {
+            seg->lost_epoch = conn->recovery_epoch;
+            transmit_segment(raw_socket, if_list, my_mip_address, dst_mip_address, conn, seq);
+        }
+    }
+}
+
+
+/*Helper function to handle an ack from the receiver*/
+static void handle_ack(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t src_mip_address,
+                       struct rdt_connection *conn, struct rdt_header *header)
+{
+    uint32_t ack = ntohl(header->ack);
+    uint32_t sack = ntohl(header->sack);
+
+    if (SEQ_LT(ack, conn->snd_una) || SEQ_GT(ack, conn->snd_max)) /*Old or invalid ack*/
+    {
+        return;
+    }
+    conn->peer_window = ntohs(header->window);
+    if (SEQ_GT(ack, conn->snd_nxt)) /*The receiver got segments we sent before a timeout made us go back*/
+    {
+        conn->snd_nxt = ack;
+    }
+
+    if (SEQ_GT(ack, conn->snd_una)) /*New data is acked*/
+    {
+        uint32_t acked = ack - conn->snd_una;
+        struct rdt_segment *last = &conn->send_buffer[(ack - 1) % RDT_SEND_BUFFER];
+        if (!last->retransmitted) /*Karn's algorithm, only measure segments sent once*/
+        {
+            update_rtt(conn, get_time_ns() - last->sent_ns);
+        }
+
+        conn->snd_una = ack;
+        conn->una_message_start = (last->flags & RDT_FLAG_EOM) != 0;
+        conn->dupacks = 0;
+
+        if (conn->in_recovery && SEQ_LEQ(conn->recover, ack)) /*Everything outstanding when the loss was detected is acked*/
+        {
+            conn->in_recovery = 0;
+        }
+        if (!conn->in_recovery) /*Grow the congestion window*/
+        {
+            if (conn->cwnd < conn->ssthresh) /*Slow start*/
+            {
+                conn->cwnd += acked;
+            } else /*Congestion avoidance, one segment per window*/
+            {
+                conn->cwnd_acc += acked;
+                while (conn->cwnd_acc >= conn->cwnd)
+                {
+                    conn->cwnd_acc -= conn->cwnd;
+                    conn->cwnd++;
+                }
+            }
+            if (conn->cwnd > RDT_WINDOW)
+            {
+                conn->cwnd = RDT_WINDOW;
+            }
+        }
+
+        /*Restart the retransmission timer for the remaining segments*/
+        conn->rto_deadline_ns = conn->snd_una == conn->snd_nxt ? 0 : get_time_ns() + conn->rto_ns;
+    } else if (conn->snd_una != conn->snd_nxt) /*Duplicate ack*/
+    {
+        conn->dupacks++;
+    }
+
+    /*Mark the segments the receiver holds beyond the cumulative ack*/
+    for (int i = 0; i < 32; i++)
+    {
+        uint32_t seq = ack + 1 + i;
+        if ((sack & (1U << i)) && SEQ_LT(seq, conn->snd_max))
+        {
+            conn->send_buffer[seq % RDT_SEND_BUFFER].sacked = 1;
+        }
+    }
+
+    retransmit_lost(raw_socket, if_list, my_mip_address, src_mip_address, conn);
+    rdt_output(raw_socket, if_list, my_mip_address, src_mip_address, conn);
+}
+
+
+/*Helper function to handle a reset from a receiver which has lost the state of the connection. The sequence starts over with a SYN
+from the oldest segment not acked, and what is left of a message the receiver only got the first part of is dropped.*/
+static void handle_reset(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t src_mip_address,
+                         struct rdt_connection *conn, struct rdt_header *header)
+{
+    uint32_t seq = ntohl(header->ack);
+
+    if (SEQ_LT(seq, conn->snd_una) || !SEQ_LT(seq, conn->snd_max)) /*Not a segment in flight*/
+    {
+        return;
+    }
+    if (conn->snd_una == conn->iss) /*The SYN is in flight already, the reset is for a segment sent before the receiver gets it*/
+    {
+        return;
+    }
+    TRACE(TRACE_WARN, TRACE_RDT_RESET, src_mip_address, conn->snd_una);
+
+    if (!conn->una_message_start)
+    {
+        while (conn->snd_una != conn->snd_end)
+        {
+            uint8_t flags = conn->send_buffer[conn->snd_una % RDT_SEND_BUFFER].flags;
+            conn->snd_una++;
+            if (flags & RDT_FLAG_EOM)
+            {
+                break;
+            }
+        }
+        conn->una_message_start = 1;
+    }
+    for (uint32_t i = conn->snd_una; i != conn->snd_end; i++) /*Every segment left is sent again as if it was new*/
+    {
+        struct rdt_segment *seg = &conn->send_buffer[i % RDT_SEND_BUFFER];
+        seg->sacked = 0;
+        seg->retransmitted = 0;
+        seg->lost_epoch = 0;
+        seg->sent_ns = 0;
+    }
+
+    conn->iss = conn->snd_una;
+    conn->snd_nxt = conn->snd_una;
+    conn->snd_max = conn->snd_una;
+    conn->cwnd = 2;
+    conn->cwnd_acc = 0;
+    conn->dupacks = 0;
+    conn->in_recovery = 0;
+    conn->peer_window = RDT_WINDOW;
+    conn->rto_deadline_ns = 0;
+
+    rdt_output(raw_socket, if_list, my_mip_address, src_mip_address, conn);
+}
+
+
+/*Helper function to tell the sender we do not know where its sequence numbers start, so it has to start over with a SYN*/
+static void send_reset(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address, uint32_t seq)
+{
+    struct rdt_header header;
+
+    header.flags = RDT_FLAG_RST;
+    header.inner_type = 0;
+    header.window = htons(RDT_WINDOW);
+    header.len = 0;
+    header.reserved = 0;
+    header.seq = 0;
+    header.ack = htonl(seq);
+    header.sack = 0;
+
+    send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, MIP_RDT, (uint8_t *)&header, sizeof(header));
+}
+
+
+/*Helper function to send an ack with the cumulative ack, the selective ack bitmap and the room we have for out of order segments*/
+static void send_ack(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+                     struct rdt_connection *conn)
+{
+    struct rdt_header header;
+    uint32_t sack = 0;
+    int held = 0;
+
+    for (int i = 0; i < RDT_WINDOW; i++)
+    {
+        if (conn->present[i])
+        {
+            held++;
+        }
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        if (conn->present[(conn->rcv_nxt + 1 + i) % RDT_WINDOW])
+        {
+            sack |= 1U << i;
+        }
+    }
+
+    header.flags = RDT_FLAG_ACK;
+    header.inner_type = 0;
+    header.window = htons((uint16_t)(RDT_WINDOW - held));
+    header.len = 0;
+    header.reserved = 0;
+    header.seq = 0;
+    header.ack = htonl(conn->rcv_nxt);
+    header.sack = htonl(sack);
+
+    send_sdu(raw_socket, if_list, my_mip_address, dst_mip_address, MIP_RDT, (uint8_t *)&header, sizeof(header));
+}
+
+
+/*Helper function to handle a data segment, deliver complete messages in order and ack it*/
+static void handle_data(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t src_mip_address,
+                        int unix_socket, struct rdt_connection *conn, struct rdt_header *header, uint8_t *data, size_t len)
+{
+    uint32_t seq = ntohl(header->seq);
+
+    if (header->flags & RDT_FLAG_SYN)
+    {
+        /*The first segment of a connection. Unless it is a duplicate of one we have already seen, the sender is new or has restarted*/
+        int32_t offset = (int32_t)(seq - conn->rcv_nxt);
+        if (!conn->synced || offset < -2 * RDT_WINDOW || offset >= RDT_WINDOW)
+        {
+            conn->synced = 1;
+            conn->rcv_nxt = seq;
+            conn->message_len = 0;
+            conn->message_overflow = 0;
+            memset(conn->present, 0, sizeof(conn->present));
+        }
+    }
+    if (!conn->synced) /*We do not know where the sequence numbers start, the sender has to start over with a SYN*/
+    {
+        send_reset(raw_socket, if_list, my_mip_address, src_mip_address, seq);
+        return;
+    }
+
+    int32_t offset = (int32_t)(seq - conn->rcv_nxt);
+    if (offset >= 0 && offset < RDT_WINDOW && !conn->present[seq % RDT_WINDOW]) /*New segment within the window*/
+    {
+        struct rdt_segment *seg = &conn->recv_buffer[seq % RDT_WINDOW];
+        seg->len = (uint16_t)len;
+        seg->flags = header->flags & RDT_FLAG_EOM;
+        seg->inner_type = header->inner_type;
+        memcpy(seg->data, data, len);
+        conn->present[seq % RDT_WINDOW] = 1;
+    }
+
+    /*Deliver the segments which are now in order*/
+    while (conn->present[conn->rcv_nxt % RDT_WINDOW])
+    {
+        struct rdt_segment *seg = &conn->recv_buffer[conn->rcv_nxt % RDT_WINDOW];
+
+        if (conn->message_len + seg->len > MAX_MESSAGE_SIZE)
+        {
+            conn->message_overflow = 1;
+        } else
+        {
+            memcpy(conn->message + conn->message_len, seg->data, seg->len);
+            conn->message_len += seg->len;
+        }
+
+        if (seg->flags & RDT_FLAG_EOM) /*The message is complete*/
+        {
+            if (conn->message_overflow)
+            {
+                TRACE(TRACE_WARN, TRACE_RDT_MESSAGE_TOO_LARGE, src_mip_address);
+            } else
+            {
+                handle_upper_sdu(unix_socket, src_mip_address, seg->inner_type, conn->message, conn->message_len);
+            }
+            conn->message_len = 0;
+            conn->message_overflow = 0;
+        }
+
+        conn->present[conn->rcv_nxt % RDT_WINDOW] = 0;
+        conn->rcv_nxt++;
+    }
+
+    send_ack(raw_socket, if_list, my_mip_address, src_mip_address, conn);
+}
+
+
+void rdt_handle_segment(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, int unix_socket,
+                        uint8_t src_mip_address, uint8_t *sdu, size_t sdu_len)
+{
+    struct rdt_header header;
+
+    if (sdu_len < sizeof(header))
+    {
+        TRACE(TRACE_WARN, TRACE_RDT_BAD_SEGMENT, sdu_len, src_mip_address);
+        return;
+    }
+    memcpy(&header, sdu, sizeof(header));
+
+    struct rdt_connection *conn = get_connection(src_mip_address);
+    if (conn == NULL)
+    {
+        return;
+    }
+
+    if (header.flags & RDT_FLAG_RST)
+    {
+        handle_reset(raw_socket, if_list, my_mip_address, src_mip_address, conn, &header);
+        return;
+    }
+    if (header.flags & RDT_FLAG_ACK)
+    {
+        handle_ack(raw_socket, if_list, my_mip_address, src_mip_address, conn, &header);
+    }
+    if (header.flags & RDT_FLAG_DATA)
+    {
+        /*The sdu is padded to 32 bits, so the length of the data is given by the header*/
+        size_t len = ntohs(header.len);
+        uint8_t *data = sdu + sizeof(header);
+        if (len > sdu_len - sizeof(header) || len > RDT_MAX_PAYLOAD) /*A reassembled segment can be longer than one we would send*/
+        {
+            TRACE(TRACE_WARN, TRACE_RDT_BAD_SEGMENT, sdu_len, src_mip_address);
+            return;
+        }
+        handle_data(raw_socket, if_list, my_mip_address, src_mip_address, unix_socket, conn, &header, data, len);
+    }
+}
+
+
+void rdt_handle_timers(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint64_t now_ns)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        struct rdt_connection *conn = connections[i];
+        if (conn == NULL || conn->rto_deadline_ns == 0 || conn->rto_deadline_ns > now_ns)
+        {
+            continue;
+        }
+
+        /*The oldest segment timed out, so we assume everything in flight is lost and start over with slow start*/
+        uint32_t flight = conn->snd_nxt - conn->snd_una;
+        conn->timeouts++;
+        conn->ssthresh = flight / 2 > 2 ? flight / 2 : 2;
+        conn->cwnd = 1;
+        conn->cwnd_acc = 0;
+        conn->dupacks = 0;
+        conn->in_recovery = 0;
+        conn->rto_ns = conn->rto_ns * 2 < RDT_MAX_RTO_NS ? conn->rto_ns * 2 : RDT_MAX_RTO_NS; /*Back off*/
+        conn->snd_nxt = conn->snd_una;
+        conn->rto_deadline_ns = 0;
+
+        TRACE(TRACE_INFO, TRACE_RDT_RETRANSMIT, i, conn->snd_una);
+        rdt_output(raw_socket, if_list, my_mip_address, (uint8_t)i, conn);
+    }
+}
+
+
+uint64_t rdt_next_deadline(void)
+{
+    uint64_t next = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (connections[i] != NULL && connections[i]->rto_deadline_ns != 0 &&
+            (next == 0 || connections[i]->rto_deadline_ns < next))
+        {
+            next = connections[i]->rto_deadline_ns;
+        }
+    }
+    return next;
+}
@@ -0,0 +1,85 @@
+#ifndef RDT_H
+#define RDT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "local_interfaces.h"
+#include "pdu.h"
+#include "utils.h"
+
+/*Reliable transport over MIP. Application messages are split into numbered segments which are sent within a sliding window,
+acknowledged with a cumulative ack and a selective ack bitmap, and retransmitted on timeout or when the acks show they were lost.
+The window is limited by a congestion window (slow start and additive increase, halved on loss) and the window advertised by the receiver.
+A receiver which does not know where the sequence numbers start, because it has restarted or been upgraded since the SYN, answers data with
+a reset. The sender then starts the sequence over with a SYN from the oldest segment not acked, and drops the rest of a message the receiver
+only got the first part of.*/
+
+/*Max number of segments in flight, and the size of the out of order buffer of the receiver*/
+#define RDT_WINDOW 128
+
+/*Number of segments the sender buffers, both in flight and waiting to be sent*/
+#define RDT_SEND_BUFFER 256
+
+/*Size of the segment header*/
+#define RDT_HEADER_SIZE 20
+
+/*Largest payload of a segment*/
+#define RDT_MAX_PAYLOAD (MAX_SDU_SIZE - RDT_HEADER_SIZE)
+
+/*Retransmission timeout limits, the timeout is calculated from the measured round trip time*/
+#define RDT_INITIAL_RTO_NS (200ULL * 1000000ULL)
+#define RDT_MIN_RTO_NS (30ULL * 1000000ULL)
+#define RDT_MAX_RTO_NS (2000ULL * 1000000ULL)
+
+/*Number of duplicate acks, or selectively acked segments above a segment, before we consider the segment lost*/
+#define RDT_DUPACK_THRESHOLD 3
+
+/*Flags of a segment*/
+#define RDT_FLAG_DATA 0x01  /*Segment carries data*/
+#define RDT_FLAG_ACK 0x02   /*Segment acknowledges data*/
+#define RDT_FLAG_EOM 0x04   /*Last segment of an application message*/
+#define RDT_FLAG_SYN 0x08   /*First segment of the connection, tells the receiver where the sequence numbers start*/
+#define RDT_FLAG_RST 0x10   /*Sent by a receiver which has no state for the connection, the ack field holds the segment it could not place*/
+
+/*Struct for the segment header, in network byte order*/
+struct rdt_header {
+    uint8_t flags;      /*RDT_FLAG_* values*/
+    uint8_t inner_type; /*SDU type of the application message (e.g. PING)*/
+    uint16_t window;    /*Number of segments the receiver has room for*/
+    uint16_t len;       /*Length of the data, since the sdu is padded to 32 bits*/
+    uint16_t reserved;  /*Padding (set to 0)*/
+    uint32_t seq;       /*Sequence number of the data segment*/
+    uint32_t ack;       /*Next sequence number the receiver expects*/
+    uint32_t sack;      /*Bit i is set if the receiver holds segment ack + 1 + i*/
+} __attribute__((packed));
+
+/*Global variable to indicate whether application messages are sent over the reliable transport*/
+extern int reliable_mode;
+
+/*Function to queue an application message for reliable delivery to a mip address, and send as much as the window allows.
+Function takes the raw socket fd, a pointer to interface_info, our mip address, the destination mip address, the sdu type of the message,
+a pointer to the message and the length of the message as parameters.
+Returns 1 if the message was queued, or dropped because it can never be sent (the interface MTU has no room for a segment, or the message
+needs more than RDT_SEND_BUFFER segments), and 0 if the send buffer does not have room for it yet, in which case the caller should try again later.*/
+int rdt_send(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint8_t dst_mip_address,
+             uint8_t inner_type, uint8_t *data, size_t data_len);
+
+
+/*Function to handle a received SDU of type MIP_RDT, either a pdu of its own or a segment reassembled from fragments. Acks move the window
+of the sender forward, and data segments are delivered in order to the application through handle_upper_sdu() when a whole message has arrived.
+Function takes the raw socket fd, a pointer to interface_info, our mip address, the unix socket fd, the source mip address,
+a pointer to the sdu and the length of the sdu as parameters.*/
+void rdt_handle_segment(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, int unix_socket,
+                        uint8_t src_mip_address, uint8_t *sdu, size_t sdu_len);
+
+
+/*Function to retransmit segments whose retransmission timer has expired.
+Function takes the raw socket fd, a pointer to interface_info, our mip address and the current monotonic time in nanoseconds as parameters.*/
+void rdt_handle_timers(int raw_socket, struct interface_info *if_list, uint8_t my_mip_address, uint64_t now_ns);
+
+
+/*Function to find the time of the next retransmission timeout, so the caller can arm a timer.
+Returns the monotonic time in nanoseconds, or 0 if no data is in flight.*/
+uint64_t rdt_next_deadline(void);
+
+#endif
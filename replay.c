@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "replay.h"
+#include "pcap.h"
+#include "link.h"
+#include "raw_socket.h"
+#include "local_interfaces.h"
+#include "utils.h"
+
+/*Max number of senders we remember the interface of, used to place broadcast frames on an interface*/
+#define MAX_REPLAY_PEERS 1024
+
+/*Struct for a sender we have seen in the capture, and the interface it sent to us on*/
+struct replay_peer {
+    uint8_t mac[6];
+    int ifindex;
+};
+
+struct replay_stats replay_stats;
+
+static struct pcap_reader reader;
+static FILE *output = NULL;
+static uint8_t my_mip;
+static int keep_timing;
+
+/*Our interfaces, learned from the capture*/
+static uint8_t interface_macs[MAX_INTERFACES][6];
+static int interface_count = 0;
+static struct replay_peer peers[MAX_REPLAY_PEERS];
+static int peer_count = 0;
+
+/*The frame link_recv() returns next*/
+static uint8_t frame[BUFFER_SIZE];
+static size_t frame_len = 0;
+static int frame_ifindex = 1;
+
+/*Timestamp of the first frame in the capture, and when we started replaying it on the monotonic clock*/
+static uint64_t first_timestamp_ns = 0;
+static uint64_t replay_start_ns = 0;
+
+
+/*Function to check whether a frame of the capture should be replayed to us*/
+static int is_replayed(const uint8_t *data, size_t len)
+{
+    if (len < sizeof(struct ether_frame) + MIP_HEADER_SIZE || data[12] != (ETH_P_MIP >> 8) || data[13] != (ETH_P_MIP & 0xff))
+    {
+        return 0;
+    }
+    uint8_t dst_mip = data[14];
+    uint8_t src_mip = data[15];
+    return src_mip != my_mip && (dst_mip == my_mip || dst_mip == 0xff);
+}
+
+
+static int is_broadcast(const uint8_t *mac)
+{
+    static const uint8_t broadcast[6] = ETH_BROADCAST_ADDR;
+    return memcmp(mac, broadcast, 6) == 0;
+}
+
+
+/*Function to find the ifindex of one of our interfaces by its mac address, returns 0 if it is not ours*/
+static int find_interface(const uint8_t *mac)
+{
+    for (int i = 0; i < interface_count; i++)
+    {
+        if (memcmp(interface_macs[i], mac, 6) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+
+/*Function to find the interface we have seen a sender on, returns 0 if we have not seen it*/
+static int find_peer(const uint8_t *mac)
+{
+    for (int i = 0; i < peer_count; i++)
+    {
+        if (memcmp(peers[i].mac, mac, 6) == 0)
+        {
+            return peers[i].ifindex;
+        }
+    }
+    return 0;
+}
+
+
+/*Function to learn our interfaces from the unicast frames of the capture, and which interface each sender is on*/
+static void learn_interfaces(void)
+{
+    uint8_t data[BUFFER_SIZE];
+    size_t len;
+    uint64_t timestamp;
+    int rc;
+
+    while ((rc = pcap_read_packet(&reader, data, sizeof(data), &len, &timestamp)) == 1)
+    {
+        if (!is_replayed(data, len) || is_broadcast(data))
+        {
+            continue;
+        }
+        int ifindex = find_interface(data);
+        if (ifindex == 0 && interface_count < MAX_INTERFACES)
+        {
+            memcpy(interface_macs[interface_count++], data, 6);
+            ifindex = interface_count;
+        }
+        if (ifindex != 0 && find_peer(data + 6) == 0 && peer_count < MAX_REPLAY_PEERS)
+        {
+            memcpy(peers[peer_count].mac, data + 6, 6);
+            peers[peer_count].ifindex = ifindex;
+            peer_count++;
+        }
+    }
+
+    if (interface_count == 0) /*Only broadcasts in the capture, so we make up an interface*/
+    {
+        uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, my_mip};
+        memcpy(interface_macs[0], mac, 6);
+        interface_count = 1;
+    }
+}
+
+
+/*Function to get the time of the capture which corresponds to now, used for the timestamps of the frames we send*/
+static uint64_t capture_time_ns(void)
+{
+    if (!keep_timing)
+    {
+        return get_time_ns(); /*The virtual time already follows the capture*/
+    }
+    return first_timestamp_ns + (get_time_ns() - replay_start_ns);
+}
+
+
+/*Replay link layer*/
+static int replay_link_open(void)
+{
+    return -1;
+}
+
+
+static void replay_get_interfaces(struct interface_info *if_list, int fd)
+{
+    memset(if_list, 0, sizeof(*if_list));
+    for (int i = 0; i < interface_count; i++)
+    {
+        struct sockaddr_ll *sll = &if_list->interface_addrs[i];
+        sll->sll_family = AF_PACKET;
+        sll->sll_protocol = htons(ETH_P_MIP);
+        sll->sll_ifindex = i + 1;
+        sll->sll_halen = 6;
+        memcpy(sll->sll_addr, interface_macs[i], 6);
+        if_list->mtu[i] = DEFAULT_MTU;
+    }
+    if_list->num_interfaces = interface_count;
+    if_list->socket_fd = fd;
+}
+
+
+static ssize_t replay_send(int fd, struct sockaddr_ll *iface, uint8_t *data, size_t len)
+{
+    replay_stats.frames_sent++;
+    if (output != NULL && !pcap_write_packet(output, data, len, capture_time_ns()))
+    {
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+
+static ssize_t replay_recv(int fd, uint8_t *data, size_t len, struct sockaddr_ll *iface)
+{
+    size_t copy = frame_len < len ? frame_len : len;
+    memcpy(data, frame, copy);
+    memset(iface, 0, sizeof(*iface));
+    iface->sll_family = AF_PACKET;
+    iface->sll_protocol = htons(ETH_P_MIP);
+    iface->sll_ifindex = frame_ifindex;
+    return (ssize_t)copy;
+}
+
+
+static const struct link_ops replay_link = { "replay", replay_link_open, replay_get_interfaces, replay_send, replay_recv };
+
+
+int replay_open(const char *input_path, const char *output_path, uint8_t my_mip_address, int recorded_timing)
+{
+    my_mip = my_mip_address;
+    keep_timing = recorded_timing;
+    memset(&replay_stats, 0, sizeof(replay_stats));
+
+    /*Read the capture once to learn the interfaces, then open it again for the replay*/
+    if (!pcap_open_reader(&reader, input_path))
+    {
+        return 0;
+    }
+    if (reader.linktype != PCAP_LINKTYPE_ETHERNET)
+    {
+        printf("%s does not hold ethernet frames (link type %u)\n", input_path, reader.linktype);
+        pcap_close_reader(&reader);
+        return 0;
+    }
+    learn_interfaces();
+    pcap_close_reader(&reader);
+    if (!pcap_open_reader(&reader, input_path))
+    {
+        return 0;
+    }
+
+    if (output_path != NULL)
+    {
+        output = pcap_open_writer(output_path);
+        if (output == NULL)
+        {
+            pcap_close_reader(&reader);
+            return 0;
+        }
+    }
+    link_set_ops(&replay_link);
+    return 1;
+}
+
+
+int replay_next_frame(uint8_t *sdu_type)
+{
+    uint64_t timestamp;
+    int rc;
+
+    while ((rc = pcap_read_packet(&reader, frame, sizeof(frame), &frame_len, &timestamp)) == 1)
+    {
+        replay_stats.frames_read++;
+        if (!is_replayed(frame, frame_len))
+        {
+            replay_stats.frames_skipped++;
+            continue;
+        }
+
+        /*Unicast frames arrive on the interface they are addressed to, broadcasts on the interface we have seen the sender on*/
+        frame_ifindex = is_broadcast(frame) ? find_peer(frame + 6) : find_interface(frame);
+        if (frame_ifindex == 0)
+        {
+            frame_ifindex = 1;
+        }
+        *sdu_type = frame[sizeof(struct ether_frame) + 3] & 0x7;
+
+        if (first_timestamp_ns == 0)
+        {
+            first_timestamp_ns = timestamp;
+            replay_start_ns = get_time_ns();
+        }
+        if (keep_timing)
+        {
+            /*Sleep until the frame is due, relative to the first frame of the capture*/
+            uint64_t due = replay_start_ns + (timestamp > first_timestamp_ns ? timestamp - first_timestamp_ns : 0);
+            uint64_t now = get_time_ns();
+            if (due > now)
+            {
+                struct timespec ts = { .tv_sec = (due - now) / 1000000000ULL, .tv_nsec = (due - now) % 1000000000ULL };
+                while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+                {
+                }
+            }
+        } else
+        {
+            set_virtual_time(timestamp > 0 ? timestamp : 1);
+        }
+        return 1;
+    }
+
+    if (rc == -1)
+    {
+        printf("The capture is damaged, stopping the replay\n");
+    }
+    return 0;
+}
+
+
+void replay_close(void)
+{
+    pcap_close_reader(&reader);
+    if (output != NULL)
+    {
+        fclose(output);
+        output = NULL;
+    }
+}
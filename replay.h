@@ -0,0 +1,42 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*Replay of captured traffic through mipd (mipd --replay). The capture is read by a link layer which hands the frames
+to handle_received_pdu() one at a time, and every frame mipd sends is written to an output pcap instead of the network.
+
+Only MIP frames for our mip address (or broadcast) which we did not send ourselves are replayed. The interfaces are learned
+from the capture: every unicast destination mac address of a replayed frame is one of our interfaces, and a broadcast frame
+arrives on the interface we have seen its sender on. If the capture has no unicast frames we use a single interface.*/
+
+/*Struct for the counters of a replay*/
+struct replay_stats {
+    uint64_t frames_read;     /*Frames in the capture*/
+    uint64_t frames_skipped;  /*Frames which were not for us, sent by us or not MIP*/
+    uint64_t frames_sent;     /*Frames mipd sent, written to the output pcap*/
+};
+
+extern struct replay_stats replay_stats;
+
+
+/*Function to open a capture for replay, learn our interfaces from it and make it the link layer.
+Takes the path of the capture, the path of the output pcap (or NULL), our mip address and whether the recorded timing
+should be kept (1) or the frames replayed as fast as possible (0) as parameters.
+When the frames are replayed as fast as possible the clock of the daemon follows the timestamps in the capture, so timeouts
+behave as they did when the traffic was recorded. Returns 1 on success and 0 on failure.*/
+int replay_open(const char *input_path, const char *output_path, uint8_t my_mip_address, int recorded_timing);
+
+
+/*Function to move to the next frame of the capture that should be replayed, which the next link_recv() returns.
+With recorded timing it sleeps until the frame is due, otherwise it sets the virtual time to the timestamp of the frame.
+Takes a pointer where the SDU type of the frame is stored as parameter.
+Returns 1 if there is a frame, and 0 at the end of the capture.*/
+int replay_next_frame(uint8_t *sdu_type);
+
+
+/*Function to close the capture and the output pcap.*/
+void replay_close(void);
+
+#endif
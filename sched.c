@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sched.h"
+#include "raw_socket.h"
+
+/*Struct for the queue of a class, a list of frames in the pool in the order they were queued*/
+struct sched_queue {
+    int head;
+    int tail;
+    int length;
+    int limit;
+    int deficit; /*Bytes the class may still send this round*/
+};
+
+static struct sched_queue queues[SCHED_CLASSES];
+static struct sched_class_stats class_stats[SCHED_CLASSES];
+static int control_limit = SCHED_DEFAULT_CONTROL_LIMIT;
+static int daemon_limit = SCHED_DEFAULT_DAEMON_LIMIT;
+static int client_limit = SCHED_DEFAULT_CLIENT_LIMIT;
+
+/*Frames of every class come from one pool, which is large enough for every queue to be full at the same time.
+It is allocated the first time a frame has to wait.*/
+static struct sched_frame *pool = NULL;
+static int free_frames = -1;
+static int backlog = 0;
+
+static int current_class = SCHED_DAEMON;
+static int round_class = SCHED_DAEMON; /*Class the deficit round robin is serving*/
+static int round_started = 0;          /*1 once the class being served has been given its quantum*/
+static int peeked_class = -1;          /*Class of the frame returned by sched_peek()*/
+
+
+int sched_configure(const char *spec)
+{
+    char copy[256];
+    if (pool != NULL || strlen(spec) >= sizeof(copy))
+    {
+        return 0;
+    }
+    strcpy(copy, spec);
+
+    char *saveptr;
+    for (char *field = strtok_r(copy, ",", &saveptr); field != NULL; field = strtok_r(NULL, ",", &saveptr))
+    {
+        char *value = strchr(field, '=');
+        if (value == NULL || atoi(value + 1) < 1)
+        {
+            printf("Invalid queue limit %s\n", field);
+            return 0;
+        }
+        *value++ = '\0';
+        if (strcmp(field, "control") == 0)
+        {
+            control_limit = atoi(value);
+        } else if (strcmp(field, "daemon") == 0)
+        {
+            daemon_limit = atoi(value);
+        } else if (strcmp(field, "client") == 0)
+        {
+            client_limit = atoi(value);
+        } else
+        {
+            printf("Unknown queue class %s\n", field);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*Function to set up the queues and the pool, returns 0 if the pool could not be allocated*/
+static int setup(void)
+{
+    int total = control_limit + daemon_limit + client_limit * SCHED_MAX_CLIENTS;
+    pool = malloc((size_t)total * sizeof(struct sched_frame));
+    if (pool == NULL)
+    {
+        perror("malloc");
+        return 0;
+    }
+    for (int i = 0; i < total; i++)
+    {
+        pool[i].next = i + 1 < total ? i + 1 : -1;
+    }
+    free_frames = 0;
+    for (int c = 0; c < SCHED_CLASSES; c++)
+    {
+        queues[c].head = queues[c].tail = -1;
+        queues[c].length = 0;
+        queues[c].deficit = 0;
+        queues[c].limit = c == SCHED_CONTROL ? control_limit : c == SCHED_DAEMON ? daemon_limit : client_limit;
+    }
+    return 1;
+}
+
+
+void sched_set_class(int tx_class)
+{
+    current_class = tx_class;
+}
+
+
+int sched_get_class(void)
+{
+    return current_class;
+}
+
+
+int sched_classify(const uint8_t *frame, size_t len)
+{
+    /*The SDU type is in the lowest 3 bits of the last byte of the mip header*/
+    if (len >= sizeof(struct ether_frame) + MIP_HEADER_SIZE)
+    {
+        int sdu_type = frame[sizeof(struct ether_frame) + 3] & 0x7;
+        if (sdu_type == MIP_ARP || sdu_type == MIP_KEEPALIVE)
+        {
+            return SCHED_CONTROL;
+        }
+    }
+    return current_class;
+}
+
+
+int sched_backlog(void)
+{
+    return backlog > 0;
+}
+
+
+int sched_enqueue(int tx_class, struct sockaddr_ll *iface, uint8_t *frame, size_t len, uint64_t now_ns)
+{
+    if (pool == NULL && !setup())
+    {
+        return 0;
+    }
+    struct sched_queue *queue = &queues[tx_class];
+    if (queue->length >= queue->limit || len > BUFFER_SIZE)
+    {
+        class_stats[tx_class].dropped++;
+        return 0;
+    }
+
+    int index = free_frames;
+    free_frames = pool[index].next;
+    struct sched_frame *entry = &pool[index];
+    entry->queued_ns = now_ns;
+    entry->iface = *iface;
+    entry->tx_class = tx_class;
+    entry->next = -1;
+    entry->len = len;
+    memcpy(entry->frame, frame, len);
+
+    if (queue->tail == -1)
+    {
+        queue->head = index;
+    } else
+    {
+        pool[queue->tail].next = index;
+    }
+    queue->tail = index;
+    queue->length++;
+    backlog++;
+    class_stats[tx_class].queued++;
+    return 1;
+}
+
+
+struct sched_frame *sched_peek(void)
+{
+    if (backlog == 0)
+    {
+        return NULL;
+    }
+    if (queues[SCHED_CONTROL].length > 0)
+    {
+        peeked_class = SCHED_CONTROL;
+        return &pool[queues[SCHED_CONTROL].head];
+    }
+
+    /*Deficit round robin over the daemon and the applications. A class gets a quantum when its turn starts and sends while
+    its deficit covers the next frame. Since the quantum is at least the largest frame, one pass over the classes finds a frame.*/
+    int classes = SCHED_CLASSES - SCHED_DAEMON;
+    for (int visited = 0; visited <= classes; )
+    {
+        struct sched_queue *queue = &queues[round_class];
+        if (queue->length == 0)
+        {
+            queue->deficit = 0;
+        } else
+        {
+            if (!round_started)
+            {
+                queue->deficit += SCHED_QUANTUM;
+                round_started = 1;
+            }
+            if ((int)pool[queue->head].len <= queue->deficit)
+            {
+                peeked_class = round_class;
+                return &pool[queue->head];
+            }
+        }
+        round_class = round_class + 1 < SCHED_CLASSES ? round_class + 1 : SCHED_DAEMON;
+        round_started = 0;
+        visited++;
+    }
+    return NULL;
+}
+
+
+void sched_done(uint64_t now_ns)
+{
+    if (peeked_class == -1)
+    {
+        return;
+    }
+    struct sched_queue *queue = &queues[peeked_class];
+    int index = queue->head;
+    struct sched_frame *entry = &pool[index];
+    if (peeked_class != SCHED_CONTROL)
+    {
+        queue->deficit -= (int)entry->len;
+    }
+    stats_latency_add(&class_stats[peeked_class].wait, now_ns - entry->queued_ns);
+    class_stats[peeked_class].sent++;
+
+    queue->head = entry->next;
+    if (queue->head == -1)
+    {
+        queue->tail = -1;
+    }
+    queue->length--;
+    backlog--;
+    entry->next = free_frames;
+    free_frames = index;
+    peeked_class = -1;
+}
+
+
+void sched_count_sent(int tx_class)
+{
+    class_stats[tx_class].sent++;
+}
+
+
+int sched_queue_length(int tx_class)
+{
+    return queues[tx_class].length;
+}
+
+
+int sched_queue_limit(int tx_class)
+{
+    return tx_class == SCHED_CONTROL ? control_limit : tx_class == SCHED_DAEMON ? daemon_limit : client_limit;
+}
+
+
+const struct sched_class_stats *sched_get_stats(int tx_class)
+{
+    return &class_stats[tx_class];
+}
+
+
+void sched_reset_stats(void)
+{
+    memset(class_stats, 0, sizeof(class_stats));
+}
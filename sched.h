@@ -0,0 +1,118 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/if_packet.h>
+#include "stats.h"
+#include "utils.h"
+
+/*Transmit scheduler of the link layer (see link.h). Frames are sent straight away as long as nothing is waiting,
+and are queued when the socket has no room (EAGAIN or ENOBUFS) or other frames are already waiting.
+
+Every frame belongs to a class. MIP-ARP and keepalive frames are in the control class, which has strict priority, so a flooding
+application can not hold back ARP requests and responses, or make a neighbour look dead. The other classes share the link with deficit round robin by bytes:
+one class for the frames the daemon sends on its own (retransmissions, acks, pending SDUs after an ARP response)
+and one class for each application connection. Every class has a queue limit, a frame which does not fit is dropped and counted,
+like a queue discipline of the kernel does. mipd keeps reading from every application, since an application may be blocked
+sending to us while we deliver to it, and the reliable transport retransmits what was dropped.
+
+The limits are set with mipd -q <spec>, a comma separated list of control=<frames>, daemon=<frames> and client=<frames>.*/
+
+/*Classes of the scheduler, the class of application connection i is SCHED_FIRST_CLIENT + i*/
+#define SCHED_CONTROL 0
+#define SCHED_DAEMON 1
+#define SCHED_FIRST_CLIENT 2
+#define SCHED_MAX_CLIENTS STATS_MAX_CLIENTS
+#define SCHED_CLASSES (SCHED_FIRST_CLIENT + SCHED_MAX_CLIENTS)
+
+/*Default queue limits in frames*/
+#define SCHED_DEFAULT_CONTROL_LIMIT 256
+#define SCHED_DEFAULT_DAEMON_LIMIT 1024
+#define SCHED_DEFAULT_CLIENT_LIMIT 256
+
+/*Bytes a class may send each round of the deficit round robin, at least the largest frame so a class sends a frame every round*/
+#define SCHED_QUANTUM BUFFER_SIZE
+
+/*How long to wait before trying again when the socket has no room*/
+#define SCHED_RETRY_NS 50000
+
+/*Struct for the counters of a class*/
+struct sched_class_stats {
+    uint64_t sent;     /*Frames sent, straight away or from the queue*/
+    uint64_t queued;   /*Frames which had to wait in the queue*/
+    uint64_t dropped;  /*Frames dropped because the queue was full*/
+    struct latency_stats wait; /*Time the queued frames waited*/
+};
+
+/*Struct for a frame waiting in the scheduler*/
+struct sched_frame {
+    uint64_t queued_ns;
+    struct sockaddr_ll iface;
+    int tx_class;
+    int next;           /*Index of the next frame of the class, or of the next free frame, -1 at the end*/
+    size_t len;
+    uint8_t frame[BUFFER_SIZE];
+};
+
+
+/*Function to set the queue limits from a spec as described above.
+Takes the spec as parameter. Returns 1 on success and 0 if the spec is invalid.*/
+int sched_configure(const char *spec);
+
+
+/*Function to set the class of the frames sent from now on, mipd sets the class of an application while it handles its message
+and SCHED_DAEMON otherwise. MIP-ARP and keepalive frames are always in the control class.
+Takes the class as parameter.*/
+void sched_set_class(int tx_class);
+
+
+/*Function to get the class set with sched_set_class(), which the multipath policy of the ARP cache uses as the flow of an SDU.
+Returns the class.*/
+int sched_get_class(void);
+
+
+/*Function to find the class of a frame. Takes a pointer to the frame and its length as parameters. Returns the class.*/
+int sched_classify(const uint8_t *frame, size_t len);
+
+
+/*Function to check if any frame is waiting. Returns 1 if one is, and 0 otherwise.*/
+int sched_backlog(void);
+
+
+/*Function to queue a frame. Takes the class, the interface, the frame, its length and the current time as parameters.
+Returns 1 if the frame was queued, and 0 if it was dropped since the queue of the class is full.*/
+int sched_enqueue(int tx_class, struct sockaddr_ll *iface, uint8_t *frame, size_t len, uint64_t now_ns);
+
+
+/*Function to find the frame which should be sent next, control frames first and then the other classes in deficit round robin.
+The frame stays in the queue until sched_done() is called, so it can be tried again if the socket has no room.
+Returns a pointer to the frame, or NULL if no frame is waiting.*/
+struct sched_frame *sched_peek(void);
+
+
+/*Function to remove the frame returned by sched_peek() after it has been sent, and count how long it waited.
+Takes the current time as parameter.*/
+void sched_done(uint64_t now_ns);
+
+
+/*Function to count a frame which was sent straight away. Takes the class as parameter.*/
+void sched_count_sent(int tx_class);
+
+
+/*Function to get the number of frames waiting in a class. Takes the class as parameter.*/
+int sched_queue_length(int tx_class);
+
+
+/*Function to get the queue limit of a class. Takes the class as parameter.*/
+int sched_queue_limit(int tx_class);
+
+
+/*Function to get the counters of a class. Takes the class as parameter. Returns a pointer to the counters.*/
+const struct sched_class_stats *sched_get_stats(int tx_class);
+
+
+/*Function to set the counters of every class to 0, called by stats_reset().*/
+void sched_reset_stats(void);
+
+#endif
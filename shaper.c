@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shaper.h"
+#include "raw_socket.h"
+#include "local_interfaces.h"
+
+/*Number of MIP addresses, since the address is 8 bits*/
+#define SHAPER_DESTINATIONS 256
+
+/*Struct for a destination, its bucket and the list of its queued frames in the pool*/
+struct shaper_destination {
+    struct token_bucket bucket;
+    int head;
+    int tail;
+    int length;
+    struct shaper_stats stats;
+};
+
+/*Struct for the bucket of an interface*/
+struct shaper_interface {
+    int ifindex; /*0 if the slot is free*/
+    struct token_bucket bucket;
+};
+
+static struct shaper_destination destinations[SHAPER_DESTINATIONS];
+static struct shaper_interface interfaces[MAX_INTERFACES];
+
+/*Buckets of the spec, the default of every interface and the interfaces which have their own*/
+static struct token_bucket default_iface_bucket;
+static struct shaper_interface iface_overrides[MAX_INTERFACES];
+static int num_iface_overrides = 0;
+
+static int enabled = 0;
+static int drop_policy = 0;
+static int queue_limit = SHAPER_DEFAULT_LIMIT;
+
+/*Frames of every destination come from one pool, which is allocated the first time a frame has to wait*/
+static struct sched_frame *pool = NULL;
+static int free_frames = -1;
+static int queued_frames = 0;
+static int next_destination = 0; /*Destination to look at first in shaper_dequeue(), so the destinations take turns*/
+
+
+/*Function to parse a rate in bits per second with an optional k, m or g suffix and an optional /<burst> in bytes.
+Takes the text and a pointer to the bucket as parameters. Returns 1 on success and 0 if the text is invalid.*/
+static int parse_bucket(const char *text, struct token_bucket *bucket)
+{
+    char *end;
+    double rate = strtod(text, &end);
+    if (end == text || rate < 0)
+    {
+        return 0;
+    }
+    if (*end == 'k' || *end == 'K')
+    {
+        rate *= 1e3;
+        end++;
+    } else if (*end == 'm' || *end == 'M')
+    {
+        rate *= 1e6;
+        end++;
+    } else if (*end == 'g' || *end == 'G')
+    {
+        rate *= 1e9;
+        end++;
+    }
+
+    memset(bucket, 0, sizeof(*bucket));
+    bucket->rate = (uint64_t)(rate / 8.0);
+    bucket->burst = bucket->rate * SHAPER_DEFAULT_BURST_NS / 1000000000ULL;
+    if (*end == '/')
+    {
+        bucket->burst = strtoull(end + 1, &end, 10);
+    }
+    if (*end != '\0')
+    {
+        return 0;
+    }
+    if (bucket->burst < 2 * BUFFER_SIZE) /*A bucket must hold the largest frame, or that frame would wait forever*/
+    {
+        bucket->burst = 2 * BUFFER_SIZE;
+    }
+    bucket->tokens = (double)bucket->burst;
+    return 1;
+}
+
+
+int shaper_configure(const char *spec)
+{
+    char copy[1024];
+    if (strlen(spec) >= sizeof(copy))
+    {
+        printf("Shaper spec is too long\n");
+        return 0;
+    }
+    strcpy(copy, spec);
+
+    struct token_bucket dest_bucket = { 0 };
+    struct token_bucket dest_overrides[SHAPER_DESTINATIONS];
+    int overridden[SHAPER_DESTINATIONS] = { 0 };
+
+    char *saveptr;
+    for (char *field = strtok_r(copy, ",", &saveptr); field != NULL; field = strtok_r(NULL, ",", &saveptr))
+    {
+        char *value = strchr(field, '=');
+        if (value == NULL)
+        {
+            printf("Invalid shaper option %s\n", field);
+            return 0;
+        }
+        *value++ = '\0';
+
+        int ok = 1;
+        if (strcmp(field, "dest") == 0)
+        {
+            ok = parse_bucket(value, &dest_bucket);
+        } else if (strncmp(field, "dest.", 5) == 0)
+        {
+            int mip = atoi(field + 5);
+            ok = mip >= 0 && mip < SHAPER_DESTINATIONS && parse_bucket(value, &dest_overrides[mip]);
+            if (ok)
+            {
+                overridden[mip] = 1;
+            }
+        } else if (strcmp(field, "iface") == 0)
+        {
+            ok = parse_bucket(value, &default_iface_bucket);
+        } else if (strncmp(field, "iface.", 6) == 0 && num_iface_overrides < MAX_INTERFACES)
+        {
+            struct shaper_interface *override = &iface_overrides[num_iface_overrides];
+            override->ifindex = atoi(field + 6);
+            ok = override->ifindex > 0 && parse_bucket(value, &override->bucket);
+            if (ok)
+            {
+                num_iface_overrides++;
+            }
+        } else if (strcmp(field, "policy") == 0)
+        {
+            ok = strcmp(value, "queue") == 0 || strcmp(value, "drop") == 0;
+            drop_policy = strcmp(value, "drop") == 0;
+        } else if (strcmp(field, "limit") == 0)
+        {
+            queue_limit = atoi(value);
+            ok = queue_limit > 0;
+        } else
+        {
+            printf("Unknown shaper option %s\n", field);
+            return 0;
+        }
+        if (!ok)
+        {
+            printf("Invalid value %s for shaper option %s\n", value, field);
+            return 0;
+        }
+    }
+
+    for (int mip = 0; mip < SHAPER_DESTINATIONS; mip++)
+    {
+        destinations[mip].bucket = overridden[mip] ? dest_overrides[mip] : dest_bucket;
+        destinations[mip].head = destinations[mip].tail = -1;
+        enabled |= destinations[mip].bucket.rate > 0;
+    }
+    enabled |= default_iface_bucket.rate > 0;
+    for (int i = 0; i < num_iface_overrides; i++)
+    {
+        enabled |= iface_overrides[i].bucket.rate > 0;
+    }
+    return 1;
+}
+
+
+int shaper_enabled(void)
+{
+    return enabled;
+}
+
+
+/*Function to add the tokens since the bucket was last updated, up to the burst*/
+static void refill(struct token_bucket *bucket, uint64_t now_ns)
+{
+    if (bucket->rate == 0)
+    {
+        return;
+    }
+    if (now_ns > bucket->last_ns)
+    {
+        bucket->tokens += (double)(now_ns - bucket->last_ns) * (double)bucket->rate / 1e9;
+        if (bucket->tokens > (double)bucket->burst)
+        {
+            bucket->tokens = (double)bucket->burst;
+        }
+    }
+    bucket->last_ns = now_ns;
+}
+
+
+/*Function to check if a bucket has tokens for a frame, a bucket which is off always has*/
+static int has_tokens(const struct token_bucket *bucket, size_t len)
+{
+    return bucket->rate == 0 || bucket->tokens >= (double)len;
+}
+
+
+/*Function to find the time a bucket has tokens for a frame. Returns the monotonic time in nanoseconds.*/
+static uint64_t tokens_time(const struct token_bucket *bucket, size_t len)
+{
+    if (has_tokens(bucket, len))
+    {
+        return bucket->last_ns;
+    }
+    return bucket->last_ns + (uint64_t)(((double)len - bucket->tokens) * 1e9 / (double)bucket->rate) + 1;
+}
+
+
+/*Function to find the bucket of an interface, which gets a slot with the bucket of the spec the first time it is used.
+Returns a pointer to the bucket, or NULL if every slot is used.*/
+static struct token_bucket *interface_bucket(int ifindex)
+{
+    for (int i = 0; i < MAX_INTERFACES; i++)
+    {
+        if (interfaces[i].ifindex == ifindex)
+        {
+            return &interfaces[i].bucket;
+        }
+        if (interfaces[i].ifindex == 0)
+        {
+            interfaces[i].ifindex = ifindex;
+            interfaces[i].bucket = default_iface_bucket;
+            for (int j = 0; j < num_iface_overrides; j++)
+            {
+                if (iface_overrides[j].ifindex == ifindex)
+                {
+                    interfaces[i].bucket = iface_overrides[j].bucket;
+                }
+            }
+            return &interfaces[i].bucket;
+        }
+    }
+    return NULL;
+}
+
+
+/*Function to take the tokens of a frame from a bucket*/
+static void use_tokens(struct token_bucket *bucket, size_t len)
+{
+    if (bucket != NULL && bucket->rate > 0)
+    {
+        bucket->tokens -= (double)len;
+    }
+}
+
+
+/*Function to set up the pool, returns 0 if it could not be allocated*/
+static int setup(void)
+{
+    pool = malloc(SHAPER_POOL_FRAMES * sizeof(struct sched_frame));
+    if (pool == NULL)
+    {
+        perror("malloc");
+        return 0;
+    }
+    for (int i = 0; i < SHAPER_POOL_FRAMES; i++)
+    {
+        pool[i].next = i + 1 < SHAPER_POOL_FRAMES ? i + 1 : -1;
+    }
+    free_frames = 0;
+    return 1;
+}
+
+
+int shaper_admit(int tx_class, struct sockaddr_ll *iface, uint8_t *frame, size_t len, uint64_t now_ns)
+{
+    struct token_bucket *iface_bucket = interface_bucket(iface->sll_ifindex);
+    if (iface_bucket != NULL)
+    {
+        refill(iface_bucket, now_ns);
+    }
+    if (tx_class == SCHED_CONTROL || len < sizeof(struct ether_frame) + MIP_HEADER_SIZE)
+    {
+        use_tokens(iface_bucket, len);
+        return SHAPER_SEND;
+    }
+
+    /*The destination is the first byte of the mip header*/
+    struct shaper_destination *destination = &destinations[frame[sizeof(struct ether_frame)]];
+    refill(&destination->bucket, now_ns);
+
+    /*A destination which has frames waiting queues the new one behind them, so its frames stay in order*/
+    if (destination->length == 0 && has_tokens(&destination->bucket, len) && (iface_bucket == NULL || has_tokens(iface_bucket, len)))
+    {
+        use_tokens(&destination->bucket, len);
+        use_tokens(iface_bucket, len);
+        destination->stats.sent++;
+        return SHAPER_SEND;
+    }
+
+    if (drop_policy || destination->length >= queue_limit || len > BUFFER_SIZE || (pool == NULL && !setup()) || free_frames == -1)
+    {
+        destination->stats.dropped++;
+        return SHAPER_DROPPED;
+    }
+
+    int index = free_frames;
+    free_frames = pool[index].next;
+    struct sched_frame *entry = &pool[index];
+    entry->queued_ns = now_ns;
+    entry->iface = *iface;
+    entry->tx_class = tx_class;
+    entry->next = -1;
+    entry->len = len;
+    memcpy(entry->frame, frame, len);
+
+    if (destination->tail == -1)
+    {
+        destination->head = index;
+    } else
+    {
+        pool[destination->tail].next = index;
+    }
+    destination->tail = index;
+    destination->length++;
+    destination->stats.queued++;
+    queued_frames++;
+    return SHAPER_QUEUED;
+}
+
+
+struct sched_frame *shaper_dequeue(uint64_t now_ns)
+{
+    if (queued_frames == 0)
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < SHAPER_DESTINATIONS; i++)
+    {
+        int mip = (next_destination + i) % SHAPER_DESTINATIONS;
+        struct shaper_destination *destination = &destinations[mip];
+        if (destination->length == 0)
+        {
+            continue;
+        }
+
+        int index = destination->head;
+        struct sched_frame *entry = &pool[index];
+        struct token_bucket *iface_bucket = interface_bucket(entry->iface.sll_ifindex);
+        refill(&destination->bucket, now_ns);
+        if (iface_bucket != NULL)
+        {
+            refill(iface_bucket, now_ns);
+        }
+        if (!has_tokens(&destination->bucket, entry->len) || (iface_bucket != NULL && !has_tokens(iface_bucket, entry->len)))
+        {
+            continue;
+        }
+
+        use_tokens(&destination->bucket, entry->len);
+        use_tokens(iface_bucket, entry->len);
+        destination->stats.sent++;
+        stats_latency_add(&destination->stats.wait, now_ns - entry->queued_ns);
+
+        destination->head = entry->next;
+        if (destination->head == -1)
+        {
+            destination->tail = -1;
+        }
+        destination->length--;
+        queued_frames--;
+        entry->next = free_frames;
+        free_frames = index;
+        next_destination = (mip + 1) % SHAPER_DESTINATIONS; /*The next destination goes first the next time*/
+        return entry;
+    }
+    return NULL;
+}
+
+
+uint64_t shaper_next_deadline(void)
+{
+    uint64_t next = 0;
+    for (int mip = 0; queued_frames > 0 && mip < SHAPER_DESTINATIONS; mip++)
+    {
+        struct shaper_destination *destination = &destinations[mip];
+        if (destination->length == 0)
+        {
+            continue;
+        }
+        struct sched_frame *entry = &pool[destination->head];
+        uint64_t deadline = tokens_time(&destination->bucket, entry->len);
+        struct token_bucket *iface_bucket = interface_bucket(entry->iface.sll_ifindex);
+        if (iface_bucket != NULL && tokens_time(iface_bucket, entry->len) > deadline)
+        {
+            deadline = tokens_time(iface_bucket, entry->len);
+        }
+        if (next == 0 || deadline < next)
+        {
+            next = deadline;
+        }
+    }
+    return next;
+}
+
+
+int shaper_get_destination(int mip, const struct token_bucket **bucket, const struct shaper_stats **stats)
+{
+    *bucket = &destinations[mip].bucket;
+    *stats = &destinations[mip].stats;
+    return destinations[mip].length;
+}
+
+
+int shaper_get_interface(int slot, int *ifindex, const struct token_bucket **bucket)
+{
+    *ifindex = interfaces[slot].ifindex;
+    *bucket = &interfaces[slot].bucket;
+    return interfaces[slot].ifindex != 0;
+}
+
+
+const char *shaper_policy(void)
+{
+    return drop_policy ? "drop" : "queue";
+}
+
+
+void shaper_reset_stats(void)
+{
+    for (int mip = 0; mip < SHAPER_DESTINATIONS; mip++)
+    {
+        memset(&destinations[mip].stats, 0, sizeof(destinations[mip].stats));
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/if_packet.h>
+#include "sched.h"
+#include "stats.h"
+
+/*Traffic shaper of the link layer (see link.h), in front of the transmit scheduler (see sched.h).
+Every destination MIP address and every interface can have a token bucket, a frame is sent when the bucket of its destination
+and the bucket of its interface both have tokens for it, so the interface bucket caps the sum of the destinations on it.
+A frame without tokens is queued or dropped depending on the policy. Queued frames of a destination are sent in order, paced by
+the timer of mipd to the time the buckets have refilled, and the destinations waiting for the same interface take turns.
+MIP-ARP and keepalive frames are not shaped, but use the tokens of their interface, so the buckets hold back the data frames after them.
+
+The shaper is set with mipd -s <spec>, a comma separated list of:
+  dest=<rate>[/<burst>]            bucket of every destination
+  dest.<mip>=<rate>[/<burst>]      bucket of one destination, instead of the one above
+  iface=<rate>[/<burst>]           bucket of every interface
+  iface.<ifindex>=<rate>[/<burst>] bucket of one interface, with the ifindex shown by the stats command
+  policy=queue|drop                queue (default) or drop the frames which have no tokens
+  limit=<frames>                   queue limit of each destination (default 256)
+The rate is in bits per second with an optional k, m or g suffix, e.g. 10m, and the burst in bytes (default 10 ms at the rate,
+at least two frames). A rate of 0 turns the bucket off.*/
+
+/*Default queue limit of each destination, and the number of frames which may wait for all destinations together*/
+#define SHAPER_DEFAULT_LIMIT 256
+#define SHAPER_POOL_FRAMES 4096
+
+/*Default burst as the time it takes to send it at the rate of the bucket*/
+#define SHAPER_DEFAULT_BURST_NS 10000000ULL
+
+/*Return values of shaper_admit()*/
+#define SHAPER_SEND 0
+#define SHAPER_QUEUED 1
+#define SHAPER_DROPPED 2
+
+/*Struct for a token bucket*/
+struct token_bucket {
+    uint64_t rate;    /*Bytes per second, 0 if the bucket is off*/
+    uint64_t burst;   /*Most tokens the bucket holds, in bytes*/
+    double tokens;    /*Tokens at last_ns, below 0 if unshaped frames have used more than there were*/
+    uint64_t last_ns;
+};
+
+/*Struct for the counters of a destination*/
+struct shaper_stats {
+    uint64_t sent;    /*Frames sent, straight away or after waiting*/
+    uint64_t queued;  /*Frames which had to wait for tokens*/
+    uint64_t dropped; /*Frames dropped by the drop policy or because the queue was full*/
+    struct latency_stats wait; /*Time the queued frames waited*/
+};
+
+
+/*Function to set up the shaper from a spec as described above.
+Takes the spec as parameter. Returns 1 on success and 0 if the spec is invalid.*/
+int shaper_configure(const char *spec);
+
+
+/*Function to check if any bucket is configured. Returns 1 if one is, and 0 otherwise.*/
+int shaper_enabled(void);
+
+
+/*Function to let a frame through the shaper. The frame uses the tokens of its buckets if it is sent,
+and is copied into the queue of its destination if it is queued.
+Takes the class of the frame in the transmit scheduler, the interface, the frame, its length and the current time as parameters.
+Returns SHAPER_SEND if the frame should be sent now, SHAPER_QUEUED if it waits, or SHAPER_DROPPED if it was dropped.*/
+int shaper_admit(int tx_class, struct sockaddr_ll *iface, uint8_t *frame, size_t len, uint64_t now_ns);
+
+
+/*Function to take the next queued frame whose buckets have refilled, using its tokens.
+The frame is valid until the next call of shaper_admit().
+Takes the current time as parameter. Returns a pointer to the frame, or NULL if no frame may be sent yet.*/
+struct sched_frame *shaper_dequeue(uint64_t now_ns);
+
+
+/*Function to get the time the next queued frame may be sent.
+Returns the monotonic time in nanoseconds, or 0 if no frame is queued.*/
+uint64_t shaper_next_deadline(void);
+
+
+/*Function to get a destination for the stats command. Takes the MIP address and pointers to set to its bucket and counters as parameters.
+Returns the number of frames queued for the destination.*/
+int shaper_get_destination(int mip, const struct token_bucket **bucket, const struct shaper_stats **stats);
+
+
+/*Function to get an interface for the stats command, interfaces get a slot the first time a frame is sent on them.
+Takes the slot, and pointers to set to the ifindex and bucket of the interface as parameters.
+Returns 1 if the slot is used, and 0 otherwise.*/
+int shaper_get_interface(int slot, int *ifindex, const struct token_bucket **bucket);
+
+
+/*Function to get the policy for frames without tokens. Returns "queue" or "drop".*/
+const char *shaper_policy(void);
+
+
+/*Function to set the counters of every destination to 0, called by stats_reset().*/
+void shaper_reset_stats(void);
+
+#endif
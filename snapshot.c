@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "snapshot.h"
+#include "mip_arp.h"
+#include "stats.h"
+#include "utils.h"
+
+/*Size of the file, room for a full cache*/
+#define SNAPSHOT_FILE_SIZE (sizeof(struct snapshot_header) + MAX_ARP_CACHE_SIZE * sizeof(struct snapshot_entry))
+
+static int file_fd = -1;
+static uint8_t *file_map = NULL;
+static uint8_t mip_address;
+static int loaded = 0;
+static uint64_t next_save_ns = 0;
+
+
+/*Function to get the header of the mapped file*/
+static struct snapshot_header *header(void)
+{
+    return (struct snapshot_header *)file_map;
+}
+
+
+/*Function to get the entries of the mapped file*/
+static struct snapshot_entry *entries(void)
+{
+    return (struct snapshot_entry *)(file_map + sizeof(struct snapshot_header));
+}
+
+
+/*Function to check if the mapped file holds a complete snapshot of this version for our MIP address*/
+static int valid(void)
+{
+    const struct snapshot_header *head = header();
+    return head->magic == SNAPSHOT_MAGIC && head->version == SNAPSHOT_VERSION && head->entry_size == sizeof(struct snapshot_entry) &&
+           head->sequence % 2 == 0 && head->count <= MAX_ARP_CACHE_SIZE && head->mip_address == mip_address;
+}
+
+
+int snapshot_open(const char *path, uint8_t my_mip_address)
+{
+    file_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (file_fd == -1)
+    {
+        perror("snapshot: open");
+        return 0;
+    }
+    if (ftruncate(file_fd, SNAPSHOT_FILE_SIZE) == -1)
+    {
+        perror("snapshot: ftruncate");
+        close(file_fd);
+        file_fd = -1;
+        return 0;
+    }
+    file_map = mmap(NULL, SNAPSHOT_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file_fd, 0);
+    if (file_map == MAP_FAILED)
+    {
+        perror("snapshot: mmap");
+        file_map = NULL;
+        close(file_fd);
+        file_fd = -1;
+        return 0;
+    }
+    mip_address = my_mip_address;
+    return 1;
+}
+
+
+int snapshot_load(struct interface_info *if_list)
+{
+    if (file_map == NULL || loaded)
+    {
+        return 0;
+    }
+    loaded = 1;
+    next_save_ns = get_time_ns() + SNAPSHOT_INTERVAL_NS;
+    if (!valid())
+    {
+        return 0;
+    }
+
+    int count = 0;
+    for (int i = 0; i < header()->count; i++)
+    {
+        struct snapshot_entry *entry = &entries()[i];
+        if (find_interface_by_mac(if_list, entry->src_mac_address) == NULL) /*The interface is gone, or has a new mac address*/
+        {
+            continue;
+        }
+        int known = arp_cache_count;
+        struct arp_entry *path = add_to_arp_cache(entry->mip_address, entry->mac_address, entry->src_mac_address);
+        if (path != NULL && arp_cache_count > known) /*A path handed over by an upgrade is already verified*/
+        {
+            path->unverified = 1;
+            path->verify_deadline_ns = 0;
+            path->last_heard_ns = 0; /*Not heard since the restart, so it is not fresh enough for proxy answers*/
+            count++;
+        }
+    }
+    STATS_ADD(arp_snapshot_loaded, count);
+    printf("Loaded %d of %d ARP entries from the snapshot, saved %lu s ago.\n", count, header()->count,
+           (unsigned long)(time(NULL) - header()->saved_s));
+    return count;
+}
+
+
+/*Function to write the cache to the file if it differs from what the file holds*/
+static void save(void)
+{
+    struct snapshot_entry fresh[MAX_ARP_CACHE_SIZE];
+    memset(fresh, 0, sizeof(fresh));
+    for (int i = 0; i < arp_cache_count; i++)
+    {
+        fresh[i].mip_address = arp_list[i].mip_address;
+        memcpy(fresh[i].mac_address, arp_list[i].mac_address, 6);
+        memcpy(fresh[i].src_mac_address, arp_list[i].src_mac_address, 6);
+    }
+    struct snapshot_header *head = header();
+    if (valid() && head->count == arp_cache_count && memcmp(entries(), fresh, arp_cache_count * sizeof(struct snapshot_entry)) == 0)
+    {
+        return; /*Unchanged, so the pages of the file stay clean*/
+    }
+
+    /*The sequence number is odd while the entries are written, so a reader never takes a half written snapshot*/
+    head->sequence |= 1;
+    atomic_thread_fence(memory_order_release);
+    head->magic = SNAPSHOT_MAGIC;
+    head->version = SNAPSHOT_VERSION;
+    head->entry_size = sizeof(struct snapshot_entry);
+    head->mip_address = mip_address;
+    head->count = arp_cache_count;
+    head->saved_s = time(NULL);
+    memcpy(entries(), fresh, sizeof(fresh));
+    atomic_thread_fence(memory_order_release);
+    head->sequence++;
+}
+
+
+void snapshot_handle_timers(uint64_t now_ns)
+{
+    if (file_map == NULL || !loaded)
+    {
+        return;
+    }
+    expire_unverified_arp_paths(now_ns);
+    if (now_ns >= next_save_ns)
+    {
+        save();
+        next_save_ns = now_ns + SNAPSHOT_INTERVAL_NS;
+    }
+}
+
+
+uint64_t snapshot_next_deadline(void)
+{
+    if (file_map == NULL)
+    {
+        return 0;
+    }
+    if (!loaded)
+    {
+        return 1;
+    }
+    uint64_t verify = unverified_arp_deadline();
+    return verify != 0 && verify < next_save_ns ? verify : next_save_ns;
+}
+
+
+void snapshot_close(void)
+{
+    if (file_map == NULL)
+    {
+        return;
+    }
+    if (loaded)
+    {
+        save();
+    }
+    munmap(file_map, SNAPSHOT_FILE_SIZE);
+    close(file_fd);
+    file_map = NULL;
+    file_fd = -1;
+}
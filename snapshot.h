@@ -0,0 +1,68 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "local_interfaces.h"
+
+/*Snapshot of the ARP cache for warm restarts, turned on with mipd -S <path>.
+
+The paths of the cache are written to a memory-mapped file every SNAPSHOT_INTERVAL_NS when they have changed, and when mipd exits.
+When mipd starts, the paths of the snapshot are loaded as unverified if the snapshot is for our MIP address, and the interface of
+the path is still ours. An unverified path is used at once, so the first SDU to a neighbour is sent without waiting for ARP,
+and it is revalidated lazily: its first use sends a unicast ARP request to the cached mac address, and the path is verified by the
+response or any frame on it. If nothing is heard within ARP_VERIFY_TIMEOUT_NS the path is removed, and the next SDU asks with a broadcast.
+
+The file is a struct snapshot_header followed by MAX_ARP_CACHE_SIZE struct snapshot_entry. The sequence number of the header is odd
+while the entries are being written, so a snapshot which a crash left half written is ignored.*/
+
+/*How often the snapshot is written if the cache has changed*/
+#define SNAPSHOT_INTERVAL_NS (1000ULL * 1000000ULL)
+
+#define SNAPSHOT_MAGIC 0x4d495041 /*"MIPA"*/
+#define SNAPSHOT_VERSION 1
+
+/*Struct for the header of the snapshot file, in host byte order since the file is only read on the same host*/
+struct snapshot_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;  /*sizeof(struct snapshot_entry), so a changed layout is not read as the old one*/
+    uint32_t sequence;    /*Odd while the entries are written*/
+    uint16_t count;
+    uint8_t mip_address;  /*Our MIP address when the snapshot was written*/
+    uint8_t reserved;
+    uint64_t saved_s;     /*Wall clock time of the last write, in seconds since the epoch*/
+} __attribute__((packed));
+
+/*Struct for a path in the snapshot file*/
+struct snapshot_entry {
+    uint8_t mip_address;
+    uint8_t mac_address[6];
+    uint8_t src_mac_address[6];
+    uint8_t reserved;
+} __attribute__((packed));
+
+
+/*Function to open the snapshot file, creating it if it does not exist, and map it.
+Takes the path of the file and our MIP address as parameters. Returns 1 on success and 0 on failure.*/
+int snapshot_open(const char *path, uint8_t my_mip_address);
+
+
+/*Function to load the paths of the snapshot into the ARP cache as unverified, called once the interfaces are known.
+Takes a pointer to interface_info as parameter. Returns the number of paths loaded.*/
+int snapshot_load(struct interface_info *if_list);
+
+
+/*Function to write the snapshot if it is due, and remove the unverified paths whose revalidation timed out.
+Takes the current time as parameter.*/
+void snapshot_handle_timers(uint64_t now_ns);
+
+
+/*Function to get the time the next snapshot or revalidation timeout is due.
+Returns the monotonic time in nanoseconds, 1 if the snapshot is still to be loaded, or 0 if there is nothing to do.*/
+uint64_t snapshot_next_deadline(void);
+
+
+/*Function to write the snapshot, unmap and close the file.*/
+void snapshot_close(void);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "stats.h"
+#include "mip_arp.h"
+#include "sched.h"
+#include "shaper.h"
+#include "keepalive.h"
+#include "upgrade.h"
+#include "trace.h"
+#include "utils.h"
+
+__thread struct mip_stats *thread_stats = NULL;
+
+struct client_stats client_stats[STATS_MAX_CLIENTS] = {
+    [0 ... STATS_MAX_CLIENTS - 1] = { -1, 0 }
+};
+
+/*The counters of every thread which has counted*/
+static struct mip_stats *blocks[STATS_MAX_THREADS];
+static int block_count = 0;
+static pthread_mutex_t block_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*Time the first thread started counting, for the uptime*/
+static uint64_t start_ns = 0;
+
+
+struct mip_stats *stats_register(void)
+{
+    pthread_mutex_lock(&block_lock);
+    if (block_count < STATS_MAX_THREADS)
+    {
+        struct mip_stats *block = aligned_alloc(64, sizeof(struct mip_stats));
+        if (block != NULL)
+        {
+            memset(block, 0, sizeof(*block));
+            blocks[block_count++] = block;
+            thread_stats = block;
+        }
+    }
+    if (start_ns == 0)
+    {
+        start_ns = get_real_time_ns();
+    }
+    pthread_mutex_unlock(&block_lock);
+    return thread_stats;
+}
+
+
+void stats_count_frame(int ifindex, size_t len, int received)
+{
+    struct mip_stats *stats = thread_stats != NULL ? thread_stats : stats_register();
+    if (stats == NULL)
+    {
+        return;
+    }
+    if (ifindex < 0 || ifindex >= STATS_MAX_IFINDEX)
+    {
+        ifindex = STATS_MAX_IFINDEX - 1;
+    }
+    struct interface_stats *iface = &stats->interfaces[ifindex];
+    if (received)
+    {
+        iface->rx_frames++;
+        iface->rx_bytes += len;
+    } else
+    {
+        iface->tx_frames++;
+        iface->tx_bytes += len;
+    }
+}
+
+
+void stats_count_batch(int events)
+{
+    int bucket = 0;
+    while (events > 1 && bucket < STATS_BATCH_BUCKETS - 1)
+    {
+        events >>= 1;
+        bucket++;
+    }
+    STATS_INC(loop_iterations);
+    STATS_INC(batch_sizes[bucket]);
+}
+
+
+void stats_count_latency(int stage, uint64_t ns)
+{
+    struct mip_stats *stats = thread_stats != NULL ? thread_stats : stats_register();
+    if (stats == NULL || stage < 0 || stage >= STATS_LATENCY_STAGES)
+    {
+        return;
+    }
+    stats_latency_add(&stats->latency[stage], ns);
+}
+
+
+void stats_latency_add(struct latency_stats *latency, uint64_t ns)
+{
+    int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    if (bucket >= STATS_LATENCY_BUCKETS)
+    {
+        bucket = STATS_LATENCY_BUCKETS - 1;
+    }
+    latency->count++;
+    latency->total_ns += ns;
+    latency->buckets[bucket]++;
+}
+
+
+void stats_sum(struct mip_stats *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    pthread_mutex_lock(&block_lock);
+    for (int b = 0; b < block_count; b++)
+    {
+        /*Every field is a uint64_t, so the blocks are added up as arrays*/
+        const uint64_t *from = (const uint64_t *)blocks[b];
+        uint64_t *to = (uint64_t *)sum;
+        for (size_t i = 0; i < sizeof(struct mip_stats) / sizeof(uint64_t); i++)
+        {
+            to[i] += from[i];
+        }
+    }
+    pthread_mutex_unlock(&block_lock);
+}
+
+
+void stats_reset(void)
+{
+    pthread_mutex_lock(&block_lock);
+    for (int b = 0; b < block_count; b++)
+    {
+        memset(blocks[b], 0, sizeof(struct mip_stats));
+    }
+    start_ns = get_real_time_ns();
+    pthread_mutex_unlock(&block_lock);
+    sched_reset_stats();
+    shaper_reset_stats();
+    keepalive_reset_stats();
+}
+
+
+/*Function to append to the JSON buffer, keeping track of the length even when the buffer is full*/
+static void append(char *buffer, size_t buffer_size, size_t *len, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void append(char *buffer, size_t buffer_size, size_t *len, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (*len < buffer_size)
+    {
+        *len += vsnprintf(buffer + *len, buffer_size - *len, format, args);
+    }
+    va_end(args);
+}
+
+
+/*Function to find the bucket a percentile of a latency histogram falls in. Returns the upper bound of the bucket in nanoseconds.*/
+static uint64_t latency_percentile(const struct latency_stats *latency, double percentile)
+{
+    uint64_t wanted = (uint64_t)(latency->count * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+    {
+        seen += latency->buckets[i];
+        if (seen > wanted)
+        {
+            return (2ULL << i) - 1;
+        }
+    }
+    return (2ULL << (STATS_LATENCY_BUCKETS - 1)) - 1;
+}
+
+
+/*Function to write the time frames waited in a queue as a "wait" object, with percentiles if any frame waited*/
+static void append_wait(char *buffer, size_t buffer_size, size_t *len, const struct latency_stats *wait)
+{
+    append(buffer, buffer_size, len, "\"wait\":{\"count\":%lu", (unsigned long)wait->count);
+    if (wait->count > 0)
+    {
+        append(buffer, buffer_size, len, ",\"mean_ns\":%lu,\"p50_ns\":%lu,\"p99_ns\":%lu", (unsigned long)(wait->total_ns / wait->count),
+               (unsigned long)latency_percentile(wait, 50.0), (unsigned long)latency_percentile(wait, 99.0));
+    }
+    append(buffer, buffer_size, len, "}");
+}
+
+
+int stats_to_json(char *buffer, size_t buffer_size)
+{
+    struct mip_stats sum;
+    stats_sum(&sum);
+    size_t len = 0;
+
+    append(buffer, buffer_size, &len, "{\"uptime_s\":%.3f,\"interfaces\":[", start_ns ? (get_real_time_ns() - start_ns) / 1e9 : 0.0);
+    int first = 1;
+    for (int i = 0; i < STATS_MAX_IFINDEX; i++)
+    {
+        struct interface_stats *iface = &sum.interfaces[i];
+        if (iface->rx_frames == 0 && iface->tx_frames == 0)
+        {
+            continue;
+        }
+        append(buffer, buffer_size, &len, "%s{\"ifindex\":%d,\"rx_frames\":%lu,\"rx_bytes\":%lu,\"tx_frames\":%lu,\"tx_bytes\":%lu}",
+               first ? "" : ",", i, (unsigned long)iface->rx_frames, (unsigned long)iface->rx_bytes,
+               (unsigned long)iface->tx_frames, (unsigned long)iface->tx_bytes);
+        first = 0;
+    }
+
+    append(buffer, buffer_size, &len, "],\"arp\":{\"requests_sent\":%lu,\"requests_received\":%lu,\"responses_sent\":%lu,"
+           "\"responses_received\":%lu,\"hits\":%lu,\"misses\":%lu,\"flushes\":%lu,"
+           "\"announcements_sent\":%lu,\"announcements_received\":%lu,\"proxy_responses_sent\":%lu,\"proxy_responses_received\":%lu,"
+           "\"snapshot_loaded\":%lu,\"snapshot_revalidations\":%lu,\"snapshot_verified\":%lu,\"snapshot_expired\":%lu,"
+           "\"path_failovers\":%lu,\"entries\":%d},",
+           (unsigned long)sum.arp_requests_sent, (unsigned long)sum.arp_requests_received, (unsigned long)sum.arp_responses_sent,
+           (unsigned long)sum.arp_responses_received, (unsigned long)sum.arp_hits, (unsigned long)sum.arp_misses,
+           (unsigned long)sum.arp_flushes, (unsigned long)sum.arp_announcements_sent, (unsigned long)sum.arp_announcements_received,
+           (unsigned long)sum.arp_proxy_responses_sent, (unsigned long)sum.arp_proxy_responses_received,
+           (unsigned long)sum.arp_snapshot_loaded, (unsigned long)sum.arp_snapshot_revalidations,
+           (unsigned long)sum.arp_snapshot_verified, (unsigned long)sum.arp_snapshot_expired,
+           (unsigned long)sum.arp_path_failovers, arp_cache_count);
+    append(buffer, buffer_size, &len, "\"pending\":{\"depth\":%d,\"drops_full\":%lu,\"drops_timeout\":%lu},",
+           pending_queue_length(), (unsigned long)sum.pending_drops_full, (unsigned long)sum.pending_drops_timeout);
+
+    append(buffer, buffer_size, &len, "\"broadcast\":{\"sent\":%lu,\"frames\":%lu,\"batched_frames\":%lu,\"received\":%lu,"
+           "\"duplicates\":%lu,\"drops\":%lu},",
+           (unsigned long)sum.broadcasts_sent, (unsigned long)sum.broadcast_frames, (unsigned long)sum.link_batched_frames,
+           (unsigned long)sum.broadcasts_received, (unsigned long)sum.broadcast_duplicates, (unsigned long)sum.broadcast_drops);
+
+    append(buffer, buffer_size, &len, "\"application\":{\"messages_in\":%lu,\"messages_out\":%lu,\"drops\":%lu,"
+           "\"delivery_queued\":%lu,\"delivery_drops\":%lu,\"clients\":[",
+           (unsigned long)sum.app_messages_in, (unsigned long)sum.app_messages_out, (unsigned long)sum.app_drops,
+           (unsigned long)sum.app_delivery_queued, (unsigned long)sum.app_delivery_drops);
+    first = 1;
+    for (int i = 0; i < STATS_MAX_CLIENTS; i++)
+    {
+        if (client_stats[i].fd == -1)
+        {
+            continue;
+        }
+        append(buffer, buffer_size, &len, "%s{\"fd\":%d,\"queued_bytes\":%d,\"delivery_bytes\":%d,\"sdu_types\":[", first ? "" : ",",
+               client_stats[i].fd, client_stats[i].queued_bytes, client_stats[i].delivery_bytes);
+        int first_type = 1;
+        for (int t = 0; t < SDU_TYPES; t++)
+        {
+            if (client_stats[i].sdu_types & (1 << t))
+            {
+                append(buffer, buffer_size, &len, "%s%d", first_type ? "" : ",", t);
+                first_type = 0;
+            }
+        }
+        append(buffer, buffer_size, &len, "]}");
+        first = 0;
+    }
+
+    append(buffer, buffer_size, &len, "]},\"loop\":{\"iterations\":%lu,\"busy_poll_hits\":%lu,\"busy_poll_fallbacks\":%lu,\"batch_sizes\":{",
+           (unsigned long)sum.loop_iterations, (unsigned long)sum.busy_poll_hits, (unsigned long)sum.busy_poll_fallbacks);
+    for (int i = 0; i < STATS_BATCH_BUCKETS; i++)
+    {
+        append(buffer, buffer_size, &len, "%s\"%d\":%lu", i ? "," : "", 1 << i, (unsigned long)sum.batch_sizes[i]);
+    }
+    append(buffer, buffer_size, &len, "}},\"latency\":{");
+
+    /*Every stage has its count, mean and percentiles, and the histogram as the upper bound of each non empty bucket in ns*/
+    static const char *const stage_names[STATS_LATENCY_STAGES] = { "kernel_rx", "dispatch", "arp", "tx", "unix" };
+    for (int s = 0; s < STATS_LATENCY_STAGES; s++)
+    {
+        struct latency_stats *latency = &sum.latency[s];
+        append(buffer, buffer_size, &len, "%s\"%s\":{\"count\":%lu", s ? "," : "", stage_names[s], (unsigned long)latency->count);
+        if (latency->count > 0)
+        {
+            append(buffer, buffer_size, &len, ",\"mean_ns\":%lu,\"p50_ns\":%lu,\"p90_ns\":%lu,\"p99_ns\":%lu",
+                   (unsigned long)(latency->total_ns / latency->count), (unsigned long)latency_percentile(latency, 50.0),
+                   (unsigned long)latency_percentile(latency, 90.0), (unsigned long)latency_percentile(latency, 99.0));
+        }
+        append(buffer, buffer_size, &len, ",\"histogram\":{");
+        first = 1;
+        for (int i = 0; i < STATS_LATENCY_BUCKETS; i++)
+        {
+            if (latency->buckets[i] == 0)
+            {
+                continue;
+            }
+            append(buffer, buffer_size, &len, "%s\"%lu\":%lu", first ? "" : ",", (unsigned long)((2ULL << i) - 1),
+                   (unsigned long)latency->buckets[i]);
+            first = 0;
+        }
+        append(buffer, buffer_size, &len, "}}");
+    }
+
+    /*The transmit scheduler, with a class for control frames, one for the daemon and one per application connection*/
+    append(buffer, buffer_size, &len, "},\"tx_classes\":[");
+    for (int c = 0; c < SCHED_CLASSES; c++)
+    {
+        const struct sched_class_stats *tx = sched_get_stats(c);
+        if (c >= SCHED_FIRST_CLIENT && client_stats[c - SCHED_FIRST_CLIENT].fd == -1 && tx->sent == 0 && tx->dropped == 0)
+        {
+            continue;
+        }
+        append(buffer, buffer_size, &len, "%s{\"class\":", c ? "," : "");
+        if (c >= SCHED_FIRST_CLIENT)
+        {
+            append(buffer, buffer_size, &len, "\"client\",\"fd\":%d", client_stats[c - SCHED_FIRST_CLIENT].fd);
+        } else
+        {
+            append(buffer, buffer_size, &len, "\"%s\"", c == SCHED_CONTROL ? "control" : "daemon");
+        }
+        append(buffer, buffer_size, &len, ",\"depth\":%d,\"limit\":%d,\"sent\":%lu,\"queued\":%lu,\"dropped\":%lu,",
+               sched_queue_length(c), sched_queue_limit(c), (unsigned long)tx->sent, (unsigned long)tx->queued, (unsigned long)tx->dropped);
+        append_wait(buffer, buffer_size, &len, &tx->wait);
+        append(buffer, buffer_size, &len, "}");
+    }
+
+    /*The shaper, with the destinations and interfaces which have a bucket or have sent through it*/
+    append(buffer, buffer_size, &len, "],\"shaper\":{\"enabled\":%s,\"policy\":\"%s\",\"destinations\":[",
+           shaper_enabled() ? "true" : "false", shaper_policy());
+    first = 1;
+    for (int mip = 0; shaper_enabled() && mip < 256; mip++)
+    {
+        const struct token_bucket *bucket;
+        const struct shaper_stats *shaped;
+        int depth = shaper_get_destination(mip, &bucket, &shaped);
+        if (shaped->sent == 0 && shaped->dropped == 0 && depth == 0)
+        {
+            continue;
+        }
+        append(buffer, buffer_size, &len, "%s{\"mip\":%d,\"rate_bps\":%lu,\"burst\":%lu,\"tokens\":%.0f,\"depth\":%d,"
+               "\"sent\":%lu,\"queued\":%lu,\"dropped\":%lu,", first ? "" : ",", mip, (unsigned long)(bucket->rate * 8),
+               (unsigned long)bucket->burst, bucket->tokens, depth, (unsigned long)shaped->sent, (unsigned long)shaped->queued,
+               (unsigned long)shaped->dropped);
+        append_wait(buffer, buffer_size, &len, &shaped->wait);
+        append(buffer, buffer_size, &len, "}");
+        first = 0;
+    }
+    append(buffer, buffer_size, &len, "],\"interfaces\":[");
+    for (int slot = 0; slot < MAX_INTERFACES; slot++)
+    {
+        int ifindex;
+        const struct token_bucket *bucket;
+        if (!shaper_get_interface(slot, &ifindex, &bucket))
+        {
+            break;
+        }
+        append(buffer, buffer_size, &len, "%s{\"ifindex\":%d,\"rate_bps\":%lu,\"burst\":%lu,\"tokens\":%.0f}", slot ? "," : "",
+               ifindex, (unsigned long)(bucket->rate * 8), (unsigned long)bucket->burst, bucket->tokens);
+    }
+
+    /*Liveness detection, with the state of every neighbour which has been in the ARP cache*/
+    uint64_t interval_ns;
+    int misses;
+    keepalive_get_config(&interval_ns, &misses);
+    const struct keepalive_stats *alive = keepalive_get_stats();
+    append(buffer, buffer_size, &len, "]},\"keepalive\":{\"enabled\":%s,\"interval_us\":%lu,\"misses\":%d,\"probes_sent\":%lu,"
+           "\"probes_received\":%lu,\"echoes_sent\":%lu,\"echoes_received\":%lu,\"neighbours_down\":%lu,\"neighbours_up\":%lu,"
+           "\"paths_down\":%lu,\"pending_failed\":%lu,\"fast_failed\":%lu,\"detection\":{\"count\":%lu", keepalive_enabled() ? "true" : "false",
+           (unsigned long)(interval_ns / 1000), misses, (unsigned long)alive->probes_sent, (unsigned long)alive->probes_received,
+           (unsigned long)alive->echoes_sent, (unsigned long)alive->echoes_received, (unsigned long)alive->neighbours_down,
+           (unsigned long)alive->neighbours_up, (unsigned long)alive->paths_down, (unsigned long)alive->pending_failed, (unsigned long)alive->fast_failed,
+           (unsigned long)alive->detection.count);
+    if (alive->detection.count > 0)
+    {
+        append(buffer, buffer_size, &len, ",\"mean_us\":%lu,\"p99_us\":%lu", (unsigned long)(alive->detection.total_ns / alive->detection.count / 1000),
+               (unsigned long)(latency_percentile(&alive->detection, 99.0) / 1000));
+    }
+    append(buffer, buffer_size, &len, "},\"neighbours\":[");
+    first = 1;
+    uint64_t now = get_time_ns();
+    for (int mip = 0; keepalive_enabled() && mip < 256; mip++)
+    {
+        const struct neighbour *neighbour = keepalive_get_neighbour(mip);
+        if (neighbour->state == NEIGHBOUR_UNKNOWN)
+        {
+            continue;
+        }
+        append(buffer, buffer_size, &len, "%s{\"mip\":%d,\"state\":\"%s\",\"silent_us\":%lu,\"down_count\":%lu}", first ? "" : ",", mip,
+               neighbour->state == NEIGHBOUR_UP ? "up" : "down", (unsigned long)((now - neighbour->last_heard_ns) / 1000),
+               (unsigned long)neighbour->down_count);
+        first = 0;
+    }
+    uint32_t generation;
+    uint64_t gap_ns;
+    upgrade_get_result(&generation, &gap_ns);
+    append(buffer, buffer_size, &len, "]},\"upgrade\":{\"generation\":%u,\"gap_us\":%.1f},\"trace_dropped\":%lu}\n", generation,
+           gap_ns / 1000.0, (unsigned long)trace_dropped());
+
+    return len < buffer_size ? (int)len : (int)buffer_size - 1;
+}
@@ -0,0 +1,155 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*Counters of mipd, read as JSON with the stats command of the control socket (see control.h).
+
+Every thread which counts gets its own block of counters, aligned to a cache line so no two threads write the same line.
+A counter is only written by its own thread, so an update is a plain load and store without a locked instruction.
+The stats command adds up the blocks of every thread.*/
+
+/*Counters are kept per ifindex up to this value, higher ifindexes share the last entry*/
+#define STATS_MAX_IFINDEX 256
+
+/*Number of buckets of the batch size histogram, bucket i counts batches of 2^i to 2^(i+1)-1 events*/
+#define STATS_BATCH_BUCKETS 8
+
+/*Max number of application clients we keep queue depths for*/
+#define STATS_MAX_CLIENTS 16
+
+/*Max number of threads which can count*/
+#define STATS_MAX_THREADS 8
+
+/*Number of buckets of a latency histogram, bucket i counts latencies of 2^i to 2^(i+1)-1 nanoseconds, the last one everything above*/
+#define STATS_LATENCY_BUCKETS 32
+
+/*Stages of the hot path we measure the latency of. Dispatch covers all of handle_received_pdu(), so it includes the TX and UNIX stages
+of the frames it sends or delivers. Kernel RX needs SO_TIMESTAMPING, which the real and emulated link layers enable.*/
+#define STATS_LATENCY_KERNEL_RX 0  /*Kernel receive timestamp until link_recv() returns the frame*/
+#define STATS_LATENCY_DISPATCH 1   /*Frame returned by link_recv() until handle_received_pdu() is done with it*/
+#define STATS_LATENCY_ARP 2        /*SDU queued for an ARP response until it is sent*/
+#define STATS_LATENCY_TX 3         /*Time spent in the send call of the link layer*/
+#define STATS_LATENCY_UNIX 4       /*Time spent handing a message to the application over the UNIX socket*/
+#define STATS_LATENCY_STAGES 5
+
+/*Struct for the counters of one interface*/
+struct interface_stats {
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+};
+
+/*Struct for the latency histogram of one stage*/
+struct latency_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t buckets[STATS_LATENCY_BUCKETS];
+};
+
+/*Struct for the counters of one thread*/
+struct mip_stats {
+    _Alignas(64) struct interface_stats interfaces[STATS_MAX_IFINDEX];
+    uint64_t arp_requests_sent;
+    uint64_t arp_requests_received;
+    uint64_t arp_responses_sent;
+    uint64_t arp_responses_received;
+    uint64_t arp_hits;
+    uint64_t arp_misses;
+    uint64_t arp_flushes;
+    uint64_t arp_announcements_sent;
+    uint64_t arp_announcements_received;
+    uint64_t arp_proxy_responses_sent;     /*Responses we sent for another node (mipd -P)*/
+    uint64_t arp_proxy_responses_received;
+    uint64_t arp_snapshot_loaded;          /*Paths loaded from the snapshot at startup (mipd -S)*/
+    uint64_t arp_snapshot_revalidations;   /*Unicast requests for paths from the snapshot when they were first used*/
+    uint64_t arp_snapshot_verified;
+    uint64_t arp_snapshot_expired;         /*Paths from the snapshot removed since nothing was heard on them*/
+    uint64_t arp_path_failovers;   /*SDUs sent on another path to a MIP address since the interface of the first one was down*/
+    uint64_t pending_drops_full;
+    uint64_t pending_drops_timeout;
+    uint64_t app_messages_in;      /*Messages from the application*/
+    uint64_t app_messages_out;     /*Messages delivered to the application*/
+    uint64_t app_drops;            /*Messages for the application which no one was connected to receive*/
+    uint64_t app_delivery_queued;  /*Messages which waited since the socket of the application was full, see dispatch.h*/
+    uint64_t app_delivery_drops;   /*Messages dropped since the queue of the application was full, or its socket failed*/
+    uint64_t broadcasts_sent;      /*Application messages sent to MIP_BROADCAST, see broadcast.h*/
+    uint64_t broadcast_frames;     /*Frames of those, one per interface*/
+    uint64_t link_batched_frames;  /*Frames sent with a single sendmmsg on several interfaces*/
+    uint64_t broadcasts_received;
+    uint64_t broadcast_duplicates; /*Copies of a broadcast received on another interface, which were not delivered again*/
+    uint64_t broadcast_drops;      /*Broadcasts not sent since they do not fit in one frame, or there was no interface to send on*/
+    uint64_t loop_iterations;
+    uint64_t busy_poll_hits;       /*Waits where spinning found an event (mipd -b)*/
+    uint64_t busy_poll_fallbacks;  /*Waits where the spin budget ran out and we blocked in epoll*/
+    uint64_t batch_sizes[STATS_BATCH_BUCKETS];
+    struct latency_stats latency[STATS_LATENCY_STAGES];
+};
+
+/*Struct for the queue depth of an application client, set by mipd since it owns the connections*/
+struct client_stats {
+    int fd;              /*-1 if the slot is unused*/
+    int queued_bytes;    /*Bytes held back because the reliable transport has no room*/
+    int delivery_bytes;  /*Bytes waiting to be delivered because the socket of the application is full*/
+    int sdu_types;       /*Bit mask of the SDU types the application registered, 0 if it takes PING messages*/
+};
+
+/*The counters of the calling thread, NULL until it counts the first time*/
+extern __thread struct mip_stats *thread_stats;
+
+/*The clients of mipd*/
+extern struct client_stats client_stats[STATS_MAX_CLIENTS];
+
+/*Macro to add to a counter of the calling thread. Takes the name of the field in struct mip_stats and the value to add.*/
+#define STATS_ADD(field, value) \
+    do { \
+        struct mip_stats *stats_block = thread_stats != NULL ? thread_stats : stats_register(); \
+        if (stats_block != NULL) \
+        { \
+            stats_block->field += (value); \
+        } \
+    } while (0)
+
+#define STATS_INC(field) STATS_ADD(field, 1)
+
+
+/*Function to give the calling thread a block of counters. Returns the block, or NULL if too many threads count.*/
+struct mip_stats *stats_register(void);
+
+
+/*Function to count a frame on an interface.
+Takes the ifindex, the length of the frame and 1 if it was received or 0 if it was sent as parameters.*/
+void stats_count_frame(int ifindex, size_t len, int received);
+
+
+/*Function to count an iteration of the event loop. Takes the number of events epoll returned as parameter.*/
+void stats_count_batch(int events);
+
+
+/*Function to count the latency of a stage of the hot path.
+Takes the stage (one of STATS_LATENCY_*) and the latency in nanoseconds as parameters.*/
+void stats_count_latency(int stage, uint64_t ns);
+
+
+/*Function to add a latency to a histogram, used for the stages above and by other modules which keep histograms of their own.
+Takes a pointer to the histogram and the latency in nanoseconds as parameters.*/
+void stats_latency_add(struct latency_stats *latency, uint64_t ns);
+
+
+/*Function to add up the counters of every thread.
+Takes a pointer to the struct mip_stats the sum is written to as parameter.*/
+void stats_sum(struct mip_stats *sum);
+
+
+/*Function to set every counter of every thread to 0. Other threads may count while it runs, so a few updates can be lost.*/
+void stats_reset(void);
+
+
+/*Function to write the counters and gauges as one line of JSON.
+Takes a buffer and its size as parameters. Returns the length of the JSON.*/
+int stats_to_json(char *buffer, size_t buffer_size);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+#include "utils.h"
+
+/*How long the background thread sleeps when every ring is empty*/
+#define TRACE_IDLE_NS 1000000
+
+/*Struct for the ring of a thread, head is only written by the thread that logs and tail only by the background thread*/
+struct trace_ring {
+    _Alignas(64) atomic_uint_fast64_t head;
+    _Alignas(64) atomic_uint_fast64_t tail;
+    struct trace_record records[TRACE_RING_SLOTS];
+};
+
+/*The format of every event, the arguments are printed with %lu or %lx*/
+static const char *const event_formats[TRACE_EVENT_COUNT] = {
+    [TRACE_PDU_SENT] = "PDU sent: %012lx -> %012lx, MIP %lu -> %lu, %lu bytes, type 0x%02lx",
+    [TRACE_PDU_RECEIVED] = "PDU received: %012lx -> %012lx, MIP %lu -> %lu, %lu bytes, type 0x%02lx",
+    [TRACE_SEND_FAILED] = "Failed to send PDU of %lu bytes to MIP address %lu, errno %lu",
+    [TRACE_SHORT_FRAME] = "Received frame of %lu bytes is too short to hold a MIP header",
+    [TRACE_BAD_SDU_LENGTH] = "Error deserializing the pdu, SDU length %lu exceeds the received frame of %lu bytes",
+    [TRACE_ARP_REQUEST_RECEIVED] = "Received MIP-ARP request for MIP address %lu from MIP address %lu",
+    [TRACE_ARP_RESPONSE_RECEIVED] = "Received MIP-ARP response for MIP address %lu",
+    [TRACE_ARP_REQUEST_SENT] = "Sent MIP-ARP request for MIP address %lu on interface %lu",
+    [TRACE_ARP_RESPONSE_SENT] = "Sent MIP-ARP response: MIP address %lu is at our MAC address",
+    [TRACE_ARP_CACHE_ADD] = "Added MIP address %lu at %012lx to the ARP cache, size %lu",
+    [TRACE_ARP_CACHE_FULL] = "ARP cache is full, can not add MIP address %lu",
+    [TRACE_ARP_MISS] = "Can not find mac destination for MIP address %lu, sending arp request",
+    [TRACE_PENDING_TIMEOUT] = "No ARP response from MIP address %lu, dropping pending SDU",
+    [TRACE_PENDING_FULL] = "Pending queue is full, dropping SDU for MIP address %lu",
+    [TRACE_DELIVERED] = "Delivered message of %lu bytes from MIP address %lu to the application",
+    [TRACE_NO_APPLICATION] = "No application connected, dropping message from MIP address %lu",
+    [TRACE_UNKNOWN_SDU_TYPE] = "Received message with unknown SDU type 0x%02lx, dropping it",
+    [TRACE_APP_MESSAGE] = "Received message of %lu bytes for MIP address %lu from the application",
+    [TRACE_FRAGMENTS_SENT] = "Sent message %lu of %lu bytes to MIP address %lu in fragments of %lu bytes",
+    [TRACE_REASSEMBLED] = "Reassembled message %lu of %lu bytes from MIP address %lu",
+    [TRACE_REASSEMBLY_TIMEOUT] = "Reassembly of message %lu from MIP address %lu timed out, dropping it",
+    [TRACE_REASSEMBLY_FULL] = "Reassembly table is full, dropping message %lu from MIP address %lu",
+    [TRACE_BAD_FRAGMENT] = "Dropping invalid fragment of message %lu from MIP address %lu",
+    [TRACE_AGGREGATE_SENT] = "Sending %lu aggregated messages (%lu bytes) to MIP address %lu",
+    [TRACE_AGGREGATE_OVERRUN] = "Aggregated message from MIP address %lu exceeds the SDU, dropping the rest",
+    [TRACE_RDT_RETRANSMIT] = "Reliable transport to MIP address %lu timed out, retransmitting from %lu",
+    [TRACE_RDT_BAD_SEGMENT] = "Dropping malformed reliable segment of %lu bytes from MIP address %lu",
+    [TRACE_RDT_MESSAGE_TOO_LARGE] = "Reliable message from MIP address %lu exceeds the maximum message size, dropping it",
+    [TRACE_LINK_DELAY_FULL] = "Queue of delayed frames is full, dropping frame",
+    [TRACE_LINK_UNKNOWN_PEER] = "Ignoring frame from a socket which is not one of our peers",
+    [TRACE_LINK_NO_TIMESTAMPS] = "Could not enable kernel receive timestamps, errno %lu",
+    [TRACE_LINK_NO_BUSY_POLL] = "Could not enable busy polling on the link socket, errno %lu",
+    [TRACE_XDP_SOCKET] = "AF_XDP socket on ifindex %lu queue %lu, XDP mode %lu (1 skb, 2 native), zero-copy %lu",
+    [TRACE_NEIGHBOUR_DOWN] = "Neighbour with MIP address %lu is down, silent for %lu us",
+    [TRACE_NEIGHBOUR_UP] = "Neighbour with MIP address %lu is up again",
+    [TRACE_ARP_PATH_DOWN] = "Path to MIP address %lu at %012lx is down, removed it from the ARP cache",
+    [TRACE_ARP_ANNOUNCE_SENT] = "Sent MIP-ARP announcement for MIP address %lu on interface %lu",
+    [TRACE_ARP_ANNOUNCE_RECEIVED] = "Received MIP-ARP announcement from MIP address %lu",
+    [TRACE_ARP_PROXY_RESPONSE_SENT] = "Sent MIP-ARP response for MIP address %lu to MIP address %lu on its behalf",
+    [TRACE_ARP_PROXY_RESPONSE_RECEIVED] = "Received MIP-ARP response for MIP address %lu from MIP address %lu on its behalf",
+    [TRACE_RDT_RESET] = "Reliable transport to MIP address %lu was reset by the receiver, starting over from %lu",
+    [TRACE_ARP_INTERFACES_CHANGED] = "Interfaces changed, announcing our MIP address on the %lu interfaces",
+    [TRACE_BAD_ARP_MESSAGE] = "Dropping MIP-ARP message of %lu bytes from MIP address %lu, it is too short",
+    [TRACE_RDT_MTU_TOO_SMALL] = "SDUs of %lu bytes leave no room for a reliable segment to MIP address %lu, dropping message",
+    [TRACE_RDT_TOO_MANY_SEGMENTS] = "Message of %lu bytes to MIP address %lu needs %lu segments, more than the send buffer holds, dropping it",
+    [TRACE_FRAGMENT_TOO_LARGE] = "Message of %lu bytes to MIP address %lu is too large to be fragmented, dropping it",
+    [TRACE_FRAGMENT_MTU_TOO_SMALL] = "SDUs of %lu bytes leave no room for a fragment to MIP address %lu, dropping message",
+    [TRACE_BROADCAST_TOO_LARGE] = "Broadcast of %lu bytes does not fit in a frame on any interface, dropping it",
+};
+
+static const char *const level_names[] = { "error", "warn", "info", "debug" };
+
+atomic_int trace_level = TRACE_INFO;
+
+/*The rings of the threads which have logged, a thread gets its ring the first time it logs after trace_start()*/
+static struct trace_ring *rings[TRACE_MAX_THREADS];
+static atomic_int ring_count = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct trace_ring *thread_ring = NULL;
+
+static atomic_uint_fast64_t dropped = 0;
+static atomic_int started = 0;
+static atomic_int running = 0;
+static pthread_t drainer;
+static FILE *binary_file = NULL;
+
+
+/*Function to give the calling thread a ring, returns NULL if there are too many threads*/
+static struct trace_ring *get_thread_ring(void)
+{
+    if (thread_ring != NULL)
+    {
+        return thread_ring;
+    }
+    pthread_mutex_lock(&ring_lock);
+    int count = atomic_load(&ring_count);
+    if (count < TRACE_MAX_THREADS)
+    {
+        struct trace_ring *ring = calloc(1, sizeof(struct trace_ring));
+        if (ring != NULL)
+        {
+            rings[count] = ring;
+            atomic_store(&ring_count, count + 1); /*Publish the ring after it is in the list*/
+            thread_ring = ring;
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return thread_ring;
+}
+
+
+void trace_event(int level, int event, const uint64_t *args)
+{
+    if (!atomic_load_explicit(&started, memory_order_relaxed)) /*No background thread, format it here*/
+    {
+        struct trace_record record = { get_time_ns(), event, level, {0}, {0} };
+        memcpy(record.args, args, sizeof(record.args));
+        char line[256];
+        trace_format(&record, line, sizeof(line));
+        puts(line);
+        return;
+    }
+
+    struct trace_ring *ring = get_thread_ring();
+    if (ring == NULL)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == TRACE_RING_SLOTS)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    struct trace_record *record = &ring->records[head & (TRACE_RING_SLOTS - 1)];
+    record->timestamp_ns = get_time_ns();
+    record->event = event;
+    record->level = level;
+    memcpy(record->args, args, sizeof(record->args));
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+int trace_format(const struct trace_record *record, char *line, size_t line_size)
+{
+    if (record->event >= TRACE_EVENT_COUNT || event_formats[record->event] == NULL)
+    {
+        return snprintf(line, line_size, "Unknown trace event %u", record->event);
+    }
+    const uint64_t *a = record->args;
+    int len = snprintf(line, line_size, event_formats[record->event], (unsigned long)a[0], (unsigned long)a[1],
+                       (unsigned long)a[2], (unsigned long)a[3], (unsigned long)a[4], (unsigned long)a[5]);
+    return len < (int)line_size ? len : (int)line_size - 1;
+}
+
+
+/*Function to write one record to the output of the background thread*/
+static void output_record(const struct trace_record *record)
+{
+    if (binary_file != NULL)
+    {
+        fwrite(record, sizeof(*record), 1, binary_file);
+        return;
+    }
+    char line[256];
+    trace_format(record, line, sizeof(line));
+    printf("[%lu.%06lu] %s: %s\n", (unsigned long)(record->timestamp_ns / 1000000000ULL),
+           (unsigned long)(record->timestamp_ns % 1000000000ULL / 1000), level_names[record->level & 3], line);
+}
+
+
+/*Background thread, drains the rings until trace_stop() and then once more so no record is left behind*/
+static void *drainer_main(void *arg)
+{
+    uint64_t reported_drops = 0;
+    while (1)
+    {
+        int stopping = !atomic_load(&running);
+        int found = 0;
+        int count = atomic_load(&ring_count);
+        for (int i = 0; i < count; i++)
+        {
+            struct trace_ring *ring = rings[i];
+            uint_fast64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            uint_fast64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            while (tail != head)
+            {
+                output_record(&ring->records[tail & (TRACE_RING_SLOTS - 1)]);
+                tail++;
+                atomic_store_explicit(&ring->tail, tail, memory_order_release);
+                found = 1;
+            }
+        }
+
+        uint64_t drops = atomic_load_explicit(&dropped, memory_order_relaxed);
+        if (drops != reported_drops && binary_file == NULL)
+        {
+            printf("%lu trace records dropped, the log can not keep up\n", (unsigned long)(drops - reported_drops));
+            reported_drops = drops;
+        }
+        if (found)
+        {
+            fflush(binary_file != NULL ? binary_file : stdout);
+        } else if (stopping)
+        {
+            break;
+        } else
+        {
+            struct timespec idle = { 0, TRACE_IDLE_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+
+int trace_start(const char *binary_path)
+{
+    if (atomic_load(&started))
+    {
+        return 0;
+    }
+    if (binary_path != NULL)
+    {
+        binary_file = fopen(binary_path, "wb");
+        if (binary_file == NULL)
+        {
+            perror("fopen");
+            return 0;
+        }
+        uint32_t header[2] = { TRACE_FILE_MAGIC, sizeof(struct trace_record) };
+        fwrite(header, sizeof(header), 1, binary_file);
+    }
+
+    atomic_store(&running, 1);
+    if (pthread_create(&drainer, NULL, drainer_main, NULL) != 0)
+    {
+        printf("Could not start the trace thread\n");
+        atomic_store(&running, 0);
+        if (binary_file != NULL)
+        {
+            fclose(binary_file);
+            binary_file = NULL;
+        }
+        return 0;
+    }
+    atomic_store(&started, 1);
+    return 1;
+}
+
+
+void trace_stop(void)
+{
+    if (!atomic_load(&started))
+    {
+        return;
+    }
+    atomic_store(&running, 0);
+    pthread_join(drainer, NULL);
+    atomic_store(&started, 0);
+    if (binary_file != NULL)
+    {
+        fclose(binary_file);
+        binary_file = NULL;
+    }
+}
+
+
+uint64_t trace_dropped(void)
+{
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+
+uint64_t trace_mac(const uint8_t *mac)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        value = (value << 8) | mac[i];
+    }
+    return value;
+}
@@ -0,0 +1,142 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*Logging of the events on the packet path. An event is a fixed size binary record (an event id and up to TRACE_MAX_ARGS integers)
+which is written to a lock-free ring owned by the thread that logs it, so logging never waits for stdio.
+A background thread started with trace_start() drains the rings and either formats the records as text on stdout,
+or writes them unformatted to a file which mip_trace decodes later. Before trace_start() the events are formatted
+on the spot, so the tools sharing this code print as before.
+
+Every event has a level. Events above TRACE_COMPILE_LEVEL are compiled out (make TRACE_LEVEL=<n>), and events above
+trace_level are skipped at run time at the cost of one load. If a ring is full the record is dropped and counted.*/
+
+/*Levels of the events*/
+#define TRACE_ERROR 0
+#define TRACE_WARN 1
+#define TRACE_INFO 2
+#define TRACE_DEBUG 3
+
+#ifndef TRACE_COMPILE_LEVEL
+#define TRACE_COMPILE_LEVEL TRACE_DEBUG
+#endif
+
+/*Max number of integer arguments of an event*/
+#define TRACE_MAX_ARGS 6
+
+/*Number of records in the ring of each thread, must be a power of two*/
+#define TRACE_RING_SLOTS 4096
+
+/*Max number of threads which can log*/
+#define TRACE_MAX_THREADS 8
+
+/*Magic number at the start of a binary trace file, followed by the size of a record*/
+#define TRACE_FILE_MAGIC 0x4D495054 /*"MIPT"*/
+
+/*The events, the format of each is in trace.c*/
+enum trace_event_id {
+    TRACE_PDU_SENT,
+    TRACE_PDU_RECEIVED,
+    TRACE_SEND_FAILED,
+    TRACE_SHORT_FRAME,
+    TRACE_BAD_SDU_LENGTH,
+    TRACE_ARP_REQUEST_RECEIVED,
+    TRACE_ARP_RESPONSE_RECEIVED,
+    TRACE_ARP_REQUEST_SENT,
+    TRACE_ARP_RESPONSE_SENT,
+    TRACE_ARP_CACHE_ADD,
+    TRACE_ARP_CACHE_FULL,
+    TRACE_ARP_MISS,
+    TRACE_PENDING_TIMEOUT,
+    TRACE_PENDING_FULL,
+    TRACE_DELIVERED,
+    TRACE_NO_APPLICATION,
+    TRACE_UNKNOWN_SDU_TYPE,
+    TRACE_APP_MESSAGE,
+    TRACE_FRAGMENTS_SENT,
+    TRACE_REASSEMBLED,
+    TRACE_REASSEMBLY_TIMEOUT,
+    TRACE_REASSEMBLY_FULL,
+    TRACE_BAD_FRAGMENT,
+    TRACE_AGGREGATE_SENT,
+    TRACE_AGGREGATE_OVERRUN,
+    TRACE_RDT_RETRANSMIT,
+    TRACE_RDT_BAD_SEGMENT,
+    TRACE_RDT_MESSAGE_TOO_LARGE,
+    TRACE_LINK_DELAY_FULL,
+    TRACE_LINK_UNKNOWN_PEER,
+    TRACE_LINK_NO_TIMESTAMPS,
+    TRACE_LINK_NO_BUSY_POLL,
+    TRACE_XDP_SOCKET,
+    TRACE_NEIGHBOUR_DOWN,
+    TRACE_NEIGHBOUR_UP,
+    TRACE_ARP_PATH_DOWN,
+    TRACE_ARP_ANNOUNCE_SENT,
+    TRACE_ARP_ANNOUNCE_RECEIVED,
+    TRACE_ARP_PROXY_RESPONSE_SENT,
+    TRACE_ARP_PROXY_RESPONSE_RECEIVED,
+    TRACE_RDT_RESET,
+    TRACE_ARP_INTERFACES_CHANGED,
+    TRACE_BAD_ARP_MESSAGE,
+    TRACE_RDT_MTU_TOO_SMALL,
+    TRACE_RDT_TOO_MANY_SEGMENTS,
+    TRACE_FRAGMENT_TOO_LARGE,
+    TRACE_FRAGMENT_MTU_TOO_SMALL,
+    TRACE_BROADCAST_TOO_LARGE,
+    TRACE_EVENT_COUNT
+};
+
+/*Struct for a record in the ring and in a binary trace file*/
+struct trace_record {
+    uint64_t timestamp_ns; /*Monotonic time of the event*/
+    uint16_t event;
+    uint8_t level;
+    uint8_t reserved[5];
+    uint64_t args[TRACE_MAX_ARGS];
+};
+
+/*The highest level which is logged, set with mipd -d or the log command of the control socket*/
+extern atomic_int trace_level;
+
+/*Macro to log an event with up to TRACE_MAX_ARGS integer arguments. Takes the level, the event id and the arguments, use 0 if the event has none.*/
+#define TRACE(level, event, ...) \
+    do { \
+        if ((level) <= TRACE_COMPILE_LEVEL && (level) <= atomic_load_explicit(&trace_level, memory_order_relaxed)) \
+        { \
+            uint64_t trace_args[TRACE_MAX_ARGS] = { __VA_ARGS__ }; \
+            trace_event((level), (event), trace_args); \
+        } \
+    } while (0)
+
+
+/*Function to write an event to the ring of the calling thread, use the TRACE macro instead which checks the level first.
+Takes the level, the event id and the arguments as parameters.*/
+void trace_event(int level, int event, const uint64_t *args);
+
+
+/*Function to start the background thread which drains the rings.
+Takes the path of a binary trace file, or NULL to format the records on stdout, as parameter. Returns 1 on success and 0 on failure.*/
+int trace_start(const char *binary_path);
+
+
+/*Function to stop the background thread after it has drained the rings.*/
+void trace_stop(void);
+
+
+/*Function to format a record as a line of text.
+Takes a pointer to the record, and a buffer and its size as parameters. Returns the length of the line.*/
+int trace_format(const struct trace_record *record, char *line, size_t line_size);
+
+
+/*Function to get the number of records dropped because a ring was full.*/
+uint64_t trace_dropped(void);
+
+
+/*Function to pack a mac address into an integer, so it can be an argument of an event.
+Takes a pointer to the mac address as parameter. Returns the address as a 48 bit integer.*/
+uint64_t trace_mac(const uint8_t *mac);
+
+#endif
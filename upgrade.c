@@ -0,0 +1,355 @@
+#define _GNU_SOURCE /*For close_range*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "upgrade.h"
+#include "mip_arp.h"
+#include "link.h"
+#include "utils.h"
+
+/*Fd the new daemon gets its end of the socketpair on*/
+#define UPGRADE_CHILD_FD 3
+
+/*Most arguments mipd is started with*/
+#define UPGRADE_MAX_ARGS 64
+
+/*Most fds handed over, the three sockets and the connections*/
+#define UPGRADE_MAX_FDS (3 + SCHED_MAX_CLIENTS)
+
+/*Struct for the first message of the handoff, which carries the fds. The ARP state, the SDUs waiting for ARP and the held back
+messages follow it on the stream*/
+struct upgrade_header {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t mip_address;
+    uint32_t generation;
+    uint64_t stop_ns;
+    int has_control;
+    uint64_t accept_count;
+    int connection_count;
+    struct {
+        int slot;
+        uint64_t accepted;
+        int blocked_len;
+        uint8_t sdu_types;
+        uint8_t sdu_type;
+    } connections[SCHED_MAX_CLIENTS];
+};
+
+static int requested = 0;
+static char requested_binary[256];
+static uint32_t result_generation = 0;
+static uint64_t result_gap_ns = 0;
+
+
+void upgrade_request(const char *binary)
+{
+    requested = 1;
+    snprintf(requested_binary, sizeof(requested_binary), "%s", binary != NULL ? binary : "");
+}
+
+
+int upgrade_requested(void)
+{
+    return requested;
+}
+
+
+int upgrade_start(char *argv[])
+{
+    requested = 0;
+    if (!link_can_hand_off())
+    {
+        printf("The link layer can not be handed over, not upgrading.\n");
+        return -1;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        perror("upgrade: socketpair");
+        return -1;
+    }
+
+    /*The arguments of the new daemon are ours, without the --upgrade-fd of an earlier upgrade*/
+    char *args[UPGRADE_MAX_ARGS + 3];
+    char fd_arg[16];
+    int count = 0;
+    args[count++] = requested_binary[0] != '\0' ? requested_binary : argv[0];
+    for (int i = 1; argv[i] != NULL && count < UPGRADE_MAX_ARGS; i++)
+    {
+        if (strcmp(argv[i], "--upgrade-fd") == 0)
+        {
+            i++;
+            continue;
+        }
+        if (strncmp(argv[i], "--upgrade-fd=", 13) == 0)
+        {
+            continue;
+        }
+        args[count++] = argv[i];
+    }
+    snprintf(fd_arg, sizeof(fd_arg), "%d", UPGRADE_CHILD_FD);
+    args[count++] = "--upgrade-fd";
+    args[count++] = fd_arg;
+    args[count] = NULL;
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("upgrade: fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        /*The new daemon only inherits its end of the socketpair, everything else comes with SCM_RIGHTS*/
+        if (fds[1] == UPGRADE_CHILD_FD)
+        {
+            fcntl(fds[1], F_SETFD, 0);
+        } else if (dup2(fds[1], UPGRADE_CHILD_FD) == -1)
+        {
+            _exit(127);
+        }
+        close_range(UPGRADE_CHILD_FD + 1, ~0U, 0);
+        execv(args[0], args);
+        perror("upgrade: execv");
+        _exit(127);
+    }
+    close(fds[1]);
+    printf("Started %s (pid %d) to take over.\n", args[0], (int)pid);
+    return fds[0];
+}
+
+
+/*Function to write a whole buffer to the stream, returns 1 on success*/
+static int write_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    while (len > 0)
+    {
+        ssize_t rc = write(fd, bytes, len);
+        if (rc == -1)
+        {
+            perror("upgrade: write");
+            return 0;
+        }
+        bytes += rc;
+        len -= rc;
+    }
+    return 1;
+}
+
+
+/*Function to read a whole buffer from the stream, returns 1 on success*/
+static int read_all(int fd, void *data, size_t len)
+{
+    uint8_t *bytes = data;
+    while (len > 0)
+    {
+        ssize_t rc = read(fd, bytes, len);
+        if (rc <= 0)
+        {
+            if (rc == -1)
+            {
+                perror("upgrade: read");
+            }
+            return 0;
+        }
+        bytes += rc;
+        len -= rc;
+    }
+    return 1;
+}
+
+
+int upgrade_send(int fd, const struct upgrade_state *state)
+{
+    struct upgrade_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = UPGRADE_MAGIC;
+    header.version = UPGRADE_VERSION;
+    header.mip_address = state->mip_address;
+    header.generation = state->generation;
+    header.stop_ns = state->stop_ns;
+    header.has_control = state->control_socket != -1;
+    header.accept_count = state->accept_count;
+    header.connection_count = state->connection_count;
+
+    int fds[UPGRADE_MAX_FDS];
+    int fd_count = 0;
+    fds[fd_count++] = state->raw_socket;
+    fds[fd_count++] = state->unix_socket;
+    if (header.has_control)
+    {
+        fds[fd_count++] = state->control_socket;
+    }
+    for (int i = 0; i < state->connection_count; i++)
+    {
+        header.connections[i].slot = state->connections[i].slot;
+        header.connections[i].accepted = state->connections[i].accepted;
+        header.connections[i].blocked_len = state->connections[i].blocked_len;
+        header.connections[i].sdu_types = state->connections[i].sdu_types;
+        header.connections[i].sdu_type = state->connections[i].sdu_type;
+        fds[fd_count++] = state->connections[i].fd;
+    }
+
+    /*The header carries the fds, as an SCM_RIGHTS message on its first byte*/
+    uint8_t control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+    ssize_t rc = sendmsg(fd, &msg, 0);
+    if (rc == -1)
+    {
+        perror("upgrade: sendmsg");
+        return 0;
+    }
+    if (!write_all(fd, (uint8_t *)&header + rc, sizeof(header) - rc))
+    {
+        return 0;
+    }
+
+    /*The ARP state, then the SDUs it points to, which the new daemon allocates again*/
+    static struct arp_state arp;
+    save_arp_state(&arp);
+    if (!write_all(fd, &arp, sizeof(arp)))
+    {
+        return 0;
+    }
+    for (int i = 0; i < arp.pending_count; i++)
+    {
+        if (!write_all(fd, arp.pending_queue[i].sdu, arp.pending_queue[i].sdu_len))
+        {
+            return 0;
+        }
+    }
+    for (int i = 0; i < state->connection_count; i++)
+    {
+        if (!write_all(fd, state->connections[i].blocked, state->connections[i].blocked_len))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+int upgrade_receive(int fd, struct upgrade_state *state)
+{
+    uint8_t ready = UPGRADE_READY;
+    if (!write_all(fd, &ready, 1))
+    {
+        return 0;
+    }
+
+    struct upgrade_header header;
+    int fds[UPGRADE_MAX_FDS];
+    uint8_t control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t rc = recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    if (rc <= 0)
+    {
+        perror("upgrade: recvmsg");
+        return 0;
+    }
+    if (!read_all(fd, (uint8_t *)&header + rc, sizeof(header) - rc))
+    {
+        return 0;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (header.magic != UPGRADE_MAGIC || header.version != UPGRADE_VERSION || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+        header.connection_count < 0 || header.connection_count > SCHED_MAX_CLIENTS)
+    {
+        fprintf(stderr, "upgrade: the old daemon sent a handoff we do not understand\n");
+        return 0;
+    }
+    int fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), fd_count * sizeof(int));
+    if (fd_count != 2 + header.has_control + header.connection_count)
+    {
+        fprintf(stderr, "upgrade: got %d fds from the old daemon\n", fd_count);
+        return 0;
+    }
+
+    state->mip_address = header.mip_address;
+    state->generation = header.generation;
+    state->stop_ns = header.stop_ns;
+    state->raw_socket = fds[0];
+    state->unix_socket = fds[1];
+    state->control_socket = header.has_control ? fds[2] : -1;
+    state->accept_count = header.accept_count;
+    state->connection_count = header.connection_count;
+    for (int i = 0; i < header.connection_count; i++)
+    {
+        struct upgrade_connection *connection = &state->connections[i];
+        connection->fd = fds[2 + header.has_control + i];
+        connection->slot = header.connections[i].slot;
+        connection->accepted = header.connections[i].accepted;
+        connection->blocked_len = header.connections[i].blocked_len;
+        connection->blocked = NULL;
+        connection->sdu_types = header.connections[i].sdu_types;
+        connection->sdu_type = header.connections[i].sdu_type;
+    }
+
+    static struct arp_state arp;
+    if (!read_all(fd, &arp, sizeof(arp)))
+    {
+        return 0;
+    }
+    for (int i = 0; i < arp.pending_count; i++)
+    {
+        arp.pending_queue[i].sdu = malloc(arp.pending_queue[i].sdu_len);
+        if (arp.pending_queue[i].sdu == NULL || !read_all(fd, arp.pending_queue[i].sdu, arp.pending_queue[i].sdu_len))
+        {
+            return 0;
+        }
+    }
+    load_arp_state(&arp);
+    for (int i = 0; i < state->connection_count; i++)
+    {
+        struct upgrade_connection *connection = &state->connections[i];
+        if (connection->blocked_len > 0)
+        {
+            connection->blocked = malloc(MAX_MESSAGE_SIZE);
+            if (connection->blocked == NULL || !read_all(fd, connection->blocked, connection->blocked_len))
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+void upgrade_set_result(uint32_t generation, uint64_t gap_ns)
+{
+    result_generation = generation;
+    result_gap_ns = gap_ns;
+}
+
+
+void upgrade_get_result(uint32_t *generation, uint64_t *gap_ns)
+{
+    *generation = result_generation;
+    *gap_ns = result_gap_ns;
+}
@@ -0,0 +1,88 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stdint.h>
+#include "sched.h"
+
+/*Hot upgrade of mipd without closing its sockets, started with mipctl upgrade [binary] or SIGUSR2.
+
+The running daemon starts the new binary (by default its own path, which may have been replaced) with its own arguments and
+--upgrade-fd <fd>, one end of a socketpair. The new daemon sets up everything which does not need the sockets and tells the old one
+it is ready, while the old one keeps handling traffic. Then the old daemon stops and sends with SCM_RIGHTS its link socket, the
+application socket, the control socket and every application connection, together with the ARP cache, the SDUs waiting for ARP and
+the messages held back for the applications. The new daemon takes over from there and the old one exits.
+Frames and messages which arrive during the handoff wait in the sockets, so the traffic gap is only the handoff itself, which the
+stats command of the new daemon shows.
+
+Not carried over: the state of the reliable transport, reassembly, aggregation, liveness detection, the transmit scheduler and
+shaper queues, the messages waiting to be delivered to the applications, and the counters. The reliable transport of the new daemon
+starts with a SYN of its own and answers the segments of the old connections with a reset, so the peers start over (see rdt.h);
+messages the old daemon had not got acked are lost. The AF_XDP link layer can not be handed over, since its rings belong to the process.*/
+
+#define UPGRADE_MAGIC 0x4d495055 /*"MIPU"*/
+#define UPGRADE_VERSION 2
+
+/*Byte the new daemon sends when it is ready to take over*/
+#define UPGRADE_READY 'R'
+
+/*Struct for an application connection which is handed over*/
+struct upgrade_connection {
+    int fd;
+    int slot;            /*Index of the connection in mipd, which is its class in the transmit scheduler*/
+    uint64_t accepted;
+    int blocked_len;     /*Length of the message held back for the reliable transport, 0 if there is none*/
+    uint8_t *blocked;    /*The held back message, allocated by upgrade_receive()*/
+    uint8_t sdu_types;   /*Bit mask of the SDU types the application registered, see dispatch.h*/
+    uint8_t sdu_type;    /*Type its messages are sent with*/
+};
+
+/*Struct for what the old daemon hands to the new one, besides the ARP state*/
+struct upgrade_state {
+    uint8_t mip_address;
+    uint32_t generation;     /*Number of upgrades since the daemon was first started*/
+    uint64_t stop_ns;        /*Real time the old daemon stopped handling traffic*/
+    int raw_socket;
+    int unix_socket;
+    int control_socket;      /*-1 if there is none*/
+    uint64_t accept_count;
+    int connection_count;
+    struct upgrade_connection connections[SCHED_MAX_CLIENTS];
+};
+
+
+/*Function to ask for an upgrade, done by the main loop of mipd after the current events.
+Takes the path of the new binary, or NULL for the one the daemon was started from, as parameter.*/
+void upgrade_request(const char *binary);
+
+
+/*Function to check if an upgrade has been asked for and not started yet. Returns 1 if it has, and 0 otherwise.*/
+int upgrade_requested(void);
+
+
+/*Function to start the new binary with the arguments of the daemon and --upgrade-fd.
+Takes the arguments mipd was started with as parameter. Returns our end of the socketpair, to poll for the ready byte, or -1 on failure.*/
+int upgrade_start(char *argv[]);
+
+
+/*Function to hand the sockets and the state to the new daemon once it is ready. The fds stay open in the old daemon,
+which should exit without unlinking any socket file.
+Takes our end of the socketpair and the state as parameters. Returns 1 on success and 0 if the new daemon did not get it.*/
+int upgrade_send(int fd, const struct upgrade_state *state);
+
+
+/*Function for the new daemon to tell the old one it is ready and receive the sockets and the state. The ARP cache and the
+SDUs waiting for ARP are loaded, the rest is filled into state.
+Takes the fd given with --upgrade-fd and a pointer to the state as parameters. Returns 1 on success and 0 on failure.*/
+int upgrade_receive(int fd, struct upgrade_state *state);
+
+
+/*Function to note that this daemon took over after an upgrade, for the stats command.
+Takes the generation and the gap in nanoseconds as parameters.*/
+void upgrade_set_result(uint32_t generation, uint64_t gap_ns);
+
+
+/*Function to get the result of the last upgrade for the stats command.
+Takes pointers to set to the generation and the gap in nanoseconds (0 if the daemon was not upgraded) as parameters.*/
+void upgrade_get_result(uint32_t *generation, uint64_t *gap_ns);
+
+#endif
@@ -1,13 +1,25 @@
+#define _GNU_SOURCE     // For pthread_setaffinity_np
 #include <stdio.h>      // For printf and perror
 #include <stdlib.h>     // For exit
 #include <string.h>     // For memset and strncpy
 #include <unistd.h>     // For close and unlink
 #include <sys/socket.h> // For socket, bind, listen, and AF_UNIX
 #include <sys/un.h>     // For struct sockaddr_un (Unix domain sockets)
+#include <sys/timerfd.h> // For timerfd_create and timerfd_settime
+#include <time.h>       // For clock_gettime
+#include <pthread.h>    // For pthread_setaffinity_np
+#include <sched.h>      // For cpu_set_t
 #include "utils.h"
 
 int debug_mode = 0;
 
+/*Virtual time set by the simulator, 0 when the monotonic clock is used*/
+static uint64_t virtual_time_ns = 0;
+
+/*The CPUs the process could run on before a thread was pinned*/
+static cpu_set_t original_cpus;
+static int pinned = 0;
+
 
 int create_unix_socket(const char *path) 
 {
@@ -49,6 +61,91 @@ int create_unix_socket(const char *path)
 }
 
 
+uint64_t get_time_ns(void)
+{
+    if (virtual_time_ns != 0) /*The simulator or a replay drives the clock*/
+    {
+        return virtual_time_ns;
+    }
+    return get_real_time_ns();
+}
+
+
+uint64_t get_real_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+void set_virtual_time(uint64_t now_ns)
+{
+    virtual_time_ns = now_ns;
+}
+
+
+int create_timer(void)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timer_fd == -1)
+    {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+    return timer_fd;
+}
+
+
+void arm_timer(int timer_fd, uint64_t deadline_ns)
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its)); /*An all zero value disarms the timer*/
+
+    if (deadline_ns != 0)
+    {
+        its.it_value.tv_sec = deadline_ns / 1000000000ULL;
+        its.it_value.tv_nsec = deadline_ns % 1000000000ULL;
+    }
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        perror("timerfd_settime");
+    }
+}
+
+
+int pin_to_cpu(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        return 0;
+    }
+    if (!pinned && pthread_getaffinity_np(pthread_self(), sizeof(original_cpus), &original_cpus) != 0)
+    {
+        return 0;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        return 0;
+    }
+    pinned = 1;
+    return 1;
+}
+
+
+void unpin_from_cpu(void)
+{
+    if (pinned)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(original_cpus), &original_cpus);
+    }
+}
+
+
 void print_help(const char *message)
 {   
     printf("%s\n",message);
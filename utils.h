@@ -3,10 +3,23 @@
 
 #include <stdint.h>
 
-/*/*Since the SDU length is 9 bits it can hold 511 * 4 = 2044 bytes, 
-however I have defined the ping message buffer to hold 256 characters due to the nature of the task (PING/PONG messages). 
-It is not defined how much data our program have to be able to send/receive.*/
-#define BUFFER_SIZE 1024
+/*Since the SDU length is 9 bits it can hold 511 * 4 = 2044 bytes, which is the largest SDU the protocol can carry.*/
+#define MAX_SDU_SIZE 2044
+
+/*Size of the mip header in bytes, which together with the SDU has to fit within the MTU of an interface*/
+#define MIP_HEADER_SIZE 4
+
+/*The largest message an application can send to the mip daemon, including the leading mip address.
+Messages larger than what fits in one SDU are fragmented by the daemon.*/
+#define MAX_MESSAGE_SIZE 65535
+
+/*The buffers must be able to hold a full frame, meaning the ethernet header (14 bytes), the mip header (4 bytes)
+and the largest SDU (2044 bytes). 2062 is rounded up to 2064 to keep it 32 bit aligned.
+An application message (1 byte mip address + SDU) also fits in this buffer.
+The buffers are not sized from the MTU of each interface: the 9 bit SDU length bounds a MIP frame at 2062 bytes whatever the MTU,
+and an interface with a smaller MTU (queried with SIOCGIFMTU) gets smaller SDUs from get_max_sdu_size() instead. A buffer per
+interface would save at most this much, and a frame is received before we know which interface it came from.*/
+#define BUFFER_SIZE 2064
 
 /*Value to determine how many connections the unix socket will queue.
 Set to 24 for now, which i believe will suffice.*/
@@ -21,6 +34,43 @@ extern int debug_mode;
 int create_unix_socket(const char *path);
 
 
+/*Function to get the current time of the monotonic clock in nanoseconds.
+Used for timers, since it is not affected by changes to the system time.*/
+uint64_t get_time_ns(void);
+
+
+/*Function to get the current time of the monotonic clock in nanoseconds, even while a virtual time is set.
+Used to measure how long the daemon spends on work when the simulator or a replay drives the clock.*/
+uint64_t get_real_time_ns(void);
+
+
+/*Function to make get_time_ns() return a virtual time instead of the monotonic clock, used by the simulator and replay.
+Takes the virtual time in nanoseconds as parameter, 0 switches back to the monotonic clock.*/
+void set_virtual_time(uint64_t now_ns);
+
+
+/*Function to create a timerfd based on the monotonic clock, which can be added to epoll.
+Returns the timer file descriptor and exits on failure.*/
+int create_timer(void);
+
+
+/*Function to arm a timerfd to expire at an absolute monotonic time in nanoseconds.
+A deadline of 0 disarms the timer.
+Takes the timer file descriptor and the deadline as parameters.*/
+void arm_timer(int timer_fd, uint64_t deadline_ns);
+
+
+/*Function to pin the calling thread to a CPU, so the thread which handles frames is not moved between CPUs.
+The CPUs it was allowed to run on before are kept for unpin_from_cpu().
+Takes the number of the CPU as parameter. Returns 1 on success and 0 on failure.*/
+int pin_to_cpu(int cpu);
+
+
+/*Function to let the calling thread run on the CPUs the process had before pin_to_cpu(), used by threads created after the pinning
+so they do not compete with the pinned thread. Does nothing if no thread has been pinned.*/
+void unpin_from_cpu(void);
+
+
 /*Helper function to print help message for running executable programs (mipd.c, ping_client.c and ping_server.c)
 Takes a poiner to a const char as parameter.*/
 void print_help(const char *message);
@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include "xdp.h"
+#include "raw_socket.h"
+#include "trace.h"
+#include "utils.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/*Macro for one BPF instruction*/
+#define BPF_INSN(opcode, dst, src, offset, immediate) \
+    ((struct bpf_insn){ .code = (opcode), .dst_reg = (dst), .src_reg = (src), .off = (offset), .imm = (immediate) })
+
+/*Frames below this index of the UMEM are for receiving, the rest for sending*/
+#define XDP_RX_FRAMES (XDP_NUM_FRAMES / 2)
+#define XDP_TX_FRAMES (XDP_NUM_FRAMES - XDP_RX_FRAMES)
+
+/*Size of the log the verifier writes when the XDP program is rejected*/
+#define VERIFIER_LOG_SIZE 65536
+
+/*Struct for one of the rings shared with the kernel. The kernel writes producer of the RX and completion rings and consumer
+of the fill and TX rings, we write the other index of each ring*/
+struct xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *descs;
+    void *map;
+    size_t map_len;
+};
+
+/*Struct for the AF_XDP socket of an interface*/
+struct xdp_socket {
+    int fd;
+    int ifindex;
+    uint8_t *umem;
+    struct xdp_ring rx, tx, fill, completion;
+    uint64_t tx_free[XDP_TX_FRAMES]; /*UMEM addresses of the send frames which are not on the TX ring*/
+    int tx_free_count;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+};
+
+static int xdp_queue = 0;
+static int xdp_mode = XDP_LINK_AUTO;
+
+static struct xdp_socket sockets[MAX_INTERFACES];
+static int socket_count = 0;
+static int next_rx = 0; /*Socket to look at first on the next receive, so no interface is starved*/
+static struct interface_info xdp_interfaces;
+
+
+void xdp_configure(int queue, int mode)
+{
+    xdp_queue = queue;
+    xdp_mode = mode;
+}
+
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/*Function to create the XSKMAP the XDP program redirects into, with the socket at the index of our queue.
+Returns the map fd, or -1 on failure.*/
+static int create_socket_map(int socket_fd)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = xdp_queue + 1;
+    int map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd == -1)
+    {
+        return -1;
+    }
+
+    uint32_t key = xdp_queue;
+    uint32_t value = socket_fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&value;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1)
+    {
+        close(map_fd);
+        return -1;
+    }
+    return map_fd;
+}
+
+
+/*Function to load the XDP program, which redirects frames with ethertype ETH_P_MIP to the socket in the map at the index of
+the receive queue and passes every other frame, or a MIP frame on a queue without a socket, to the kernel stack.
+Takes the map fd as parameter. Returns the program fd, or -1 on failure.*/
+static int load_program(int map_fd)
+{
+    const struct bpf_insn program[] = {
+        BPF_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+        BPF_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+        BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        BPF_INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, sizeof(struct ether_frame)),
+        BPF_INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 8, 0),          /*Shorter than an ethernet header, pass*/
+        BPF_INSN(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_4, BPF_REG_2, offsetof(struct ether_frame, eth_proto), 0),
+        BPF_INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 6, htons(ETH_P_MIP)), /*Not a MIP frame, pass*/
+        BPF_INSN(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0),
+        BPF_INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+        BPF_INSN(0, 0, 0, 0, 0),                                                   /*Second half of the 64 bit load*/
+        BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),          /*Action if the map has no socket*/
+        BPF_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        BPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        BPF_INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        BPF_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    static char log[VERIFIER_LOG_SIZE];
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)program;
+    attr.insn_cnt = sizeof(program) / sizeof(program[0]);
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    attr.log_buf = (uint64_t)(uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    int prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (prog_fd == -1 && log[0] != '\0')
+    {
+        printf("The XDP program was rejected by the verifier:\n%s\n", log);
+    }
+    return prog_fd;
+}
+
+
+/*Function to attach the program to an interface with a bpf link, in the given XDP_FLAGS_* mode.
+Returns the link fd, or -1 on failure.*/
+static int attach_program(int prog_fd, int ifindex, uint32_t flags)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = flags;
+    return sys_bpf(BPF_LINK_CREATE, &attr);
+}
+
+
+/*Function to map one of the rings of a socket. Takes the socket, the offsets of the ring, the size of a descriptor,
+the page offset of the ring and the ring as parameters. Returns 1 on success and 0 on failure.*/
+static int map_ring(int fd, struct xdp_ring_offset *offsets, size_t desc_size, off_t page_offset, struct xdp_ring *ring)
+{
+    ring->map_len = offsets->desc + XDP_RING_SIZE * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, page_offset);
+    if (ring->map == MAP_FAILED)
+    {
+        return 0;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + offsets->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + offsets->consumer);
+    ring->descs = (uint8_t *)ring->map + offsets->desc;
+    return 1;
+}
+
+
+/*Function to fail with a message, used while setting up the sockets where there is nothing to fall back to*/
+static void fail(const char *what, int ifindex)
+{
+    fprintf(stderr, "AF_XDP on ifindex %d: %s: %s\n", ifindex, what, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+
+/*Function to create the AF_XDP socket, UMEM and rings of an interface, bind it and attach the XDP program*/
+static void open_socket(struct xdp_socket *xsk, int ifindex)
+{
+    memset(xsk, 0, sizeof(*xsk));
+    xsk->ifindex = ifindex;
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd == -1)
+    {
+        fail("socket", ifindex);
+    }
+
+    xsk->umem = mmap(NULL, (size_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xsk->umem == MAP_FAILED)
+    {
+        fail("mmap of the UMEM", ifindex);
+    }
+    struct xdp_umem_reg umem_reg;
+    memset(&umem_reg, 0, sizeof(umem_reg));
+    umem_reg.addr = (uint64_t)(uintptr_t)xsk->umem;
+    umem_reg.len = (uint64_t)XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+    umem_reg.chunk_size = XDP_FRAME_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) == -1)
+    {
+        fail("XDP_UMEM_REG", ifindex);
+    }
+
+    int ring_size = XDP_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) == -1 ||
+        setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) == -1)
+    {
+        fail("ring setup", ifindex);
+    }
+
+    struct xdp_mmap_offsets offsets;
+    socklen_t offsets_len = sizeof(offsets);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_len) == -1)
+    {
+        fail("XDP_MMAP_OFFSETS", ifindex);
+    }
+    if (!map_ring(xsk->fd, &offsets.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING, &xsk->fill) ||
+        !map_ring(xsk->fd, &offsets.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING, &xsk->completion) ||
+        !map_ring(xsk->fd, &offsets.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING, &xsk->rx) ||
+        !map_ring(xsk->fd, &offsets.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING, &xsk->tx))
+    {
+        fail("mmap of the rings", ifindex);
+    }
+
+    /*Give the kernel every receive frame, the ring is as large as the number of receive frames so they all fit*/
+    uint64_t *fill = xsk->fill.descs;
+    for (int i = 0; i < XDP_RX_FRAMES; i++)
+    {
+        fill[i & (XDP_RING_SIZE - 1)] = (uint64_t)i * XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(xsk->fill.producer, XDP_RX_FRAMES, __ATOMIC_RELEASE);
+    for (int i = 0; i < XDP_TX_FRAMES; i++)
+    {
+        xsk->tx_free[i] = (uint64_t)(XDP_RX_FRAMES + i) * XDP_FRAME_SIZE;
+    }
+    xsk->tx_free_count = XDP_TX_FRAMES;
+
+    xsk->map_fd = create_socket_map(xsk->fd);
+    if (xsk->map_fd == -1)
+    {
+        fail("XSKMAP", ifindex);
+    }
+    xsk->prog_fd = load_program(xsk->map_fd);
+    if (xsk->prog_fd == -1)
+    {
+        fail("loading the XDP program", ifindex);
+    }
+
+    /*Attach in the driver if we may, and fall back to skb mode*/
+    int native = 0;
+    xsk->link_fd = -1;
+    if (xdp_mode != XDP_LINK_SKB)
+    {
+        xsk->link_fd = attach_program(xsk->prog_fd, ifindex, XDP_FLAGS_DRV_MODE);
+        native = xsk->link_fd != -1;
+    }
+    if (xsk->link_fd == -1 && xdp_mode != XDP_LINK_NATIVE)
+    {
+        xsk->link_fd = attach_program(xsk->prog_fd, ifindex, XDP_FLAGS_SKB_MODE);
+    }
+    if (xsk->link_fd == -1)
+    {
+        fail("attaching the XDP program", ifindex);
+    }
+
+    /*Zero-copy needs native mode and a driver which supports it, copy mode works everywhere*/
+    struct sockaddr_xdp addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifindex;
+    addr.sxdp_queue_id = xdp_queue;
+    int zerocopy = 0;
+    if (native)
+    {
+        addr.sxdp_flags = XDP_ZEROCOPY;
+        zerocopy = bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!zerocopy)
+    {
+        addr.sxdp_flags = XDP_COPY;
+        if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            fail("bind", ifindex);
+        }
+    }
+    TRACE(TRACE_INFO, TRACE_XDP_SOCKET, ifindex, xdp_queue, native ? XDP_LINK_NATIVE : XDP_LINK_SKB, zerocopy);
+}
+
+
+int xdp_open(void)
+{
+    /*The interfaces are found the same way as for the raw socket, the MTU query needs a socket which supports interface ioctls*/
+    int query_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (query_fd == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    get_local_interfaces(&xdp_interfaces, query_fd);
+    close(query_fd);
+
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1)
+    {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < xdp_interfaces.num_interfaces; i++)
+    {
+        struct xdp_socket *xsk = &sockets[socket_count];
+        open_socket(xsk, xdp_interfaces.interface_addrs[i].sll_ifindex);
+        socket_count++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, xsk->fd, &ev) == -1)
+        {
+            perror("epoll_ctl: xdp socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return epoll_fd;
+}
+
+
+void xdp_get_interfaces(struct interface_info *if_list, int fd)
+{
+    memcpy(if_list, &xdp_interfaces, sizeof(*if_list));
+    if_list->socket_fd = fd;
+}
+
+
+/*Function to move the send frames the kernel is done with from the completion ring to the free list*/
+static void reap_completions(struct xdp_socket *xsk)
+{
+    uint32_t consumer = *xsk->completion.consumer;
+    uint32_t producer = __atomic_load_n(xsk->completion.producer, __ATOMIC_ACQUIRE);
+    const uint64_t *addrs = xsk->completion.descs;
+    while (consumer != producer)
+    {
+        xsk->tx_free[xsk->tx_free_count++] = addrs[consumer & (XDP_RING_SIZE - 1)];
+        consumer++;
+    }
+    __atomic_store_n(xsk->completion.consumer, consumer, __ATOMIC_RELEASE);
+}
+
+
+ssize_t xdp_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len)
+{
+    struct xdp_socket *xsk = NULL;
+    for (int i = 0; i < socket_count; i++)
+    {
+        if (sockets[i].ifindex == iface->sll_ifindex)
+        {
+            xsk = &sockets[i];
+            break;
+        }
+    }
+    if (xsk == NULL || len > XDP_FRAME_SIZE)
+    {
+        errno = xsk == NULL ? ENXIO : EMSGSIZE;
+        return -1;
+    }
+
+    reap_completions(xsk);
+    if (xsk->tx_free_count == 0) /*Every send frame is in flight, kick the kernel and look again*/
+    {
+        sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+        reap_completions(xsk);
+        if (xsk->tx_free_count == 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    /*The TX ring holds as many descriptors as there are send frames, so there is always room for a free frame*/
+    uint64_t addr = xsk->tx_free[--xsk->tx_free_count];
+    memcpy(xsk->umem + addr, frame, len);
+    uint32_t producer = *xsk->tx.producer;
+    struct xdp_desc *desc = &((struct xdp_desc *)xsk->tx.descs)[producer & (XDP_RING_SIZE - 1)];
+    desc->addr = addr;
+    desc->len = len;
+    desc->options = 0;
+    __atomic_store_n(xsk->tx.producer, producer + 1, __ATOMIC_RELEASE);
+
+    /*The kernel only sends from the TX ring when it is woken, EAGAIN and EBUSY mean it is already busy with the ring*/
+    if (sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+    {
+        return -1;
+    }
+    return (ssize_t)len;
+}
+
+
+ssize_t xdp_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface)
+{
+    for (int n = 0; n < socket_count; n++)
+    {
+        struct xdp_socket *xsk = &sockets[(next_rx + n) % socket_count];
+        uint32_t consumer = *xsk->rx.consumer;
+        if (consumer == __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE))
+        {
+            continue;
+        }
+        next_rx = (next_rx + n + 1) % socket_count;
+
+        struct xdp_desc *desc = &((struct xdp_desc *)xsk->rx.descs)[consumer & (XDP_RING_SIZE - 1)];
+        size_t copied = desc->len < len ? desc->len : len;
+        memcpy(frame, xsk->umem + desc->addr, copied);
+        uint64_t addr = desc->addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+        __atomic_store_n(xsk->rx.consumer, consumer + 1, __ATOMIC_RELEASE);
+
+        /*Give the frame back to the kernel, the fill ring always has room since every receive frame fits on it*/
+        uint32_t producer = *xsk->fill.producer;
+        ((uint64_t *)xsk->fill.descs)[producer & (XDP_RING_SIZE - 1)] = addr;
+        __atomic_store_n(xsk->fill.producer, producer + 1, __ATOMIC_RELEASE);
+
+        /*Fill in the interface the same way recvmsg does for the raw socket, with the source mac address*/
+        memset(iface, 0, sizeof(*iface));
+        iface->sll_family = AF_PACKET;
+        iface->sll_protocol = htons(ETH_P_MIP);
+        iface->sll_ifindex = xsk->ifindex;
+        iface->sll_halen = 6;
+        if (copied >= sizeof(struct ether_frame))
+        {
+            memcpy(iface->sll_addr, ((struct ether_frame *)frame)->src_addr, 6);
+        }
+        return (ssize_t)copied;
+    }
+    return 0;
+}
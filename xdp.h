@@ -0,0 +1,66 @@
+#ifndef XDP_H
+#define XDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <linux/if_packet.h>
+#include "local_interfaces.h"
+
+/*AF_XDP link layer, chosen with mipd -l xdp[,queue=<n>][,mode=auto|skb|native] and only built with make XDP=1.
+
+Every interface gets an AF_XDP socket with its own UMEM, bound to one receive queue (default 0), and a small XDP program
+which redirects the frames with ethertype ETH_P_MIP to the socket and passes every other frame to the kernel stack.
+The program is attached with a bpf link, so it is removed when mipd exits. No libbpf is needed, the program is a handful
+of BPF instructions loaded with the bpf() syscall.
+
+Native mode runs the program in the driver and binds the socket in zero-copy mode if the driver supports it, otherwise in copy mode.
+Skb (generic) mode runs the program after the kernel has built an skb, which works on every interface, e.g. veth, but always copies.
+The default (auto) tries native mode first and falls back to skb mode.
+
+The first half of the UMEM frames is handed to the kernel on the fill ring for receiving. A received frame is copied out and
+its UMEM frame is put straight back on the fill ring. The second half is used for sending, a frame is taken from a free list,
+put on the TX ring, and returns to the free list when the kernel reports it on the completion ring.
+
+mipd polls a single fd, so open returns an epoll fd which holds the sockets of every interface.*/
+
+/*Values for the mode option*/
+#define XDP_LINK_AUTO 0
+#define XDP_LINK_SKB 1
+#define XDP_LINK_NATIVE 2
+
+/*Number of UMEM frames of each socket, half for receiving and half for sending, and the size of one frame*/
+#define XDP_NUM_FRAMES 4096
+#define XDP_FRAME_SIZE 2048
+
+/*Number of descriptors in each of the four rings, must be a power of two*/
+#define XDP_RING_SIZE 2048
+
+
+/*Function to set the receive queue and the mode of the AF_XDP link layer. Must be called before xdp_open().
+Takes the queue the sockets bind to and one of the XDP_LINK_* modes as parameters.*/
+void xdp_configure(int queue, int mode);
+
+
+/*Function to create an AF_XDP socket and attach the XDP program on every interface except loopback.
+Returns an epoll fd which is readable when one of the sockets has received a frame, and exits on failure.*/
+int xdp_open(void);
+
+
+/*Function to fill the interface list with the interfaces which have an AF_XDP socket.
+Takes a pointer to struct interface_info and the fd returned by xdp_open() as parameters.*/
+void xdp_get_interfaces(struct interface_info *if_list, int fd);
+
+
+/*Function to send a frame on the AF_XDP socket of an interface.
+Takes the fd returned by xdp_open(), the interface, a pointer to the frame and its length as parameters.
+Returns the length, or -1 with errno set if the interface has no socket or no UMEM frame is free.*/
+ssize_t xdp_send(int fd, struct sockaddr_ll *iface, uint8_t *frame, size_t len);
+
+
+/*Function to receive a frame from the first socket, in round robin order, which has one.
+Takes the fd returned by xdp_open(), a buffer, the size of the buffer and a pointer to the interface as parameters.
+Returns the length of the frame, or 0 if no socket had a frame.*/
+ssize_t xdp_recv(int fd, uint8_t *frame, size_t len, struct sockaddr_ll *iface);
+
+#endif